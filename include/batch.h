@@ -0,0 +1,45 @@
+#include <sys/types.h>
+
+// Parse one model spec into `config` and tool-specific `options`
+typedef int (batch_parse_func)(int argc, char ** argv,
+		modelConfigType * config, void ** options);
+
+// Free the tool-specific options of a spec
+typedef void (batch_free_func)(void * options);
+
+// Fit and report one model; `gram` is X^T X of its predictors, or NULL
+typedef int (batch_fit_func)(modelConfigType * config, void * options,
+		modelDataType * data, gsl_matrix * gram);
+
+typedef struct {
+	modelConfigType * config;
+	void * options;
+	int dataset;			// shared parse the job uses
+	FILE * output;			// captured stdout
+	pid_t pid;
+	int status;
+} batchJob;
+
+// Input parsed once for every job with the same encoding and responses
+typedef struct {
+	modelConfigType config;
+	modelDataType data;
+	gsl_matrix * gram;		// X^T X over every predictor, or NULL
+} batchDataset;
+
+int read_jobs(char * fileName, batch_parse_func parse,
+		batch_free_func freeOptions, batchJob ** jobs);
+
+void batch_jobs_free(batchJob * jobs, int njobs,
+		batch_free_func freeOptions);
+
+int batch_dataset(batchDataset ** datasets, int * ndata,
+		modelConfigType * config, char ** lines, int nrow,
+		char ** testLines, int testRows, bool useGram);
+
+void batch_datasets_free(batchDataset * datasets, int ndata);
+
+int batch_run(batchJob * job, batchDataset * dataset, batch_fit_func fit);
+
+int run_batch(modelConfigType * config, batch_parse_func parse,
+		batch_fit_func fit, batch_free_func freeOptions, bool useGram);
@@ -0,0 +1,78 @@
+/*
+ * Binary stream passed between tools in place of csv text: BINARY_MAGIC (a
+ * line of its own, so readers can tell it from a csv header), the version,
+ * the number of columns and their names, then batches of up to
+ * BINARY_BATCH_ROWS rows stored column by column. Each batch starts with its
+ * row count (0 ends the stream) and each of its columns with its type:
+ * native doubles, or text as length and bytes. Numbers are in the byte order
+ * of the machine, as the stream is meant for pipes between local processes.
+ */
+#define BINARY_MAGIC "\x93" "CSB\n"
+#define BINARY_MAGIC_LEN 5
+#define BINARY_VERSION 1
+#define BINARY_BATCH_ROWS 4096
+
+// Numbers read into csv-style lines are packed into cells of a marker and
+// ten bytes holding seven bits each, which never contain a comma or NUL
+#define BINARY_CELL '\x1f'
+#define BINARY_CELL_LEN 11
+
+typedef enum {
+	BINARY_NUMBERS,
+	BINARY_TEXT
+} binaryColumnType;
+
+// Rows being gathered into a batch, cell by cell
+typedef struct {
+	FILE * output;
+	int ncol;
+	int col;			// next cell of the current row
+	size_t nrows;			// complete rows in the batch
+	double * numbers;		// by column, then row
+	char ** texts;			// as numbers, NULL for numbers
+} binaryWriter;
+
+// Batch being turned back into lines
+typedef struct {
+	FILE * input;
+	int ncol;
+	char ** names;
+	bool pack;			// pack numbers rather than format them
+	bool header;			// header line still to be given
+	size_t nrows;
+	size_t row;			// next row of the batch
+	binaryColumnType * types;
+	double * numbers;		// by column, then row
+	char ** texts;
+} binaryReader;
+
+bool binary_detect(const char * line, ssize_t len);
+
+void binary_pack(double x, char * cell);
+
+bool binary_unpack(const char * cell, double * x);
+
+double binary_atof(const char * value);
+
+int binary_format(double x, char * text);
+
+binaryWriter * binary_writer_open(FILE * output, char ** names, int ncol);
+
+void binary_put_number(binaryWriter * writer, double x);
+
+void binary_put_text(binaryWriter * writer, const char * text, size_t len);
+
+void binary_put_field(binaryWriter * writer, const csvField * field);
+
+void binary_end_row(binaryWriter * writer);
+
+void binary_writer_close(binaryWriter * writer);
+
+binaryReader * binary_reader_open(FILE * input, bool pack);
+
+ssize_t binary_getline(binaryReader * reader, char ** line, size_t * len);
+
+ssize_t binary_read_line(FILE * input, binaryReader ** binary, bool pack,
+		char ** line, size_t * len);
+
+void binary_reader_close(binaryReader * reader);
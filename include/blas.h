@@ -0,0 +1,11 @@
+// Block sizes of the built-in kernels: a BLAS_BLOCK_M x BLAS_BLOCK_K block of
+// op(A) and a BLAS_BLOCK_K x BLAS_BLOCK_N panel of op(B) are packed so that
+// both stay in cache while a block of C is updated
+#define BLAS_BLOCK_M 64
+#define BLAS_BLOCK_N 256
+#define BLAS_BLOCK_K 128
+
+// Products with fewer multiply-adds than this run on one thread
+#define BLAS_PARALLEL_MIN 100000
+
+void blas_set_threads(int n);
@@ -82,7 +82,8 @@ typedef struct encodeData {
 	char * columnName;
 	char ** textValues;
 	struct encodeData * nextEncoding;
-	double * numValues;
+	double * numValues;		// target encodings, NULL for dummy
+	int ncat;			// categories in textValues
 } encodeData;
 
 typedef int (encode_func)(dataColumn * data, gsl_vector * response, int nrow,
@@ -0,0 +1,20 @@
+// Bytes read at a time when the whole input is loaded into memory
+#define CSV_READ_CHUNK (1 << 20)
+
+// Field of a csv line: a slice of the line, not terminated
+typedef struct {
+	const char * start;
+	size_t len;
+} csvField;
+
+char * csv_read_all(FILE * input, size_t * size, bool pack);
+
+const char * csv_line(const char * line, const char * end, const char ** stop);
+
+bool csv_next_field(const char ** p, const char * stop, csvField * field);
+
+int csv_header(const char * line, const char * stop, char *** names);
+
+int csv_column(char ** names, int n, const char * token);
+
+bool csv_number(const csvField * field, double * value);
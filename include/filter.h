@@ -0,0 +1,92 @@
+/*
+ * Expressions over the columns of a csv row, compiled once into postfix code
+ * run against each row. Only the fields the code references are sliced out
+ * of a row, and only those compared with numbers are converted.
+ */
+
+// Deepest evaluation stack an expression may need, and most parentheses and
+// negations around any part of it
+#define FILTER_MAX_DEPTH 256
+
+typedef enum {
+	FILTER_NUMBER,		// field compared with a number
+	FILTER_TEXT,		// field compared with text
+	FILTER_IN_NUMBER,	// field in a set of numbers
+	FILTER_IN_TEXT,		// field in a set of text
+	FILTER_NA,
+	FILTER_AND,
+	FILTER_OR,
+	FILTER_NOT
+} filterOpcode;
+
+typedef enum {
+	FILTER_EQ,
+	FILTER_NE,
+	FILTER_LT,
+	FILTER_LE,
+	FILTER_GT,
+	FILTER_GE
+} filterCompare;
+
+typedef struct {
+	filterOpcode code;
+	filterCompare compare;
+	int slot;			// referenced column
+	double number;
+	char * text;
+	int nset;
+	double * numbers;		// sorted set
+	char ** texts;			// sorted set
+} filterInstr;
+
+typedef enum {
+	TOKEN_END,
+	TOKEN_NAME,
+	TOKEN_NUMBER,
+	TOKEN_TEXT,
+	TOKEN_COMPARE,
+	TOKEN_AND,
+	TOKEN_OR,
+	TOKEN_NOT,
+	TOKEN_IN,
+	TOKEN_ISNA,
+	TOKEN_OPEN,
+	TOKEN_CLOSE,
+	TOKEN_COMMA
+} filterToken;
+
+// Compiled expression and the state of its compilation
+typedef struct {
+	filterInstr * code;
+	int ncode;
+	char ** columns;		// name of each slot
+	int nslot;
+	int depth;			// stack needed by the code
+	const char * pos;		// compilation: next character
+	const char * tokenStart;	// compilation: current token
+	filterToken token;		// compilation: current token
+	char * tokenText;
+	double tokenNumber;
+	filterCompare tokenCompare;
+} filterProgram;
+
+// Fields of the referenced columns in the row being evaluated
+typedef struct {
+	int * slotOf;			// slot of each field, -1 if unused
+	int lastField;			// highest referenced field
+	csvField * fields;		// by slot
+	double * numbers;		// by slot
+	char * state;			// 0 unparsed, 1 number, 2 not a number
+} filterRow;
+
+int filter_compile(const char * expression, filterProgram * program);
+
+void filter_free(filterProgram * program);
+
+int filter_row_open(const filterProgram * program, char ** names,
+		int nfield, filterRow * row);
+
+void filter_row_free(filterRow * row);
+
+bool filter_match(const filterProgram * program, filterRow * row,
+		const char * line, const char * stop, bool * stack);
@@ -0,0 +1,71 @@
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+
+// Rows of the design handled by each thread at a time
+#define GRAM_BLOCK_ROWS 1024
+
+// Cholesky pivots below this fraction of their diagonal count as singular
+#define GRAM_SINGULAR 1e-10
+
+// Gram kernels copy a row block into panels of GRAM_PANEL columns and keep
+// tiles of GRAM_TILE_ROWS by up to GRAM_TILE_MAX_WIDTH entries in registers
+#define GRAM_PANEL 8
+#define GRAM_TILE_ROWS 4
+#define GRAM_TILE_MAX_WIDTH 16
+
+typedef void (gram_tile_func)(const double * a, const double * b,
+		size_t rows, size_t stride, double * acc);
+
+// Micro-kernel for one instruction set and the width of its tiles
+typedef struct {
+	const char * name;
+	size_t width;
+	gram_tile_func * tile;
+} gramKernel;
+
+// Product of base columns, generated per row block rather than stored
+typedef struct {
+	int nfactors;
+	size_t * factors;		// base columns, repeated for powers
+	char * name;
+} gramFeature;
+
+gram_tile_func gram_tile_scalar;
+gram_tile_func gram_tile_avx2;
+gram_tile_func gram_tile_avx512;
+
+const gramKernel * gram_kernel(const char * name);
+
+void gram_accumulate_kernel(const gramKernel * kernel, const gsl_matrix * X,
+		const gsl_vector * y, gsl_matrix * G, gsl_vector * Xty);
+
+void gram_accumulate(const gsl_matrix * X, const gsl_vector * y,
+		gsl_matrix * G, gsl_vector * Xty);
+
+void gram_symmetrize(gsl_matrix * G);
+
+int gram_compute(const gsl_matrix * X, const gsl_vector * y, gsl_matrix * G,
+		gsl_vector * Xty);
+
+int gram_augmented(const gsl_matrix * X, const gsl_vector * y,
+		gsl_matrix * A);
+
+void gram_sweep(gsl_matrix * A, size_t k, bool inverse);
+
+int gram_solve_normal(const gsl_matrix * G, double lambda,
+		const gsl_vector * Xty, gsl_vector * coef, gsl_matrix * inverse);
+
+int gram_solve(const gsl_matrix * G, double lambda, const gsl_matrix * X,
+		const gsl_vector * y, gsl_vector * coef, gsl_matrix * covMatrix,
+		double * chisq);
+
+void gram_feature_block(const gsl_matrix * X, size_t start,
+		const gramFeature * features, int nfeatures, gsl_matrix * Z);
+
+int gram_compute_features(const gsl_matrix * X, const gsl_vector * y,
+		const gramFeature * features, int nfeatures, gsl_matrix * G,
+		gsl_vector * Xty);
+
+void gram_feature_residuals(const gsl_matrix * X, const gsl_vector * y,
+		const gramFeature * features, int nfeatures,
+		const gsl_vector * coef, gsl_vector * resid);
@@ -0,0 +1,48 @@
+// Alternating projections stop when level means fall below this fraction
+#define GROUP_DEMEAN_TOLERANCE 1e-10
+#define GROUP_DEMEAN_MAX_ITER 10000
+
+// Rows are compressed only when it at least halves them
+#define GROUP_COMPRESS_RATIO 0.5
+
+// Rows of one input partitioned by the value of a key column
+typedef struct {
+	size_t ngroups;
+	char ** keys;			// in order of first appearance
+	size_t * rowGroup;		// group of each data row
+	size_t * start;			// group g is order[start[g]..start[g+1])
+	size_t * order;			// data rows sorted by group
+} groupIndex;
+
+int group_lines(char ** lines, int nrow, const char * column,
+		groupIndex * groups);
+
+void group_free(groupIndex * groups);
+
+int load_group_data(modelConfigType * config, char ** columns, int n,
+		modelDataType * data, groupIndex * groups);
+
+void group_demean(groupIndex * factors, int nfactors, gsl_vector * v);
+
+int group_absorbed(groupIndex * factors, int nfactors);
+
+// Rows sharing every predictor value collapsed into one observation each
+typedef struct {
+	size_t nrow;			// distinct rows, 0 if not compressed
+	size_t total;			// input rows
+	double * count;
+	double * mean;			// of the (transformed) response
+	double * ss;			// sum of squares about the mean
+} compressedRows;
+
+size_t design_width(const char * header, char ** keys, size_t nkeys,
+		bool dummy);
+
+int compress_lines(char *** lines, int nrow, int index,
+		transformType transformation, bool dummy,
+		compressedRows * rows);
+
+void compressed_free(compressedRows * rows);
+
+int load_compressed_data(modelConfigType * config, modelDataType * data,
+		compressedRows * rows);
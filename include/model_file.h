@@ -0,0 +1,103 @@
+#include <stdint.h>
+
+/*
+ * Saved model, laid out to be used in place once mapped into memory: a
+ * modelHeader, then sections at 8-byte aligned offsets from the start of
+ * the file. These are
+ *
+ * - the coefficients, as doubles, and their covariance matrix when saved;
+ * - the offset of each coefficient's name in the string pool;
+ * - a modelEncoding for each encoded column, with its categories and their
+ *   target encodings or dummy coefficients, and a hash table of the
+ *   categories (FNV-1a, linear probing);
+ * - the pool of NUL-terminated strings.
+ *
+ * Numbers are in the byte order of the machine that saved the model, which
+ * is checked on loading.
+ */
+#define MODEL_MAGIC "CSMODEL"
+#define MODEL_VERSION 1
+#define MODEL_BYTE_ORDER 0x01020304
+
+#define MODEL_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;		// MODEL_BYTE_ORDER as written
+	uint32_t transformation;
+	uint32_t encoding;
+	uint32_t ncoef;
+	uint32_t nencoded;
+	uint64_t nrow;			// training rows
+	double rss;			// training residual sum of squares
+	uint32_t response;		// name, empty for the first column
+	uint32_t kind;			// modelKind
+	uint64_t coef;			// offsets of the sections
+	uint64_t covariance;		// 0 when not saved
+	uint64_t names;
+	uint64_t encodings;
+	uint64_t strings;
+	uint64_t size;			// of the whole file
+} modelHeader;
+
+typedef struct {
+	uint32_t name;
+	uint32_t ncat;
+	int32_t coef;			// of a target encoded column, or -1
+	uint32_t mask;			// hash table slots - 1
+	uint64_t categories;		// string offsets
+	uint64_t values;		// doubles: target encodings
+	uint64_t indicators;		// int32 dummy coefficients, or -1
+	uint64_t table;			// uint32 category + 1 per slot
+} modelEncoding;
+
+// A model in memory, either mapped from its file or built in a buffer
+typedef struct {
+	char * data;
+	size_t size;
+	bool mapped;
+	const modelHeader * header;
+	const double * coef;
+	const double * covariance;	// NULL when not saved
+	const uint32_t * names;
+	const modelEncoding * encodings;
+	const char * strings;
+} modelFile;
+
+// What is saved of a fitted model
+typedef struct {
+	transformType transformation;
+	encodeType encoding;
+	modelKind kind;
+	int ncoef;
+	char ** names;
+	double * coef;
+	double * covariance;		// ncoef x ncoef, or NULL
+	encodeData * encodings;
+	char * response;		// NULL for the first column
+	size_t nrow;
+	double rss;
+} modelInfo;
+
+uint64_t model_hash(const char * key, size_t len);
+
+char * model_file_build(const modelInfo * info, size_t * size);
+
+int model_file_view(modelFile * model, char * data, size_t size,
+		bool mapped);
+
+int model_file_open(const char * path, modelFile * model);
+
+int model_file_read_text(FILE * file, modelInfo * info);
+
+void model_info_free(modelInfo * info);
+
+void model_file_close(modelFile * model);
+
+const char * model_file_name(const modelFile * model, uint32_t i);
+
+int model_file_lookup(const modelFile * model, const modelEncoding * e,
+		const char * key, size_t len);
+
+void model_file_export(const modelFile * model, FILE * output);
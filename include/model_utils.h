@@ -1,3 +1,11 @@
+// What a saved model holds; predict only scores linear ones
+typedef enum {
+	MODEL_LINEAR,
+	MODEL_ABSORBED,		// slopes without the absorbed fixed effects
+	MODEL_FEATURES,		// with --interact or --poly terms
+	MODEL_SPLINE		// with --spline bases
+} modelKind;
+
 typedef struct {
 	char * name;
 	FILE * input;
@@ -5,8 +13,42 @@ typedef struct {
 	diagnoseType diagnostic;
 	transformType transformation;
 	double testRatio;
+	int threads;			// given by --threads, 0 if not
+	int nresp;			// named responses, 0 for the first column
+	char ** responses;
+	int ncols;			// named predictors, 0 for all
+	char ** columns;
+	char * jobs;			// batch job file
+	char * serve;			// socket to serve fits on
+	char * connect;			// socket of a daemon to fit with
+	encodeData * encodingInfo;	// dictionaries saved with the model
+	modelKind kind;			// of the model saved under name
 } modelConfigType;
 
+// Parsed, encoded and split input shared by the modeling tools
+typedef struct {
+	int nrow;			// training rows
+	int ncol;			// predictors, including the intercept
+	int testRows;
+	char ** colNames;		// predictor names
+	encodeData * encodingInfo;
+	dataColumn * columnHead;
+	dataColumn * testData;
+	gsl_vector * response;		// first column of columnHead
+	gsl_matrix * dataMatrix;
+	gsl_vector * testResponse;	// NULL without a test split
+	gsl_matrix * testMatrix;
+	int nresp;			// responses, the first also in response
+	char ** respNames;
+	gsl_matrix * responses;		// nrow x nresp, NULL for one response
+	gsl_matrix * testResponses;
+} modelDataType;
+
+// Names of the transformations and encodings in saved models, by value
+#define TRANSFORM_NAMES {"none", "log", "log_offset"}
+#define ENCODE_NAMES {"none", "dummy", "target_mean", "target_median"}
+#define MODEL_KIND_NAMES {"linear", "absorbed", "features", "spline"}
+
 // Field 2:
 // no_argument: 0
 // required_argument: 1
@@ -27,12 +69,41 @@ typedef struct {
 	{"adjusted-r-squared",	no_argument,		NULL, 'R'}, \
 	{"f-statistic",		no_argument,		NULL, 'f'}, \
 	{"rmse",		no_argument,		NULL, 'm'}, \
-	{"mae",			no_argument,		NULL, 'M'}
+	{"mae",			no_argument,		NULL, 'M'}, \
+	{"responses",		required_argument,	NULL, 'y'}, \
+	{"columns",		required_argument,	NULL, 'C'}, \
+	{"jobs",		required_argument,	NULL, 'J'}, \
+	{"serve",		required_argument,	NULL, 'U'}, \
+	{"connect",		required_argument,	NULL, 'O'}, \
+	{"threads",		required_argument,	NULL, 'N'}
+
+#define COMMON_OPTION_STRING ":hi:dtTlLn:s:abrRfmMy:C:J:U:O:N:"
+
+modelConfigType * config_alloc(void);
 
-#define COMMON_OPTION_STRING ":hi:dtTlLn:s:abrRfmM"
+void config_free(modelConfigType * config);
+
+int split_names(char * list, char *** names, int n);
 
 int parse_args(int opt, modelConfigType * config, char * helpMessage);
 
+int split_responses(dataColumn ** head, char ** names, int nresp);
+
+gsl_matrix * response_matrix(dataColumn * head, int ncol, int nresp,
+		int nrow);
+
+void transform_responses(modelDataType * data, transformType type);
+
+int model_data_subset(modelDataType * data, char ** names, int n,
+		size_t * cols);
+
+int load_model_data(modelConfigType * config, modelDataType * data);
+
+int parse_model_data(modelConfigType * config, char ** lines, int nrow,
+		char ** testLines, int testRows, modelDataType * data);
+
+void model_data_free(modelDataType * data);
+
 void coefficient_p_values(gsl_vector * pVals, gsl_matrix * varCovar,
 		gsl_vector * coef, int n, int df);
 
@@ -42,11 +113,42 @@ void print_coefficients(gsl_vector * coef, gsl_vector * pVals, char ** names,
 void print_diagnostics(double rSquared, double adjRSquared, double fStat,
 		double AIC, double BIC);
 
-void save_model(char * baseName, gsl_vector * coef, char ** colNames, int p);
+void save_model(modelConfigType * config, gsl_vector * coef,
+		gsl_matrix * covMatrix, char ** colNames, int p, int nrow,
+		double rss);
+
+double diagnostic_value(diagnoseType type, double chisq, double tss,
+		int nrow, int ncol, gsl_vector * testResid);
+
+bool diagnostic_lower_better(diagnoseType type);
+
+bool diagnostic_needs_test(diagnoseType type);
+
+double gcv_score(double chisq, int nrow, double df);
+
+size_t select_path(diagnoseType type, gsl_matrix * path, gsl_vector * rss,
+		gsl_vector * df, gsl_vector * labels, char * labelName,
+		gsl_vector * y, char ** colNames, gsl_matrix * testMatrix,
+		gsl_vector * testResponse);
+
+int svd_solve_responses(size_t rank, const gsl_vector * lambdas,
+		const gsl_matrix * X, const gsl_matrix * Y, gsl_matrix * B,
+		gsl_vector * rss, gsl_matrix * covFactor,
+		gsl_multifit_linear_workspace * work);
+
+void diagnostics_responses(modelConfigType * config, modelDataType * data,
+		gsl_matrix * B, gsl_vector * rss, gsl_matrix * covFactor,
+		gsl_vector * covScale);
+
+double diagnostics_report(diagnoseType type, double chisq, double tss,
+		int nrow, int ncol, gsl_vector * coef, gsl_matrix * covMatrix,
+		char ** colNames, gsl_vector * testResid,
+		modelConfigType * config);
 
 double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
 		gsl_vector * coef, gsl_matrix * covMatrix, char ** colNames,
-		int testRows, dataColumn * testData, char * modelName);
+		gsl_matrix * testMatrix, gsl_vector * testResponse,
+		modelConfigType * config);
 
 #define LM_HELP_MESSAGE \
 	"OPTIONS:\n" \
@@ -55,6 +157,32 @@ double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
 	"\t-n, --name\tGive a name for the model. This option is required " \
 		"to\n" \
 	"\t\t\tuse the DIAGNOSTICS option.\n" \
+	"\t-y, --responses\tComma-separated names of response columns. " \
+		"Each is fit\n" \
+	"\t\t\tagainst all other columns from a single " \
+		"factorization\n" \
+	"\t\t\tand reported in turn (default: the first column).\n" \
+	"\t-C, --columns\tComma-separated names of the predictors to use " \
+		"(default:\n" \
+	"\t\t\tall other columns).\n" \
+	"\t-J, --jobs\tRun every model spec in the given file against " \
+		"the input,\n" \
+	"\t\t\tparsed once. Each line holds a model name followed by " \
+		"that\n" \
+	"\t\t\tmodel's options; specs run concurrently and each saves " \
+		"its\n" \
+	"\t\t\tcoefficients to <name>.coef.\n" \
+	"\t-U, --serve\tLoad the input once and serve fits on the given " \
+		"Unix\n" \
+	"\t\t\tsocket until interrupted. Requests run concurrently " \
+		"as\n" \
+	"\t\t\twith --jobs, on the test split given to the daemon.\n" \
+	"\t-O, --connect\tFit with the daemon serving the given socket " \
+		"instead of\n" \
+	"\t\t\treading an input; the other options apply as usual.\n" \
+	"\t-N, --threads\tNumber of threads for the fit and the BLAS " \
+		"(default: all\n" \
+	"\t\t\tcores, or OMP_NUM_THREADS).\n" \
 	"\t-h,--help\tPrint this help message\n\n" \
 	"RESPONSE TRANSPOSITION:\n" \
 	"\tThe following options transpose the response variable. This is " \
@@ -0,0 +1,12 @@
+// Running moments and range of a column, mergeable across chunks
+typedef struct {
+	size_t n;
+	double mean;
+	double m2;
+	double min;
+	double max;
+} normMoments;
+
+void norm_update(normMoments * m, double x);
+
+void norm_merge(normMoments * a, const normMoments * b);
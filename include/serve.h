@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+/*
+ * Fits served over a Unix socket by a daemon that holds the parsed input. A
+ * request is a uint32 count of strings, then each string as a uint32 length
+ * and its bytes: the client's working directory, then its command line. The
+ * reply is the uint32 exit status of the fit, then what it wrote to stdout
+ * and to stderr, each as a uint64 length and its bytes.
+ */
+
+// Most strings in a request, and the longest
+#define SERVE_MAX_ARGS 256
+#define SERVE_MAX_STRING (1 << 20)
+
+// What the daemon keeps between requests
+typedef struct {
+	batch_parse_func * parse;
+	batch_fit_func * fit;
+	batch_free_func * freeOptions;
+	bool useGram;
+	char ** lines;			// of the input, header first
+	int nrow;
+	char ** testLines;
+	int testRows;
+	batchDataset * datasets;	// parsed so far
+	int ndata;
+} serveDaemon;
+
+char ** serve_arguments(int argc, char ** argv);
+
+int serve_request(modelConfigType * config, int argc, char ** argv);
+
+pid_t serve_handle(serveDaemon * server, int client);
+
+int run_serve(modelConfigType * config, batch_parse_func parse,
+		batch_fit_func fit, batch_free_func freeOptions, bool useGram);
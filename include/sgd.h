@@ -0,0 +1,43 @@
+// Adam step size and moment decays of the first-order solver
+#define SGD_RATE 0.1
+#define SGD_BETA1 0.9
+#define SGD_BETA2 0.999
+#define SGD_EPSILON 1e-8
+
+// Rows per mini-batch unless --batch is given
+#define SGD_BATCH 256
+#define SGD_BATCH_STR "256"
+
+// Epochs stop early once the relative change of the coefficients over an
+// epoch falls below this
+#define SGD_TOLERANCE 1e-6
+
+// Rows of a memory-mapped csv input, read a block at a time
+typedef struct {
+	char * map;
+	size_t size;
+	char * first;			// first data row
+	char * next;			// next unread row
+	int nfield;			// fields per row
+	int response;			// field of the response
+	int ncol;			// predictors, including the intercept
+	int * fields;			// field of each predictor, -1 for intercept
+	char ** colNames;
+	double * values;		// fields of the current row
+	transformType transformation;
+} streamInput;
+
+int stream_open(modelConfigType * config, streamInput * input);
+
+void stream_rewind(streamInput * input);
+
+size_t stream_block(streamInput * input, gsl_matrix * X, gsl_vector * y);
+
+void stream_close(streamInput * input);
+
+int sgd_solve(streamInput * input, int epochs, size_t batch, double lambda,
+		double alpha, bool verbose, gsl_vector * coef, double * chisq,
+		double * tss, size_t * nrow);
+
+int fit_sgd(modelConfigType * config, int epochs, int batch, double lambda,
+		double alpha);
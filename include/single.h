@@ -0,0 +1,23 @@
+#include <gsl/gsl_matrix_float.h>
+
+// Iterative refinement against the float design stops once the update is
+// this small relative to the coefficients, or after SINGLE_MAX_REFINE steps
+#define SINGLE_TOLERANCE 1e-12
+#define SINGLE_MAX_REFINE 10
+
+gsl_matrix_float * single_matrix(const gsl_matrix * X);
+
+int single_gram(const gsl_matrix_float * X, const gsl_vector * y,
+		gsl_matrix * G, gsl_vector * Xty);
+
+void single_residuals(const gsl_matrix_float * X, const gsl_vector * y,
+		const gsl_vector * coef, gsl_vector * resid);
+
+void single_gradient(const gsl_matrix_float * X, const gsl_vector * r,
+		gsl_vector * g);
+
+int single_refine(const gsl_matrix_float * X, const gsl_vector * y,
+		const gsl_matrix * M, gsl_vector * coef, gsl_vector * resid);
+
+int single_pseudo_inverse(const gsl_matrix * G, double tol, bool balance,
+		gsl_matrix * M);
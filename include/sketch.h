@@ -0,0 +1,10 @@
+// Preconditioned refinement stops when the gradient is this small relative
+// to the residual, or after SKETCH_MAX_ITER iterations
+#define SKETCH_TOLERANCE 1e-10
+#define SKETCH_MAX_ITER 100
+
+int sketch_count(const gsl_matrix * X, const gsl_vector * y,
+		unsigned long seed, gsl_matrix * SX, gsl_vector * Sy);
+
+int sketch_refine(const gsl_matrix * X, const gsl_vector * y,
+		const gsl_matrix * R, gsl_vector * coef, size_t * iterations);
@@ -0,0 +1,36 @@
+#include <gsl/gsl_bspline.h>
+
+// Cubic splines: four nonzero basis functions per row
+#define SPLINE_ORDER 4
+
+// B-spline basis of one predictor, stored by its nonzeros in each row
+typedef struct {
+	char * name;
+	size_t column;			// predictor expanded
+	size_t nbreak;			// knots, including both ends
+	size_t ncoef;			// basis functions kept (the first is dropped)
+	double min;			// range of the knots
+	double max;
+	size_t * start;			// first nonzero function of each row
+	double * values;		// SPLINE_ORDER values per row
+} splineBasis;
+
+int spline_basis(const gsl_matrix * X, size_t column, size_t nbreak,
+		splineBasis * spline);
+
+void spline_eval(const gsl_matrix * X, splineBasis * spline);
+
+void spline_free(splineBasis * spline);
+
+void spline_accumulate_row(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines,
+		const size_t * offsets, size_t i, gsl_matrix * G,
+		gsl_vector * Xty);
+
+int spline_gram(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines, gsl_matrix * G,
+		gsl_vector * Xty);
+
+void spline_residuals(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines,
+		const gsl_vector * coef, gsl_vector * resid);
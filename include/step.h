@@ -0,0 +1,25 @@
+// Pivots below this fraction of their unswept value are taken as collinear
+#define STEP_COLLINEAR 1e-10
+
+// Best subsets: subsets are bit sets, and subtrees with at least this many
+// candidates left are searched as separate tasks
+#define SUBSET_MAX_PREDICTORS 40
+#define SUBSET_MAX_PREDICTORS_STR "40"
+#define SUBSET_TASK_CANDIDATES 8
+
+// Lowest residual sums of squares found so far for each subset size
+typedef struct {
+	int keep;		// models kept per size
+	int * count;		// models held per size
+	double * worst;		// RSS a model of each size must beat
+	double * rss;		// keep per size, ascending
+	uint64_t * sets;	// predictors as bits, matching rss
+	gsl_vector * pivots;	// unswept diagonal, for collinearity
+} subsetTable;
+
+void subset_search(subsetTable * table, gsl_matrix * A, uint64_t set,
+		int size, size_t * cand, int ncand);
+
+void subset_find(subsetTable * table, int keep, const gsl_matrix * A);
+
+void subset_table_free(subsetTable * table);
@@ -0,0 +1,321 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+#include "core.h"
+#include "gram.h"
+#include "model_utils.h"
+#include "batch.h"
+#include "blas.h"
+
+// Most options on one spec line
+#define BATCH_MAX_ARGS 256
+
+/*
+ * Read a job file: each line holds a model name followed by that model's
+ * options, as they would be given on the command line. Blank lines and
+ * lines starting with '#' are skipped. Options that apply to the whole run
+ * (--input, --test-ratio, --threads, --jobs, --serve and --connect) are
+ * rejected. Returns the number of jobs, or -1 if a spec does not parse.
+ */
+int read_jobs(char * fileName, batch_parse_func parse,
+		batch_free_func freeOptions, batchJob ** jobs)
+{
+	int njobs = 0;
+	int argc;
+	int status;
+	size_t len = 0;
+	char * line = NULL;
+	char * token;
+	char * argv[BATCH_MAX_ARGS + 1];
+	FILE * file;
+
+	file = fopen(fileName, "r");
+	if (!file) {
+		perror("Error opening job file");
+		return -1;
+	}
+
+	*jobs = NULL;
+	while (getline(&line, &len, file) != -1) {
+		batchJob * job;
+
+		token = strtok(line, " \t\r\n");
+		if (!token || token[0] == '#') continue;
+
+		*jobs = realloc(*jobs, (njobs + 1) * sizeof(batchJob));
+		job = *jobs + njobs++;
+		job->config = config_alloc();
+		job->options = NULL;
+		job->config->name = strdup(token);
+
+		argc = 0;
+		argv[argc++] = strdup(token);
+		while ((token = strtok(NULL, " \t\r\n")) &&
+				argc < BATCH_MAX_ARGS) {
+			argv[argc++] = strdup(token);
+		}
+		argv[argc] = NULL;
+
+		// Restart getopt for each spec
+		optind = 0;
+		status = parse(argc, argv, job->config, &job->options);
+		for (int i = 0; i < argc; i++) {
+			free(argv[i]);
+		}
+		if (status) {
+			fprintf(stderr, "Invalid spec for job '%s'.\n",
+					job->config->name);
+		} else if (job->config->input != stdin ||
+				job->config->testRatio ||
+				job->config->threads || job->config->jobs ||
+				job->config->serve || job->config->connect) {
+			fprintf(stderr, "Job '%s' sets an option of the "
+					"whole run: --input, --test-ratio, "
+					"--threads, --jobs, --serve or "
+					"--connect.\n", job->config->name);
+			status = 1;
+		}
+		if (job->config->input && job->config->input != stdin) {
+			fclose(job->config->input);
+		}
+		if (status) {
+			batch_jobs_free(*jobs, njobs, freeOptions);
+			free(line);
+			fclose(file);
+			return -1;
+		}
+	}
+	free(line);
+	fclose(file);
+
+	return njobs;
+}
+
+void batch_jobs_free(batchJob * jobs, int njobs,
+		batch_free_func freeOptions)
+{
+	for (int i = 0; i < njobs; i++) {
+		if (jobs[i].options) freeOptions(jobs[i].options);
+		config_free(jobs[i].config);
+	}
+	free(jobs);
+}
+
+/*
+ * Fit one job against its shared dataset: cut the predictors down to the
+ * job's columns (taking the matching block of the shared Gram matrix),
+ * transform the responses and hand over to the tool. Runs in a child
+ * process, so the shared data may be modified freely.
+ */
+int batch_run(batchJob * job, batchDataset * dataset, batch_fit_func fit)
+{
+	int ncols = job->config->ncols;
+	size_t * cols;
+	modelDataType data = dataset->data;
+	gsl_matrix * gram = dataset->gram;
+
+	if (ncols > 0) {
+		cols = malloc((ncols + 1) * sizeof(size_t));
+		if (model_data_subset(&data, job->config->columns, ncols,
+					cols)) {
+			return 1;
+		}
+		if (gram) {
+			gram = gsl_matrix_alloc(ncols + 1, ncols + 1);
+			for (int i = 0; i <= ncols; i++) {
+				for (int j = 0; j <= ncols; j++) {
+					gsl_matrix_set(gram, i, j,
+						gsl_matrix_get(dataset->gram,
+							cols[i], cols[j]));
+				}
+			}
+		}
+		free(cols);
+	}
+	transform_responses(&data, job->config->transformation);
+	job->config->encodingInfo = data.encodingInfo;
+
+	return fit(job->config, job->options, &data, gram);
+}
+
+/*
+ * Index of the dataset parsed with the encoding and responses of `config`,
+ * parsing it from a copy of the lines (with the cross-products of its
+ * predictors when `useGram` is set) if there is none yet. Returns -1 if the
+ * lines do not parse.
+ */
+int batch_dataset(batchDataset ** datasets, int * ndata,
+		modelConfigType * config, char ** lines, int nrow,
+		char ** testLines, int testRows, bool useGram)
+{
+	int k;
+	batchDataset * dataset;
+	char ** copy;
+	char ** testCopy;
+
+	for (k = 0; k < *ndata; k++) {
+		modelConfigType * c = &(*datasets)[k].config;
+		bool same = c->encoding == config->encoding &&
+			c->nresp == config->nresp;
+		for (int j = 0; same && j < c->nresp; j++) {
+			same = !strcmp(c->responses[j], config->responses[j]);
+		}
+		if (same) return k;
+	}
+
+	*datasets = realloc(*datasets, (k + 1) * sizeof(batchDataset));
+	dataset = *datasets + k;
+	memset(&dataset->config, 0, sizeof(modelConfigType));
+	dataset->config.encoding = config->encoding;
+	dataset->config.nresp = config->nresp;
+	dataset->config.responses = malloc(config->nresp * sizeof(char *));
+	for (int j = 0; j < config->nresp; j++) {
+		dataset->config.responses[j] = strdup(config->responses[j]);
+	}
+	dataset->gram = NULL;
+
+	// Parsing consumes lines, so each parse gets its own copy
+	copy = malloc((nrow + 1) * sizeof(char *));
+	testCopy = malloc((testRows + 1) * sizeof(char *));
+	for (int j = 0; j <= nrow; j++) copy[j] = strdup(lines[j]);
+	for (int j = 0; testRows && j <= testRows; j++) {
+		testCopy[j] = strdup(testLines[j]);
+	}
+	if (parse_model_data(&dataset->config, copy, nrow, testCopy,
+				testRows, &dataset->data)) {
+		return -1;
+	}
+	if (useGram) {
+		size_t p = dataset->data.ncol;
+		dataset->gram = gsl_matrix_alloc(p, p);
+		gram_compute(dataset->data.dataMatrix, NULL, dataset->gram,
+				NULL);
+	}
+	(*ndata)++;
+
+	return k;
+}
+
+void batch_datasets_free(batchDataset * datasets, int ndata)
+{
+	for (int k = 0; k < ndata; k++) {
+		if (datasets[k].gram) gsl_matrix_free(datasets[k].gram);
+		model_data_free(&datasets[k].data);
+		for (int j = 0; j < datasets[k].config.nresp; j++) {
+			free(datasets[k].config.responses[j]);
+		}
+		free(datasets[k].config.responses);
+	}
+	free(datasets);
+}
+
+// Wait for any running job and record how it ended
+void batch_wait(batchJob * jobs, int njobs)
+{
+	int status;
+	pid_t pid;
+
+	pid = wait(&status);
+	for (int i = 0; i < njobs; i++) {
+		if (jobs[i].pid == pid) {
+			jobs[i].status = WIFEXITED(status) ?
+				WEXITSTATUS(status) : 1;
+		}
+	}
+}
+
+/*
+ * Run every spec in config->jobs against the input. The input is read
+ * once and parsed once per distinct encoding and response set; when
+ * `useGram` is set the cross-products of all predictors are formed once per
+ * parse as well, and each job takes the block for its columns. Jobs then
+ * run concurrently in child processes (as many as OpenMP threads), each
+ * inheriting the parsed data, and their output is printed in spec order.
+ */
+int run_batch(modelConfigType * config, batch_parse_func parse,
+		batch_fit_func fit, batch_free_func freeOptions, bool useGram)
+{
+	int nrow;
+	int testRows;
+	int njobs;
+	int ndata = 0;
+	int running = 0;
+	int failed = 0;
+	int nworkers = omp_get_max_threads();
+	char buffer[BUFSIZ];
+	size_t nread;
+	char ** lines = NULL;
+	char ** testLines = NULL;
+	batchJob * jobs;
+	batchDataset * datasets = NULL;
+
+	njobs = read_jobs(config->jobs, parse, freeOptions, &jobs);
+	if (njobs < 0) return 1;
+
+	// Read the input once
+	nrow = read_rows(&lines, config->input);
+	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
+	nrow -= testRows;
+	fclose(config->input);
+
+	// Parse once per encoding and response set
+	for (int i = 0; i < njobs; i++) {
+		jobs[i].dataset = batch_dataset(&datasets, &ndata,
+				jobs[i].config, lines, nrow, testLines,
+				testRows, useGram);
+		if (jobs[i].dataset < 0) return 1;
+	}
+
+	// Run jobs in child processes, output captured in temporary files
+	for (int i = 0; i < njobs; i++) {
+		if (running == nworkers) {
+			batch_wait(jobs, njobs);
+			running--;
+		}
+		jobs[i].output = tmpfile();
+		jobs[i].status = 1;
+		fflush(stdout);
+		fflush(stderr);
+		jobs[i].pid = fork();
+		if (jobs[i].pid == 0) {
+			// Jobs already fill the cores; threads after fork
+			// would also hang the OpenMP runtime
+			blas_set_threads(1);
+			dup2(fileno(jobs[i].output), STDOUT_FILENO);
+			jobs[i].status = batch_run(&jobs[i],
+					&datasets[jobs[i].dataset], fit);
+			fflush(stdout);
+			_exit(jobs[i].status ? EXIT_FAILURE : EXIT_SUCCESS);
+		} else if (jobs[i].pid < 0) {
+			perror("Error starting job");
+		} else {
+			running++;
+		}
+	}
+	while (running > 0) {
+		batch_wait(jobs, njobs);
+		running--;
+	}
+
+	// Output in spec order
+	for (int i = 0; i < njobs; i++) {
+		printf("Job: %s\n", jobs[i].config->name);
+		rewind(jobs[i].output);
+		while ((nread = fread(buffer, 1, sizeof(buffer),
+						jobs[i].output)) > 0) {
+			fwrite(buffer, 1, nread, stdout);
+		}
+		printf("\n");
+		fclose(jobs[i].output);
+		if (jobs[i].status) {
+			fprintf(stderr, "Job '%s' failed.\n",
+					jobs[i].config->name);
+			failed++;
+		}
+	}
+
+	batch_datasets_free(datasets, ndata);
+	batch_jobs_free(jobs, njobs, freeOptions);
+
+	return failed > 0;
+}
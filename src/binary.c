@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+
+// Whether a line read from the input is the start of a binary stream
+bool binary_detect(const char * line, ssize_t len)
+{
+	return len == BINARY_MAGIC_LEN && !memcmp(line, BINARY_MAGIC, len);
+}
+
+// Write x as a packed cell of BINARY_CELL_LEN bytes (not terminated)
+void binary_pack(double x, char * cell)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &x, sizeof(bits));
+	cell[0] = BINARY_CELL;
+	for (int i = 1; i < BINARY_CELL_LEN; i++) {
+		cell[i] = (char) (0x80 | (bits & 0x7f));
+		bits >>= 7;
+	}
+}
+
+// Read a packed cell; false if `cell` is not one
+bool binary_unpack(const char * cell, double * x)
+{
+	uint64_t bits = 0;
+
+	if (cell[0] != BINARY_CELL) return false;
+	for (int i = BINARY_CELL_LEN - 1; i > 0; i--) {
+		if (!(cell[i] & 0x80)) return false;
+		bits = bits << 7 | (cell[i] & 0x7f);
+	}
+	memcpy(x, &bits, sizeof(bits));
+
+	return true;
+}
+
+// Value of a field that may be a packed cell, as atof() otherwise
+double binary_atof(const char * value)
+{
+	double x;
+
+	return binary_unpack(value, &x) ? x : atof(value);
+}
+
+/*
+ * Shortest of %.15g and %.17g that reads back as x, into a buffer of at
+ * least 32 bytes. Returns the length.
+ */
+int binary_format(double x, char * text)
+{
+	int len = sprintf(text, "%.15g", x);
+
+	return strtod(text, NULL) == x ? len : sprintf(text, "%.17g", x);
+}
+
+/*
+ * Start a binary stream of the given columns on `output`. Cells are then put
+ * row by row, each row closed with binary_end_row().
+ */
+binaryWriter * binary_writer_open(FILE * output, char ** names, int ncol)
+{
+	binaryWriter * writer = malloc(sizeof(binaryWriter));
+	uint32_t version = BINARY_VERSION;
+	uint32_t n = ncol;
+
+	writer->output = output;
+	writer->ncol = ncol;
+	writer->col = 0;
+	writer->nrows = 0;
+	writer->numbers = malloc(ncol * BINARY_BATCH_ROWS * sizeof(double));
+	writer->texts = calloc(ncol * BINARY_BATCH_ROWS, sizeof(char *));
+
+	fwrite(BINARY_MAGIC, 1, BINARY_MAGIC_LEN, output);
+	fwrite(&version, sizeof(version), 1, output);
+	fwrite(&n, sizeof(n), 1, output);
+	for (int j = 0; j < ncol; j++) {
+		uint32_t len = strlen(names[j]);
+
+		fwrite(&len, sizeof(len), 1, output);
+		fwrite(names[j], 1, len, output);
+	}
+
+	return writer;
+}
+
+void binary_put_number(binaryWriter * writer, double x)
+{
+	if (writer->col >= writer->ncol) return;
+	writer->numbers[writer->col++ * BINARY_BATCH_ROWS + writer->nrows] = x;
+}
+
+void binary_put_text(binaryWriter * writer, const char * text, size_t len)
+{
+	if (writer->col >= writer->ncol) return;
+	writer->texts[writer->col++ * BINARY_BATCH_ROWS + writer->nrows] =
+		strndup(text, len);
+}
+
+// Put a csv field as a number when it is one, and as text otherwise
+void binary_put_field(binaryWriter * writer, const csvField * field)
+{
+	double x;
+
+	if (csv_number(field, &x)) {
+		binary_put_number(writer, x);
+	} else {
+		binary_put_text(writer, field->start, field->len);
+	}
+}
+
+/*
+ * Write the gathered rows as a batch. A column is stored as doubles when all
+ * its cells in the batch are numbers, and as text otherwise.
+ */
+void binary_flush(binaryWriter * writer)
+{
+	uint32_t nrows = writer->nrows;
+	char number[32];
+
+	if (nrows == 0) return;
+	fwrite(&nrows, sizeof(nrows), 1, writer->output);
+	for (int j = 0; j < writer->ncol; j++) {
+		double * numbers = writer->numbers + j * BINARY_BATCH_ROWS;
+		char ** texts = writer->texts + j * BINARY_BATCH_ROWS;
+		uint8_t type = BINARY_NUMBERS;
+
+		for (size_t i = 0; i < nrows && type == BINARY_NUMBERS; i++) {
+			if (texts[i]) type = BINARY_TEXT;
+		}
+		fwrite(&type, sizeof(type), 1, writer->output);
+		if (type == BINARY_NUMBERS) {
+			fwrite(numbers, sizeof(double), nrows, writer->output);
+			continue;
+		}
+		for (size_t i = 0; i < nrows; i++) {
+			const char * text = texts[i];
+			uint32_t len;
+
+			if (!text) {
+				binary_format(numbers[i], number);
+				text = number;
+			}
+			len = strlen(text);
+			fwrite(&len, sizeof(len), 1, writer->output);
+			fwrite(text, 1, len, writer->output);
+			free(texts[i]);
+			texts[i] = NULL;
+		}
+	}
+	writer->nrows = 0;
+}
+
+// Close the current row, leaving any cells not put empty
+void binary_end_row(binaryWriter * writer)
+{
+	while (writer->col < writer->ncol) {
+		binary_put_text(writer, "", 0);
+	}
+	writer->col = 0;
+	if (++writer->nrows == BINARY_BATCH_ROWS) binary_flush(writer);
+}
+
+// Write the last batch and the end of the stream
+void binary_writer_close(binaryWriter * writer)
+{
+	uint32_t end = 0;
+
+	binary_flush(writer);
+	fwrite(&end, sizeof(end), 1, writer->output);
+	free(writer->numbers);
+	free(writer->texts);
+	free(writer);
+}
+
+/*
+ * Read the schema of a binary stream whose magic line has been consumed.
+ * Its rows are then given back by binary_getline() as csv lines, with the
+ * numbers packed into cells when `pack` is set (for read_columns() and
+ * for binary output) and formatted otherwise. Returns NULL on a bad stream.
+ */
+binaryReader * binary_reader_open(FILE * input, bool pack)
+{
+	binaryReader * reader;
+	uint32_t version;
+	uint32_t ncol;
+
+	if (fread(&version, sizeof(version), 1, input) != 1 ||
+			version != BINARY_VERSION ||
+			fread(&ncol, sizeof(ncol), 1, input) != 1) {
+		fprintf(stderr, "Unsupported binary input.\n");
+		return NULL;
+	}
+
+	reader = malloc(sizeof(binaryReader));
+	reader->input = input;
+	reader->ncol = ncol;
+	reader->names = calloc(ncol, sizeof(char *));
+	reader->pack = pack;
+	reader->header = true;
+	reader->nrows = 0;
+	reader->row = 0;
+	reader->types = malloc(ncol * sizeof(binaryColumnType));
+	reader->numbers = malloc(ncol * BINARY_BATCH_ROWS * sizeof(double));
+	reader->texts = calloc(ncol * BINARY_BATCH_ROWS, sizeof(char *));
+	for (uint32_t j = 0; j < ncol; j++) {
+		uint32_t len;
+
+		if (fread(&len, sizeof(len), 1, input) != 1 ||
+				!(reader->names[j] = calloc(len + 1, 1)) ||
+				fread(reader->names[j], 1, len, input) != len) {
+			fprintf(stderr, "Truncated binary input.\n");
+			binary_reader_close(reader);
+			return NULL;
+		}
+	}
+
+	return reader;
+}
+
+// Read the next batch, returning false at the end of the stream
+bool binary_batch(binaryReader * reader)
+{
+	uint32_t nrows;
+
+	for (size_t i = 0; i < (size_t) reader->ncol * BINARY_BATCH_ROWS;
+			i++) {
+		free(reader->texts[i]);
+		reader->texts[i] = NULL;
+	}
+	if (fread(&nrows, sizeof(nrows), 1, reader->input) != 1 ||
+			nrows == 0 || nrows > BINARY_BATCH_ROWS) {
+		return false;
+	}
+	for (int j = 0; j < reader->ncol; j++) {
+		double * numbers = reader->numbers + j * BINARY_BATCH_ROWS;
+		char ** texts = reader->texts + j * BINARY_BATCH_ROWS;
+		uint8_t type;
+
+		if (fread(&type, sizeof(type), 1, reader->input) != 1) {
+			return false;
+		}
+		reader->types[j] = type;
+		if (type == BINARY_NUMBERS) {
+			if (fread(numbers, sizeof(double), nrows,
+						reader->input) != nrows) {
+				return false;
+			}
+			continue;
+		}
+		for (uint32_t i = 0; i < nrows; i++) {
+			uint32_t len;
+
+			if (fread(&len, sizeof(len), 1, reader->input) != 1) {
+				return false;
+			}
+			texts[i] = calloc(len + 1, 1);
+			if (fread(texts[i], 1, len, reader->input) != len) {
+				return false;
+			}
+		}
+	}
+	reader->nrows = nrows;
+	reader->row = 0;
+
+	return true;
+}
+
+/*
+ * Put the next line of the stream in *line as getline() would, the header
+ * first, without a newline. Returns its length, or -1 at the end.
+ */
+ssize_t binary_getline(binaryReader * reader, char ** line, size_t * len)
+{
+	size_t used = 0;
+
+	if (!reader->header && reader->row == reader->nrows &&
+			!binary_batch(reader)) {
+		return -1;
+	}
+
+	for (int j = 0; j < reader->ncol; j++) {
+		size_t k = (size_t) j * BINARY_BATCH_ROWS + reader->row;
+		size_t need = used + BINARY_CELL_LEN + 32;
+		const char * text = reader->header ? reader->names[j] :
+			reader->types[j] == BINARY_TEXT ? reader->texts[k] :
+			NULL;
+
+		if (text) need += strlen(text);
+		if (need > *len) {
+			*len = 2 * need;
+			*line = realloc(*line, *len);
+		}
+		if (j) (*line)[used++] = ',';
+		if (text) {
+			strcpy(*line + used, text);
+			used += strlen(text);
+		} else if (reader->pack) {
+			binary_pack(reader->numbers[k], *line + used);
+			used += BINARY_CELL_LEN;
+		} else {
+			used += binary_format(reader->numbers[k],
+					*line + used);
+		}
+	}
+	if (!*len) *line = realloc(*line, *len = 1);
+	(*line)[used] = '\0';
+	if (reader->header) {
+		reader->header = false;
+	} else {
+		reader->row++;
+	}
+
+	return used;
+}
+
+/*
+ * getline() for tools taking either csv or the binary stream of another
+ * tool: its magic line switches *binary to reading the stream, packing the
+ * numbers when `pack` is set. Returns -1 at the end or on a bad stream.
+ */
+ssize_t binary_read_line(FILE * input, binaryReader ** binary, bool pack,
+		char ** line, size_t * len)
+{
+	ssize_t got;
+
+	if (*binary) return binary_getline(*binary, line, len);
+	got = getline(line, len, input);
+	if (got == -1 || !binary_detect(*line, got)) return got;
+	*binary = binary_reader_open(input, pack);
+
+	return *binary ? binary_getline(*binary, line, len) : -1;
+}
+
+void binary_reader_close(binaryReader * reader)
+{
+	for (size_t i = 0; i < (size_t) reader->ncol * BINARY_BATCH_ROWS;
+			i++) {
+		free(reader->texts[i]);
+	}
+	for (int j = 0; j < reader->ncol; j++) {
+		free(reader->names[j]);
+	}
+	free(reader->names);
+	free(reader->types);
+	free(reader->numbers);
+	free(reader->texts);
+	free(reader);
+}
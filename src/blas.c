@@ -0,0 +1,265 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <gsl/gsl_cblas.h>
+#include "blas.h"
+
+#ifdef BLAS_OPENBLAS
+void openblas_set_num_threads(int n);
+#endif
+#ifdef BLAS_BLIS
+void bli_thread_set_num_threads(long n);
+#endif
+
+/*
+ * Use n threads for the OpenMP loops of the tools and for the CBLAS they
+ * are linked against, whose own thread pool may not follow OpenMP.
+ */
+void blas_set_threads(int n)
+{
+	omp_set_num_threads(n);
+#ifdef BLAS_OPENBLAS
+	openblas_set_num_threads(n);
+#endif
+#ifdef BLAS_BLIS
+	bli_thread_set_num_threads(n);
+#endif
+}
+
+#ifdef BLAS_BUILTIN
+/*
+ * Cache-blocked, multithreaded replacements for the CBLAS routines behind
+ * gsl_blas_dgemm(), gsl_blas_dsyrk() and gsl_blas_dgemv(), built in place of
+ * those of the reference gslcblas when no optimized CBLAS is available. Being
+ * defined in the program, they take precedence over the library's.
+ */
+
+// Element (i, j) of op(A) for a row-major A
+#define BLAS_OP(A, trans, ld, i, j) ((trans) == CblasNoTrans ? \
+		(A)[(size_t) (i) * (ld) + (j)] : (A)[(size_t) (j) * (ld) + (i)])
+
+#define BLAS_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// C = beta C over an M x N row-major C, or over one triangle with `uplo`
+void blas_scale(int M, int N, double beta, double * C, int ldc, int uplo)
+{
+	if (beta == 1) return;
+
+	#pragma omp parallel for if ((double) M * N > BLAS_PARALLEL_MIN)
+	for (int i = 0; i < M; i++) {
+		int start = uplo == CblasUpper ? i : 0;
+		int end = uplo == CblasLower ? i + 1 : N;
+		double * c = C + (size_t) i * ldc;
+
+		for (int j = start; j < end; j++) {
+			c[j] = beta == 0 ? 0 : beta * c[j];
+		}
+	}
+}
+
+/*
+ * Rows [i0, i1) and columns [j0, j1) of C += alpha op(A) op(B), or their
+ * part in one triangle of C with `uplo`. Blocks of op(A) and op(B) are
+ * copied contiguously into packA and packB first, so the inner loop runs
+ * over unit-stride rows whichever way the inputs are transposed.
+ */
+void blas_gemm_block(enum CBLAS_TRANSPOSE transA,
+		enum CBLAS_TRANSPOSE transB, int i0, int i1, int j0, int j1,
+		int K, double alpha, const double * A, int lda,
+		const double * B, int ldb, double * C, int ldc, int uplo,
+		double * packA, double * packB)
+{
+	for (int k0 = 0; k0 < K; k0 += BLAS_BLOCK_K) {
+		int k1 = BLAS_MIN(k0 + BLAS_BLOCK_K, K);
+
+		for (int i = i0; i < i1; i++) {
+			double * a = packA + (i - i0) * BLAS_BLOCK_K - k0;
+
+			for (int p = k0; p < k1; p++) {
+				a[p] = alpha * BLAS_OP(A, transA, lda, i, p);
+			}
+		}
+		for (int p = k0; p < k1; p++) {
+			double * b = packB + (p - k0) * BLAS_BLOCK_N - j0;
+
+			for (int j = j0; j < j1; j++) {
+				b[j] = BLAS_OP(B, transB, ldb, p, j);
+			}
+		}
+
+		for (int i = i0; i < i1; i++) {
+			int start = j0;
+			int end = j1;
+			double * c = C + (size_t) i * ldc;
+			const double * a = packA + (i - i0) * BLAS_BLOCK_K - k0;
+
+			if (uplo == CblasUpper && start < i) start = i;
+			if (uplo == CblasLower && end > i + 1) end = i + 1;
+			for (int p = k0; p < k1; p++) {
+				const double * b = packB + (p - k0) *
+					BLAS_BLOCK_N - j0;
+
+				for (int j = start; j < end; j++) {
+					c[j] += a[p] * b[j];
+				}
+			}
+		}
+	}
+}
+
+/*
+ * C += alpha op(A) op(B) for row-major M x K op(A), K x N op(B) and M x N
+ * C, restricted to one triangle of C with `uplo` (0 for all of it). Blocks
+ * of C are spread over threads.
+ */
+void blas_gemm_blocked(enum CBLAS_TRANSPOSE transA,
+		enum CBLAS_TRANSPOSE transB, int M, int N, int K, double alpha,
+		const double * A, int lda, const double * B, int ldb,
+		double * C, int ldc, int uplo)
+{
+	int nbi = (M + BLAS_BLOCK_M - 1) / BLAS_BLOCK_M;
+	int nbj = (N + BLAS_BLOCK_N - 1) / BLAS_BLOCK_N;
+
+	#pragma omp parallel if ((double) M * N * K > BLAS_PARALLEL_MIN)
+	{
+		double * packA = malloc(BLAS_BLOCK_M * BLAS_BLOCK_K *
+				sizeof(double));
+		double * packB = malloc(BLAS_BLOCK_K * BLAS_BLOCK_N *
+				sizeof(double));
+
+		#pragma omp for collapse(2) schedule(dynamic)
+		for (int bi = 0; bi < nbi; bi++) {
+			for (int bj = 0; bj < nbj; bj++) {
+				int i0 = bi * BLAS_BLOCK_M;
+				int i1 = BLAS_MIN(i0 + BLAS_BLOCK_M, M);
+				int j0 = bj * BLAS_BLOCK_N;
+				int j1 = BLAS_MIN(j0 + BLAS_BLOCK_N, N);
+
+				// Skip blocks wholly outside the triangle
+				if ((uplo == CblasUpper && i0 >= j1) ||
+						(uplo == CblasLower &&
+						 j0 >= i1)) {
+					continue;
+				}
+				blas_gemm_block(transA, transB, i0, i1, j0, j1,
+						K, alpha, A, lda, B, ldb, C,
+						ldc, uplo, packA, packB);
+			}
+		}
+
+		free(packA);
+		free(packB);
+	}
+}
+
+void cblas_dgemm(const enum CBLAS_ORDER Order,
+		const enum CBLAS_TRANSPOSE TransA,
+		const enum CBLAS_TRANSPOSE TransB, const int M, const int N,
+		const int K, const double alpha, const double * A,
+		const int lda, const double * B, const int ldb,
+		const double beta, double * C, const int ldc)
+{
+	// A column-major matrix reads as its transpose in row-major order,
+	// and C^T = op(B)^T op(A)^T
+	if (Order == CblasColMajor) {
+		cblas_dgemm(CblasRowMajor, TransB, TransA, N, M, K, alpha, B,
+				ldb, A, lda, beta, C, ldc);
+		return;
+	}
+
+	blas_scale(M, N, beta, C, ldc, 0);
+	if (alpha != 0 && K > 0) {
+		blas_gemm_blocked(TransA, TransB, M, N, K, alpha, A, lda, B,
+				ldb, C, ldc, 0);
+	}
+}
+
+void cblas_dsyrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo,
+		const enum CBLAS_TRANSPOSE Trans, const int N, const int K,
+		const double alpha, const double * A, const int lda,
+		const double beta, double * C, const int ldc)
+{
+	enum CBLAS_TRANSPOSE other = Trans == CblasNoTrans ? CblasTrans :
+		CblasNoTrans;
+
+	if (Order == CblasColMajor) {
+		cblas_dsyrk(CblasRowMajor, Uplo == CblasUpper ? CblasLower :
+				CblasUpper, other, N, K, alpha, A, lda, beta,
+				C, ldc);
+		return;
+	}
+
+	// op(A) op(A)^T, the second factor being A read the other way
+	blas_scale(N, N, beta, C, ldc, Uplo);
+	if (alpha != 0 && K > 0) {
+		blas_gemm_blocked(Trans, other, N, N, K, alpha, A, lda, A, lda,
+				C, ldc, Uplo);
+	}
+}
+
+void cblas_dgemv(const enum CBLAS_ORDER order,
+		const enum CBLAS_TRANSPOSE TransA, const int M, const int N,
+		const double alpha, const double * A, const int lda,
+		const double * X, const int incX, const double beta,
+		double * Y, const int incY)
+{
+	int lenX = TransA == CblasNoTrans ? N : M;
+	int lenY = TransA == CblasNoTrans ? M : N;
+	const double * x;
+	double * y;
+
+	if (order == CblasColMajor) {
+		cblas_dgemv(CblasRowMajor, TransA == CblasNoTrans ?
+				CblasTrans : CblasNoTrans, N, M, alpha, A,
+				lda, X, incX, beta, Y, incY);
+		return;
+	}
+
+	// Negative increments run through the vector from its end
+	x = incX < 0 ? X - (ptrdiff_t) (lenX - 1) * incX : X;
+	y = incY < 0 ? Y - (ptrdiff_t) (lenY - 1) * incY : Y;
+	for (int i = 0; i < lenY; i++) {
+		y[(ptrdiff_t) i * incY] = beta == 0 ? 0 :
+			beta * y[(ptrdiff_t) i * incY];
+	}
+	if (alpha == 0) return;
+
+	if (TransA == CblasNoTrans) {
+		#pragma omp parallel for schedule(static) \
+			if ((double) M * N > BLAS_PARALLEL_MIN)
+		for (int i = 0; i < M; i++) {
+			const double * a = A + (size_t) i * lda;
+			double sum = 0;
+
+			for (int j = 0; j < N; j++) {
+				sum += a[j] * x[(ptrdiff_t) j * incX];
+			}
+			y[(ptrdiff_t) i * incY] += alpha * sum;
+		}
+		return;
+	}
+
+	// Rows are split over threads, each adding into its own copy of y
+	#pragma omp parallel if ((double) M * N > BLAS_PARALLEL_MIN)
+	{
+		double * local = calloc(N, sizeof(double));
+
+		#pragma omp for schedule(static)
+		for (int i = 0; i < M; i++) {
+			const double * a = A + (size_t) i * lda;
+			double xi = alpha * x[(ptrdiff_t) i * incX];
+
+			for (int j = 0; j < N; j++) {
+				local[j] += a[j] * xi;
+			}
+		}
+
+		#pragma omp critical
+		for (int j = 0; j < N; j++) {
+			y[(ptrdiff_t) j * incY] += local[j];
+		}
+
+		free(local);
+	}
+}
+#endif
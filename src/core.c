@@ -19,6 +19,8 @@
 #include <gsl/gsl_statistics_double.h>
 
 #include "core.h"
+#include "csv.h"
+#include "binary.h"
 #include "debug.h"
 
 dataColumn * column_alloc(int n, char name[])
@@ -77,6 +79,9 @@ valueType detect_type(const char *value)
 	const char *p = value;
 	const char *P = p + strlen(p) - 1;
 
+	// Numbers of a binary input arrive packed
+	if (*p == BINARY_CELL) return TYPE_DOUBLE;
+
 	// Skip leading whitespaces
 	while (isspace(*p)) p++;
 
@@ -145,7 +150,9 @@ void translate_row_value(rowValue * row, dataColumn * column, int n)
 	column->rawValues[n - 1] = strdup(row->value);
 	if (column->type == TYPE_DOUBLE) {
 		// Doubles immediately set values
-		sscanf(row->value, "%lf", &value);
+		if (!binary_unpack(row->value, &value)) {
+			sscanf(row->value, "%lf", &value);
+		}
 		gsl_vector_set(column->vector, n - 1, value);
 	} else {
 		// Save data to encode later if categorical
@@ -232,16 +239,30 @@ int process_row(dataColumn * data, size_t n, int row, char * line,
 	return ncol;
 }
 
+/*
+ * Read the input into lines, the header first. A binary stream written by
+ * another tool's --binary is recognized by its first line, and its rows come
+ * out as lines whose numbers are packed cells rather than text.
+ */
 int read_rows(char *** lines, FILE * input)
 {
 	int nrow = 0;
 	char * line = NULL;
 	char * p;
-	size_t len;
+	size_t len = 0;
+	ssize_t got;
 	int capacity = 0;
+	binaryReader * binary = NULL;
 
 	// Read in the document
-	while (getline(&line, &len, input) != -1) {
+	while ((got = binary ? binary_getline(binary, &line, &len) :
+				getline(&line, &len, input)) != -1) {
+		if (!nrow && !binary && binary_detect(line, got)) {
+			binary = binary_reader_open(input, true);
+			if (!binary) break;
+			continue;
+		}
+
 		// Reallocate if more memory is needed
 		if (nrow >= capacity) {
 			capacity = capacity == 0 ? 1 : capacity + 100;
@@ -269,6 +290,8 @@ int read_rows(char *** lines, FILE * input)
 		nrow++;
 	}
 
+	if (binary) binary_reader_close(binary);
+
 	// No lines read
 	if (nrow == 0) {
 		free(line);
@@ -307,17 +330,16 @@ int read_columns(dataColumn * colHead, char ** lines, encode_func fn, int nrow,
 			p = p->nextColumn;
 		}
 	} else {
-		// Create Encoding
-		encodeData * encodeHead = *encoding;
+		// Create Encoding, one entry per encoded column in order
+		encodeData ** tail = encoding;
 		while (p) {
 			if (p->to_encode) {
 				addedCols += fn(p, colHead->vector, nrow,
-		    			&encodeHead);
-				encodeHead = encodeHead->nextEncoding;
+		    			tail);
+				if (*tail) tail = &(*tail)->nextEncoding;
 			}
 			p = p->nextColumn;
 		}
-		*encoding = encodeHead;
 	}
 
 	// Add new columns
@@ -338,42 +360,38 @@ int test_split(char *** trainLines, char *** testLines, double ratio, int nrow)
 {
 	int testRows;
 	int tmp;
+	int j = 1;
+	int k = 1;
+	bool * selected;
+	char ** lines = *trainLines;
 
 	if (ratio >= 1 || ratio < 0) {
 		return 0;
 	}
 
-	// Get selection of random integers
+	// Get selection of random rows (row 0 is the header)
 	testRows = ratio * nrow;
-	int selections[testRows];
+	selected = calloc(nrow + 1, sizeof(bool));
 	for (int i = 0; i < testRows; i++) {
-		tmp = rand() % (nrow - 1) + 1;
-		while (includes_int(selections, testRows, tmp)) {
-			tmp = rand() % (nrow - 1) + 1; // Cannot be row 0
-		}
-		selections[i] = tmp;
+		do {
+			tmp = rand() % nrow + 1;
+		} while (selected[tmp]);
+		selected[tmp] = true;
 	}
 
-	// Place selected lines into new buffer
+	// Move selected lines into new buffer, keeping the rest in order.
+	// Lines are moved rather than shared since parsing modifies them.
 	*testLines = malloc((testRows + 1) * sizeof(char *));
-	(*testLines)[0] = strdup((*trainLines)[0]);
-	int j = 0;
-	for (int i = 0; i < nrow; i++) {
-		if (includes_int(selections, testRows, i)) {
-			(*testLines)[j + 1] = (*trainLines)[i + 1];
-			j++;
-		}
-	}
-
-	// Remove selected lines from old buffer
-	int k = 0;
-	for (int i = 0; i < testRows; i++) {
-		for (int j = selections[i]; j < nrow - k; j++) { 
-			(*trainLines)[j] = (*trainLines)[j + 1];
+	(*testLines)[0] = strdup(lines[0]);
+	for (int i = 1; i <= nrow; i++) {
+		if (selected[i]) {
+			(*testLines)[j++] = lines[i];
+		} else {
+			lines[k++] = lines[i];
 		}
-		k++;
 	}
-	*trainLines = realloc(*trainLines, (nrow - testRows + 1) * sizeof(char *));
+	free(selected);
+	*trainLines = realloc(lines, (nrow - testRows + 1) * sizeof(char *));
 
 	return testRows;
 }
@@ -0,0 +1,164 @@
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+
+/*
+ * Helpers for tools that work on the bytes of a csv input directly instead of
+ * parsing every cell with read_rows() and read_columns(): lines and fields are
+ * slices of the input, and only the fields a tool needs are converted.
+ */
+
+/*
+ * Read all of `input` into one buffer, terminated for convenience, with its
+ * length in *size. Works on pipes as well as files. A binary stream is turned
+ * into csv lines, with numbers packed when `pack` is set and formatted
+ * otherwise. Returns NULL on failure.
+ */
+char * csv_read_all(FILE * input, size_t * size, bool pack)
+{
+	size_t capacity = CSV_READ_CHUNK;
+	size_t got;
+	char * buffer = malloc(capacity + 1);
+	char * grown;
+
+	*size = 0;
+	while (buffer && (got = fread(buffer + *size, 1, capacity - *size,
+					input)) > 0) {
+		*size += got;
+		if (*size == capacity) {
+			capacity *= 2;
+			grown = realloc(buffer, capacity + 1);
+			if (!grown) {
+				free(buffer);
+				buffer = NULL;
+				break;
+			}
+			buffer = grown;
+		}
+	}
+	if (!buffer || ferror(input)) {
+		perror("Failed to read input");
+		free(buffer);
+		return NULL;
+	}
+	buffer[*size] = '\0';
+
+	if (*size > BINARY_MAGIC_LEN && binary_detect(buffer,
+				BINARY_MAGIC_LEN)) {
+		FILE * stream = fmemopen(buffer + BINARY_MAGIC_LEN,
+				*size - BINARY_MAGIC_LEN, "r");
+		FILE * text = open_memstream(&grown, size);
+		binaryReader * binary = binary_reader_open(stream, pack);
+		char * line = NULL;
+		size_t len = 0;
+		ssize_t n;
+
+		while (binary && (n = binary_getline(binary, &line, &len)) !=
+				-1) {
+			fwrite(line, 1, n, text);
+			fputc('\n', text);
+		}
+		fclose(text);
+		fclose(stream);
+		free(line);
+		free(buffer);
+		if (!binary) {
+			free(grown);
+			return NULL;
+		}
+		binary_reader_close(binary);
+		buffer = grown;
+	}
+
+	return buffer;
+}
+
+/*
+ * Find the end of the line starting at `line`, before `end` at the latest:
+ * *stop is set past its last character (excluding "\n" or "\r\n"), and the
+ * start of the next line is returned.
+ */
+const char * csv_line(const char * line, const char * end, const char ** stop)
+{
+	const char * newline = memchr(line, '\n', end - line);
+
+	*stop = newline ? newline : end;
+	if (*stop > line && (*stop)[-1] == '\r') (*stop)--;
+
+	return newline ? newline + 1 : end;
+}
+
+/*
+ * Slice the field starting at *p of a line ending at `stop` and move *p past
+ * its comma. Returns false once the line is used up; an empty line has one
+ * empty field.
+ */
+bool csv_next_field(const char ** p, const char * stop, csvField * field)
+{
+	const char * comma;
+
+	if (*p > stop) return false;
+	comma = memchr(*p, ',', stop - *p);
+	if (!comma) comma = stop;
+	field->start = *p;
+	field->len = comma - *p;
+	*p = comma + 1;
+
+	return true;
+}
+
+// Split a header line into newly allocated names, returning their number
+int csv_header(const char * line, const char * stop, char *** names)
+{
+	int n = 0;
+	csvField field;
+
+	*names = NULL;
+	while (csv_next_field(&line, stop, &field)) {
+		*names = realloc(*names, (n + 1) * sizeof(char *));
+		(*names)[n++] = strndup(field.start, field.len);
+	}
+
+	return n;
+}
+
+/*
+ * Index of the column named `token`, or given by its position from 0 when
+ * no column has that name. Returns -1 when neither matches.
+ */
+int csv_column(char ** names, int n, const char * token)
+{
+	char * end;
+	long index;
+
+	for (int i = 0; i < n; i++) {
+		if (!strcmp(names[i], token)) return i;
+	}
+	index = strtol(token, &end, 10);
+	if (end == token || *end || index < 0 || index >= n) return -1;
+
+	return index;
+}
+
+/*
+ * Convert a field, which may be a packed cell of a binary input, to a
+ * number. Returns false for empty, missing or text fields, which tools pass
+ * through untouched.
+ */
+bool csv_number(const csvField * field, double * value)
+{
+	char buffer[64];
+	char * end;
+	size_t len = field->len;
+
+	if (len == BINARY_CELL_LEN && binary_unpack(field->start, value)) {
+		return true;
+	}
+	if (len == 0 || len >= sizeof(buffer)) return false;
+	memcpy(buffer, field->start, len);
+	buffer[len] = '\0';
+	*value = strtod(buffer, &end);
+	while (isspace(*end)) end++;
+
+	return end != buffer && !*end && isfinite(*value);
+}
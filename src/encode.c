@@ -37,11 +37,13 @@ int no_encode(dataColumn * data, gsl_vector * response, int nrow,
 	      encodeData ** encoding)
 {
 	// Unused
-	(void)data;
 	(void)response;
 	(void)nrow;
 	(void)encoding;
 
+	// Character values come up as 0, as documented
+	gsl_vector_set_zero(data->vector);
+
 	return 0;
 }
 
@@ -69,11 +71,14 @@ int dummy_encode(dataColumn * data, gsl_vector * response, int nrow,
 	} else {
 		// Initialize encoding
 		*encoding = malloc(sizeof(encodeData));
-		(*encoding)->columnName = data->name;
+		(*encoding)->columnName = strdup(name);
 		(*encoding)->textValues = malloc(nrow * sizeof(char *));
+		(*encoding)->nextEncoding = NULL;
+		(*encoding)->numValues = NULL;
 		ncat = unique_categories(data->to_encode, nrow,
 			   &((*encoding)->textValues));
 	}
+	(*encoding)->ncat = ncat;
 
 	// Construct new columns
 	head = data;
@@ -84,8 +89,8 @@ int dummy_encode(dataColumn * data, gsl_vector * response, int nrow,
 			newCols++;
 		}
 
-		head->name = realloc(head->name, sizeof(*head->name) +
-		       sizeof("_") + sizeof((*encoding)->textValues[i]));
+		head->name = realloc(head->name, strlen(name) +
+		       strlen((*encoding)->textValues[i]) + 2);
 		strcat(head->name, "_");
 		strcat(head->name, (*encoding)->textValues[i]);
 		head->type = TYPE_DOUBLE;
@@ -128,17 +133,20 @@ int mean_target_encode(dataColumn * data, gsl_vector * response, int nrow,
 	} else {
 		// Initialize encoding
 		tmpEncoding = malloc(sizeof(encodeData));
-		tmpEncoding->columnName = data->name;
+		tmpEncoding->columnName = strdup(data->name);
 		tmpEncoding->textValues = malloc(nrow * sizeof(char *));
+		tmpEncoding->nextEncoding = NULL;
 		ncat = unique_categories(data->to_encode, nrow,
 			   &(tmpEncoding->textValues));
 		tmpEncoding->numValues = malloc(ncat * sizeof(double));
+		tmpEncoding->ncat = ncat;
 	}
 
 	// Calculate target means
 	for (i = 0; i < ncat; i++) {
 		// add value to set
 		n = 0;
+		sum = 0;
 		for (j = 0; j < nrow; j++) {
 			if (strcmp(data->to_encode[j],
  					tmpEncoding->textValues[i]) == 0) {
@@ -204,11 +212,13 @@ int median_target_encode(dataColumn * data, gsl_vector * response, int nrow,
 	} else {
 		// Initialize encoding
 		tmpEncoding = malloc(sizeof(encodeData));
-		tmpEncoding->columnName = data->name;
+		tmpEncoding->columnName = strdup(data->name);
 		tmpEncoding->textValues = malloc(nrow * sizeof(char *));
+		tmpEncoding->nextEncoding = NULL;
 		ncat = unique_categories(data->to_encode, nrow,
 			   &(tmpEncoding->textValues));
 		tmpEncoding->numValues = malloc(ncat * sizeof(double));
+		tmpEncoding->ncat = ncat;
 	}
 
 	// Calculate target medians
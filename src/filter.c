@@ -0,0 +1,153 @@
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "filter.h"
+
+/*
+ * Keep the rows of a csv file matching an expression over its columns (see
+ * filter.h). Matching rows are copied to the output as they were read,
+ * unless they are written as a binary stream.
+ */
+
+#define HELP_MESSAGE \
+	"Keep the rows of a CSV file matching an expression.\n\n" \
+	"USAGE:\n" \
+	"\tfilter [-h] [-i <path>] [-b] [-e] <expression>\n\n" \
+	"STANDARD OPTIONS:\n" \
+	"\t-h, --help\tPrint this help message.\n" \
+	"\t-i, --input\tSpecify input file. If not given, stdin will be " \
+		"used.\n" \
+	"\t-b, --binary\tWrite the binary stream the other tools read " \
+		"instead of\n" \
+	"\t\t\tCSV, saving them from parsing text.\n" \
+	"\t-e, --expression\tThe expression, which may also be given as " \
+		"the last\n" \
+	"\t\t\targument.\n\n" \
+	"EXPRESSIONS:\n" \
+	"\tColumns are named as in the header, in backquotes if the name " \
+		"is not an\n" \
+	"\tidentifier. They are compared with numbers or quoted text:\n\n" \
+	"\t\tprice >= 100 && store != \"B7\"\n" \
+	"\t\tstore in (\"A9\", \"B7\") || !(x1 < 0.5)\n" \
+	"\t\tisna(x2) or not isna(`unit price`)\n\n" \
+	"\tOperators are ==, !=, <, <=, >, >=, in (...), isna(column),\n" \
+	"\t&& (and), || (or) and ! (not). isna() holds for fields that are " \
+		"empty,\n" \
+	"\tNA or NaN. A field that is not a number fails every comparison " \
+		"with a\n" \
+	"\tnumber, != included.\n"
+
+int main(int argc, char * argv[])
+{
+	// Options
+	int opt;
+	const struct option commandOptions[] = {
+		{"help",	no_argument,		NULL,	'h'},
+		{"input",	required_argument,	NULL,	'i'},
+		{"expression",	required_argument,	NULL,	'e'},
+		{"binary",	no_argument,		NULL,	'b'},
+		{NULL,		0,			NULL,	0}
+	};
+
+	char * expression = NULL;
+	char * line = NULL;
+	size_t len = 0;
+	ssize_t got;
+	int nfield;
+	int status;
+	bool binaryOut = false;
+	char ** names;
+	bool * stack;
+	binaryReader * binary = NULL;
+	binaryWriter * writer = NULL;
+	FILE * input = stdin;
+	filterProgram program;
+	filterRow row;
+
+	while ((opt = getopt_long_only(argc, argv, "hi:e:b", commandOptions,
+					NULL)) != -1) {
+		switch (opt) {
+			case 'h':
+				printf(HELP_MESSAGE);
+				return 0;
+			case 'i':
+				input = fopen(optarg, "r");
+				if (!input) {
+					fprintf(stderr, "Could not open "
+							"'%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'e':
+				expression = optarg;
+				break;
+			case 'b':
+				binaryOut = true;
+				break;
+			default:
+				fprintf(stderr, HELP_MESSAGE);
+				return 1;
+		};
+	}
+	if (!expression && optind == argc - 1) expression = argv[optind];
+	if (!expression || optind < argc - (expression == argv[optind])) {
+		fprintf(stderr, "Give one expression.\n");
+		return 1;
+	}
+	if (filter_compile(expression, &program)) {
+		filter_free(&program);
+		return 1;
+	}
+
+	// Header: resolve the referenced columns and pass it through
+	if ((got = binary_read_line(input, &binary, binaryOut, &line,
+					&len)) == -1) {
+		fprintf(stderr, "No header row.\n");
+		return 1;
+	}
+	nfield = csv_header(line, line + strcspn(line, "\r\n"), &names);
+	status = filter_row_open(&program, names, nfield, &row);
+	stack = malloc(program.depth * sizeof(bool));
+
+	if (!status && binaryOut) {
+		writer = binary_writer_open(stdout, names, nfield);
+	} else if (!status) {
+		fwrite(line, 1, got, stdout);
+		if (line[got - 1] != '\n') putchar('\n');
+	}
+	while (!status && (got = binary_read_line(input, &binary, binaryOut,
+					&line, &len)) != -1) {
+		const char * stop;
+		const char * p = line;
+		csvField field;
+
+		csv_line(line, line + got, &stop);
+		if (stop == line) continue;
+		if (!filter_match(&program, &row, line, stop, stack)) {
+			continue;
+		}
+		if (!writer) {
+			fwrite(line, 1, got, stdout);
+			if (line[got - 1] != '\n') putchar('\n');
+			continue;
+		}
+		while (csv_next_field(&p, stop, &field)) {
+			binary_put_field(writer, &field);
+		}
+		binary_end_row(writer);
+	}
+	if (writer) binary_writer_close(writer);
+	if (binary) binary_reader_close(binary);
+	if (input != stdin) fclose(input);
+
+	for (int f = 0; f < nfield; f++) {
+		free(names[f]);
+	}
+	free(names);
+	free(line);
+	free(stack);
+	filter_row_free(&row);
+	filter_free(&program);
+
+	return status;
+}
@@ -0,0 +1,496 @@
+#include "core.h"
+#include "csv.h"
+#include "filter.h"
+
+// Read the next token of the expression into the program
+int filter_next(filterProgram * program)
+{
+	const char * p = program->pos;
+	const char * start;
+
+	free(program->tokenText);
+	program->tokenText = NULL;
+	while (isspace(*p)) p++;
+	start = p;
+	program->tokenStart = p;
+
+	if (!*p) {
+		program->token = TOKEN_END;
+	} else if (*p == '(' || *p == ')' || *p == ',') {
+		program->token = *p == '(' ? TOKEN_OPEN : *p == ')' ?
+			TOKEN_CLOSE : TOKEN_COMMA;
+		p++;
+	} else if (!strncmp(p, "&&", 2) || !strncmp(p, "||", 2)) {
+		program->token = *p == '&' ? TOKEN_AND : TOKEN_OR;
+		p += 2;
+	} else if (strchr("=!<>", *p) && p[1] == '=') {
+		program->token = TOKEN_COMPARE;
+		program->tokenCompare = *p == '=' ? FILTER_EQ : *p == '!' ?
+			FILTER_NE : *p == '<' ? FILTER_LE : FILTER_GE;
+		p += 2;
+	} else if (*p == '<' || *p == '>') {
+		program->token = TOKEN_COMPARE;
+		program->tokenCompare = *p == '<' ? FILTER_LT : FILTER_GT;
+		p++;
+	} else if (*p == '!') {
+		program->token = TOKEN_NOT;
+		p++;
+	} else if (*p == '"' || *p == '\'' || *p == '`') {
+		const char * close = strchr(p + 1, *p);
+
+		if (!close) {
+			fprintf(stderr, "Unterminated %c in expression.\n",
+					*p);
+			return 1;
+		}
+		program->token = *p == '`' ? TOKEN_NAME : TOKEN_TEXT;
+		program->tokenText = strndup(p + 1, close - p - 1);
+		p = close + 1;
+	} else if (isdigit(*p) || *p == '.' || *p == '-' || *p == '+') {
+		char * end;
+
+		program->token = TOKEN_NUMBER;
+		program->tokenNumber = strtod(p, &end);
+		if (end == p) {
+			fprintf(stderr, "Bad number in expression: %s\n", p);
+			return 1;
+		}
+		p = end;
+	} else if (isalpha(*p) || *p == '_') {
+		while (isalnum(*p) || *p == '_' || *p == '.') p++;
+		program->tokenText = strndup(start, p - start);
+		program->token = !strcmp(program->tokenText, "and") ?
+			TOKEN_AND : !strcmp(program->tokenText, "or") ?
+			TOKEN_OR : !strcmp(program->tokenText, "not") ?
+			TOKEN_NOT : !strcmp(program->tokenText, "in") ?
+			TOKEN_IN : !strcmp(program->tokenText, "isna") ?
+			TOKEN_ISNA : TOKEN_NAME;
+	} else {
+		fprintf(stderr, "Unexpected '%c' in expression.\n", *p);
+		return 1;
+	}
+	program->pos = p;
+
+	return 0;
+}
+
+// Slot of a referenced column, adding it on first use
+int filter_slot(filterProgram * program, const char * name)
+{
+	for (int s = 0; s < program->nslot; s++) {
+		if (!strcmp(program->columns[s], name)) return s;
+	}
+	program->columns = realloc(program->columns, (program->nslot + 1) *
+			sizeof(char *));
+	program->columns[program->nslot] = strdup(name);
+
+	return program->nslot++;
+}
+
+filterInstr * filter_emit(filterProgram * program, filterOpcode code)
+{
+	filterInstr * instr;
+
+	program->code = realloc(program->code, (program->ncode + 1) *
+			sizeof(filterInstr));
+	instr = program->code + program->ncode++;
+	memset(instr, 0, sizeof(filterInstr));
+	instr->code = code;
+
+	return instr;
+}
+
+int filter_expect(filterProgram * program, filterToken token,
+		const char * what)
+{
+	if (program->token != token) {
+		fprintf(stderr, "Expected %s in expression near '%s'.\n",
+				what, program->tokenStart);
+		return 1;
+	}
+
+	return filter_next(program);
+}
+
+int filter_compare_numbers(const void * x, const void * y)
+{
+	double a = *(const double *) x;
+	double b = *(const double *) y;
+
+	return (a > b) - (a < b);
+}
+
+// Set of a membership test: "(" value ("," value)* ")", all of one kind
+int filter_set(filterProgram * program, filterInstr * instr)
+{
+	if (filter_expect(program, TOKEN_OPEN, "'('")) return 1;
+	instr->code = program->token == TOKEN_TEXT ? FILTER_IN_TEXT :
+		FILTER_IN_NUMBER;
+	do {
+		if (instr->nset && filter_next(program)) return 1;
+		if (instr->code == FILTER_IN_TEXT &&
+				program->token == TOKEN_TEXT) {
+			instr->texts = realloc(instr->texts, (instr->nset + 1) *
+					sizeof(char *));
+			instr->texts[instr->nset++] =
+				strdup(program->tokenText);
+		} else if (instr->code == FILTER_IN_NUMBER &&
+				program->token == TOKEN_NUMBER) {
+			instr->numbers = realloc(instr->numbers,
+					(instr->nset + 1) * sizeof(double));
+			instr->numbers[instr->nset++] = program->tokenNumber;
+		} else {
+			fprintf(stderr, "Sets hold either numbers or quoted "
+					"text.\n");
+			return 1;
+		}
+		if (filter_next(program)) return 1;
+	} while (program->token == TOKEN_COMMA);
+
+	if (instr->code == FILTER_IN_TEXT) {
+		qsort(instr->texts, instr->nset, sizeof(char *),
+				compare_items);
+	} else {
+		qsort(instr->numbers, instr->nset, sizeof(double),
+				filter_compare_numbers);
+	}
+
+	return filter_expect(program, TOKEN_CLOSE, "')'");
+}
+
+int filter_or(filterProgram * program, int depth, int nesting);
+
+/*
+ * primary: "(" or ")" | "isna" "(" column ")" | column test
+ * Here and below `depth` is the evaluation stack the code needs so far and
+ * `nesting` the parentheses and negations around it, both bounded so that
+ * neither the stack nor the recursion of the parser can grow without limit.
+ */
+int filter_primary(filterProgram * program, int depth, int nesting)
+{
+	filterInstr * instr;
+	int slot;
+
+	if (depth > FILTER_MAX_DEPTH) {
+		fprintf(stderr, "Expression nested too deeply.\n");
+		return 1;
+	}
+	program->depth = GSL_MAX(program->depth, depth);
+
+	if (program->token == TOKEN_OPEN) {
+		if (filter_next(program) || filter_or(program, depth,
+					nesting + 1)) {
+			return 1;
+		}
+		return filter_expect(program, TOKEN_CLOSE, "')'");
+	}
+	if (program->token == TOKEN_ISNA) {
+		if (filter_next(program) ||
+				filter_expect(program, TOKEN_OPEN, "'('")) {
+			return 1;
+		}
+		if (program->token != TOKEN_NAME) {
+			return filter_expect(program, TOKEN_NAME, "a column");
+		}
+		filter_emit(program, FILTER_NA)->slot = filter_slot(program,
+				program->tokenText);
+		if (filter_next(program)) return 1;
+		return filter_expect(program, TOKEN_CLOSE, "')'");
+	}
+	if (program->token != TOKEN_NAME) {
+		return filter_expect(program, TOKEN_NAME, "a column");
+	}
+
+	slot = filter_slot(program, program->tokenText);
+	if (filter_next(program)) return 1;
+	instr = filter_emit(program, FILTER_NUMBER);
+	instr->slot = slot;
+	if (program->token == TOKEN_IN) {
+		if (filter_next(program)) return 1;
+		return filter_set(program, instr);
+	}
+	if (program->token != TOKEN_COMPARE) {
+		return filter_expect(program, TOKEN_COMPARE, "a comparison");
+	}
+	instr->compare = program->tokenCompare;
+	if (filter_next(program)) return 1;
+	if (program->token == TOKEN_NUMBER) {
+		instr->number = program->tokenNumber;
+	} else if (program->token == TOKEN_TEXT) {
+		instr->code = FILTER_TEXT;
+		instr->text = strdup(program->tokenText);
+	} else {
+		fprintf(stderr, "Columns are compared with a number or "
+				"quoted text.\n");
+		return 1;
+	}
+
+	return filter_next(program);
+}
+
+// not: ("!" | "not") not | primary
+int filter_not(filterProgram * program, int depth, int nesting)
+{
+	if (nesting > FILTER_MAX_DEPTH) {
+		fprintf(stderr, "Expression nested too deeply.\n");
+		return 1;
+	}
+	if (program->token == TOKEN_NOT) {
+		if (filter_next(program) || filter_not(program, depth,
+					nesting + 1)) {
+			return 1;
+		}
+		filter_emit(program, FILTER_NOT);
+		return 0;
+	}
+
+	return filter_primary(program, depth, nesting);
+}
+
+// and: not (("&&" | "and") not)*, the right operand one level deeper
+int filter_and(filterProgram * program, int depth, int nesting)
+{
+	if (filter_not(program, depth, nesting)) return 1;
+	while (program->token == TOKEN_AND) {
+		if (filter_next(program) || filter_not(program, depth + 1,
+					nesting)) {
+			return 1;
+		}
+		filter_emit(program, FILTER_AND);
+	}
+
+	return 0;
+}
+
+// or: and (("||" | "or") and)*
+int filter_or(filterProgram * program, int depth, int nesting)
+{
+	if (filter_and(program, depth, nesting)) return 1;
+	while (program->token == TOKEN_OR) {
+		if (filter_next(program) || filter_and(program, depth + 1,
+					nesting)) {
+			return 1;
+		}
+		filter_emit(program, FILTER_OR);
+	}
+
+	return 0;
+}
+
+// Compile an expression into postfix code, returning nonzero on errors
+int filter_compile(const char * expression, filterProgram * program)
+{
+	memset(program, 0, sizeof(filterProgram));
+	program->pos = expression;
+	program->depth = 1;
+
+	if (filter_next(program) || filter_or(program, 1, 0)) return 1;
+	if (program->token != TOKEN_END) {
+		fprintf(stderr, "Unexpected text at the end of the "
+				"expression: %s\n", program->tokenStart);
+		return 1;
+	}
+
+	return 0;
+}
+
+void filter_free(filterProgram * program)
+{
+	for (int i = 0; i < program->ncode; i++) {
+		filterInstr * instr = program->code + i;
+
+		free(instr->text);
+		free(instr->numbers);
+		for (int k = 0; instr->texts && k < instr->nset; k++) {
+			free(instr->texts[k]);
+		}
+		free(instr->texts);
+	}
+	for (int s = 0; s < program->nslot; s++) {
+		free(program->columns[s]);
+	}
+	free(program->code);
+	free(program->columns);
+	free(program->tokenText);
+}
+
+// Missing fields: empty, NA or NaN
+bool filter_missing(const csvField * field)
+{
+	return field->len == 0 || (field->len == 2 &&
+			!strncasecmp(field->start, "NA", 2)) ||
+		(field->len == 3 && !strncasecmp(field->start, "NaN", 3));
+}
+
+// Value of the field in `slot` as a number, converted on first use
+bool filter_number(filterRow * row, int slot, double * x)
+{
+	if (!row->state[slot]) {
+		row->state[slot] = csv_number(row->fields + slot,
+				row->numbers + slot) ? 1 : 2;
+	}
+	*x = row->numbers[slot];
+
+	return row->state[slot] == 1;
+}
+
+bool filter_test(filterCompare compare, int order)
+{
+	switch (compare) {
+		case FILTER_EQ: return order == 0;
+		case FILTER_NE: return order != 0;
+		case FILTER_LT: return order < 0;
+		case FILTER_LE: return order <= 0;
+		case FILTER_GT: return order > 0;
+		case FILTER_GE: return order >= 0;
+	}
+
+	return false;
+}
+
+// Order of a field against text, as strcmp()
+int filter_text_order(const csvField * field, const char * text)
+{
+	size_t len = strlen(text);
+	int order = memcmp(field->start, text, GSL_MIN(field->len, len));
+
+	return order ? order : (field->len > len) - (field->len < len);
+}
+
+bool filter_in_text(const csvField * field, char ** texts, int n)
+{
+	int lo = 0;
+	int hi = n - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int order = filter_text_order(field, texts[mid]);
+
+		if (!order) return true;
+		if (order < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Find the fields of the columns the program references among the `nfield`
+ * header names. Returns nonzero, naming them, if any are missing.
+ */
+int filter_row_open(const filterProgram * program, char ** names,
+		int nfield, filterRow * row)
+{
+	int status = 0;
+
+	row->slotOf = malloc(nfield * sizeof(int));
+	row->lastField = -1;
+	row->fields = malloc(program->nslot * sizeof(csvField));
+	row->numbers = malloc(program->nslot * sizeof(double));
+	row->state = malloc(program->nslot);
+	for (int f = 0; f < nfield; f++) {
+		row->slotOf[f] = -1;
+	}
+	for (int s = 0; s < program->nslot; s++) {
+		int f;
+
+		for (f = 0; f < nfield && strcmp(names[f],
+					program->columns[s]); f++);
+		if (f == nfield) {
+			fprintf(stderr, "Column '%s' not found.\n",
+					program->columns[s]);
+			status = 1;
+		} else {
+			row->slotOf[f] = s;
+			row->lastField = GSL_MAX(row->lastField, f);
+		}
+	}
+
+	return status;
+}
+
+void filter_row_free(filterRow * row)
+{
+	free(row->slotOf);
+	free(row->fields);
+	free(row->numbers);
+	free(row->state);
+}
+
+// Run the program on the row ending at `stop`
+bool filter_match(const filterProgram * program, filterRow * row,
+		const char * line, const char * stop, bool * stack)
+{
+	const char * p = line;
+	csvField field;
+	int top = 0;
+
+	// Slice the referenced fields; absent ones stay empty
+	for (int s = 0; s < program->nslot; s++) {
+		row->fields[s].start = line;
+		row->fields[s].len = 0;
+		row->state[s] = 0;
+	}
+	for (int f = 0; f <= row->lastField &&
+			csv_next_field(&p, stop, &field); f++) {
+		if (row->slotOf[f] >= 0) row->fields[row->slotOf[f]] = field;
+	}
+
+	for (int i = 0; i < program->ncode; i++) {
+		const filterInstr * instr = program->code + i;
+		const csvField * f = row->fields + instr->slot;
+		double x;
+
+		switch (instr->code) {
+			case FILTER_NUMBER:
+				stack[top++] = filter_number(row, instr->slot,
+						&x) && filter_test(
+						instr->compare, (x >
+							instr->number) - (x <
+							instr->number));
+				break;
+
+			case FILTER_TEXT:
+				stack[top++] = filter_test(instr->compare,
+						filter_text_order(f,
+							instr->text));
+				break;
+
+			case FILTER_IN_NUMBER:
+				stack[top++] = filter_number(row, instr->slot,
+						&x) && bsearch(&x,
+						instr->numbers, instr->nset,
+						sizeof(double),
+						filter_compare_numbers);
+				break;
+
+			case FILTER_IN_TEXT:
+				stack[top++] = filter_in_text(f, instr->texts,
+						instr->nset);
+				break;
+
+			case FILTER_NA:
+				stack[top++] = filter_missing(f);
+				break;
+
+			case FILTER_AND:
+				top--;
+				stack[top - 1] = stack[top - 1] && stack[top];
+				break;
+
+			case FILTER_OR:
+				top--;
+				stack[top - 1] = stack[top - 1] || stack[top];
+				break;
+
+			case FILTER_NOT:
+				stack[top - 1] = !stack[top - 1];
+				break;
+		}
+	}
+
+	return stack[0];
+}
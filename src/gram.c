@@ -0,0 +1,329 @@
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_linalg.h>
+#include "core.h"
+#include "gram.h"
+
+/*
+ * Add the contribution of the rows of X to the upper triangle of G = X^T X
+ * and, when given, to Xty = X^T y, in one pass with the widest kernel the
+ * CPU supports (see gram_kernel.c).
+ */
+void gram_accumulate(const gsl_matrix * X, const gsl_vector * y,
+		gsl_matrix * G, gsl_vector * Xty)
+{
+	gram_accumulate_kernel(gram_kernel(NULL), X, y, G, Xty);
+}
+
+// Copy the upper triangle of G into the lower
+void gram_symmetrize(gsl_matrix * G)
+{
+	for (size_t i = 0; i < G->size1; i++) {
+		for (size_t j = 0; j < i; j++) {
+			gsl_matrix_set(G, i, j, gsl_matrix_get(G, j, i));
+		}
+	}
+}
+
+/*
+ * Compute G = X^T X and Xty = X^T y (Xty and y may be NULL). Row blocks are
+ * spread over threads, each accumulating into its own copy, and the copies
+ * are summed at the end.
+ */
+int gram_compute(const gsl_matrix * X, const gsl_vector * y, gsl_matrix * G,
+		gsl_vector * Xty)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	size_t nblocks = (n + GRAM_BLOCK_ROWS - 1) / GRAM_BLOCK_ROWS;
+
+	gsl_matrix_set_zero(G);
+	if (Xty) gsl_vector_set_zero(Xty);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * localG = gsl_matrix_calloc(p, p);
+		gsl_vector * localXty = Xty ? gsl_vector_calloc(p) : NULL;
+
+		#pragma omp for schedule(static)
+		for (size_t b = 0; b < nblocks; b++) {
+			size_t start = b * GRAM_BLOCK_ROWS;
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, n - start);
+			gsl_matrix_const_view block = gsl_matrix_const_submatrix(
+					X, start, 0, rows, p);
+			gsl_vector_const_view yBlock;
+
+			if (localXty) {
+				yBlock = gsl_vector_const_subvector(y, start,
+						rows);
+				gram_accumulate(&block.matrix, &yBlock.vector,
+						localG, localXty);
+			} else {
+				gram_accumulate(&block.matrix, NULL, localG,
+						NULL);
+			}
+		}
+
+		#pragma omp critical
+		{
+			gsl_matrix_add(G, localG);
+			if (localXty) gsl_vector_add(Xty, localXty);
+		}
+
+		gsl_matrix_free(localG);
+		if (localXty) gsl_vector_free(localXty);
+	}
+
+	gram_symmetrize(G);
+
+	return 0;
+}
+
+/*
+ * Fill the (p + 1) x (p + 1) cross-product matrix of [X y]: X^T X in the
+ * leading block, X^T y in the last row and column and y^T y in the corner.
+ */
+int gram_augmented(const gsl_matrix * X, const gsl_vector * y,
+		gsl_matrix * A)
+{
+	size_t p = X->size2;
+	double yty;
+	gsl_matrix_view G = gsl_matrix_submatrix(A, 0, 0, p, p);
+	gsl_vector_view Xty = gsl_matrix_subcolumn(A, p, 0, p);
+	gsl_vector_view yTX = gsl_matrix_subrow(A, p, 0, p);
+
+	gram_compute(X, y, &G.matrix, &Xty.vector);
+	gsl_vector_memcpy(&yTX.vector, &Xty.vector);
+	gsl_blas_ddot(y, y, &yty);
+	gsl_matrix_set(A, p, p, yty);
+
+	return 0;
+}
+
+/*
+ * Sweep the symmetric matrix A on pivot k in place, or undo an earlier sweep
+ * when `inverse` is set. Once the predictors in a set S of a cross-product
+ * matrix (see gram_augmented()) are swept, the last column holds their least
+ * squares coefficients, the corner their residual sum of squares and the
+ * S x S block -(X_S^T X_S)^{-1}. Each sweep is a rank-one update.
+ */
+void gram_sweep(gsl_matrix * A, size_t k, bool inverse)
+{
+	size_t m = A->size1;
+	double d = gsl_matrix_get(A, k, k);
+	double sign = inverse ? -1 : 1;
+	gsl_vector * a = gsl_vector_alloc(m);
+
+	gsl_matrix_get_col(a, A, k);
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < m; i++) {
+		double ai = gsl_vector_get(a, i);
+
+		if (i == k) continue;
+		for (size_t j = 0; j < m; j++) {
+			if (j == k) continue;
+			*gsl_matrix_ptr(A, i, j) -= ai * gsl_vector_get(a, j) /
+				d;
+		}
+		gsl_matrix_set(A, i, k, sign * ai / d);
+		gsl_matrix_set(A, k, i, sign * ai / d);
+	}
+	gsl_matrix_set(A, k, k, -1 / d);
+
+	gsl_vector_free(a);
+}
+
+/*
+ * Solve (G + lambda^2 I) beta = Xty by Cholesky. When given, `inverse`
+ * receives (G + lambda^2 I)^{-1}. Returns nonzero, leaving the outputs
+ * unset, when G is numerically singular.
+ */
+int gram_solve_normal(const gsl_matrix * G, double lambda,
+		const gsl_vector * Xty, gsl_vector * coef, gsl_matrix * inverse)
+{
+	size_t p = G->size1;
+	int status;
+	gsl_matrix * L;
+	gsl_vector_view diag;
+	gsl_error_handler_t * handler;
+
+	L = gsl_matrix_alloc(p, p);
+	gsl_matrix_memcpy(L, G);
+	diag = gsl_matrix_diagonal(L);
+	gsl_vector_add_constant(&diag.vector, lambda * lambda);
+
+	// Report failure rather than abort; the caller can fall back to SVD
+	handler = gsl_set_error_handler_off();
+	status = gsl_linalg_cholesky_decomp1(L);
+	gsl_set_error_handler(handler);
+	for (size_t i = 0; !status && i < p; i++) {
+		if (pow(gsl_matrix_get(L, i, i), 2) <= GRAM_SINGULAR *
+				gsl_matrix_get(G, i, i)) {
+			status = GSL_EDOM;
+		}
+	}
+	if (status) {
+		gsl_matrix_free(L);
+		return status;
+	}
+
+	gsl_linalg_cholesky_solve(L, Xty, coef);
+	if (inverse) {
+		gsl_linalg_cholesky_invert(L);
+		gsl_matrix_memcpy(inverse, L);
+	}
+	gsl_matrix_free(L);
+
+	return 0;
+}
+
+/*
+ * Least squares coefficients from the cross-product block G = X^T X of the
+ * columns of X, ridge penalized when lambda > 0, by Cholesky solution of
+ * (G + lambda^2 I) beta = X^T y. The residual sum of squares (plus the
+ * penalty) goes in chisq and, when given, covMatrix receives
+ * RSS / (n - p) (G + lambda^2 I)^{-1}. Returns nonzero, leaving the outputs
+ * unset, when the block is numerically singular.
+ */
+int gram_solve(const gsl_matrix * G, double lambda, const gsl_matrix * X,
+		const gsl_vector * y, gsl_vector * coef, gsl_matrix * covMatrix,
+		double * chisq)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	int status;
+	double rss;
+	gsl_vector * Xty;
+	gsl_vector * resid;
+
+	Xty = gsl_vector_alloc(p);
+	gsl_blas_dgemv(CblasTrans, 1.0, X, y, 0, Xty);
+	status = gram_solve_normal(G, lambda, Xty, coef, covMatrix);
+	gsl_vector_free(Xty);
+	if (status) return status;
+
+	// Residuals directly rather than from y^T y - beta^T X^T y
+	resid = gsl_vector_alloc(n);
+	gsl_vector_memcpy(resid, y);
+	gsl_blas_dgemv(CblasNoTrans, -1.0, X, coef, 1.0, resid);
+	rss = pow(gsl_blas_dnrm2(resid), 2);
+	*chisq = rss + pow(lambda * gsl_blas_dnrm2(coef), 2);
+	gsl_vector_free(resid);
+
+	if (covMatrix) gsl_matrix_scale(covMatrix, rss / (n - p));
+
+	return 0;
+}
+
+/*
+ * Fill Z with rows start.. of the design extended by derived features: the
+ * columns of X followed by each feature's product of base columns.
+ */
+void gram_feature_block(const gsl_matrix * X, size_t start,
+		const gramFeature * features, int nfeatures, gsl_matrix * Z)
+{
+	size_t p = X->size2;
+
+	for (size_t i = 0; i < Z->size1; i++) {
+		for (size_t j = 0; j < p; j++) {
+			gsl_matrix_set(Z, i, j, gsl_matrix_get(X, start + i,
+						j));
+		}
+		for (int f = 0; f < nfeatures; f++) {
+			double value = 1;
+			for (int k = 0; k < features[f].nfactors; k++) {
+				value *= gsl_matrix_get(X, start + i,
+						features[f].factors[k]);
+			}
+			gsl_matrix_set(Z, i, p + f, value);
+		}
+	}
+}
+
+/*
+ * As gram_compute(), for the design extended by derived features. Feature
+ * columns are generated one row block at a time and never stored whole; G
+ * and Xty are (p + nfeatures) square and long.
+ */
+int gram_compute_features(const gsl_matrix * X, const gsl_vector * y,
+		const gramFeature * features, int nfeatures, gsl_matrix * G,
+		gsl_vector * Xty)
+{
+	size_t n = X->size1;
+	size_t q = X->size2 + nfeatures;
+	size_t nblocks = (n + GRAM_BLOCK_ROWS - 1) / GRAM_BLOCK_ROWS;
+
+	gsl_matrix_set_zero(G);
+	gsl_vector_set_zero(Xty);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * localG = gsl_matrix_calloc(q, q);
+		gsl_vector * localXty = gsl_vector_calloc(q);
+		gsl_matrix * Z = gsl_matrix_alloc(GRAM_BLOCK_ROWS, q);
+
+		#pragma omp for schedule(static)
+		for (size_t b = 0; b < nblocks; b++) {
+			size_t start = b * GRAM_BLOCK_ROWS;
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, n - start);
+			gsl_matrix_view block = gsl_matrix_submatrix(Z, 0, 0,
+					rows, q);
+			gsl_vector_const_view yBlock =
+				gsl_vector_const_subvector(y, start, rows);
+
+			gram_feature_block(X, start, features, nfeatures,
+					&block.matrix);
+			gram_accumulate(&block.matrix, &yBlock.vector, localG,
+					localXty);
+		}
+
+		#pragma omp critical
+		{
+			gsl_matrix_add(G, localG);
+			gsl_vector_add(Xty, localXty);
+		}
+
+		gsl_matrix_free(Z);
+		gsl_matrix_free(localG);
+		gsl_vector_free(localXty);
+	}
+
+	gram_symmetrize(G);
+
+	return 0;
+}
+
+// Residuals y - Z coef of the design extended by derived features
+void gram_feature_residuals(const gsl_matrix * X, const gsl_vector * y,
+		const gramFeature * features, int nfeatures,
+		const gsl_vector * coef, gsl_vector * resid)
+{
+	size_t n = X->size1;
+	size_t q = X->size2 + nfeatures;
+	size_t nblocks = (n + GRAM_BLOCK_ROWS - 1) / GRAM_BLOCK_ROWS;
+
+	gsl_vector_memcpy(resid, y);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * Z = gsl_matrix_alloc(GRAM_BLOCK_ROWS, q);
+
+		#pragma omp for schedule(static)
+		for (size_t b = 0; b < nblocks; b++) {
+			size_t start = b * GRAM_BLOCK_ROWS;
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, n - start);
+			gsl_matrix_view block = gsl_matrix_submatrix(Z, 0, 0,
+					rows, q);
+			gsl_vector_view rBlock = gsl_vector_subvector(resid,
+					start, rows);
+
+			gram_feature_block(X, start, features, nfeatures,
+					&block.matrix);
+			gsl_blas_dgemv(CblasNoTrans, -1.0, &block.matrix, coef,
+					1.0, &rBlock.vector);
+		}
+
+		gsl_matrix_free(Z);
+	}
+}
@@ -0,0 +1,165 @@
+#include <omp.h>
+#include <gsl/gsl_blas.h>
+#include "core.h"
+#include "gram.h"
+
+/*
+ * Benchmark of the Gram kernels against gsl_blas_dsyrk() and
+ * gsl_blas_dgemv(), the calls they replace in gram_accumulate(). Both run
+ * over the same row blocks of a random design on one thread.
+ */
+
+#define HELP_MESSAGE \
+	"Time the Gram matrix kernels against gsl_blas_dsyrk().\n\n" \
+	"USAGE:\n" \
+	"\tgram_bench [-h] [-n <rows>] [-r <repeats>]\n\n" \
+	"OPTIONS:\n" \
+	"\t-h, --help\tPrint this help message.\n" \
+	"\t-n, --rows\tRows of the random design (default 100000).\n" \
+	"\t-r, --repeats\tTimed runs per kernel, the fastest being " \
+		"reported\n" \
+	"\t\t\t(default 3).\n"
+
+// Seconds for the fastest of `repeats` passes over the row blocks of X, with
+// `kernel` or, when NULL, with DSYRK and DGEMV
+double bench_run(const gramKernel * kernel, const gsl_matrix * X,
+		const gsl_vector * y, gsl_matrix * G, gsl_vector * Xty,
+		int repeats)
+{
+	double best = 0;
+
+	for (int r = 0; r < repeats; r++) {
+		double start = omp_get_wtime();
+		double elapsed;
+
+		gsl_matrix_set_zero(G);
+		gsl_vector_set_zero(Xty);
+		for (size_t s = 0; s < X->size1; s += GRAM_BLOCK_ROWS) {
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, X->size1 - s);
+			gsl_matrix_const_view block =
+				gsl_matrix_const_submatrix(X, s, 0, rows,
+						X->size2);
+			gsl_vector_const_view yBlock =
+				gsl_vector_const_subvector(y, s, rows);
+
+			if (kernel) {
+				gram_accumulate_kernel(kernel, &block.matrix,
+						&yBlock.vector, G, Xty);
+			} else {
+				gsl_blas_dsyrk(CblasUpper, CblasTrans, 1.0,
+						&block.matrix, 1.0, G);
+				gsl_blas_dgemv(CblasTrans, 1.0, &block.matrix,
+						&yBlock.vector, 1.0, Xty);
+			}
+		}
+		elapsed = omp_get_wtime() - start;
+		if (!r || elapsed < best) best = elapsed;
+	}
+
+	return best;
+}
+
+// Largest difference over the upper triangle of G and Xty, relative to G
+double bench_error(const gsl_matrix * G, const gsl_vector * Xty,
+		const gsl_matrix * G0, const gsl_vector * Xty0)
+{
+	double scale = 0;
+	double error = 0;
+
+	for (size_t j = 0; j < G->size1; j++) {
+		scale = GSL_MAX(scale, fabs(gsl_matrix_get(G0, j, j)));
+		error = GSL_MAX(error, fabs(gsl_vector_get(Xty, j) -
+					gsl_vector_get(Xty0, j)));
+		for (size_t k = j; k < G->size2; k++) {
+			error = GSL_MAX(error, fabs(gsl_matrix_get(G, j, k) -
+						gsl_matrix_get(G0, j, k)));
+		}
+	}
+
+	return scale ? error / scale : error;
+}
+
+int main(int argc, char * argv[])
+{
+	int opt;
+	const struct option commandOptions[] = {
+		{"help",	no_argument,		NULL,	'h'},
+		{"rows",	required_argument,	NULL,	'n'},
+		{"repeats",	required_argument,	NULL,	'r'},
+		{NULL,		0,			NULL,	0}
+	};
+	const size_t columns[] = {8, 32, 128, 512};
+	const char * names[] = {"scalar", "avx2", "avx512"};
+	size_t n = 100000;
+	int repeats = 3;
+
+	while ((opt = getopt_long_only(argc, argv, "hn:r:", commandOptions,
+					NULL)) != -1) {
+		switch (opt) {
+		case 'h':
+			printf(HELP_MESSAGE);
+			return 0;
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, HELP_MESSAGE);
+			return 1;
+		}
+	}
+	if (!n || repeats < 1) {
+		fprintf(stderr, "Rows and repeats must be positive.\n");
+		return 1;
+	}
+
+	omp_set_num_threads(1);
+	printf("Kernel\tColumns\tSeconds\tGFLOP/s\tSpeedup\tError\n");
+	for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); c++) {
+		size_t p = columns[c];
+		// Multiply-adds of the upper triangle of X^T X and of X^T y
+		double flops = (double) n * p * (p + 3);
+		double base;
+		gsl_matrix * X = gsl_matrix_alloc(n, p);
+		gsl_vector * y = gsl_vector_alloc(n);
+		gsl_matrix * G0 = gsl_matrix_alloc(p, p);
+		gsl_vector * Xty0 = gsl_vector_alloc(p);
+		gsl_matrix * G = gsl_matrix_alloc(p, p);
+		gsl_vector * Xty = gsl_vector_alloc(p);
+
+		srand(1);
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = 0; j < p; j++) {
+				gsl_matrix_set(X, i, j,
+						(double) rand() / RAND_MAX);
+			}
+			gsl_vector_set(y, i, (double) rand() / RAND_MAX);
+		}
+
+		base = bench_run(NULL, X, y, G0, Xty0, repeats);
+		printf("dsyrk\t%zu\t%.4f\t%.2f\t%.2f\t%g\n", p, base,
+				flops / base / 1e9, 1.0, 0.0);
+		for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+			const gramKernel * kernel = gram_kernel(names[k]);
+			double seconds;
+
+			if (!kernel) continue;
+			seconds = bench_run(kernel, X, y, G, Xty, repeats);
+			printf("%s\t%zu\t%.4f\t%.2f\t%.2f\t%.2g\n",
+					kernel->name, p, seconds,
+					flops / seconds / 1e9, base / seconds,
+					bench_error(G, Xty, G0, Xty0));
+		}
+
+		gsl_matrix_free(X);
+		gsl_vector_free(y);
+		gsl_matrix_free(G0);
+		gsl_vector_free(Xty0);
+		gsl_matrix_free(G);
+		gsl_vector_free(Xty);
+	}
+
+	return 0;
+}
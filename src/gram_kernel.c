@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gram.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAM_X86
+#endif
+
+/*
+ * Micro-kernels for one tile of the Gram matrix of a row block: the
+ * GRAM_TILE_ROWS columns starting at `a` against the `width` columns
+ * starting at `b`, both in the panel layout of gram_accumulate_kernel() with
+ * consecutive panels `stride` doubles apart. The tile is kept in registers
+ * over all the rows and then written to acc (row-major, `width` wide).
+ */
+void gram_tile_scalar(const double * a, const double * b, size_t rows,
+		size_t stride, double * acc)
+{
+	double sum[GRAM_TILE_ROWS * GRAM_PANEL] = {0};
+
+	(void) stride;
+
+	for (size_t i = 0; i < rows; i++) {
+		const double * ai = a + i * GRAM_PANEL;
+		const double * bi = b + i * GRAM_PANEL;
+
+		for (int t = 0; t < GRAM_TILE_ROWS; t++) {
+			for (int c = 0; c < GRAM_PANEL; c++) {
+				sum[t * GRAM_PANEL + c] += ai[t] * bi[c];
+			}
+		}
+	}
+
+	memcpy(acc, sum, sizeof(sum));
+}
+
+#ifdef GRAM_X86
+// 4 x 8 tile in eight 4-wide registers, two loads and four broadcasts per row
+__attribute__((target("avx2,fma")))
+void gram_tile_avx2(const double * a, const double * b, size_t rows,
+		size_t stride, double * acc)
+{
+	__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+	__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+	__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+
+	(void) stride;
+
+	for (size_t i = 0; i < rows; i++) {
+		const double * ai = a + i * GRAM_PANEL;
+		__m256d b0 = _mm256_loadu_pd(b + i * GRAM_PANEL);
+		__m256d b1 = _mm256_loadu_pd(b + i * GRAM_PANEL + 4);
+		__m256d x;
+
+		x = _mm256_broadcast_sd(ai);
+		c00 = _mm256_fmadd_pd(x, b0, c00);
+		c01 = _mm256_fmadd_pd(x, b1, c01);
+		x = _mm256_broadcast_sd(ai + 1);
+		c10 = _mm256_fmadd_pd(x, b0, c10);
+		c11 = _mm256_fmadd_pd(x, b1, c11);
+		x = _mm256_broadcast_sd(ai + 2);
+		c20 = _mm256_fmadd_pd(x, b0, c20);
+		c21 = _mm256_fmadd_pd(x, b1, c21);
+		x = _mm256_broadcast_sd(ai + 3);
+		c30 = _mm256_fmadd_pd(x, b0, c30);
+		c31 = _mm256_fmadd_pd(x, b1, c31);
+	}
+
+	_mm256_storeu_pd(acc, c00);
+	_mm256_storeu_pd(acc + 4, c01);
+	_mm256_storeu_pd(acc + 8, c10);
+	_mm256_storeu_pd(acc + 12, c11);
+	_mm256_storeu_pd(acc + 16, c20);
+	_mm256_storeu_pd(acc + 20, c21);
+	_mm256_storeu_pd(acc + 24, c30);
+	_mm256_storeu_pd(acc + 28, c31);
+}
+
+// 4 x 16 tile over two panels in eight 8-wide registers
+__attribute__((target("avx512f")))
+void gram_tile_avx512(const double * a, const double * b, size_t rows,
+		size_t stride, double * acc)
+{
+	__m512d c00 = _mm512_setzero_pd(), c01 = _mm512_setzero_pd();
+	__m512d c10 = _mm512_setzero_pd(), c11 = _mm512_setzero_pd();
+	__m512d c20 = _mm512_setzero_pd(), c21 = _mm512_setzero_pd();
+	__m512d c30 = _mm512_setzero_pd(), c31 = _mm512_setzero_pd();
+
+	for (size_t i = 0; i < rows; i++) {
+		const double * ai = a + i * GRAM_PANEL;
+		__m512d b0 = _mm512_loadu_pd(b + i * GRAM_PANEL);
+		__m512d b1 = _mm512_loadu_pd(b + stride + i * GRAM_PANEL);
+		__m512d x;
+
+		x = _mm512_set1_pd(ai[0]);
+		c00 = _mm512_fmadd_pd(x, b0, c00);
+		c01 = _mm512_fmadd_pd(x, b1, c01);
+		x = _mm512_set1_pd(ai[1]);
+		c10 = _mm512_fmadd_pd(x, b0, c10);
+		c11 = _mm512_fmadd_pd(x, b1, c11);
+		x = _mm512_set1_pd(ai[2]);
+		c20 = _mm512_fmadd_pd(x, b0, c20);
+		c21 = _mm512_fmadd_pd(x, b1, c21);
+		x = _mm512_set1_pd(ai[3]);
+		c30 = _mm512_fmadd_pd(x, b0, c30);
+		c31 = _mm512_fmadd_pd(x, b1, c31);
+	}
+
+	_mm512_storeu_pd(acc, c00);
+	_mm512_storeu_pd(acc + 8, c01);
+	_mm512_storeu_pd(acc + 16, c10);
+	_mm512_storeu_pd(acc + 24, c11);
+	_mm512_storeu_pd(acc + 32, c20);
+	_mm512_storeu_pd(acc + 40, c21);
+	_mm512_storeu_pd(acc + 48, c30);
+	_mm512_storeu_pd(acc + 56, c31);
+}
+#endif
+
+/*
+ * The named kernel, or with NULL the widest one the CPU supports, checked
+ * through cpuid. Returns NULL when the named kernel is unknown or unsupported.
+ */
+const gramKernel * gram_kernel(const char * name)
+{
+	static const gramKernel kernels[] = {
+#ifdef GRAM_X86
+		{"avx512", 2 * GRAM_PANEL, gram_tile_avx512},
+		{"avx2", GRAM_PANEL, gram_tile_avx2},
+#endif
+		{"scalar", GRAM_PANEL, gram_tile_scalar},
+	};
+	size_t nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+	for (size_t k = 0; k < nkernels; k++) {
+		bool supported = true;
+
+#ifdef GRAM_X86
+		if (kernels[k].tile == gram_tile_avx512) {
+			supported = __builtin_cpu_supports("avx512f");
+		} else if (kernels[k].tile == gram_tile_avx2) {
+			supported = __builtin_cpu_supports("avx2") &&
+				__builtin_cpu_supports("fma");
+		}
+#endif
+		if (supported && (!name || !strcmp(name, kernels[k].name))) {
+			return &kernels[k];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Add the rows of X to the upper triangle of G = X^T X and, when given, to
+ * Xty = X^T y with `kernel`. The columns of [X y] are first copied into
+ * panels of GRAM_PANEL columns, each holding its rows contiguously and
+ * zero-padded past the last column, so that a tile streams both its operands
+ * with unit stride and a panel of the row block stays in cache across the
+ * tiles using it. Xty comes out of the tiles against the column of y.
+ */
+void gram_accumulate_kernel(const gramKernel * kernel, const gsl_matrix * X,
+		const gsl_vector * y, gsl_matrix * G, gsl_vector * Xty)
+{
+	size_t rows = X->size1;
+	size_t p = X->size2;
+	size_t ncols = p + (y && Xty ? 1 : 0);
+	size_t width = kernel->width;
+	size_t npanels = (ncols + width - 1) / width * (width / GRAM_PANEL);
+	size_t stride = rows * GRAM_PANEL;
+	double * pack;
+	double acc[GRAM_TILE_ROWS * GRAM_TILE_MAX_WIDTH];
+
+	if (!rows || !p) return;
+	pack = calloc(npanels * stride, sizeof(double));
+
+	for (size_t i = 0; i < rows; i++) {
+		for (size_t j = 0; j < ncols; j++) {
+			pack[j / GRAM_PANEL * stride + i * GRAM_PANEL +
+				j % GRAM_PANEL] = j < p ?
+				gsl_matrix_get(X, i, j) : gsl_vector_get(y, i);
+		}
+	}
+
+	// Tiles on or above the diagonal, the row of y being left out
+	for (size_t jt = 0; jt < p; jt += GRAM_TILE_ROWS) {
+		const double * a = pack + jt / GRAM_PANEL * stride +
+			jt % GRAM_PANEL;
+
+		for (size_t kt = jt / width * width; kt < ncols; kt += width) {
+			kernel->tile(a, pack + kt / GRAM_PANEL * stride, rows,
+					stride, acc);
+
+			for (size_t t = 0; t < GRAM_TILE_ROWS && jt + t < p;
+					t++) {
+				size_t j = jt + t;
+
+				for (size_t c = 0; c < width; c++) {
+					size_t k = kt + c;
+					double v = acc[t * width + c];
+
+					if (k < j || k >= ncols) continue;
+					if (k < p) {
+						*gsl_matrix_ptr(G, j, k) += v;
+					} else {
+						*gsl_vector_ptr(Xty, j) += v;
+					}
+				}
+			}
+		}
+	}
+
+	free(pack);
+}
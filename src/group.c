@@ -0,0 +1,493 @@
+#include <stdint.h>
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "model_utils.h"
+#include "group.h"
+
+// FNV-1a hash of a key
+uint64_t group_hash(const char * key)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (*key) {
+		hash ^= (unsigned char) *key++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * Cut the field at `index` out of a comma-separated line in place, returning
+ * a copy of it.
+ */
+char * cut_field(char * line, int index)
+{
+	char * field = line;
+	char * end;
+	char * key;
+
+	for (int i = 0; i < index && field; i++) {
+		field = strchr(field, ',');
+		if (field) field++;
+	}
+	if (!field) return NULL;
+
+	end = strchr(field, ',');
+	key = end ? strndup(field, end - field) : strdup(field);
+	if (end) {
+		memmove(field, end + 1, strlen(end + 1) + 1);
+	} else if (field > line) {
+		field[-1] = '\0';
+	} else {
+		field[0] = '\0';
+	}
+
+	return key;
+}
+
+/*
+ * Take the key column out of the header and every data line, assigning each
+ * row to the group of its key. Keys are looked up in an open-addressing
+ * hash table, so partitioning is a single pass; the rows of every group are
+ * then gathered with a counting sort. Returns nonzero if the column is not
+ * in the header or a row is missing it.
+ */
+int group_lines(char ** lines, int nrow, const char * column,
+		groupIndex * groups)
+{
+	int index = 0;
+	size_t slot;
+	size_t mask;
+	size_t * table;
+	size_t * fill;
+	char * header;
+	char * rest;
+	char * name;
+
+	// Locate and remove the key column in the header
+	header = strdup(lines[0]);
+	rest = header;
+	while ((name = strsep(&rest, ",")) && strcmp(name, column)) {
+		index++;
+	}
+	free(header);
+	if (!name) {
+		fprintf(stderr, "Column '%s' not found.\n", column);
+		return 1;
+	}
+	free(cut_field(lines[0], index));
+
+	// Table of group ids + 1 (0 marks an empty slot), at most half full
+	for (mask = 1; mask < 2 * (size_t) nrow; mask <<= 1);
+	table = calloc(mask, sizeof(size_t));
+	mask--;
+
+	groups->ngroups = 0;
+	groups->keys = NULL;
+	groups->rowGroup = malloc(nrow * sizeof(size_t));
+	for (int i = 0; i < nrow; i++) {
+		char * key = cut_field(lines[i + 1], index);
+		double number;
+
+		// Packed numbers of a binary input become readable labels
+		if (key && binary_unpack(key, &number)) {
+			key = realloc(key, 32);
+			binary_format(number, key);
+		}
+		if (!key) {
+			fprintf(stderr, "Row %d has no '%s' value.\n", i + 1,
+					column);
+			free(table);
+			return 1;
+		}
+		slot = group_hash(key) & mask;
+		while (table[slot] &&
+				strcmp(groups->keys[table[slot] - 1], key)) {
+			slot = (slot + 1) & mask;
+		}
+		if (!table[slot]) {
+			groups->keys = realloc(groups->keys,
+					(groups->ngroups + 1) *
+					sizeof(char *));
+			groups->keys[groups->ngroups++] = key;
+			table[slot] = groups->ngroups;
+		} else {
+			free(key);
+		}
+		groups->rowGroup[i] = table[slot] - 1;
+	}
+	free(table);
+
+	// Counting sort of rows by group
+	groups->start = calloc(groups->ngroups + 1, sizeof(size_t));
+	groups->order = malloc(nrow * sizeof(size_t));
+	for (int i = 0; i < nrow; i++) {
+		groups->start[groups->rowGroup[i] + 1]++;
+	}
+	for (size_t g = 0; g < groups->ngroups; g++) {
+		groups->start[g + 1] += groups->start[g];
+	}
+	fill = malloc(groups->ngroups * sizeof(size_t));
+	memcpy(fill, groups->start, groups->ngroups * sizeof(size_t));
+	for (int i = 0; i < nrow; i++) {
+		groups->order[fill[groups->rowGroup[i]]++] = i;
+	}
+	free(fill);
+
+	return 0;
+}
+
+void group_free(groupIndex * groups)
+{
+	for (size_t g = 0; g < groups->ngroups; g++) {
+		free(groups->keys[g]);
+	}
+	free(groups->keys);
+	free(groups->rowGroup);
+	free(groups->start);
+	free(groups->order);
+}
+
+/*
+ * Read the input, partition its rows on each of the `n` named columns (one
+ * groupIndex per column) and parse the remaining columns as usual. Rows of
+ * the design keep their input order; use groups->order to visit them group
+ * by group.
+ */
+int load_group_data(modelConfigType * config, char ** columns, int n,
+		modelDataType * data, groupIndex * groups)
+{
+	int nrow;
+	char ** lines = NULL;
+
+	nrow = read_rows(&lines, config->input);
+	fclose(config->input);
+	for (int f = 0; f < n; f++) {
+		if (group_lines(lines, nrow, columns[f], &groups[f])) {
+			return 1;
+		}
+	}
+
+	return parse_model_data(config, lines, nrow, NULL, 0, data);
+}
+
+/*
+ * Subtract from v its mean within each level of every factor. With one
+ * factor this is a single pass; with several, the projections are
+ * alternated until no level mean exceeds GROUP_DEMEAN_TOLERANCE relative to
+ * the largest value of v (or GROUP_DEMEAN_MAX_ITER passes).
+ */
+void group_demean(groupIndex * factors, int nfactors, gsl_vector * v)
+{
+	size_t n = v->size;
+	double scale;
+	double change;
+	double * means;
+
+	scale = GSL_MAX(fabs(gsl_vector_max(v)), fabs(gsl_vector_min(v)));
+	scale = GSL_MAX(scale, 1);
+	for (int iter = 0; iter < GROUP_DEMEAN_MAX_ITER; iter++) {
+		change = 0;
+		for (int f = 0; f < nfactors; f++) {
+			groupIndex * groups = &factors[f];
+			means = calloc(groups->ngroups, sizeof(double));
+			for (size_t i = 0; i < n; i++) {
+				means[groups->rowGroup[i]] +=
+					gsl_vector_get(v, i);
+			}
+			for (size_t g = 0; g < groups->ngroups; g++) {
+				means[g] /= groups->start[g + 1] -
+					groups->start[g];
+				change = GSL_MAX(change, fabs(means[g]));
+			}
+			for (size_t i = 0; i < n; i++) {
+				*gsl_vector_ptr(v, i) -=
+					means[groups->rowGroup[i]];
+			}
+			free(means);
+		}
+		if (nfactors == 1 ||
+				change <= GROUP_DEMEAN_TOLERANCE * scale) {
+			break;
+		}
+	}
+}
+
+/*
+ * Number of fixed effects removed by group_demean(): the levels of every
+ * factor, less one for each factor after the first since their sums all
+ * span the constant. This is exact for one factor and assumes the factors
+ * are connected (every level linked through shared rows) for more.
+ */
+int group_absorbed(groupIndex * factors, int nfactors)
+{
+	int absorbed = 0;
+
+	for (int f = 0; f < nfactors; f++) {
+		absorbed += factors[f].ngroups;
+	}
+
+	return absorbed - (nfactors - 1);
+}
+
+// Put `value` back as field `index` of a line cut by cut_field()
+char * paste_field(const char * line, int index, const char * value)
+{
+	const char * field = line;
+	char * pasted;
+	size_t head;
+
+	for (int i = 0; i < index; i++) {
+		const char * comma = strchr(field, ',');
+		field = comma ? comma + 1 : field + strlen(field);
+	}
+	head = field - line;
+	pasted = malloc(strlen(line) + strlen(value) + 2);
+	memcpy(pasted, line, head);
+	if (*line) {
+		sprintf(pasted + head, index > 0 && !*field ? ",%s" : "%s,%s",
+				value, field);
+	} else {
+		strcpy(pasted, value);
+	}
+
+	return pasted;
+}
+
+/*
+ * Columns of the design parse_model_data() makes from `header` and the rows
+ * `keys` (the response cut out): the intercept and one per other field, and
+ * with `dummy` encoding one fewer than its categories for a text field.
+ */
+size_t design_width(const char * header, char ** keys, size_t nkeys,
+		bool dummy)
+{
+	size_t width = 1;
+	char * first;
+	char * rest;
+	char * field;
+	char ** values;
+
+	for (const char * c = header; *c; c++) {
+		if (*c == ',') width++;
+	}
+	if (!dummy || nkeys == 0) return width;
+
+	// Fields are typed by the first row, as read_columns() does
+	values = malloc(nkeys * sizeof(char *));
+	first = strdup(keys[0]);
+	rest = first;
+	for (int j = 0; (field = strsep(&rest, ",")); j++) {
+		size_t ncat = 1;
+
+		if (!*field || detect_type(field) != TYPE_STRING) continue;
+		for (size_t g = 0; g < nkeys; g++) {
+			char * copy = strdup(keys[g]);
+
+			values[g] = cut_field(copy, j);
+			if (!values[g]) values[g] = strdup("");
+			free(copy);
+		}
+		qsort(values, nkeys, sizeof(char *), compare_items);
+		for (size_t g = 1; g < nkeys; g++) {
+			if (strcmp(values[g], values[g - 1])) ncat++;
+		}
+		if (ncat > 2) width += ncat - 2;
+		for (size_t g = 0; g < nkeys; g++) {
+			free(values[g]);
+		}
+	}
+	free(first);
+	free(values);
+
+	return width;
+}
+
+/*
+ * Collapse data rows that agree on every field but the response (field
+ * `index`) into one row whose response is their mean, keeping each group's
+ * count and sum of squares about the mean (updated as in Welford's
+ * algorithm, after the transformation). Row text is hashed as for
+ * group_lines(); only the distinct rows are kept while reading. As soon as
+ * there are too many to at least halve the rows, reading stops, `lines` is
+ * left as it was and rows->nrow is 0. The same happens when there are fewer
+ * distinct rows than columns of the design (see design_width()), which only
+ * the uncompressed fit can take.
+ */
+int compress_lines(char *** lines, int nrow, int index,
+		transformType transformation, bool dummy,
+		compressedRows * rows)
+{
+	size_t slot;
+	size_t mask;
+	size_t capacity = 0;
+	size_t * table;
+	char ** keys = NULL;
+	size_t limit = GROUP_COMPRESS_RATIO * nrow;
+	char ** compressed;
+	char value[32];
+
+	// Sized for the most distinct rows that are kept
+	for (mask = 1; mask < 2 * limit + 2; mask <<= 1);
+	table = calloc(mask, sizeof(size_t));
+	mask--;
+
+	rows->nrow = 0;
+	rows->total = nrow;
+	rows->count = NULL;
+	rows->mean = NULL;
+	rows->ss = NULL;
+	for (int i = 1; i <= nrow; i++) {
+		size_t g;
+		double y;
+		double delta;
+		char * key = strdup((*lines)[i]);
+		char * field = cut_field(key, index);
+
+		if (!field) {
+			fprintf(stderr, "Row %d has no response.\n", i);
+			free(key);
+			free(table);
+			return 1;
+		}
+		y = binary_atof(field);
+		free(field);
+		if (transformation == TRANSFORM_LOG) {
+			y = log(y);
+		} else if (transformation == TRANSFORM_LOG_OFFSET) {
+			y = log_offset(y);
+		}
+
+		slot = group_hash(key) & mask;
+		while (table[slot] && strcmp(keys[table[slot] - 1], key)) {
+			slot = (slot + 1) & mask;
+		}
+		if (!table[slot]) {
+			if (rows->nrow == capacity) {
+				capacity = capacity ? 2 * capacity : 64;
+				keys = realloc(keys, capacity * sizeof(char *));
+				rows->count = realloc(rows->count,
+						capacity * sizeof(double));
+				rows->mean = realloc(rows->mean,
+						capacity * sizeof(double));
+				rows->ss = realloc(rows->ss,
+						capacity * sizeof(double));
+			}
+			g = rows->nrow++;
+			keys[g] = key;
+			table[slot] = rows->nrow;
+			if (rows->nrow > limit) break;
+			rows->count[g] = 0;
+			rows->mean[g] = 0;
+			rows->ss[g] = 0;
+		} else {
+			g = table[slot] - 1;
+			free(key);
+		}
+
+		rows->count[g]++;
+		delta = y - rows->mean[g];
+		rows->mean[g] += delta / rows->count[g];
+		rows->ss[g] += delta * (y - rows->mean[g]);
+	}
+	free(table);
+
+	if (rows->nrow > limit || rows->nrow < design_width((*lines)[0], keys,
+				rows->nrow, dummy)) {
+		for (size_t g = 0; g < rows->nrow; g++) {
+			free(keys[g]);
+		}
+		free(keys);
+		compressed_free(rows);
+		rows->nrow = 0;
+		return 0;
+	}
+
+	// Header, then one line per distinct row with its mean response
+	compressed = malloc((rows->nrow + 1) * sizeof(char *));
+	compressed[0] = (*lines)[0];
+	for (size_t g = 0; g < rows->nrow; g++) {
+		snprintf(value, sizeof(value), "%.17g", rows->mean[g]);
+		compressed[g + 1] = paste_field(keys[g], index, value);
+		free(keys[g]);
+	}
+	free(keys);
+	for (int i = 1; i <= nrow; i++) {
+		free((*lines)[i]);
+	}
+	free(*lines);
+	*lines = compressed;
+
+	return 0;
+}
+
+void compressed_free(compressedRows * rows)
+{
+	free(rows->count);
+	free(rows->mean);
+	free(rows->ss);
+}
+
+/*
+ * As load_model_data(), but first try compress_lines() when every row can
+ * be represented by its group: a single response, no test split and no
+ * target encoding (which would see only the group means). When rows are
+ * compressed the response is already transformed, and data holds one row
+ * per distinct predictor row.
+ */
+int load_compressed_data(modelConfigType * config, modelDataType * data,
+		compressedRows * rows)
+{
+	int nrow;
+	int testRows;
+	int index = 0;
+	char ** lines = NULL;
+	char ** testLines = NULL;
+	char * header;
+	char * rest;
+	char * name;
+	modelConfigType plain;
+
+	nrow = read_rows(&lines, config->input);
+	fclose(config->input);
+	rows->nrow = 0;
+
+	if (nrow > 0 && config->nresp <= 1 && config->testRatio == 0 &&
+			(config->encoding == ENCODE_NONE ||
+			 config->encoding == ENCODE_DUMMY)) {
+		// Position of the response in the header
+		if (config->nresp == 1) {
+			header = strdup(lines[0]);
+			rest = header;
+			while ((name = strsep(&rest, ",")) &&
+					strcmp(name, config->responses[0])) {
+				index++;
+			}
+			free(header);
+			if (!name) index = -1;
+		}
+		if (index >= 0 && compress_lines(&lines, nrow, index,
+					config->transformation,
+					config->encoding == ENCODE_DUMMY,
+					rows)) {
+			return 1;
+		}
+	}
+
+	if (rows->nrow > 0) {
+		plain = *config;
+		plain.transformation = TRANSFORM_NONE;
+		if (parse_model_data(&plain, lines, rows->nrow, NULL, 0,
+					data)) {
+			return 1;
+		}
+		config->encodingInfo = plain.encodingInfo;
+		return 0;
+	}
+
+	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
+	return parse_model_data(config, lines, nrow - testRows, testLines,
+			testRows, data);
+}
@@ -1,162 +1,1134 @@
 #include <gsl/gsl_multifit.h>
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_linalg.h>
+#include <float.h>
 #include <unistd.h>
 #include <time.h>
 #include "core.h"
+#include "gram.h"
 #include "model_utils.h"
+#include "batch.h"
+#include "serve.h"
+#include "group.h"
+#include "spline.h"
+#include "sketch.h"
+#include "sgd.h"
+#include "single.h"
 
 #define LM_HELP_INTRO \
 	"Usage: lm [-h] [-i file] [-n name] [TRANSFORM] [ENCODING] " \
-		"[DIAGNOSTIC]\n" \
+		"[DIAGNOSTIC] \\\n\t\t[UNIQUE]\n" \
 	"Perform linear regression from the command line.\n\n"
 
-int main(int argc, char *argv[])
+#define LM_UNIQUE_HELP \
+	"\nUNIQUE:\n" \
+	"\t-k, --by <column>\n\n" \
+	"\tFit a separate model to the rows sharing each value of the " \
+		"column, which\n" \
+	"\tis not used as a predictor. One table is printed (and saved " \
+		"to\n" \
+	"\t<name>.groups when named) with a row per group: the key, its " \
+		"number of\n" \
+	"\trows, the coefficients, RSS and R-squared. Groups with fewer " \
+		"rows than\n" \
+	"\tcoefficients are reported as nan.\n\n" \
+	"\t-A, --absorb <comma-separated columns>\n\n" \
+	"\tAbsorb the fixed effects of categorical columns with many " \
+		"levels instead\n" \
+	"\tof encoding them: the response and other predictors are " \
+		"demeaned within\n" \
+	"\teach level (alternating between columns when several are " \
+		"given) and the\n" \
+	"\tremaining coefficients fit on the result. The absorbed " \
+		"effects count\n" \
+	"\ttoward the degrees of freedom; with several columns every " \
+		"level is\n" \
+	"\tassumed connected to the others through shared rows.\n\n" \
+	"\t-I, --interact <a:b[:c...],...>\n\n" \
+	"\tAdd the product of the named predictors as a term. Like " \
+		"--poly, the\n" \
+	"\tterm is computed while accumulating the cross-products and " \
+		"never stored\n" \
+	"\tas a column; the model is then solved from the normal " \
+		"equations.\n\n" \
+	"\t-P, --poly <x:degree,...>\n\n" \
+	"\tAdd the powers 2 to degree of the named predictor as terms.\n\n" \
+	"\t-S, --spline <x:knots,...>\n\n" \
+	"\tReplace the named predictor by a cubic B-spline basis on the " \
+		"given number\n" \
+	"\tof uniform knots over its range. Only the few nonzero basis " \
+		"values of\n" \
+	"\teach row are stored, and their cross-products are " \
+		"accumulated as a\n" \
+	"\tbanded block.\n\n" \
+	"\t-K, --sketch <rows>\n\n" \
+	"\tCompress the data to the given number of rows with a " \
+		"CountSketch in one\n" \
+	"\tpass and fit that instead: an approximate fit for very many " \
+		"rows. Use\n" \
+	"\tat least several times as many rows as predictors. P-values " \
+		"are not\n" \
+	"\treported.\n\n" \
+	"\t-Q, --refine\n\n" \
+	"\tWith --sketch, refine the sketched fit to the exact least " \
+		"squares\n" \
+	"\tsolution by conjugate gradients preconditioned with the " \
+		"sketch.\n\n" \
+	"\t-D, --sgd <epochs>\n\n" \
+	"\tFit by mini-batch stochastic gradient descent (Adam) for up to " \
+		"the given\n" \
+	"\tnumber of passes over the rows, for data too wide for the " \
+		"normal\n" \
+	"\tequations. The input file is mapped and read a block of rows " \
+		"at a time,\n" \
+	"\tso it must be a file rather than a pipe, and only numeric " \
+		"columns are\n" \
+	"\tused. Unless a diagnostic is asked for, the objective and " \
+		"relative\n" \
+	"\tchange of each epoch are printed. P-values are not " \
+		"reported.\n\n" \
+	"\t-B, --batch <rows>\n\n" \
+	"\tRows per mini-batch with --sgd (default: " SGD_BATCH_STR ").\n\n" \
+	"\t-F, --single\n\n" \
+	"\tFit against a copy of the design rounded to single precision. " \
+		"The\n" \
+	"\tnormal equations are accumulated and solved in double precision " \
+		"and\n" \
+	"\tthe fit is refined against the copy, so coefficients agree with " \
+		"the\n" \
+	"\tdefault fit to about the condition number of the design times " \
+		"1e-7\n" \
+	"\t(the rounding of the data to single precision), relative to " \
+		"their size.\n" \
+	"\tBoth copies are held only while the float one is made; the " \
+		"double\n" \
+	"\tprecision design is then freed, so the fit runs in half its " \
+		"memory.\n"
+
+// Options of one lm model
+typedef struct {
+	char * by;			// --by column, or NULL
+	int nabsorb;
+	char ** absorb;			// --absorb columns
+	int ninteract;
+	char ** interact;		// --interact specs, a:b
+	int npoly;
+	char ** poly;			// --poly specs, x:degree
+	int nspline;
+	char ** spline;			// --spline specs, x:knots
+	int sketch;			// --sketch rows, 0 for none
+	bool refine;
+	int epochs;			// --sgd epochs, 0 for none
+	int batch;			// --batch rows
+	bool single;
+} lmOptions;
+
+/*
+ * Fit every response from a single decomposition of the data matrix. Each
+ * fit matches gsl_multifit_linear() on that response alone.
+ */
+int fit_lm_responses(modelConfigType * config, modelDataType * data)
 {
-	// Command-line options
-	const struct option commandOptions[] = {
-		COMMON_OPTIONS,
-	};
-	int opt;
-	modelConfigType * config;
+	size_t rank;
+	gsl_vector * rss;
+	gsl_vector * covScale;
+	gsl_matrix * coef;
+	gsl_matrix * covFactor;
+	gsl_multifit_linear_workspace * work;
+
+	work = gsl_multifit_linear_alloc(data->nrow, data->ncol);
+	if (gsl_multifit_linear_bsvd(data->dataMatrix, work)) {
+		return 1;
+	}
+	rank = gsl_multifit_linear_rank(GSL_DBL_EPSILON, work);
+
+	coef = gsl_matrix_alloc(data->ncol, data->nresp);
+	covFactor = gsl_matrix_alloc(data->ncol, data->ncol);
+	rss = gsl_vector_alloc(data->nresp);
+	svd_solve_responses(rank, NULL, data->dataMatrix, data->responses,
+			coef, rss, covFactor, work);
+	gsl_multifit_linear_free(work);
+
+	// \hat\sigma^2 = RSS / (n - p) for each response
+	covScale = gsl_vector_alloc(data->nresp);
+	gsl_vector_memcpy(covScale, rss);
+	gsl_vector_scale(covScale, 1.0 / (data->nrow - data->ncol));
+	diagnostics_responses(config, data, coef, rss, covFactor, covScale);
+
+	gsl_vector_free(covScale);
+	gsl_vector_free(rss);
+	gsl_matrix_free(covFactor);
+	gsl_matrix_free(coef);
+
+	return 0;
+}
+
+// Print the per-group table of fit_lm_groups()
+void print_group_table(FILE * output, const char * by, groupIndex * groups,
+		gsl_matrix * results, char ** colNames)
+{
+	size_t p = results->size2 - 2;
+
+	fprintf(output, "%s\trows", by);
+	for (size_t j = 0; j < p; j++) {
+		fprintf(output, "\t%s", colNames[j]);
+	}
+	fprintf(output, "\tRSS\tR-squared\n");
+	for (size_t g = 0; g < groups->ngroups; g++) {
+		fprintf(output, "%s\t%zu", groups->keys[g],
+				groups->start[g + 1] - groups->start[g]);
+		for (size_t j = 0; j < p + 2; j++) {
+			fprintf(output, "\t%g", gsl_matrix_get(results, g, j));
+		}
+		fprintf(output, "\n");
+	}
+}
+
+/*
+ * Fit a separate model to the rows of every group. The rows are gathered
+ * group by group once, then groups are spread over threads; each thread
+ * reuses a single workspace sized for the largest group.
+ */
+int fit_lm_groups(modelConfigType * config, modelDataType * data,
+		groupIndex * groups, const char * by)
+{
+	size_t p = data->ncol;
+	size_t maxRows = 0;
+	char * name;
+	FILE * file;
+	gsl_vector * y;
+	gsl_matrix * X;
+	gsl_matrix * results;
+
+	// Contiguous rows per group
+	X = gsl_matrix_alloc(data->nrow, p);
+	y = gsl_vector_alloc(data->nrow);
+	for (int i = 0; i < data->nrow; i++) {
+		gsl_vector_view row = gsl_matrix_row(data->dataMatrix,
+				groups->order[i]);
+		gsl_matrix_set_row(X, i, &row.vector);
+		gsl_vector_set(y, i, gsl_vector_get(data->response,
+					groups->order[i]));
+	}
+	for (size_t g = 0; g < groups->ngroups; g++) {
+		maxRows = GSL_MAX(maxRows,
+				groups->start[g + 1] - groups->start[g]);
+	}
+
+	// Coefficients, RSS and R-squared of each group
+	results = gsl_matrix_alloc(groups->ngroups, p + 2);
+	#pragma omp parallel
+	{
+		gsl_multifit_linear_workspace * work;
+		gsl_matrix * covMatrix;
+
+		work = gsl_multifit_linear_alloc(GSL_MAX(maxRows, p), p);
+		covMatrix = gsl_matrix_alloc(p, p);
+		#pragma omp for schedule(dynamic, 16)
+		for (size_t g = 0; g < groups->ngroups; g++) {
+			size_t n = groups->start[g + 1] - groups->start[g];
+			double chisq;
+			double tss;
+			gsl_vector_view row = gsl_matrix_row(results, g);
+			gsl_vector_view coef = gsl_vector_subvector(
+					&row.vector, 0, p);
+			gsl_matrix_view Xg;
+			gsl_vector_view yg;
+
+			if (n < p) {
+				gsl_vector_set_all(&row.vector, NAN);
+				continue;
+			}
+			Xg = gsl_matrix_submatrix(X, groups->start[g], 0, n, p);
+			yg = gsl_vector_subvector(y, groups->start[g], n);
+			gsl_multifit_linear(&Xg.matrix, &yg.vector,
+					&coef.vector, covMatrix, &chisq, work);
+			tss = gsl_stats_tss(yg.vector.data, yg.vector.stride,
+					n);
+			gsl_vector_set(&row.vector, p, chisq);
+			gsl_vector_set(&row.vector, p + 1,
+					diagnostic_value(R_SQUARED, chisq, tss,
+						n, p - 1, NULL));
+		}
+		gsl_matrix_free(covMatrix);
+		gsl_multifit_linear_free(work);
+	}
+	gsl_matrix_free(X);
+	gsl_vector_free(y);
 
-	// Model variables
-	int nrow;
-	int ncol;
-	int testRows;
+	print_group_table(stdout, by, groups, results, data->colNames);
+	if (config->name) {
+		name = malloc(strlen(config->name) + sizeof(".groups"));
+		sprintf(name, "%s.groups", config->name);
+		file = fopen(name, "w");
+		print_group_table(file, by, groups, results, data->colNames);
+		fclose(file);
+		free(name);
+	}
+	gsl_matrix_free(results);
+
+	return 0;
+}
+
+/*
+ * Fit the model with the fixed effects of the absorbed factors removed by
+ * demeaning the response and every predictor within their levels; the
+ * intercept is absorbed along with them. Coefficients match a fit with the
+ * factors dummy encoded, without forming those columns.
+ */
+int fit_lm_absorbed(modelConfigType * config, modelDataType * data,
+		groupIndex * factors, int nfactors)
+{
+	int n = data->nrow;
+	int k = data->ncol - 1;
+	int absorbed;
+	double tss;
 	double chisq;
-	char ** lines = NULL;
-	char ** testLines = NULL;
-	char ** colNames = NULL;
-	encodeData * encodingInfo;
-	dataColumn * columnHead;
-	dataColumn * testData;
-	dataColumn * colPtr;
-	gsl_vector * response;
 	gsl_vector * coef;
-	gsl_matrix * dataMatrix;
 	gsl_matrix * covMatrix;
+	gsl_matrix_view X;
 	gsl_multifit_linear_workspace * work;
 
-	config = malloc(sizeof(modelConfigType));
-	config->input = stdin;
-	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING,
-					commandOptions, NULL)) != -1) {
-		if (parse_args(opt, config, LM_HELP_INTRO LM_HELP_MESSAGE)) {
+	absorbed = group_absorbed(factors, nfactors);
+	if (k < 1 || n - k - absorbed < 1) {
+		fprintf(stderr, "Too few rows or predictors left after "
+				"absorbing fixed effects.\n");
+		return 1;
+	}
+	tss = gsl_stats_tss(data->response->data, data->response->stride, n);
+
+	// Columns are demeaned independently
+	#pragma omp parallel for schedule(dynamic)
+	for (int j = 0; j <= k; j++) {
+		gsl_vector_view col = gsl_matrix_column(data->dataMatrix, j);
+		group_demean(factors, nfactors, j == 0 ? data->response :
+				&col.vector);
+	}
+
+	// The intercept column is now zero; fit the rest
+	X = gsl_matrix_submatrix(data->dataMatrix, 0, 1, n, k);
+	work = gsl_multifit_linear_alloc(n, k);
+	coef = gsl_vector_alloc(k);
+	covMatrix = gsl_matrix_alloc(k, k);
+	if (gsl_multifit_linear(&X.matrix, data->response, coef, covMatrix,
+				&chisq, work)) {
+		return 1;
+	}
+	gsl_multifit_linear_free(work);
+
+	// \hat\sigma^2 = RSS / (n - k - absorbed) rather than RSS / (n - k)
+	gsl_matrix_scale(covMatrix, (double) (n - k) / (n - k - absorbed));
+	config->kind = MODEL_ABSORBED;
+	diagnostics_report(config->diagnostic, chisq, tss, n,
+			k + absorbed - 1, coef, covMatrix, data->colNames + 1,
+			NULL, config);
+
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+/*
+ * Fit the model on rows compressed by load_compressed_data(): weighted least
+ * squares with each distinct row weighted by its count and fit to its mean
+ * response gives the coefficients of the fit to every row. The residual and
+ * total sums of squares add back the spread within each group, so the
+ * standard errors and diagnostics match the uncompressed fit as well.
+ */
+int fit_lm_compressed(modelConfigType * config, modelDataType * data,
+		compressedRows * rows)
+{
+	size_t n = rows->total;
+	size_t p = data->ncol;
+	double chisq;
+	double rss;
+	double tss = 0;
+	double grandMean = 0;
+	gsl_vector_view weights;
+	gsl_vector * coef;
+	gsl_matrix * covMatrix;
+	gsl_multifit_linear_workspace * work;
+
+	weights = gsl_vector_view_array(rows->count, rows->nrow);
+	work = gsl_multifit_linear_alloc(rows->nrow, p);
+	coef = gsl_vector_alloc(p);
+	covMatrix = gsl_matrix_alloc(p, p);
+	if (gsl_multifit_wlinear(data->dataMatrix, &weights.vector,
+				data->response, coef, covMatrix, &chisq,
+				work)) {
+		return 1;
+	}
+	gsl_multifit_linear_free(work);
+
+	// Add the sums of squares within groups
+	rss = chisq;
+	for (size_t g = 0; g < rows->nrow; g++) {
+		rss += rows->ss[g];
+		grandMean += rows->count[g] * rows->mean[g] / n;
+	}
+	for (size_t g = 0; g < rows->nrow; g++) {
+		tss += rows->ss[g] + rows->count[g] *
+			pow(rows->mean[g] - grandMean, 2);
+	}
+
+	// The weighted covariance is (X^T W X)^{-1}; scale by RSS / (n - p)
+	gsl_matrix_scale(covMatrix, rss / (n - p));
+	diagnostics_report(config->diagnostic, rss, tss, n, p - 1, coef,
+			covMatrix, data->colNames, NULL, config);
+
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+// Index of the named predictor, or -1
+int predictor_index(modelDataType * data, const char * name)
+{
+	for (int j = 1; j < data->ncol; j++) {
+		if (!strcmp(data->colNames[j], name)) return j;
+	}
+	fprintf(stderr, "Column '%s' not found.\n", name);
+
+	return -1;
+}
+
+/*
+ * Resolve the --interact and --poly specs against the predictors. Returns
+ * the number of features, or -1 if a spec names an unknown column.
+ */
+int lm_features(modelDataType * data, lmOptions * opts,
+		gramFeature ** features)
+{
+	int nfeatures = 0;
+	int degree;
+	int index;
+	char * spec;
+	char * name;
+	char * rest;
+	gramFeature * f;
+
+	*features = NULL;
+	for (int i = 0; i < opts->ninteract; i++) {
+		*features = realloc(*features,
+				(nfeatures + 1) * sizeof(gramFeature));
+		f = *features + nfeatures++;
+		f->name = strdup(opts->interact[i]);
+		f->nfactors = 0;
+		f->factors = NULL;
+		spec = strdup(opts->interact[i]);
+		rest = spec;
+		while ((name = strsep(&rest, ":"))) {
+			if ((index = predictor_index(data, name)) < 0) {
+				return -1;
+			}
+			f->factors = realloc(f->factors,
+					(f->nfactors + 1) * sizeof(size_t));
+			f->factors[f->nfactors++] = index;
+		}
+		free(spec);
+	}
+
+	for (int i = 0; i < opts->npoly; i++) {
+		spec = strdup(opts->poly[i]);
+		rest = spec;
+		name = strsep(&rest, ":");
+		degree = rest ? atoi(rest) : 0;
+		if (degree < 2) {
+			fprintf(stderr, "Polynomial degree of '%s' must be "
+					"at least 2.\n", name);
+			return -1;
+		}
+		if ((index = predictor_index(data, name)) < 0) {
+			return -1;
+		}
+		for (int d = 2; d <= degree; d++) {
+			*features = realloc(*features,
+					(nfeatures + 1) * sizeof(gramFeature));
+			f = *features + nfeatures++;
+			f->name = malloc(strlen(name) + 16);
+			sprintf(f->name, "%s^%d", name, d);
+			f->nfactors = d;
+			f->factors = malloc(d * sizeof(size_t));
+			for (int k = 0; k < d; k++) {
+				f->factors[k] = index;
+			}
+		}
+		free(spec);
+	}
+
+	return nfeatures;
+}
+
+/*
+ * Fit the model with --interact and --poly terms. The cross-products of the
+ * extended design are accumulated with the terms generated per row block,
+ * so memory stays at that of the base columns, and the normal equations are
+ * solved by Cholesky. Residuals take a second pass over the blocks.
+ */
+int fit_lm_features(modelConfigType * config, modelDataType * data,
+		lmOptions * opts)
+{
+	int nfeatures;
+	size_t n = data->nrow;
+	size_t q;
+	double rss;
+	double tss;
+	char ** names;
+	gramFeature * features;
+	gsl_vector * Xty;
+	gsl_vector * coef;
+	gsl_vector * resid;
+	gsl_vector * testResid = NULL;
+	gsl_matrix * G;
+	gsl_matrix * covMatrix;
+
+	nfeatures = lm_features(data, opts, &features);
+	if (nfeatures < 0) return 1;
+	q = data->ncol + nfeatures;
+	if (n <= q) {
+		fprintf(stderr, "More terms than rows.\n");
+		return 1;
+	}
+
+	G = gsl_matrix_alloc(q, q);
+	Xty = gsl_vector_alloc(q);
+	coef = gsl_vector_alloc(q);
+	covMatrix = gsl_matrix_alloc(q, q);
+	gram_compute_features(data->dataMatrix, data->response, features,
+			nfeatures, G, Xty);
+	if (gram_solve_normal(G, 0, Xty, coef, covMatrix)) {
+		fprintf(stderr, "Terms are collinear.\n");
+		return 1;
+	}
+
+	resid = gsl_vector_alloc(n);
+	gram_feature_residuals(data->dataMatrix, data->response, features,
+			nfeatures, coef, resid);
+	rss = pow(gsl_blas_dnrm2(resid), 2);
+	gsl_matrix_scale(covMatrix, rss / (n - q));
+	tss = gsl_stats_tss(data->response->data, data->response->stride, n);
+	if (data->testMatrix) {
+		testResid = gsl_vector_alloc(data->testRows);
+		gram_feature_residuals(data->testMatrix, data->testResponse,
+				features, nfeatures, coef, testResid);
+	}
+
+	names = malloc(q * sizeof(char *));
+	memcpy(names, data->colNames, data->ncol * sizeof(char *));
+	for (int f = 0; f < nfeatures; f++) {
+		names[data->ncol + f] = features[f].name;
+	}
+	config->kind = MODEL_FEATURES;
+	diagnostics_report(config->diagnostic, rss, tss, n, q - 1, coef,
+			covMatrix, names, testResid, config);
+
+	for (int f = 0; f < nfeatures; f++) {
+		free(features[f].name);
+		free(features[f].factors);
+	}
+	free(features);
+	free(names);
+	if (testResid) gsl_vector_free(testResid);
+	gsl_vector_free(resid);
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+	gsl_vector_free(Xty);
+	gsl_matrix_free(G);
+
+	return 0;
+}
+
+/*
+ * Fit the model with --spline bases in place of their predictors. The
+ * normal equations of the extended design are formed by spline_gram() from
+ * the stored nonzeros and solved by Cholesky.
+ */
+int fit_lm_splines(modelConfigType * config, modelDataType * data,
+		lmOptions * opts)
+{
+	int nsplines = opts->nspline;
+	int nkeep = 0;
+	int nbreak;
+	int index;
+	size_t n = data->nrow;
+	size_t q = data->ncol - nsplines;
+	size_t offset;
+	double rss;
+	double tss;
+	char * name;
+	char ** keep;
+	char ** names;
+	splineBasis * splines;
+	splineBasis * testSplines = NULL;
+	gsl_vector * Xty;
+	gsl_vector * coef;
+	gsl_vector * resid;
+	gsl_vector * testResid = NULL;
+	gsl_matrix * G;
+	gsl_matrix * covMatrix;
+
+	// Bases from the predictors they replace
+	splines = calloc(nsplines, sizeof(splineBasis));
+	if (data->testMatrix) {
+		testSplines = calloc(nsplines, sizeof(splineBasis));
+	}
+	for (int s = 0; s < nsplines; s++) {
+		name = strdup(opts->spline[s]);
+		nbreak = strchr(name, ':') ? atoi(strchr(name, ':') + 1) : 0;
+		if (strchr(name, ':')) *strchr(name, ':') = '\0';
+		splines[s].name = name;
+		if ((index = predictor_index(data, name)) < 0 ||
+				spline_basis(data->dataMatrix, index, nbreak,
+					&splines[s])) {
 			return 1;
 		}
+		q += splines[s].ncoef;
+		if (testSplines) {
+			testSplines[s] = splines[s];
+			testSplines[s].name = NULL;
+			testSplines[s].start = NULL;
+			testSplines[s].values = NULL;
+			spline_eval(data->testMatrix, &testSplines[s]);
+		}
+	}
+	if (n <= q) {
+		fprintf(stderr, "More terms than rows.\n");
+		return 1;
 	}
 
-	// Set random seed
-	srand(time(NULL));
+	// Drop the expanded predictors, which the bases span
+	keep = malloc(data->ncol * sizeof(char *));
+	for (int j = 1; j < data->ncol; j++) {
+		bool splined = false;
+		for (int s = 0; s < nsplines; s++) {
+			splined |= splines[s].column == (size_t) j;
+		}
+		if (!splined) keep[nkeep++] = data->colNames[j];
+	}
+	if (model_data_subset(data, keep, nkeep, NULL)) {
+		return 1;
+	}
+	free(keep);
 
-	// Parse incoming csv file
-	nrow = read_rows(&lines, config->input);
-	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
-	nrow -= testRows;
-	fclose(config->input);
-	columnHead = column_alloc(nrow, "");
-	testData = column_alloc(testRows, "");
-	switch(config->encoding) {
-		case ENCODE_DUMMY:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, dummy_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, dummy_encode,
-		 			testRows, &encodingInfo);
-			}
-			break;
-
-		case ENCODE_MEAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					mean_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					mean_target_encode, testRows,
-					&encodingInfo);
+	G = gsl_matrix_alloc(q, q);
+	Xty = gsl_vector_alloc(q);
+	coef = gsl_vector_alloc(q);
+	covMatrix = gsl_matrix_alloc(q, q);
+	spline_gram(data->dataMatrix, data->response, splines, nsplines, G,
+			Xty);
+	if (gram_solve_normal(G, 0, Xty, coef, covMatrix)) {
+		fprintf(stderr, "Terms are collinear.\n");
+		return 1;
+	}
+
+	resid = gsl_vector_alloc(n);
+	spline_residuals(data->dataMatrix, data->response, splines, nsplines,
+			coef, resid);
+	rss = pow(gsl_blas_dnrm2(resid), 2);
+	gsl_matrix_scale(covMatrix, rss / (n - q));
+	tss = gsl_stats_tss(data->response->data, data->response->stride, n);
+	if (testSplines) {
+		testResid = gsl_vector_alloc(data->testRows);
+		spline_residuals(data->testMatrix, data->testResponse,
+				testSplines, nsplines, coef, testResid);
+	}
+
+	// Basis functions are named x_bs1, x_bs2, ...
+	names = malloc(q * sizeof(char *));
+	for (int j = 0; j < data->ncol; j++) {
+		names[j] = strdup(data->colNames[j]);
+	}
+	offset = data->ncol;
+	for (int s = 0; s < nsplines; s++) {
+		for (size_t k = 0; k < splines[s].ncoef; k++) {
+			names[offset] = malloc(strlen(splines[s].name) + 24);
+			sprintf(names[offset++], "%s_bs%zu", splines[s].name,
+					k + 1);
+		}
+	}
+	config->kind = MODEL_SPLINE;
+	diagnostics_report(config->diagnostic, rss, tss, n, q - 1, coef,
+			covMatrix, names, testResid, config);
+
+	for (size_t j = 0; j < q; j++) {
+		free(names[j]);
+	}
+	free(names);
+	for (int s = 0; s < nsplines; s++) {
+		spline_free(&splines[s]);
+		if (testSplines) spline_free(&testSplines[s]);
+	}
+	free(splines);
+	free(testSplines);
+	if (testResid) gsl_vector_free(testResid);
+	gsl_vector_free(resid);
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+	gsl_vector_free(Xty);
+	gsl_matrix_free(G);
+
+	return 0;
+}
+
+/*
+ * Fit the model on a CountSketch of the data, refined to the exact solution
+ * with --refine. Diagnostics use the residuals of every row.
+ */
+int fit_lm_sketch(modelConfigType * config, modelDataType * data,
+		lmOptions * opts)
+{
+	size_t m = opts->sketch;
+	size_t p = data->ncol;
+	size_t iterations;
+	double chisq;
+	gsl_vector * Sy;
+	gsl_vector * coef;
+	gsl_vector * resid;
+	gsl_vector * tau;
+	gsl_matrix * SX;
+	gsl_matrix * covMatrix;
+	gsl_matrix_view R;
+	gsl_multifit_linear_workspace * work;
+
+	if (m < p) {
+		fprintf(stderr, "The sketch needs at least as many rows as "
+				"predictors.\n");
+		return 1;
+	}
+
+	SX = gsl_matrix_alloc(m, p);
+	Sy = gsl_vector_alloc(m);
+	sketch_count(data->dataMatrix, data->response, rand(), SX, Sy);
+
+	// Solve the small problem as usual
+	work = gsl_multifit_linear_alloc(m, p);
+	coef = gsl_vector_alloc(p);
+	covMatrix = gsl_matrix_alloc(p, p);
+	if (gsl_multifit_linear(SX, Sy, coef, covMatrix, &chisq, work)) {
+		return 1;
+	}
+	gsl_multifit_linear_free(work);
+	gsl_matrix_free(covMatrix);
+
+	if (opts->refine) {
+		tau = gsl_vector_alloc(p);
+		gsl_linalg_QR_decomp(SX, tau);
+		R = gsl_matrix_submatrix(SX, 0, 0, p, p);
+		if (sketch_refine(data->dataMatrix, data->response, &R.matrix,
+					coef, &iterations)) {
+			fprintf(stderr, "The sketch is rank deficient.\n");
+			return 1;
+		}
+		if (config->diagnostic == ALL) {
+			printf("Refinement iterations: %zu\n\n", iterations);
+		}
+		gsl_vector_free(tau);
+	}
+	gsl_matrix_free(SX);
+	gsl_vector_free(Sy);
+
+	resid = gsl_vector_alloc(data->nrow);
+	gsl_multifit_linear_residuals(data->dataMatrix, data->response, coef,
+			resid);
+	chisq = pow(gsl_blas_dnrm2(resid), 2);
+	gsl_vector_free(resid);
+	diagnostics(config->diagnostic, chisq, data->response, coef, NULL,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
+
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+/*
+ * Fit the model with the design held in single precision. The normal
+ * equations are accumulated and solved in double precision, falling back to
+ * a pseudo-inverse truncated at single precision when they are singular,
+ * and the solution is then refined against the float design.
+ */
+int fit_lm_single(modelConfigType * config, modelDataType * data)
+{
+	size_t n = data->nrow;
+	size_t p = data->ncol;
+	int steps;
+	double chisq;
+	gsl_vector * Xty;
+	gsl_vector * coef;
+	gsl_vector * resid;
+	gsl_matrix * G;
+	gsl_matrix * covMatrix;
+	gsl_matrix_float * X;
+
+	X = single_matrix(data->dataMatrix);
+	gsl_matrix_free(data->dataMatrix);
+	data->dataMatrix = NULL;
+
+	G = gsl_matrix_alloc(p, p);
+	Xty = gsl_vector_alloc(p);
+	coef = gsl_vector_calloc(p);
+	covMatrix = gsl_matrix_alloc(p, p);
+	single_gram(X, data->response, G, Xty);
+	if (gram_solve_normal(G, 0, Xty, coef, covMatrix)) {
+		single_pseudo_inverse(G, FLT_EPSILON, true, covMatrix);
+		gsl_vector_set_zero(coef);
+	}
+	gsl_matrix_free(G);
+	gsl_vector_free(Xty);
+
+	resid = gsl_vector_alloc(n);
+	steps = single_refine(X, data->response, covMatrix, coef, resid);
+	if (config->diagnostic == ALL) {
+		printf("Refinement steps: %d\n\n", steps);
+	}
+	chisq = pow(gsl_blas_dnrm2(resid), 2);
+	gsl_matrix_scale(covMatrix, chisq / (n - p));
+	gsl_vector_free(resid);
+	gsl_matrix_float_free(X);
+
+	diagnostics(config->diagnostic, chisq, data->response, coef, covMatrix,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
+
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+int lm_options(int argc, char ** argv, modelConfigType * config,
+		void ** options)
+{
+	// Command-line options
+	const struct option commandOptions[] = {
+		COMMON_OPTIONS,
+		{"by",		required_argument,	NULL, 'k'},
+		{"absorb",	required_argument,	NULL, 'A'},
+		{"interact",	required_argument,	NULL, 'I'},
+		{"poly",	required_argument,	NULL, 'P'},
+		{"spline",	required_argument,	NULL, 'S'},
+		{"sketch",	required_argument,	NULL, 'K'},
+		{"refine",	no_argument,		NULL, 'Q'},
+		{"sgd",		required_argument,	NULL, 'D'},
+		{"batch",	required_argument,	NULL, 'B'},
+		{"single",	no_argument,		NULL, 'F'},
+	};
+	int opt;
+	lmOptions * opts;
+
+	opts = malloc(sizeof(lmOptions));
+	opts->by = NULL;
+	opts->nabsorb = 0;
+	opts->absorb = NULL;
+	opts->ninteract = 0;
+	opts->interact = NULL;
+	opts->npoly = 0;
+	opts->poly = NULL;
+	opts->nspline = 0;
+	opts->spline = NULL;
+	opts->sketch = 0;
+	opts->refine = false;
+	opts->epochs = 0;
+	opts->batch = SGD_BATCH;
+	opts->single = false;
+	*options = opts;
+	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING
+					"k:A:I:P:S:K:QD:B:F", commandOptions,
+					NULL)) != -1) {
+		if (parse_args(opt, config, LM_HELP_INTRO LM_HELP_MESSAGE
+					LM_UNIQUE_HELP)) {
+			return 1;
+		}
+		if (opt == 'k') {
+			opts->by = strdup(optarg);
+		}
+		if (opt == 'A') {
+			opts->nabsorb = split_names(optarg, &opts->absorb,
+					opts->nabsorb);
+		}
+		if (opt == 'I') {
+			opts->ninteract = split_names(optarg, &opts->interact,
+					opts->ninteract);
+		}
+		if (opt == 'P') {
+			opts->npoly = split_names(optarg, &opts->poly,
+					opts->npoly);
+		}
+		if (opt == 'S') {
+			opts->nspline = split_names(optarg, &opts->spline,
+					opts->nspline);
+		}
+		if (opt == 'K') {
+			sscanf(optarg, "%d", &opts->sketch);
+			if (opts->sketch < 1) {
+				fprintf(stderr, "Sketch rows must be "
+						"positive.\n");
+				return 1;
 			}
-			break;
-
-		case ENCODE_MEDIAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					median_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					median_target_encode, testRows,
-					&encodingInfo);
+		}
+		if (opt == 'Q') {
+			opts->refine = true;
+		}
+		if (opt == 'D') {
+			sscanf(optarg, "%d", &opts->epochs);
+			if (opts->epochs < 1) {
+				fprintf(stderr, "Epochs must be positive.\n");
+				return 1;
 			}
-			break;
-
-		case ENCODE_NONE:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, no_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, no_encode,
-					testRows, &encodingInfo);
+		}
+		if (opt == 'F') {
+			opts->single = true;
+		}
+		if (opt == 'B') {
+			sscanf(optarg, "%d", &opts->batch);
+			if (opts->batch < 1) {
+				fprintf(stderr, "Batch rows must be "
+						"positive.\n");
+				return 1;
 			}
-			break;
+		}
 	}
-	dataMatrix = gsl_matrix_alloc(nrow, ncol);
-	response = columnHead->vector; // First column is the response
-	if (arrange_data(columnHead, dataMatrix, ncol)) return 1;
 
-	// Pull out column names, skipping the response
-	colPtr = columnHead;
-	colPtr = colPtr->nextColumn;
-	colNames = malloc(ncol * sizeof(char *));
-	for (int i = 0; i < ncol; i++) {
-		colNames[i] = strdup(colPtr->name);
-		colPtr = colPtr->nextColumn;
+	return 0;
+}
+
+void lm_options_free(void * options)
+{
+	lmOptions * opts = options;
+	char ** lists[] = {opts->absorb, opts->interact, opts->poly,
+		opts->spline};
+	int counts[] = {opts->nabsorb, opts->ninteract, opts->npoly,
+		opts->nspline};
+
+	for (int l = 0; l < 4; l++) {
+		for (int i = 0; i < counts[l]; i++) {
+			free(lists[l][i]);
+		}
+		free(lists[l]);
 	}
+	free(opts->by);
+	free(opts);
+}
 
-	// We cannot make a model with more columns than rows
-	if (nrow < ncol) {
-		fprintf(stderr, "More columns than rows; check encoding "
-	  			"method or test ratio.\n");
-		exit(EXIT_FAILURE);
+/*
+ * Fit and report one model. Given the cross-products of the predictors (in
+ * --jobs mode) the normal equations are solved by Cholesky, falling back to
+ * the SVD when they are too ill-conditioned.
+ */
+int lm_fit(modelConfigType * config, void * options, modelDataType * data,
+		gsl_matrix * gram)
+{
+	lmOptions * opts = options;
+	double chisq;
+	gsl_vector * coef;
+	gsl_matrix * covMatrix;
+	gsl_multifit_linear_workspace * work;
+
+	if (opts->by || opts->nabsorb || opts->ninteract || opts->npoly ||
+			opts->nspline || opts->sketch || opts->epochs ||
+			opts->single) {
+		fprintf(stderr, "--by, --absorb, --interact, --poly, "
+				"--spline, --sketch, --sgd and --single are "
+				"not available with --jobs or --serve.\n");
+		return 1;
+	}
+	if (data->nresp > 1) {
+		return fit_lm_responses(config, data);
 	}
 
 	// Allocate remaining data
-	work = gsl_multifit_linear_alloc(nrow, ncol);
-	coef = gsl_vector_calloc(ncol);
-	covMatrix = gsl_matrix_calloc(ncol, ncol);
+	coef = gsl_vector_calloc(data->ncol);
+	covMatrix = gsl_matrix_calloc(data->ncol, data->ncol);
 
-	// Perform transformation if necessary
-	switch(config->transformation) {
-		case TRANSFORM_LOG:
-			transform(response, log, nrow);
-			break;
+	// Fit the model
+	if (!gram || gram_solve(gram, 0, data->dataMatrix, data->response,
+				coef, covMatrix, &chisq)) {
+		work = gsl_multifit_linear_alloc(data->nrow, data->ncol);
+		if (gsl_multifit_linear(data->dataMatrix, data->response, coef,
+					covMatrix, &chisq, work)) {
+			return 1;
+		}
+		gsl_multifit_linear_free(work);
+	}
 
-		case TRANSFORM_LOG_OFFSET:
-			transform(response, log_offset, nrow);
-			break;
+	// Print diagnostics
+	diagnostics(config->diagnostic, chisq, data->response, coef, covMatrix,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
 
-		case TRANSFORM_NONE:
-			break;
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	modelConfigType * config;
+	void * options;
+	lmOptions * opts;
+	modelDataType data;
+	groupIndex groups;
+	groupIndex * factors;
+	compressedRows rows;
+	char ** args;
+
+	args = serve_arguments(argc, argv);
+	config = config_alloc();
+	if (lm_options(argc, argv, config, &options)) {
+		return 1;
+	}
+	opts = options;
+	if (config->connect) {
+		return serve_request(config, argc, args);
+	}
+	if (config->serve) {
+		return run_serve(config, lm_options, lm_fit, lm_options_free,
+				true);
 	}
 
-	// Fit the model
-	if (gsl_multifit_linear(dataMatrix, response, coef, covMatrix, &chisq,
-				work)) {
+	// Set random seed
+	srand(time(NULL));
+
+	if (opts->by && opts->nabsorb) {
+		fprintf(stderr, "--by and --absorb cannot be combined.\n");
 		return 1;
 	}
-	gsl_matrix_free(dataMatrix);
-	gsl_multifit_linear_free(work);
+	if (opts->refine && !opts->sketch) {
+		fprintf(stderr, "--refine needs --sketch.\n");
+		return 1;
+	}
+	if (opts->epochs) {
+		if (opts->by || opts->nabsorb || opts->ninteract ||
+				opts->npoly || opts->nspline || opts->sketch ||
+				opts->single || config->jobs) {
+			fprintf(stderr, "--sgd fits the plain model.\n");
+			return 1;
+		}
+		if (fit_sgd(config, opts->epochs, opts->batch, 0, 0)) {
+			return 1;
+		}
+		free(config);
+		return 0;
+	}
+	if (opts->single) {
+		if (opts->by || opts->nabsorb || opts->ninteract ||
+				opts->npoly || opts->nspline || opts->sketch ||
+				config->jobs || config->nresp > 1) {
+			fprintf(stderr, "--single fits the plain model of a "
+					"single response.\n");
+			return 1;
+		}
+		if (load_model_data(config, &data) ||
+				fit_lm_single(config, &data)) {
+			return 1;
+		}
+		model_data_free(&data);
+		free(config);
+		return 0;
+	}
+	if (opts->sketch) {
+		if (opts->by || opts->nabsorb || opts->ninteract ||
+				opts->npoly || opts->nspline ||
+				config->jobs || config->nresp > 1) {
+			fprintf(stderr, "--sketch fits the plain model of a "
+					"single response.\n");
+			return 1;
+		}
+		if (load_model_data(config, &data) ||
+				fit_lm_sketch(config, &data, opts)) {
+			return 1;
+		}
+		model_data_free(&data);
+		free(config);
+		return 0;
+	}
+	if (opts->ninteract || opts->npoly || opts->nspline) {
+		if (opts->by || opts->nabsorb || config->jobs ||
+				config->nresp > 1 ||
+				(opts->nspline && (opts->ninteract ||
+						   opts->npoly))) {
+			fprintf(stderr, "--interact, --poly and --spline are "
+					"not available with --by, --absorb, "
+					"--jobs, multiple responses or each "
+					"other.\n");
+			return 1;
+		}
+		if (load_model_data(config, &data)) {
+			return 1;
+		}
+		if (opts->nspline ? fit_lm_splines(config, &data, opts) :
+				fit_lm_features(config, &data, opts)) {
+			return 1;
+		}
+		model_data_free(&data);
+		free(config);
+		return 0;
+	}
+	if (opts->nabsorb) {
+		if (config->jobs || config->testRatio > 0 ||
+				config->nresp > 1) {
+			fprintf(stderr, "--absorb is not available with "
+					"--jobs, test splits or multiple "
+					"responses.\n");
+			return 1;
+		}
+		factors = malloc(opts->nabsorb * sizeof(groupIndex));
+		if (load_group_data(config, opts->absorb, opts->nabsorb, &data,
+					factors) ||
+				fit_lm_absorbed(config, &data, factors,
+					opts->nabsorb)) {
+			return 1;
+		}
+		for (int f = 0; f < opts->nabsorb; f++) {
+			group_free(&factors[f]);
+		}
+		free(factors);
+		model_data_free(&data);
+		free(config);
+		return 0;
+	}
+	if (opts->by) {
+		if (config->jobs || config->testRatio > 0 ||
+				config->diagnostic != ALL || config->nresp > 1) {
+			fprintf(stderr, "--by is not available with "
+					"--jobs, diagnostics, test splits or "
+					"multiple responses.\n");
+			return 1;
+		}
+		if (load_group_data(config, &opts->by, 1, &data, &groups) ||
+				fit_lm_groups(config, &data, &groups,
+					opts->by)) {
+			return 1;
+		}
+		group_free(&groups);
+		model_data_free(&data);
+		free(config);
+		return 0;
+	}
 
-	// Print diagnostics
-	diagnostics(config->diagnostic, chisq, response, coef, covMatrix,
-			colNames, testRows, testData, config->name);
+	if (config->jobs) {
+		return run_batch(config, lm_options, lm_fit, lm_options_free,
+				true);
+	}
+
+	// Parse incoming csv file, collapsing duplicate rows when worthwhile
+	if (load_compressed_data(config, &data, &rows)) {
+		exit(EXIT_FAILURE);
+	}
+	if (rows.nrow > 0) {
+		if (fit_lm_compressed(config, &data, &rows)) return 1;
+		compressed_free(&rows);
+	} else if (lm_fit(config, options, &data, NULL)) {
+		return 1;
+	}
 
 	// Free memory
-	gsl_matrix_free(covMatrix);
-	column_free(testData);
-	free(colNames);
+	model_data_free(&data);
 	free(config);
-	gsl_vector_free(coef);
+	free(opts);
 
 	return 0;
 }
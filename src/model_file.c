@@ -0,0 +1,595 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "core.h"
+#include "model_utils.h"
+#include "model_file.h"
+
+// FNV-1a hash of a key of `len` bytes
+uint64_t model_hash(const char * key, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// Index of the coefficient called `name`, or -1
+int32_t model_coefficient(const modelInfo * info, const char * name)
+{
+	for (int i = 0; i < info->ncoef; i++) {
+		if (!strcmp(info->names[i], name)) return i;
+	}
+
+	return -1;
+}
+
+// Copy `text` to the string pool, returning its offset there
+uint32_t model_pool_add(char * pool, uint32_t * used, const char * text)
+{
+	uint32_t offset = *used;
+	size_t len = strlen(text) + 1;
+
+	memcpy(pool + offset, text, len);
+	*used += len;
+
+	return offset;
+}
+
+/*
+ * Lay a model out as a file in a new buffer of *size bytes. Encoded columns
+ * that no coefficient depends on (left out with --columns) are dropped.
+ * Under dummy encoding, category c of column x takes the coefficient of the
+ * indicator x_c, and the last category has none.
+ */
+char * model_file_build(const modelInfo * info, size_t * size)
+{
+	int nkept = 0;
+	size_t at;
+	size_t poolSize;
+	uint32_t used = 0;
+	char * data;
+	char * pool;
+	modelHeader * header;
+	modelEncoding * entries;
+	encodeData ** kept = NULL;
+	int32_t * targets = NULL;
+	int32_t ** indicators = NULL;
+	bool dummy = info->encoding == ENCODE_DUMMY;
+
+	// Coefficients each encoded column feeds
+	for (encodeData * e = info->encodings; e; e = e->nextEncoding) {
+		int32_t * found = malloc(GSL_MAX(e->ncat, 1) *
+				sizeof(int32_t));
+		int32_t target = dummy ? -1 :
+			model_coefficient(info, e->columnName);
+		bool any = target >= 0;
+
+		for (int c = 0; c < e->ncat; c++) {
+			char * name = malloc(strlen(e->columnName) +
+					strlen(e->textValues[c]) + 2);
+
+			sprintf(name, "%s_%s", e->columnName, e->textValues[c]);
+			found[c] = dummy ? model_coefficient(info, name) : -1;
+			any = any || found[c] >= 0;
+			free(name);
+		}
+		if (!any) {
+			free(found);
+			continue;
+		}
+		kept = realloc(kept, (nkept + 1) * sizeof(encodeData *));
+		targets = realloc(targets, (nkept + 1) * sizeof(int32_t));
+		indicators = realloc(indicators, (nkept + 1) *
+				sizeof(int32_t *));
+		kept[nkept] = e;
+		targets[nkept] = target;
+		indicators[nkept++] = found;
+	}
+
+	// Offsets of the sections
+	at = MODEL_ALIGN(sizeof(modelHeader));
+	at += MODEL_ALIGN(info->ncoef * sizeof(double));
+	if (info->covariance) {
+		at += MODEL_ALIGN((size_t) info->ncoef * info->ncoef *
+				sizeof(double));
+	}
+	at += MODEL_ALIGN(info->ncoef * sizeof(uint32_t));
+	at += MODEL_ALIGN(nkept * sizeof(modelEncoding));
+	poolSize = info->response ? strlen(info->response) + 1 : 1;
+	for (int i = 0; i < info->ncoef; i++) {
+		poolSize += strlen(info->names[i]) + 1;
+	}
+	for (int k = 0; k < nkept; k++) {
+		size_t slots;
+
+		for (slots = 1; slots < 2 * (size_t) kept[k]->ncat;
+				slots <<= 1);
+		at += MODEL_ALIGN(kept[k]->ncat * sizeof(uint32_t));
+		at += MODEL_ALIGN(kept[k]->ncat * sizeof(double));
+		at += MODEL_ALIGN(kept[k]->ncat * sizeof(int32_t));
+		at += MODEL_ALIGN(slots * sizeof(uint32_t));
+		poolSize += strlen(kept[k]->columnName) + 1;
+		for (int c = 0; c < kept[k]->ncat; c++) {
+			poolSize += strlen(kept[k]->textValues[c]) + 1;
+		}
+	}
+	*size = MODEL_ALIGN(at + poolSize);
+	data = calloc(*size, 1);
+
+	header = (modelHeader *) data;
+	memcpy(header->magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+	header->version = MODEL_VERSION;
+	header->byteOrder = MODEL_BYTE_ORDER;
+	header->transformation = info->transformation;
+	header->encoding = info->encoding;
+	header->kind = info->kind;
+	header->ncoef = info->ncoef;
+	header->nencoded = nkept;
+	header->nrow = info->nrow;
+	header->rss = info->rss;
+	header->size = *size;
+	header->strings = at;
+	pool = data + at;
+	header->response = model_pool_add(pool, &used,
+			info->response ? info->response : "");
+
+	at = MODEL_ALIGN(sizeof(modelHeader));
+	header->coef = at;
+	memcpy(data + at, info->coef, info->ncoef * sizeof(double));
+	at += MODEL_ALIGN(info->ncoef * sizeof(double));
+	if (info->covariance) {
+		header->covariance = at;
+		memcpy(data + at, info->covariance, (size_t) info->ncoef *
+				info->ncoef * sizeof(double));
+		at += MODEL_ALIGN((size_t) info->ncoef * info->ncoef *
+				sizeof(double));
+	}
+	header->names = at;
+	for (int i = 0; i < info->ncoef; i++) {
+		((uint32_t *) (data + at))[i] = model_pool_add(pool, &used,
+				info->names[i]);
+	}
+	at += MODEL_ALIGN(info->ncoef * sizeof(uint32_t));
+	header->encodings = at;
+	entries = (modelEncoding *) (data + at);
+	at += MODEL_ALIGN(nkept * sizeof(modelEncoding));
+
+	for (int k = 0; k < nkept; k++) {
+		modelEncoding * entry = entries + k;
+		encodeData * e = kept[k];
+		uint32_t * categories;
+		uint32_t * table;
+
+		entry->name = model_pool_add(pool, &used, e->columnName);
+		entry->ncat = e->ncat;
+		entry->coef = targets[k];
+		for (entry->mask = 1; entry->mask < 2 * (uint32_t) e->ncat;
+				entry->mask <<= 1);
+		entry->mask--;
+
+		entry->categories = at;
+		categories = (uint32_t *) (data + at);
+		at += MODEL_ALIGN(e->ncat * sizeof(uint32_t));
+		entry->values = at;
+		if (e->numValues) {
+			memcpy(data + at, e->numValues,
+					e->ncat * sizeof(double));
+		}
+		at += MODEL_ALIGN(e->ncat * sizeof(double));
+		entry->indicators = at;
+		memcpy(data + at, indicators[k], e->ncat * sizeof(int32_t));
+		at += MODEL_ALIGN(e->ncat * sizeof(int32_t));
+		entry->table = at;
+		table = (uint32_t *) (data + at);
+		at += MODEL_ALIGN((entry->mask + 1) * sizeof(uint32_t));
+
+		for (int c = 0; c < e->ncat; c++) {
+			size_t len = strlen(e->textValues[c]);
+			uint32_t slot = model_hash(e->textValues[c], len) &
+				entry->mask;
+
+			categories[c] = model_pool_add(pool, &used,
+					e->textValues[c]);
+			while (table[slot]) slot = (slot + 1) & entry->mask;
+			table[slot] = c + 1;
+		}
+		free(indicators[k]);
+	}
+	free(kept);
+	free(targets);
+	free(indicators);
+
+	return data;
+}
+
+// Whether `count` items of `width` bytes at `offset` lie within the model
+bool model_file_within(const modelFile * model, uint64_t offset,
+		uint64_t count, size_t width)
+{
+	return offset % 8 == 0 && offset <= model->size &&
+		count <= (model->size - offset) / width;
+}
+
+/*
+ * Point `model` at the sections of the model file in `data`, checking that
+ * they lie within its `size` bytes. `data` is then owned by the model.
+ */
+int model_file_view(modelFile * model, char * data, size_t size,
+		bool mapped)
+{
+	const modelHeader * header = (const modelHeader *) data;
+	uint64_t used;
+	bool valid;
+
+	model->data = data;
+	model->size = size;
+	model->mapped = mapped;
+	model->header = header;
+
+	valid = size >= sizeof(modelHeader) && size % 8 == 0 &&
+		!memcmp(header->magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) &&
+		header->version == MODEL_VERSION &&
+		header->byteOrder == MODEL_BYTE_ORDER &&
+		header->size == size && !data[size - 1] &&
+		header->transformation <= TRANSFORM_LOG_OFFSET &&
+		header->encoding <= ENCODE_MEDIAN_TARGET &&
+		header->kind <= MODEL_SPLINE &&
+		model_file_within(model, header->coef, header->ncoef,
+				sizeof(double)) &&
+		(!header->covariance || model_file_within(model,
+			header->covariance, (uint64_t) header->ncoef *
+			header->ncoef, sizeof(double))) &&
+		model_file_within(model, header->names, header->ncoef,
+				sizeof(uint32_t)) &&
+		model_file_within(model, header->encodings,
+				header->nencoded, sizeof(modelEncoding)) &&
+		header->strings < size && header->response < size -
+		header->strings;
+	if (!valid) {
+		fprintf(stderr, "Unsupported or damaged model file.\n");
+		return 1;
+	}
+
+	model->coef = (const double *) (data + header->coef);
+	model->covariance = header->covariance ?
+		(const double *) (data + header->covariance) : NULL;
+	model->names = (const uint32_t *) (data + header->names);
+	model->encodings = (const modelEncoding *) (data + header->encodings);
+	model->strings = data + header->strings;
+
+	for (uint32_t i = 0; valid && i < header->ncoef; i++) {
+		valid = model->names[i] < size - header->strings;
+	}
+	for (uint32_t k = 0; valid && k < header->nencoded; k++) {
+		const modelEncoding * e = model->encodings + k;
+		const uint32_t * categories =
+			(const uint32_t *) (data + e->categories);
+		const int32_t * indicators =
+			(const int32_t *) (data + e->indicators);
+
+		valid = e->name < size - header->strings &&
+			e->coef < (int64_t) header->ncoef &&
+			((uint64_t) e->mask + 1) / 2 >= e->ncat &&
+			!(e->mask & (e->mask + 1)) &&
+			model_file_within(model, e->categories, e->ncat,
+					sizeof(uint32_t)) &&
+			model_file_within(model, e->values, e->ncat,
+					sizeof(double)) &&
+			model_file_within(model, e->indicators, e->ncat,
+					sizeof(int32_t)) &&
+			model_file_within(model, e->table,
+					(uint64_t) e->mask + 1,
+					sizeof(uint32_t));
+		for (uint32_t c = 0; valid && c < e->ncat; c++) {
+			valid = categories[c] < size - header->strings &&
+				indicators[c] < (int64_t) header->ncoef;
+		}
+		// No more slots taken than categories, so that the table
+		// keeps the empty slot every lookup stops at
+		used = 0;
+		for (uint32_t s = 0; valid && s <= e->mask; s++) {
+			uint32_t id = ((const uint32_t *) (data + e->table))[s];
+
+			valid = id <= e->ncat;
+			if (id) used++;
+		}
+		valid = valid && used <= e->ncat;
+	}
+	if (!valid) {
+		fprintf(stderr, "Unsupported or damaged model file.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Load a model saved as <name>.model by mapping it, so that only the pages
+ * used are read, or from the text of a <name>.coef file.
+ */
+int model_file_open(const char * path, modelFile * model)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	char magic[sizeof(MODEL_MAGIC)] = "";
+	FILE * file;
+	modelInfo info;
+	char * data;
+	size_t size;
+	int status;
+
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Could not open '%s'.\n", path);
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+
+	if (read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+			!memcmp(magic, MODEL_MAGIC, sizeof(MODEL_MAGIC))) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "Could not map '%s'.\n", path);
+			return 1;
+		}
+		status = model_file_view(model, data, st.st_size, true);
+		if (status) munmap(data, st.st_size);
+		return status;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	file = fdopen(fd, "r");
+	status = model_file_read_text(file, &info);
+	fclose(file);
+	if (status) return 1;
+	data = model_file_build(&info, &size);
+	model_info_free(&info);
+
+	return model_file_view(model, data, size, false);
+}
+
+/*
+ * Read the text export of a model: "name<TAB>coefficient" lines, then lines
+ * starting with '#' for the rest (see model_file_export()). Files saved
+ * before the binary format, without some of these lines, are read too.
+ */
+int model_file_read_text(FILE * file, modelInfo * info)
+{
+	char * line = NULL;
+	size_t len = 0;
+	int status = 0;
+	int covRows = 0;
+	encodeData * e = NULL;
+	encodeData ** tail = &info->encodings;
+	const char * transforms[] = TRANSFORM_NAMES;
+	const char * encodings[] = ENCODE_NAMES;
+	const char * kinds[] = MODEL_KIND_NAMES;
+
+	memset(info, 0, sizeof(modelInfo));
+	while (!status && getline(&line, &len, file) != -1) {
+		char * rest = line;
+		char * key;
+		char * end;
+
+		rest[strcspn(rest, "\r\n")] = '\0';
+		key = strsep(&rest, "\t");
+		if (!*key && !rest) continue;
+		if (*key != '#') {
+			if (!rest || covRows) {
+				status = 1;
+				continue;
+			}
+			info->names = realloc(info->names, (info->ncoef + 1) *
+					sizeof(char *));
+			info->coef = realloc(info->coef, (info->ncoef + 1) *
+					sizeof(double));
+			info->names[info->ncoef] = strdup(key);
+			info->coef[info->ncoef++] = strtod(rest, &end);
+			status = end == rest;
+		} else if (!rest) {
+			continue;
+		} else if (!strcmp(key, "#transform")) {
+			int t;
+
+			for (t = TRANSFORM_LOG_OFFSET; t > TRANSFORM_NONE &&
+					strcmp(transforms[t], rest); t--);
+			info->transformation = t;
+		} else if (!strcmp(key, "#encoding")) {
+			int t;
+
+			for (t = ENCODE_MEDIAN_TARGET; t > ENCODE_NONE &&
+					strcmp(encodings[t], rest); t--);
+			info->encoding = t;
+		} else if (!strcmp(key, "#kind")) {
+			int t;
+
+			for (t = MODEL_SPLINE; t > MODEL_LINEAR &&
+					strcmp(kinds[t], rest); t--);
+			info->kind = t;
+		} else if (!strcmp(key, "#response")) {
+			free(info->response);
+			info->response = strdup(rest);
+		} else if (!strcmp(key, "#rows")) {
+			info->nrow = strtoul(rest, NULL, 10);
+		} else if (!strcmp(key, "#rss")) {
+			info->rss = strtod(rest, NULL);
+		} else if (!strcmp(key, "#category")) {
+			char * column = strsep(&rest, "\t");
+			char * category = strsep(&rest, "\t");
+
+			if (!category) {
+				status = 1;
+				continue;
+			}
+			if (!e || strcmp(e->columnName, column)) {
+				e = calloc(1, sizeof(encodeData));
+				e->columnName = strdup(column);
+				*tail = e;
+				tail = &e->nextEncoding;
+			}
+			e->textValues = realloc(e->textValues, (e->ncat + 1) *
+					sizeof(char *));
+			e->numValues = realloc(e->numValues, (e->ncat + 1) *
+					sizeof(double));
+			e->textValues[e->ncat] = strdup(category);
+			e->numValues[e->ncat++] = rest ? strtod(rest, NULL) : 0;
+		} else if (!strcmp(key, "#covariance")) {
+			// A row per coefficient, after its name
+			strsep(&rest, "\t");
+			if (covRows == info->ncoef || !rest) {
+				status = 1;
+				continue;
+			}
+			if (!info->covariance) {
+				info->covariance = malloc((size_t) info->ncoef *
+						info->ncoef * sizeof(double));
+			}
+			for (int j = 0; !status && j < info->ncoef; j++) {
+				info->covariance[covRows * info->ncoef + j] =
+					strtod(rest, &end);
+				status = end == rest;
+				rest = end;
+			}
+			covRows++;
+		}
+	}
+	if (status) {
+		fprintf(stderr, "Malformed model line: %s\n", line);
+	} else if (info->ncoef == 0) {
+		fprintf(stderr, "No coefficients in the model.\n");
+		status = 1;
+	} else if (covRows && covRows != info->ncoef) {
+		fprintf(stderr, "Incomplete covariance in the model.\n");
+		status = 1;
+	}
+	free(line);
+	if (status) model_info_free(info);
+
+	return status;
+}
+
+// Free a model read by model_file_read_text()
+void model_info_free(modelInfo * info)
+{
+	encodeData * e = info->encodings;
+
+	while (e) {
+		encodeData * next = e->nextEncoding;
+
+		for (int c = 0; c < e->ncat; c++) {
+			free(e->textValues[c]);
+		}
+		free(e->columnName);
+		free(e->textValues);
+		free(e->numValues);
+		free(e);
+		e = next;
+	}
+	for (int i = 0; i < info->ncoef; i++) {
+		free(info->names[i]);
+	}
+	free(info->names);
+	free(info->coef);
+	free(info->covariance);
+	free(info->response);
+}
+
+void model_file_close(modelFile * model)
+{
+	if (model->mapped) {
+		munmap(model->data, model->size);
+	} else {
+		free(model->data);
+	}
+}
+
+// Name of coefficient i
+const char * model_file_name(const modelFile * model, uint32_t i)
+{
+	return model->strings + model->names[i];
+}
+
+// Category of an encoded column equal to the `len` bytes of key, or -1
+int model_file_lookup(const modelFile * model, const modelEncoding * e,
+		const char * key, size_t len)
+{
+	const uint32_t * table = (const uint32_t *) (model->data + e->table);
+	const uint32_t * categories =
+		(const uint32_t *) (model->data + e->categories);
+	uint32_t slot = model_hash(key, len) & e->mask;
+
+	while (table[slot]) {
+		const char * category = model->strings +
+			categories[table[slot] - 1];
+
+		if (!strncmp(category, key, len) && !category[len]) {
+			return table[slot] - 1;
+		}
+		slot = (slot + 1) & e->mask;
+	}
+
+	return -1;
+}
+
+/*
+ * Write a model as text, one "name<TAB>coefficient" line per coefficient
+ * at full precision, followed by '#' lines for the transformation, the
+ * encoding, the training metadata, the categories of the encoded columns
+ * (with their target encodings) and the rows of the covariance matrix.
+ */
+void model_file_export(const modelFile * model, FILE * output)
+{
+	const modelHeader * header = model->header;
+	const char * transforms[] = TRANSFORM_NAMES;
+	const char * encodings[] = ENCODE_NAMES;
+	const char * kinds[] = MODEL_KIND_NAMES;
+
+	for (uint32_t i = 0; i < header->ncoef; i++) {
+		fprintf(output, "%s\t%.17g\n", model_file_name(model, i),
+				model->coef[i]);
+	}
+	fprintf(output, "#transform\t%s\n",
+			transforms[header->transformation]);
+	fprintf(output, "#encoding\t%s\n", encodings[header->encoding]);
+	if (header->kind != MODEL_LINEAR) {
+		fprintf(output, "#kind\t%s\n", kinds[header->kind]);
+	}
+	if (model->strings[header->response]) {
+		fprintf(output, "#response\t%s\n",
+				model->strings + header->response);
+	}
+	fprintf(output, "#rows\t%lu\n", (unsigned long) header->nrow);
+	fprintf(output, "#rss\t%.17g\n", header->rss);
+	for (uint32_t k = 0; k < header->nencoded; k++) {
+		const modelEncoding * e = model->encodings + k;
+		const uint32_t * categories =
+			(const uint32_t *) (model->data + e->categories);
+		const double * values =
+			(const double *) (model->data + e->values);
+
+		for (uint32_t c = 0; c < e->ncat; c++) {
+			fprintf(output, "#category\t%s\t%s",
+					model->strings + e->name,
+					model->strings + categories[c]);
+			if (header->encoding != ENCODE_DUMMY) {
+				fprintf(output, "\t%.17g", values[c]);
+			}
+			fprintf(output, "\n");
+		}
+	}
+	for (uint32_t i = 0; model->covariance && i < header->ncoef; i++) {
+		fprintf(output, "#covariance\t%s", model_file_name(model, i));
+		for (uint32_t j = 0; j < header->ncoef; j++) {
+			fprintf(output, "\t%.17g",
+					model->covariance[i * header->ncoef +
+					j]);
+		}
+		fprintf(output, "\n");
+	}
+}
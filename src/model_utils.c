@@ -1,9 +1,58 @@
 #include <gsl/gsl_statistics_double.h>
+#include <gsl/gsl_blas.h>
 #include "core.h"
+#include "gram.h"
+#include "blas.h"
 #include "model_utils.h"
+#include "model_file.h"
+
+modelConfigType * config_alloc(void)
+{
+	modelConfigType * config;
+
+	config = calloc(1, sizeof(modelConfigType));
+	config->input = stdin;
+
+	return config;
+}
+
+// Free a config and the options parsed into it, but not its input
+void config_free(modelConfigType * config)
+{
+	for (int j = 0; j < config->nresp; j++) {
+		free(config->responses[j]);
+	}
+	for (int j = 0; j < config->ncols; j++) {
+		free(config->columns[j]);
+	}
+	free(config->name);
+	free(config->responses);
+	free(config->columns);
+	free(config->jobs);
+	free(config->serve);
+	free(config->connect);
+	free(config);
+}
+
+// Append the names in a comma-separated list to the n in `names`
+int split_names(char * list, char *** names, int n)
+{
+	char * token;
+
+	token = strtok(list, ",");
+	while (token) {
+		*names = realloc(*names, (n + 1) * sizeof(char *));
+		(*names)[n++] = strdup(token);
+		token = strtok(NULL, ",");
+	}
+
+	return n;
+}
 
 int parse_args(int opt, modelConfigType * config, char * helpMessage)
 {
+	int threads;
+
 	switch(opt) {
 		case 'h':
 			printf("%s", helpMessage);
@@ -71,6 +120,7 @@ int parse_args(int opt, modelConfigType * config, char * helpMessage)
 			break;
 
 		case 'n':
+			free(config->name);
 			config->name = strdup(optarg);
 			return 0;
 			break;
@@ -161,6 +211,45 @@ int parse_args(int opt, modelConfigType * config, char * helpMessage)
 			return 0;
 			break;
 
+		case 'y':
+			config->nresp = split_names(optarg,
+					&config->responses, config->nresp);
+			return 0;
+			break;
+
+		case 'C':
+			config->ncols = split_names(optarg, &config->columns,
+					config->ncols);
+			return 0;
+			break;
+
+		case 'J':
+			config->jobs = strdup(optarg);
+			return 0;
+			break;
+
+		case 'U':
+			config->serve = strdup(optarg);
+			return 0;
+			break;
+
+		case 'O':
+			config->connect = strdup(optarg);
+			return 0;
+			break;
+
+		case 'N':
+			if (sscanf(optarg, "%d", &threads) != 1 ||
+					threads < 1) {
+				fprintf(stderr, "Threads must be "
+						"positive.\n");
+				return 1;
+			}
+			blas_set_threads(threads);
+			config->threads = threads;
+			return 0;
+			break;
+
 		case '?':
 			// Unknown parameter, we just pass through for custom
 			// arguments
@@ -175,6 +264,338 @@ int parse_args(int opt, modelConfigType * config, char * helpMessage)
 	};
 }
 
+/*
+ * Reorder the column list at `head` so the columns named in `names` become
+ * responses: the first takes the place of the response at the head, ahead
+ * of the intercept, and the others are moved to the end of the list. The
+ * remaining columns, including a former head that was not named, keep their
+ * order as predictors. Returns the number of predictors (with the
+ * intercept), or -1 if a name is not found.
+ */
+int split_responses(dataColumn ** head, char ** names, int nresp)
+{
+	int ncols = 0;
+	int npred = 0;
+	dataColumn * col;
+	dataColumn ** cols;
+	dataColumn ** resp;
+	dataColumn ** pred;
+
+	for (col = *head; col; col = col->nextColumn) ncols++;
+	cols = malloc(ncols * sizeof(dataColumn *));
+	resp = calloc(nresp, sizeof(dataColumn *));
+	pred = malloc(ncols * sizeof(dataColumn *));
+	col = *head;
+	for (int i = 0; i < ncols; i++) {
+		cols[i] = col;
+		col = col->nextColumn;
+	}
+
+	// Intercept (always second) first, then unnamed columns in order
+	pred[npred++] = cols[1];
+	for (int i = 0; i < ncols; i++) {
+		bool named = false;
+		for (int j = 0; j < nresp; j++) {
+			if (i != 1 && !resp[j] &&
+					!strcmp(cols[i]->name, names[j])) {
+				resp[j] = cols[i];
+				named = true;
+				break;
+			}
+		}
+		if (!named && i != 1) pred[npred++] = cols[i];
+	}
+	for (int j = 0; j < nresp; j++) {
+		if (!resp[j]) {
+			fprintf(stderr, "Response column '%s' not found.\n",
+					names[j]);
+			free(pred);
+			free(resp);
+			free(cols);
+			return -1;
+		}
+	}
+
+	// Relink: response, predictors, then the other responses
+	*head = resp[0];
+	col = resp[0];
+	for (int i = 0; i < npred; i++) {
+		col->nextColumn = pred[i];
+		col = col->nextColumn;
+	}
+	for (int j = 1; j < nresp; j++) {
+		col->nextColumn = resp[j];
+		col = col->nextColumn;
+	}
+	col->nextColumn = NULL;
+
+	free(pred);
+	free(resp);
+	free(cols);
+
+	return npred;
+}
+
+/*
+ * Gather the responses of a column list arranged by split_responses() as
+ * the columns of a new matrix, or return NULL for a single response.
+ */
+gsl_matrix * response_matrix(dataColumn * head, int ncol, int nresp,
+		int nrow)
+{
+	gsl_matrix * Y;
+	dataColumn * col = head;
+
+	if (nresp < 2) return NULL;
+	Y = gsl_matrix_alloc(nrow, nresp);
+	for (int j = 0; j < nresp; j++) {
+		gsl_matrix_set_col(Y, j, col->vector);
+
+		// The second response follows the predictors
+		col = col->nextColumn;
+		for (int i = 0; j == 0 && i < ncol; i++) {
+			col = col->nextColumn;
+		}
+	}
+
+	return Y;
+}
+
+// Apply a response transformation to every response of both splits
+void transform_responses(modelDataType * data, transformType type)
+{
+	double (* func)(double) = NULL;
+	gsl_matrix * Ys[] = {data->responses, data->testResponses};
+
+	switch(type) {
+		case TRANSFORM_LOG:
+			func = log;
+			break;
+
+		case TRANSFORM_LOG_OFFSET:
+			func = log_offset;
+			break;
+
+		case TRANSFORM_NONE:
+			return;
+	}
+
+	transform(data->response, func, data->nrow);
+	if (data->testResponse) {
+		transform(data->testResponse, func, data->testRows);
+	}
+	for (int k = 0; k < 2; k++) {
+		for (size_t j = 0; Ys[k] && j < Ys[k]->size2; j++) {
+			gsl_vector_view col = gsl_matrix_column(Ys[k], j);
+			transform(&col.vector, func, Ys[k]->size1);
+		}
+	}
+}
+
+/*
+ * Keep only the intercept and the predictors named in `names`, in that
+ * order. When given, `cols` (n + 1 entries) receives the positions of the
+ * kept columns in the original design.
+ */
+int model_data_subset(modelDataType * data, char ** names, int n,
+		size_t * cols)
+{
+	size_t * keep;
+	char ** colNames;
+	gsl_matrix * X;
+	gsl_matrix * T = NULL;
+
+	keep = malloc((n + 1) * sizeof(size_t));
+	keep[0] = 0;
+	for (int i = 0; i < n; i++) {
+		int j = 1;
+		while (j < data->ncol && strcmp(data->colNames[j], names[i])) {
+			j++;
+		}
+		if (j == data->ncol) {
+			fprintf(stderr, "Column '%s' not found.\n", names[i]);
+			free(keep);
+			return 1;
+		}
+		keep[i + 1] = j;
+	}
+
+	colNames = malloc((n + 1) * sizeof(char *));
+	X = gsl_matrix_alloc(data->nrow, n + 1);
+	if (data->testMatrix) T = gsl_matrix_alloc(data->testRows, n + 1);
+	for (int i = 0; i <= n; i++) {
+		gsl_vector_view col = gsl_matrix_column(data->dataMatrix,
+				keep[i]);
+		gsl_matrix_set_col(X, i, &col.vector);
+		if (T) {
+			col = gsl_matrix_column(data->testMatrix, keep[i]);
+			gsl_matrix_set_col(T, i, &col.vector);
+		}
+		colNames[i] = strdup(data->colNames[keep[i]]);
+	}
+
+	for (int i = 0; i < data->ncol; i++) {
+		free(data->colNames[i]);
+	}
+	free(data->colNames);
+	gsl_matrix_free(data->dataMatrix);
+	if (data->testMatrix) gsl_matrix_free(data->testMatrix);
+	data->colNames = colNames;
+	data->dataMatrix = X;
+	data->testMatrix = T;
+	data->ncol = n + 1;
+	if (cols) memcpy(cols, keep, (n + 1) * sizeof(size_t));
+	free(keep);
+
+	return 0;
+}
+
+/*
+ * Read the csv input named by `config`, hold out a test split and parse it
+ * with parse_model_data().
+ */
+int load_model_data(modelConfigType * config, modelDataType * data)
+{
+	int nrow;
+	int testRows;
+	char ** lines = NULL;
+	char ** testLines = NULL;
+
+	nrow = read_rows(&lines, config->input);
+	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
+	fclose(config->input);
+
+	return parse_model_data(config, lines, nrow - testRows, testLines,
+			testRows, data);
+}
+
+/*
+ * Encode categorical columns of the training and test lines (consumed) and
+ * arrange training (and test) matrices with the intercept as the first
+ * column. Columns named with --responses are taken out of the predictors;
+ * when there are several they are also gathered as matrices. The predictors
+ * are then cut down to those named with --columns and the response
+ * transformation is applied to both splits.
+ */
+int parse_model_data(modelConfigType * config, char ** lines, int nrow,
+		char ** testLines, int testRows, modelDataType * data)
+{
+	dataColumn * colPtr;
+	encode_func * encoder = no_encode;
+
+	switch(config->encoding) {
+		case ENCODE_DUMMY:
+			encoder = dummy_encode;
+			break;
+
+		case ENCODE_MEAN_TARGET:
+			encoder = mean_target_encode;
+			break;
+
+		case ENCODE_MEDIAN_TARGET:
+			encoder = median_target_encode;
+			break;
+
+		case ENCODE_NONE:
+			break;
+	}
+
+	// Parse incoming csv lines
+	data->nrow = nrow;
+	data->testRows = testRows;
+	data->columnHead = column_alloc(data->nrow, "");
+	data->testData = column_alloc(data->testRows, "");
+	data->encodingInfo = NULL;
+	data->ncol = read_columns(data->columnHead, lines, encoder, data->nrow,
+			&data->encodingInfo);
+	if (data->ncol < 0) {
+		fprintf(stderr, "Rows have differing numbers of columns.\n");
+		return 1;
+	}
+	// The test split gets its own encoding so that the training
+	// dictionaries are kept for saving with the model
+	if (data->testRows > 0) {
+		encodeData * testEncoding = NULL;
+
+		read_columns(data->testData, testLines, encoder,
+				data->testRows, &testEncoding);
+	}
+	config->encodingInfo = data->encodingInfo;
+	if (config->nresp > 0) {
+		data->ncol = split_responses(&data->columnHead,
+				config->responses, config->nresp);
+		if (data->ncol < 0) return 1;
+		if (data->testRows > 0) {
+			split_responses(&data->testData, config->responses,
+					config->nresp);
+		}
+	}
+
+	// We cannot make a model with more columns than rows
+	if (data->nrow < data->ncol) {
+		fprintf(stderr, "More columns than rows; check encoding "
+	  			"method or test ratio.\n");
+		return 1;
+	}
+
+	data->dataMatrix = gsl_matrix_alloc(data->nrow, data->ncol);
+	data->response = data->columnHead->vector; // First column is response
+	if (arrange_data(data->columnHead, data->dataMatrix, data->ncol)) {
+		return 1;
+	}
+	data->testMatrix = NULL;
+	data->testResponse = NULL;
+	if (data->testRows > 0) {
+		data->testMatrix = gsl_matrix_alloc(data->testRows, data->ncol);
+		data->testResponse = data->testData->vector;
+		if (arrange_data(data->testData, data->testMatrix,
+					data->ncol)) {
+			return 1;
+		}
+	}
+
+	// Pull out column names, skipping the response
+	colPtr = data->columnHead->nextColumn;
+	data->colNames = malloc(data->ncol * sizeof(char *));
+	for (int i = 0; i < data->ncol; i++) {
+		data->colNames[i] = strdup(colPtr->name);
+		colPtr = colPtr->nextColumn;
+	}
+
+	// Further responses follow the predictors
+	data->nresp = GSL_MAX(config->nresp, 1);
+	data->respNames = config->responses;
+	data->responses = response_matrix(data->columnHead, data->ncol,
+			data->nresp, data->nrow);
+	data->testResponses = NULL;
+	if (data->testRows > 0) {
+		data->testResponses = response_matrix(data->testData,
+				data->ncol, data->nresp, data->testRows);
+	}
+
+	if (config->ncols > 0 && model_data_subset(data, config->columns,
+				config->ncols, NULL)) {
+		return 1;
+	}
+	transform_responses(data, config->transformation);
+
+	return 0;
+}
+
+void model_data_free(modelDataType * data)
+{
+	if (data->responses) gsl_matrix_free(data->responses);
+	if (data->testResponses) gsl_matrix_free(data->testResponses);
+	for (int i = 0; i < data->ncol; i++) {
+		free(data->colNames[i]);
+	}
+	free(data->colNames);
+	if (data->dataMatrix) gsl_matrix_free(data->dataMatrix);
+	if (data->testMatrix) gsl_matrix_free(data->testMatrix);
+	column_free(data->testData);
+	column_free(data->columnHead);
+}
+
 void coefficient_p_values(gsl_vector * pVals, gsl_matrix * varCovar,
 		gsl_vector * coef, int n, int df)
 {
@@ -228,77 +649,77 @@ void print_diagnostics(double rSquared, double adjRSquared, double fStat,
 	printf("\tBIC: %g\n", BIC);
 }
 
-void save_model(char * baseName, gsl_vector * coef, char ** colNames, int p)
+/*
+ * Save the model as <config->name>.model, holding the coefficients at full
+ * precision with their covariance (when given), the response
+ * transformation, the encoding dictionaries and the training metadata. The
+ * same model is exported as text to <config->name>.coef for inspection.
+ */
+void save_model(modelConfigType * config, gsl_vector * coef,
+		gsl_matrix * covMatrix, char ** colNames, int p, int nrow,
+		double rss)
 {
 	FILE * file;
 	char * name;
+	char * data;
+	size_t size;
+	modelInfo info = {0};
+	modelFile model;
 
-	// Write coefficients and column names
-	name = strcat(baseName, ".coef");
-	file = fopen(name, "w");
+	info.transformation = config->transformation;
+	info.encoding = config->encoding;
+	info.kind = config->kind;
+	info.ncoef = p + 1;
+	info.names = colNames;
+	info.coef = malloc(info.ncoef * sizeof(double));
 	for (int i = 0; i <= p; i++) {
-		fprintf(file, "%s\t%g\n", colNames[i], gsl_vector_get(coef, i));
+		info.coef[i] = gsl_vector_get(coef, i);
 	}
-	fclose(file);
+	if (covMatrix && covMatrix->size1 == (size_t) info.ncoef) {
+		info.covariance = malloc((size_t) info.ncoef * info.ncoef *
+				sizeof(double));
+		for (int i = 0; i <= p; i++) {
+			for (int j = 0; j <= p; j++) {
+				info.covariance[i * info.ncoef + j] =
+					gsl_matrix_get(covMatrix, i, j);
+			}
+		}
+	}
+	info.encodings = config->encodingInfo;
+	info.response = config->nresp > 0 ? config->responses[0] : NULL;
+	info.nrow = nrow;
+	info.rss = rss;
+	data = model_file_build(&info, &size);
+	free(info.coef);
+	free(info.covariance);
+
+	name = malloc(strlen(config->name) + sizeof(".model"));
+	sprintf(name, "%s.model", config->name);
+	file = fopen(name, "w");
+	if (!file || fwrite(data, 1, size, file) != size) {
+		fprintf(stderr, "Could not write '%s'.\n", name);
+	}
+	if (file) fclose(file);
+
+	// Text export
+	sprintf(name, "%s.coef", config->name);
+	file = fopen(name, "w");
+	if (file && !model_file_view(&model, data, size, false)) {
+		model_file_export(&model, file);
+		data = NULL;
+		model_file_close(&model);
+	}
+	if (file) fclose(file);
+	free(data);
+	free(name);
 }
 
-double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
-		gsl_vector * coef, gsl_matrix * covMatrix, char ** colNames,
-		int testRows, dataColumn * testData, char * modelName)
+double diagnostic_value(diagnoseType type, double chisq, double tss,
+		int nrow, int ncol, gsl_vector * testResid)
 {
-	int ncol = coef->size - 1;
-	int nrow = response->size;
 	double value = 0;
-	double tss = 0;
-	gsl_vector * pVals = NULL;
-	gsl_vector * testResponse;
-	gsl_vector * testResid;
-	gsl_matrix * testMatrix;
-
-	if (testRows > 0) {
-		// Test-split diagnostics
-		testMatrix = gsl_matrix_alloc(testRows, ncol);
-		if (arrange_data(testData, testMatrix, ncol)) {
-			return -1;
-		}
-		testResid = gsl_vector_alloc(testRows);
-		testResponse = testData->vector; // First column is the response
-		if (gsl_multifit_linear_residuals(testMatrix, testResponse,
-					coef, testResid)) {
-			return -1;
-		}
-	} else {
-		// Non-test-split diagnostics
-		tss = gsl_stats_tss(response->data, response->stride, nrow);
-	}
 
 	switch(type) {
-		case ALL:
-			double aic, bic, rsq, adjRSQ, f;
-			// We just print things out here
-			if (covMatrix) {
-				pVals = gsl_vector_alloc(ncol + 1);
-				coefficient_p_values(pVals, covMatrix, coef,
-						ncol + 1, nrow - ncol - 1);
-			}
-			aic = nrow * log(log(2 * M_PI) + 1 + chisq / nrow) +
-				2 * ncol;
-			bic = nrow * log(log(2 * M_PI) + 1 + chisq / nrow) +
-				2 * log(nrow);
-			rsq = 1 - (chisq/tss);
-			adjRSQ = 1 - ((1 - rsq) * (nrow - 1) /
-					(nrow - ncol - 1));
-			f = ((tss - chisq) * (nrow - ncol) /
-					((ncol - 1) * chisq));
-			value = 0;
-			print_coefficients(coef, pVals, colNames, ncol);
-			printf("\n");
-			print_diagnostics(rsq, adjRSQ, f, aic, bic);
-			if (modelName) save_model(modelName, coef, colNames,
-					ncol);
-			return 0; // Early return to avoid printing
-			break;
-
 		case AIC:
 			value = nrow * log(log(2 * M_PI) + 1 + chisq / nrow) +
 				2 * ncol;
@@ -306,7 +727,7 @@ double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
 
 		case BIC:
 			value = nrow * log(log(2 * M_PI) + 1 + chisq / nrow) +
-				2 * log(nrow);
+				ncol * log(nrow);
 			break;
 
 		case R_SQUARED:
@@ -324,26 +745,349 @@ double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
 			break;
 
 		case RMSE:
-			if (gsl_vector_mul(testResid, testResid)) {
-				return -1;
+			for (size_t i = 0; i < testResid->size; i++) {
+				value += pow(gsl_vector_get(testResid, i), 2);
 			}
-			value = sqrt(gsl_vector_sum(testResid) / testRows);
-			gsl_vector_free(testResid);
-			gsl_matrix_free(testMatrix);
+			value = sqrt(value / testResid->size);
 			break;
 
 		case MAE:
-			if (gsl_vector_mul(testResid, testResid) &&
-					gsl_vector_div(testResid, testResid)) {
-				return -1;
+			for (size_t i = 0; i < testResid->size; i++) {
+				value += fabs(gsl_vector_get(testResid, i));
 			}
-			value = gsl_vector_sum(testResid) / testRows;
-			gsl_vector_free(testResid);
-			gsl_matrix_free(testMatrix);
+			value = value / testResid->size;
 			break;
+
+		case ALL:
+			break;
+	}
+
+	return value;
+}
+
+bool diagnostic_lower_better(diagnoseType type)
+{
+	switch(type) {
+		case R_SQUARED:
+		case ADJ_R_SQUARED:
+		case F_STATISTIC:
+			return false;
+
+		default:
+			return true;
+	}
+}
+
+bool diagnostic_needs_test(diagnoseType type)
+{
+	return type == RMSE || type == MAE;
+}
+
+double gcv_score(double chisq, int nrow, double df)
+{
+	return nrow * chisq / pow(nrow - df, 2);
+}
+
+/*
+ * Score candidate models held as the columns of `path` and return the index
+ * of the best one. Each candidate has a training residual sum of squares
+ * (`rss`), effective degrees of freedom (`df`) and a label such as its
+ * tolerance or lambda. The criterion is GCV when `type` is ALL, otherwise the
+ * requested diagnostic; holdout diagnostics are computed for every candidate
+ * from a single product with the test matrix. The scored path is printed,
+ * one candidate per row.
+ */
+size_t select_path(diagnoseType type, gsl_matrix * path, gsl_vector * rss,
+		gsl_vector * df, gsl_vector * labels, char * labelName,
+		gsl_vector * y, char ** colNames, gsl_matrix * testMatrix,
+		gsl_vector * testResponse)
+{
+	size_t n = y->size;
+	size_t p = path->size1;
+	size_t npath = path->size2;
+	size_t best = 0;
+	double tss;
+	gsl_vector * scores;
+	gsl_matrix * testResid = NULL;
+
+	scores = gsl_vector_alloc(npath);
+	tss = gsl_stats_tss(y->data, y->stride, n);
+
+	// Holdout residuals for every candidate at once: Y_test - X_test B
+	if (testMatrix && diagnostic_needs_test(type)) {
+		testResid = gsl_matrix_alloc(testMatrix->size1, npath);
+		for (size_t k = 0; k < npath; k++) {
+			gsl_matrix_set_col(testResid, k, testResponse);
+		}
+		gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, -1.0, testMatrix,
+				path, 1.0, testResid);
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t k = 0; k < npath; k++) {
+		gsl_vector_view resid;
+		double chisq = gsl_vector_get(rss, k);
+		double dof = gsl_vector_get(df, k);
+		double value;
+
+		if (type == ALL) {
+			value = gcv_score(chisq, n, dof);
+		} else if (testResid) {
+			resid = gsl_matrix_column(testResid, k);
+			value = diagnostic_value(type, chisq, tss, n,
+					round(dof) - 1, &resid.vector);
+		} else {
+			value = diagnostic_value(type, chisq, tss, n,
+					round(dof) - 1, NULL);
+		}
+		gsl_vector_set(scores, k, value);
+	}
+
+	for (size_t k = 1; k < npath; k++) {
+		double value = gsl_vector_get(scores, k);
+		double bestValue = gsl_vector_get(scores, best);
+		if (diagnostic_lower_better(type) ? value < bestValue :
+				value > bestValue) {
+			best = k;
+		}
 	}
 
-	printf("%f\n", value);
-	save_model(modelName, coef, colNames, ncol);
+	// Print the path, one candidate per row
+	printf("Path:\n%s\tdf\t%s", labelName, type == ALL ? "GCV" :
+			"diagnostic");
+	for (size_t j = 0; j < p; j++) {
+		printf("\t%s", colNames[j]);
+	}
+	printf("\n");
+	for (size_t k = 0; k < npath; k++) {
+		printf("%g\t%g\t%g", gsl_vector_get(labels, k),
+				gsl_vector_get(df, k),
+				gsl_vector_get(scores, k));
+		for (size_t j = 0; j < p; j++) {
+			printf("\t%g", gsl_matrix_get(path, j, k));
+		}
+		printf("\n");
+	}
+	printf("\n");
+
+	if (testResid) gsl_matrix_free(testResid);
+	gsl_vector_free(scores);
+
+	return best;
+}
+
+/*
+ * Coefficients for every column of Y (columns of B) from the decomposition
+ * of X held by `work` (see gsl_multifit_linear_svd() and _bsvd()), keeping
+ * `rank` singular values. When `lambdas` is given each response is ridge
+ * filtered by its own lambda, s / (s^2 + lambda^2) in place of 1 / s. The
+ * projections U^T Y, the back-substitution and the residuals are each a
+ * single matrix product. When given, `covFactor` receives the unscaled
+ * covariance D^{-1} V \Sigma^{-2} V^T D^{-1} shared by all responses.
+ */
+int svd_solve_responses(size_t rank, const gsl_vector * lambdas,
+		const gsl_matrix * X, const gsl_matrix * Y, gsl_matrix * B,
+		gsl_vector * rss, gsl_matrix * covFactor,
+		gsl_multifit_linear_workspace * work)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	size_t k = Y->size2;
+	gsl_matrix * C;
+	gsl_matrix * R;
+	gsl_matrix * W;
+	gsl_matrix_const_view U;
+	gsl_matrix_const_view V;
+
+	U = gsl_matrix_const_submatrix(work->A, 0, 0, n, rank);
+	V = gsl_matrix_const_submatrix(work->Q, 0, 0, p, rank);
+
+	// B = D^{-1} V F \Sigma^{-1} U^T Y
+	C = gsl_matrix_alloc(rank, k);
+	gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &U.matrix, Y, 0, C);
+	for (size_t i = 0; i < rank; i++) {
+		double s = gsl_vector_get(work->S, i);
+		for (size_t j = 0; j < k; j++) {
+			double lambda = lambdas ? gsl_vector_get(lambdas, j) : 0;
+			*gsl_matrix_ptr(C, i, j) *= s / (s * s +
+					lambda * lambda);
+		}
+	}
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &V.matrix, C, 0, B);
+	for (size_t i = 0; i < p; i++) {
+		gsl_vector_view row = gsl_matrix_row(B, i);
+		gsl_vector_scale(&row.vector, 1 / gsl_vector_get(work->D, i));
+	}
+	gsl_matrix_free(C);
+
+	// Residual sums of squares from R = Y - X B
+	R = gsl_matrix_alloc(n, k);
+	gsl_matrix_memcpy(R, Y);
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, -1.0, X, B, 1.0, R);
+	for (size_t j = 0; j < k; j++) {
+		gsl_vector_view col = gsl_matrix_column(R, j);
+		gsl_vector_set(rss, j, pow(gsl_blas_dnrm2(&col.vector), 2));
+	}
+	gsl_matrix_free(R);
+
+	// W W^T with W = D^{-1} V \Sigma^{-1}
+	if (covFactor) {
+		W = gsl_matrix_alloc(p, rank);
+		gsl_matrix_memcpy(W, &V.matrix);
+		for (size_t i = 0; i < rank; i++) {
+			gsl_vector_view col = gsl_matrix_column(W, i);
+			gsl_vector_scale(&col.vector,
+					1 / gsl_vector_get(work->S, i));
+		}
+		for (size_t j = 0; j < p; j++) {
+			gsl_vector_view row = gsl_matrix_row(W, j);
+			gsl_vector_scale(&row.vector,
+					1 / gsl_vector_get(work->D, j));
+		}
+		gsl_blas_dsyrk(CblasUpper, CblasNoTrans, 1.0, W, 0, covFactor);
+		gram_symmetrize(covFactor);
+		gsl_matrix_free(W);
+	}
+
+	return 0;
+}
+
+/*
+ * Print the coefficients and diagnostics of each response fit as the
+ * columns of B. Response j has covariance covScale[j] * covFactor (none
+ * when covFactor is NULL) and is saved as <name>.<response>.coef.
+ */
+void diagnostics_responses(modelConfigType * config, modelDataType * data,
+		gsl_matrix * B, gsl_vector * rss, gsl_matrix * covFactor,
+		gsl_vector * covScale)
+{
+	char * name = NULL;
+	modelConfigType named = *config;
+	gsl_matrix * covMatrix = NULL;
+
+	if (covFactor) {
+		covMatrix = gsl_matrix_alloc(covFactor->size1,
+				covFactor->size2);
+	}
+	for (int j = 0; j < data->nresp; j++) {
+		gsl_vector_view coef = gsl_matrix_column(B, j);
+		gsl_vector_view response = gsl_matrix_column(data->responses,
+				j);
+		gsl_vector_view testResponse;
+
+		if (data->testResponses) {
+			testResponse = gsl_matrix_column(data->testResponses,
+					j);
+		}
+		if (covMatrix) {
+			gsl_matrix_memcpy(covMatrix, covFactor);
+			gsl_matrix_scale(covMatrix,
+					gsl_vector_get(covScale, j));
+		}
+		if (config->name) {
+			name = malloc(strlen(config->name) +
+					strlen(data->respNames[j]) + 2);
+			sprintf(name, "%s.%s", config->name,
+					data->respNames[j]);
+		}
+
+		named.name = name;
+		named.responses = data->respNames + j;
+		named.nresp = 1;
+
+		printf("Response: %s\n", data->respNames[j]);
+		diagnostics(config->diagnostic, gsl_vector_get(rss, j),
+				&response.vector, &coef.vector, covMatrix,
+				data->colNames, data->testMatrix,
+				data->testResponses ? &testResponse.vector :
+				NULL, &named);
+		printf("\n");
+		free(name);
+		name = NULL;
+	}
+
+	if (covMatrix) gsl_matrix_free(covMatrix);
+}
+
+/*
+ * Report a fitted model: with ALL, print the coefficients (with p-values when
+ * covMatrix is given) and diagnostics, otherwise print the one diagnostic.
+ * `ncol` is the number of parameters besides the intercept, which may exceed
+ * the printed coefficients (see lm --absorb). Saves the model to
+ * <name>.coef when the config names one.
+ */
+double diagnostics_report(diagnoseType type, double chisq, double tss,
+		int nrow, int ncol, gsl_vector * coef, gsl_matrix * covMatrix,
+		char ** colNames, gsl_vector * testResid,
+		modelConfigType * config)
+{
+	double value = 0;
+	gsl_vector * pVals = NULL;
+
+	if (diagnostic_needs_test(type) && !testResid) {
+		fprintf(stderr, "This diagnostic requires a test ratio.\n");
+		return -1;
+	}
+
+	if (type == ALL) {
+		double aic, bic, rsq, adjRSQ, f;
+		// We just print things out here
+		if (covMatrix) {
+			pVals = gsl_vector_alloc(coef->size);
+			coefficient_p_values(pVals, covMatrix, coef, coef->size,
+					nrow - ncol - 1);
+		}
+		aic = diagnostic_value(AIC, chisq, tss, nrow, ncol, NULL);
+		bic = diagnostic_value(BIC, chisq, tss, nrow, ncol, NULL);
+		rsq = diagnostic_value(R_SQUARED, chisq, tss, nrow, ncol,
+				NULL);
+		adjRSQ = diagnostic_value(ADJ_R_SQUARED, chisq, tss, nrow,
+				ncol, NULL);
+		f = diagnostic_value(F_STATISTIC, chisq, tss, nrow, ncol,
+				NULL);
+		print_coefficients(coef, pVals, colNames, coef->size - 1);
+		printf("\n");
+		print_diagnostics(rsq, adjRSQ, f, aic, bic);
+		if (pVals) gsl_vector_free(pVals);
+	} else {
+		value = diagnostic_value(type, chisq, tss, nrow, ncol,
+				testResid);
+		printf("%f\n", value);
+	}
+
+	if (config->name) {
+		save_model(config, coef, covMatrix, colNames, coef->size - 1,
+				nrow, chisq);
+	}
+	return value;
+}
+
+double diagnostics(diagnoseType type, double chisq, gsl_vector * response,
+		gsl_vector * coef, gsl_matrix * covMatrix, char ** colNames,
+		gsl_matrix * testMatrix, gsl_vector * testResponse,
+		modelConfigType * config)
+{
+	int ncol = coef->size - 1;
+	int nrow = response->size;
+	double value;
+	double tss = 0;
+	gsl_vector * testResid = NULL;
+
+	if (testMatrix) {
+		// Test-split diagnostics
+		testResid = gsl_vector_alloc(testMatrix->size1);
+		if (gsl_multifit_linear_residuals(testMatrix, testResponse,
+					coef, testResid)) {
+			return -1;
+		}
+	} else {
+		// Non-test-split diagnostics
+		tss = gsl_stats_tss(response->data, response->stride, nrow);
+	}
+
+	value = diagnostics_report(type, chisq, tss, nrow, ncol, coef,
+			covMatrix, colNames, testResid, config);
+
+	if (testResid) gsl_vector_free(testResid);
 	return value;
 }
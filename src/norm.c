@@ -0,0 +1,546 @@
+#include <omp.h>
+#include <gsl/gsl_sort.h>
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "norm.h"
+
+/*
+ * Standardize columns of a csv file. Statistics are gathered in one read of
+ * the input, split into chunks of lines that threads summarize separately
+ * before the summaries are merged, and can be saved so that the same scaling
+ * is later applied to new data. Applying saved statistics streams the input
+ * a line at a time.
+ */
+
+// Digits of the standardized values and of the saved statistics
+#define NORM_FORMAT "%.10g"
+#define NORM_STATS_FORMAT "%.17g"
+
+#define HELP_MESSAGE \
+	"Standardize columns of a CSV file.\n\n" \
+	"USAGE:\n" \
+	"\tnorm [-h] [-i <path>] [-b] [-c <comma-separated columns>]\n" \
+	"\t\t[-m <method>] [-s <path>] [-l <path>]\n\n" \
+	"STANDARD OPTIONS:\n" \
+	"\t-h, --help\tPrint this help message.\n" \
+	"\t-i, --input\tSpecify input file. If not given, stdin will be " \
+		"used.\n" \
+	"\t-b, --binary\tWrite the binary stream the other tools read " \
+		"instead of\n" \
+	"\t\t\tCSV, saving them from parsing text.\n\n" \
+	"NORMALIZATION OPTIONS:\n" \
+	"\t-c, --columns\tColumns to standardize, by name or index " \
+		"starting at 0.\n" \
+	"\t\t\tMay be a comma-separated list. All columns with\n" \
+	"\t\t\tnumeric values are used if not given.\n" \
+	"\t-m, --method\tzscore (default) subtracts the mean and divides " \
+		"by the\n" \
+	"\t\t\tstandard deviation, minmax maps the range onto [0, 1]\n" \
+	"\t\t\tand robust subtracts the median and divides by the\n" \
+	"\t\t\tinterquartile range. Constant columns are only " \
+		"centered.\n" \
+	"\t-s, --save\tWrite the statistics of each column to the given " \
+		"file.\n" \
+	"\t-l, --load\tApply the statistics of a file written by --save " \
+		"instead\n" \
+	"\t\t\tof computing them. The input is then streamed.\n\n" \
+	"Fields that are empty or not numbers are written unchanged.\n"
+
+typedef enum {
+	NORM_ZSCORE,
+	NORM_MINMAX,
+	NORM_ROBUST
+} normMethod;
+
+// Lines [start, end) of the input and the summaries of their columns
+typedef struct {
+	const char * start;
+	const char * end;
+	normMoments * moments;
+	double ** values;		// numeric values, kept for robust
+	size_t * capacity;
+} normChunk;
+
+// Standardized value of x: (x - center) / scale
+typedef struct {
+	bool active;
+	double center;
+	double scale;
+} normScale;
+
+const char * normMethodNames[] = {"zscore", "minmax", "robust"};
+
+/*
+ * Summarize the active fields of the lines of a chunk. With `keep`, the
+ * numeric values are also collected for the quantiles.
+ */
+void norm_summarize(normChunk * chunk, const normScale * scales, int nfield,
+		bool keep)
+{
+	const char * line = chunk->start;
+	const char * stop;
+	const char * next;
+	const char * p;
+	csvField field;
+	double x;
+
+	while (line < chunk->end) {
+		next = csv_line(line, chunk->end, &stop);
+		p = line;
+		for (int f = 0; f < nfield && csv_next_field(&p, stop, &field);
+				f++) {
+			normMoments * m = chunk->moments + f;
+
+			if (!scales[f].active || !csv_number(&field, &x)) {
+				continue;
+			}
+			norm_update(m, x);
+			if (!keep) continue;
+			if (m->n > chunk->capacity[f]) {
+				chunk->capacity[f] = 2 * m->n;
+				chunk->values[f] = realloc(chunk->values[f],
+						chunk->capacity[f] *
+						sizeof(double));
+			}
+			chunk->values[f][m->n - 1] = x;
+		}
+		line = next;
+	}
+}
+
+/*
+ * Write the line ending at `stop` with its active fields standardized, to
+ * `writer` when given. Other fields are copied byte for byte.
+ */
+void norm_line(FILE * output, binaryWriter * writer, const char * line,
+		const char * stop, const normScale * scales, int nfield)
+{
+	const char * p = line;
+	csvField field;
+	double x;
+
+	for (int f = 0; csv_next_field(&p, stop, &field); f++) {
+		bool active = f < nfield && scales[f].active &&
+			csv_number(&field, &x);
+
+		if (active) x = (x - scales[f].center) / scales[f].scale;
+		if (writer && active) {
+			binary_put_number(writer, x);
+		} else if (writer) {
+			binary_put_field(writer, &field);
+		} else {
+			if (f) fputc(',', output);
+			if (active) {
+				fprintf(output, NORM_FORMAT, x);
+			} else {
+				fwrite(field.start, 1, field.len, output);
+			}
+		}
+	}
+	if (writer) {
+		binary_end_row(writer);
+	} else {
+		fputc('\n', output);
+	}
+}
+
+/*
+ * Center and scale of a column from its merged moments, or from its sorted
+ * values for robust. Constant columns keep a scale of 1.
+ */
+void norm_scale(normScale * scale, normMethod method, const normMoments * m,
+		const double * sorted)
+{
+	switch (method) {
+		case NORM_ZSCORE:
+			scale->center = m->mean;
+			scale->scale = m->n > 1 ? sqrt(m->m2 / (m->n - 1)) : 0;
+			break;
+
+		case NORM_MINMAX:
+			scale->center = m->min;
+			scale->scale = m->max - m->min;
+			break;
+
+		case NORM_ROBUST:
+			scale->center = gsl_stats_median_from_sorted_data(
+					sorted, 1, m->n);
+			scale->scale = gsl_stats_quantile_from_sorted_data(
+					sorted, 1, m->n, 0.75) -
+				gsl_stats_quantile_from_sorted_data(sorted, 1,
+						m->n, 0.25);
+			break;
+	}
+	if (!(scale->scale > 0)) scale->scale = 1;
+}
+
+/*
+ * Compute the scaling of the active fields from the data lines in
+ * [start, end), each thread summarizing its own chunk of lines. Fields that
+ * were not asked for by name and hold no numbers are left inactive. Returns
+ * nonzero when a named column has no numeric values.
+ */
+int norm_compute(const char * start, const char * end, normScale * scales,
+		char ** names, int nfield, normMethod method, bool named,
+		normChunk ** chunksOut, int * nchunksOut)
+{
+	int nchunks = omp_get_max_threads();
+	size_t length = end - start;
+	bool keep = method == NORM_ROBUST;
+	normChunk * chunks = calloc(nchunks, sizeof(normChunk));
+	normMoments * total = calloc(nfield, sizeof(normMoments));
+
+	// Split at line boundaries
+	for (int c = 0; c < nchunks; c++) {
+		const char * p = start + length * c / nchunks;
+		const char * newline;
+
+		if (c > 0 && p > start && p[-1] != '\n') {
+			newline = memchr(p, '\n', end - p);
+			p = newline ? newline + 1 : end;
+		}
+		chunks[c].start = c > 0 ? GSL_MAX(p, chunks[c - 1].start) : p;
+		if (c > 0) chunks[c - 1].end = chunks[c].start;
+		chunks[c].moments = calloc(nfield, sizeof(normMoments));
+		chunks[c].values = calloc(nfield, sizeof(double *));
+		chunks[c].capacity = calloc(nfield, sizeof(size_t));
+	}
+	chunks[nchunks - 1].end = end;
+
+	#pragma omp parallel for schedule(static, 1)
+	for (int c = 0; c < nchunks; c++) {
+		norm_summarize(chunks + c, scales, nfield, keep);
+	}
+
+	for (int f = 0; f < nfield; f++) {
+		double * sorted = NULL;
+
+		if (!scales[f].active) continue;
+		for (int c = 0; c < nchunks; c++) {
+			norm_merge(total + f, chunks[c].moments + f);
+		}
+		if (total[f].n == 0) {
+			if (named) {
+				fprintf(stderr, "Column '%s' has no numeric "
+						"values.\n", names[f]);
+				return 1;
+			}
+			scales[f].active = false;
+			continue;
+		}
+		if (keep) {
+			size_t n = 0;
+
+			sorted = malloc(total[f].n * sizeof(double));
+			for (int c = 0; c < nchunks; c++) {
+				memcpy(sorted + n, chunks[c].values[f],
+						chunks[c].moments[f].n *
+						sizeof(double));
+				n += chunks[c].moments[f].n;
+			}
+			gsl_sort(sorted, 1, n);
+		}
+		norm_scale(scales + f, method, total + f, sorted);
+		free(sorted);
+	}
+
+	for (int c = 0; c < nchunks; c++) {
+		for (int f = 0; f < nfield; f++) {
+			free(chunks[c].values[f]);
+		}
+		free(chunks[c].moments);
+		free(chunks[c].values);
+		free(chunks[c].capacity);
+	}
+	free(total);
+	*chunksOut = chunks;
+	*nchunksOut = nchunks;
+
+	return 0;
+}
+
+// Statistics file: the method, then each active column with its scaling
+int norm_save(const char * path, normMethod method, const normScale * scales,
+		char ** names, int nfield)
+{
+	FILE * file = fopen(path, "w");
+
+	if (!file) {
+		fprintf(stderr, "Could not open '%s'.\n", path);
+		return 1;
+	}
+	fprintf(file, "method\t%s\n", normMethodNames[method]);
+	for (int f = 0; f < nfield; f++) {
+		if (!scales[f].active) continue;
+		fprintf(file, "%s\t" NORM_STATS_FORMAT "\t" NORM_STATS_FORMAT
+				"\n", names[f], scales[f].center,
+				scales[f].scale);
+	}
+	fclose(file);
+
+	return 0;
+}
+
+// Activate the columns of a statistics file with their scaling
+int norm_load(const char * path, normScale * scales, char ** names,
+		int nfield)
+{
+	FILE * file = fopen(path, "r");
+	char * line = NULL;
+	size_t len = 0;
+	int status = 0;
+
+	if (!file) {
+		fprintf(stderr, "Could not open '%s'.\n", path);
+		return 1;
+	}
+	while (!status && getline(&line, &len, file) != -1) {
+		char * rest = line;
+		char * name = strsep(&rest, "\t");
+		double center;
+		double scale;
+		int f;
+
+		if (!strcmp(name, "method")) continue;
+		if (!rest || sscanf(rest, "%lf\t%lf", &center, &scale) != 2) {
+			fprintf(stderr, "Malformed statistics line for "
+					"'%s'.\n", name);
+			status = 1;
+			continue;
+		}
+		for (f = 0; f < nfield && strcmp(names[f], name); f++);
+		if (f == nfield) {
+			fprintf(stderr, "Column '%s' not found.\n", name);
+			status = 1;
+			continue;
+		}
+		scales[f].active = true;
+		scales[f].center = center;
+		scales[f].scale = scale;
+	}
+	free(line);
+	fclose(file);
+
+	return status;
+}
+
+int main(int argc, char * argv[])
+{
+	// Options
+	int opt;
+	const struct option commandOptions[] = {
+		{"help",	no_argument,		NULL,	'h'},
+		{"input",	required_argument,	NULL,	'i'},
+		{"columns",	required_argument,	NULL,	'c'},
+		{"method",	required_argument,	NULL,	'm'},
+		{"save",	required_argument,	NULL,	's'},
+		{"load",	required_argument,	NULL,	'l'},
+		{"binary",	no_argument,		NULL,	'b'},
+		{NULL,		0,			NULL,	0}
+	};
+
+	normMethod method = NORM_ZSCORE;
+	char * columnStr = NULL;
+	char * savePath = NULL;
+	char * loadPath = NULL;
+	FILE * input = stdin;
+	char ** names;
+	int nfield;
+	int status = 0;
+	bool binaryOut = false;
+	normScale * scales;
+	binaryReader * binary = NULL;
+	binaryWriter * writer = NULL;
+
+	while ((opt = getopt_long_only(argc, argv, "hi:c:m:s:l:b",
+					commandOptions, NULL)) != -1) {
+		switch (opt) {
+			case 'h':
+				printf(HELP_MESSAGE);
+				return 0;
+			case 'i':
+				input = fopen(optarg, "r");
+				if (!input) {
+					fprintf(stderr, "Could not open "
+							"'%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'c':
+				columnStr = optarg;
+				break;
+			case 'm':
+				if (!strcmp(optarg, "zscore")) {
+					method = NORM_ZSCORE;
+				} else if (!strcmp(optarg, "minmax")) {
+					method = NORM_MINMAX;
+				} else if (!strcmp(optarg, "robust")) {
+					method = NORM_ROBUST;
+				} else {
+					fprintf(stderr, "Unknown method: "
+							"%s\n", optarg);
+					return 1;
+				}
+				break;
+			case 's':
+				savePath = optarg;
+				break;
+			case 'l':
+				loadPath = optarg;
+				break;
+			case 'b':
+				binaryOut = true;
+				break;
+			default:
+				fprintf(stderr, HELP_MESSAGE);
+				return 1;
+		};
+	}
+	if (loadPath && (columnStr || savePath)) {
+		fprintf(stderr, "Columns and statistics come from the --load "
+				"file.\n");
+		return 1;
+	}
+
+	if (loadPath) {
+		// Stream the input through the saved scaling
+		char * line = NULL;
+		size_t len = 0;
+		ssize_t got;
+
+		if ((got = binary_read_line(input, &binary, binaryOut, &line,
+						&len)) == -1) {
+			fprintf(stderr, "No header row.\n");
+			return 1;
+		}
+		nfield = csv_header(line, line + strcspn(line, "\r\n"),
+				&names);
+		scales = calloc(nfield, sizeof(normScale));
+		status = norm_load(loadPath, scales, names, nfield);
+		if (!status && binaryOut) {
+			writer = binary_writer_open(stdout, names, nfield);
+		} else if (!status) {
+			fputs(line, stdout);
+			if (line[got - 1] != '\n') putchar('\n');
+		}
+		while (!status && (got = binary_read_line(input,
+						&binary, binaryOut, &line,
+						&len)) != -1) {
+			const char * stop;
+
+			csv_line(line, line + got, &stop);
+			if (stop == line) continue;
+			norm_line(stdout, writer, line, stop, scales, nfield);
+		}
+		if (binary) binary_reader_close(binary);
+		free(line);
+	} else {
+		// Read everything once, summarize in parallel, then transform
+		size_t size;
+		char * buffer = csv_read_all(input, &size, binaryOut);
+		const char * end;
+		const char * start;
+		const char * headerEnd;
+		normChunk * chunks = NULL;
+		int nchunks = 0;
+
+		if (!buffer) return 1;
+		end = buffer + size;
+		start = csv_line(buffer, end, &headerEnd);
+		nfield = csv_header(buffer, headerEnd, &names);
+		scales = calloc(nfield, sizeof(normScale));
+		if (columnStr) {
+			char * token = strtok(columnStr, ",");
+
+			while (token && !status) {
+				int f = csv_column(names, nfield, token);
+
+				if (f < 0) {
+					fprintf(stderr, "Column '%s' not "
+							"found.\n", token);
+					status = 1;
+				} else {
+					scales[f].active = true;
+				}
+				token = strtok(NULL, ",");
+			}
+		} else {
+			for (int f = 0; f < nfield; f++) {
+				scales[f].active = true;
+			}
+		}
+
+		if (!status) {
+			status = norm_compute(start, end, scales, names,
+					nfield, method, columnStr, &chunks,
+					&nchunks);
+		}
+		if (!status && savePath) {
+			status = norm_save(savePath, method, scales, names,
+					nfield);
+		}
+		if (!status && binaryOut) {
+			// The stream is written in order on one thread
+			const char * line = start;
+			const char * stop;
+
+			writer = binary_writer_open(stdout, names, nfield);
+			while (line < end) {
+				const char * next = csv_line(line, end, &stop);
+
+				if (stop > line) {
+					norm_line(NULL, writer, line, stop,
+							scales, nfield);
+				}
+				line = next;
+			}
+		} else if (!status) {
+			char ** text = calloc(nchunks, sizeof(char *));
+			size_t * length = calloc(nchunks, sizeof(size_t));
+
+			// Chunks are formatted in parallel and written in
+			// order
+			#pragma omp parallel for schedule(static, 1)
+			for (int c = 0; c < nchunks; c++) {
+				FILE * out = open_memstream(text + c,
+						length + c);
+				const char * line = chunks[c].start;
+				const char * next;
+				const char * stop;
+
+				while (line < chunks[c].end) {
+					next = csv_line(line, chunks[c].end,
+							&stop);
+					if (stop > line) {
+						norm_line(out, NULL, line,
+							stop, scales, nfield);
+					}
+					line = next;
+				}
+				fclose(out);
+			}
+
+			fwrite(buffer, 1, headerEnd - buffer, stdout);
+			putchar('\n');
+			for (int c = 0; c < nchunks; c++) {
+				fwrite(text[c], 1, length[c], stdout);
+				free(text[c]);
+			}
+			free(text);
+			free(length);
+		}
+		free(chunks);
+		free(buffer);
+	}
+	if (writer) binary_writer_close(writer);
+	if (input != stdin) fclose(input);
+
+	for (int f = 0; f < nfield; f++) {
+		free(names[f]);
+	}
+	free(names);
+	free(scales);
+
+	return status;
+}
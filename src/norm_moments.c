@@ -0,0 +1,32 @@
+#include "core.h"
+#include "norm.h"
+
+// Welford's update of the moments with x
+void norm_update(normMoments * m, double x)
+{
+	double delta = x - m->mean;
+
+	m->n++;
+	m->mean += delta / m->n;
+	m->m2 += delta * (x - m->mean);
+	if (m->n == 1 || x < m->min) m->min = x;
+	if (m->n == 1 || x > m->max) m->max = x;
+}
+
+// Fold the moments of b into a (Chan et al.'s pairwise combination)
+void norm_merge(normMoments * a, const normMoments * b)
+{
+	size_t n = a->n + b->n;
+	double delta = b->mean - a->mean;
+
+	if (b->n == 0) return;
+	if (a->n == 0) {
+		*a = *b;
+		return;
+	}
+	a->mean += delta * b->n / n;
+	a->m2 += b->m2 + delta * delta * a->n * b->n / n;
+	a->min = GSL_MIN(a->min, b->min);
+	a->max = GSL_MAX(a->max, b->max);
+	a->n = n;
+}
@@ -1,14 +1,26 @@
 #include <gsl/gsl_multifit.h>
+#include <gsl/gsl_blas.h>
 #include <unistd.h>
 #include <time.h>
 #include "core.h"
+#include "gram.h"
 #include "model_utils.h"
+#include "batch.h"
+#include "serve.h"
+#include "sgd.h"
+
+// Elastic-net coordinate descent
+#define ENET_DEFAULT_PATH 100
+#define ENET_DEFAULT_PATH_STR "100"
+#define ENET_TOLERANCE 1e-7
+#define ENET_MAX_PASSES 100000
 
 #define PLM_HELP_INTRO \
 	"Usage: plm [-h] [-i file] [-n name] [TRANSFORM] [ENCODING] " \
 		"[DIAGNOSTIC] \\\n\t\t[UNIQUE]\n\n" \
 	"Perform penalized linear regression using the ridge regression " \
-		"method. This\n" \
+		"method, or\n" \
+	"the lasso/elastic net (see UNIQUE). This\n" \
 	"method may improve predictions by introducing a slight bias that " \
 		"can lead to a\n" \
 	"simpler model.\n\n"
@@ -32,12 +44,595 @@
 	"\t-c, --l-curve\n\n" \
 	"\tAutomatically choose lambda via the L-curve method which attempts " \
 		"to\n" \
-	"\tfind the best compromising value of lambda.\n" \
+	"\tfind the best compromising value of lambda.\n\n" \
+	"\t-P, --path <number of lambda values>\n\n" \
+	"\tEvaluate a path of lambda values spaced between the largest and " \
+		"smallest\n" \
+	"\tsingular values of the data, all from a single decomposition. " \
+		"The\n" \
+	"\tcoefficient path is printed and the lambda with the best " \
+		"DIAGNOSTIC\n" \
+	"\t(GCV if none is given) is reported as the model.\n\n" \
+	"\t-e, --elastic-net <number between 0 and 1>\n\n" \
+	"\tUse the elastic-net penalty instead of ridge, mixing lasso (1) " \
+		"and ridge\n" \
+	"\t(0) penalties. Coefficients may be exactly zero. Lambda is then " \
+		"measured\n" \
+	"\ton standardized columns per observation, and without --lambda a " \
+		"path of\n" \
+	"\t" ENET_DEFAULT_PATH_STR " values (or --path) is fit and the best " \
+		"selected.\n\n" \
+	"\t-o, --lasso\n\n" \
+	"\tSame as --elastic-net 1.\n\n" \
+	"\t-D, --sgd <epochs>\n\n" \
+	"\tFit the ridge or elastic-net model for --lambda by mini-batch " \
+		"stochastic\n" \
+	"\tgradient descent (Adam, with a proximal step for the lasso " \
+		"part) for up\n" \
+	"\tto the given number of passes over the rows. Lambda is then " \
+		"measured on\n" \
+	"\tstandardized columns per observation for ridge too. The input " \
+		"file is\n" \
+	"\tmapped and read a block of rows at a time, so it must be a " \
+		"file rather\n" \
+	"\tthan a pipe, and only numeric columns are used. Unless a " \
+		"diagnostic is\n" \
+	"\tasked for, the objective and relative change of each epoch " \
+		"are printed.\n\n" \
+	"\t-B, --batch <rows>\n\n" \
+	"\tRows per mini-batch with --sgd (default: " SGD_BATCH_STR ").\n"
+
+// Number of lambda values examined by the GCV and L-curve searches
+#define LAMBDA_POINTS 200
 
 #define MULT_LAMBDAS "Multiple lambda-related options set; only set one of " \
-	"lambda, gcv-curve, and l-curve."
+	"lambda, gcv-curve, l-curve, and path.\n"
 
-int main(int argc, char *argv[])
+/*
+ * Ridge solutions for every lambda in `lambdas` from the decomposition held in
+ * `work`. With b = U^T y, each solution is D^{-1} V diag(s / (s^2 + lambda^2))
+ * b, so after the single projection a lambda costs O(p) to filter and the
+ * whole path is one p x p by p x N product. Column k of `path` receives the
+ * coefficients, `rss` the residual sum of squares about the residual mean
+ * (as the rank path of tsvdlm) and `df` the effective degrees of freedom
+ * (trace of the hat matrix).
+ */
+int ridge_path(gsl_vector * y, gsl_vector * lambdas, gsl_matrix * path,
+		gsl_vector * rss, gsl_vector * df,
+		gsl_multifit_linear_workspace * work)
+{
+	size_t n = y->size;
+	size_t p = path->size1;
+	size_t npath = lambdas->size;
+	double yNorm;
+	double bNorm;
+	double ySum = 0;
+	gsl_vector * b;
+	gsl_vector * ones;
+	gsl_vector * USum;
+	gsl_matrix * F;
+	gsl_vector_view D;
+	gsl_matrix_const_view U;
+	gsl_matrix_const_view V;
+
+	U = gsl_matrix_const_submatrix(work->A, 0, 0, n, p);
+	V = gsl_matrix_const_submatrix(work->Q, 0, 0, p, p);
+	D = gsl_vector_subvector(work->D, 0, p);
+
+	b = gsl_vector_alloc(p);
+	gsl_blas_dgemv(CblasTrans, 1.0, &U.matrix, y, 0, b);
+	yNorm = pow(gsl_blas_dnrm2(y), 2);
+	bNorm = pow(gsl_blas_dnrm2(b), 2);
+
+	// Column sums of U give the sum of each fit, and so the residual mean
+	ones = gsl_vector_alloc(n);
+	USum = gsl_vector_alloc(p);
+	gsl_vector_set_all(ones, 1.0);
+	gsl_blas_dgemv(CblasTrans, 1.0, &U.matrix, ones, 0, USum);
+	gsl_blas_ddot(y, ones, &ySum);
+	gsl_vector_free(ones);
+
+	// Filtered coefficients in the rotated basis, one column per lambda
+	F = gsl_matrix_alloc(p, npath);
+	#pragma omp parallel for
+	for (size_t k = 0; k < npath; k++) {
+		double l2 = pow(gsl_vector_get(lambdas, k), 2);
+		double resid = yNorm - bNorm;
+		double fitSum = 0;
+		double dof = 0;
+		double mean;
+		double s2;
+		double f;
+		double bi;
+
+		for (size_t i = 0; i < p; i++) {
+			s2 = pow(gsl_vector_get(work->S, i), 2);
+			bi = gsl_vector_get(b, i);
+			f = s2 / (s2 + l2);
+			gsl_matrix_set(F, i, k, bi * gsl_vector_get(work->S, i)
+					/ (s2 + l2));
+			resid += pow((1 - f) * bi, 2);
+			fitSum += f * bi * gsl_vector_get(USum, i);
+			dof += f;
+		}
+		mean = (ySum - fitSum) / n;
+		gsl_vector_set(rss, k, resid - n * mean * mean);
+		gsl_vector_set(df, k, dof);
+	}
+
+	// Rotate back and undo the column balancing
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &V.matrix, F, 0, path);
+	for (size_t j = 0; j < p; j++) {
+		gsl_vector_view row = gsl_matrix_row(path, j);
+		gsl_vector_scale(&row.vector, 1 / gsl_vector_get(&D.vector,
+					j));
+	}
+
+	gsl_matrix_free(F);
+	gsl_vector_free(USum);
+	gsl_vector_free(b);
+
+	return 0;
+}
+
+/*
+ * Elastic-net problem on standardized columns: R = Z^T Z / n and
+ * c = Z^T y / n where Z holds the centered columns of X scaled to unit
+ * variance. Constant columns (including the intercept) have zero scale and
+ * are left out of the penalized fit.
+ */
+typedef struct {
+	size_t n;
+	size_t p;
+	double yMean;
+	double yVar;
+	gsl_vector * mean;
+	gsl_vector * sd;
+	gsl_vector * c;
+	gsl_matrix * R;
+} enetProblem;
+
+// Options of one plm model
+typedef struct {
+	double lambda;			// -1 for GCV, -2 for L-curve
+	double alpha;			// elastic-net mixing, -1 for ridge
+	int pathLength;
+	int epochs;			// --sgd epochs, 0 for none
+	int batch;			// --batch rows
+} plmOptions;
+
+// Centers X in place
+int enet_setup(gsl_matrix * X, gsl_vector * y, enetProblem * prob)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+
+	prob->n = n;
+	prob->p = p;
+	prob->mean = gsl_vector_alloc(p);
+	prob->sd = gsl_vector_alloc(p);
+	prob->c = gsl_vector_alloc(p);
+	prob->R = gsl_matrix_alloc(p, p);
+
+	// Center columns before forming the Gram matrix to avoid
+	// cancellation between large means and small variances
+	#pragma omp parallel for
+	for (size_t j = 0; j < p; j++) {
+		gsl_vector_view col = gsl_matrix_column(X, j);
+		double m = gsl_stats_mean(col.vector.data, col.vector.stride,
+				n);
+		gsl_vector_set(prob->mean, j, m);
+		gsl_vector_add_constant(&col.vector, -m);
+	}
+	if (gram_compute(X, y, prob->R, prob->c)) {
+		return 1;
+	}
+
+	// Standardize
+	for (size_t j = 0; j < p; j++) {
+		gsl_vector_set(prob->sd, j,
+				sqrt(gsl_matrix_get(prob->R, j, j) / n));
+	}
+	for (size_t j = 0; j < p; j++) {
+		double sj = gsl_vector_get(prob->sd, j);
+		for (size_t k = 0; k < p; k++) {
+			double sk = gsl_vector_get(prob->sd, k);
+			double * r = gsl_matrix_ptr(prob->R, j, k);
+			*r = (sj > 0 && sk > 0) ? *r / (n * sj * sk) : 0;
+		}
+		*gsl_vector_ptr(prob->c, j) = sj > 0 ?
+			gsl_vector_get(prob->c, j) / (n * sj) : 0;
+	}
+	prob->yMean = gsl_stats_mean(y->data, y->stride, n);
+	prob->yVar = gsl_stats_tss(y->data, y->stride, n) / n;
+
+	return 0;
+}
+
+void enet_free(enetProblem * prob)
+{
+	gsl_vector_free(prob->mean);
+	gsl_vector_free(prob->sd);
+	gsl_vector_free(prob->c);
+	gsl_matrix_free(prob->R);
+}
+
+double soft_threshold(double z, double t)
+{
+	if (z > t) return z - t;
+	if (z < -t) return z + t;
+	return 0;
+}
+
+/*
+ * One cyclical pass of coordinate descent over the columns flagged in `set`
+ * (restricted to nonzero coefficients when `activeOnly`). The gradient
+ * grad = c - R beta is kept current with a covariance update after every
+ * change. Returns the largest coefficient change.
+ */
+double enet_pass(enetProblem * prob, double l1, double denom, bool * set,
+		bool activeOnly, gsl_vector * beta, gsl_vector * grad)
+{
+	double maxDelta = 0;
+	double old;
+	double new;
+	double delta;
+	gsl_vector_view row;
+
+	for (size_t j = 0; j < prob->p; j++) {
+		if (!set[j]) continue;
+		old = gsl_vector_get(beta, j);
+		if (activeOnly && old == 0) continue;
+
+		// R_jj = 1 on standardized columns
+		new = soft_threshold(gsl_vector_get(grad, j) + old, l1) /
+			denom;
+		if (new != old) {
+			delta = new - old;
+			gsl_vector_set(beta, j, new);
+			row = gsl_matrix_row(prob->R, j);
+			gsl_blas_daxpy(-delta, &row.vector, grad);
+			maxDelta = GSL_MAX(maxDelta, fabs(delta));
+		}
+	}
+
+	return maxDelta;
+}
+
+/*
+ * Solve for one lambda, warm started from `beta` and its gradient at the
+ * previous lambda. Columns are screened with the sequential strong rule, the
+ * fit iterates on the active set until it settles, and any KKT violations
+ * among screened-out columns are added back before finishing.
+ */
+int enet_solve(enetProblem * prob, double alpha, double lambda,
+		double lambdaPrev, gsl_vector * beta, gsl_vector * grad,
+		bool * strong)
+{
+	size_t passes = 0;
+	int violations;
+	double l1 = lambda * alpha;
+	double denom = 1 + lambda * (1 - alpha);
+
+	for (size_t j = 0; j < prob->p; j++) {
+		strong[j] = gsl_vector_get(prob->sd, j) > 0 &&
+			(gsl_vector_get(beta, j) != 0 ||
+			 fabs(gsl_vector_get(grad, j)) >=
+			 alpha * (2 * lambda - lambdaPrev));
+	}
+
+	do {
+		while (passes++ < ENET_MAX_PASSES) {
+			if (enet_pass(prob, l1, denom, strong, false, beta,
+						grad) < ENET_TOLERANCE) {
+				break;
+			}
+			while (passes++ < ENET_MAX_PASSES &&
+					enet_pass(prob, l1, denom, strong, true,
+						beta, grad) >= ENET_TOLERANCE);
+		}
+
+		violations = 0;
+		for (size_t j = 0; j < prob->p; j++) {
+			if (!strong[j] && gsl_vector_get(prob->sd, j) > 0 &&
+					fabs(gsl_vector_get(grad, j)) > l1) {
+				strong[j] = true;
+				violations++;
+			}
+		}
+	} while (violations && passes < ENET_MAX_PASSES);
+
+	if (passes >= ENET_MAX_PASSES) {
+		fprintf(stderr, "Coordinate descent did not converge for "
+				"lambda %g.\n", lambda);
+	}
+
+	return 0;
+}
+
+double enet_lambda_max(enetProblem * prob, double alpha)
+{
+	double maxGrad = 0;
+
+	for (size_t j = 0; j < prob->p; j++) {
+		maxGrad = GSL_MAX(maxGrad, fabs(gsl_vector_get(prob->c, j)));
+	}
+
+	return maxGrad / GSL_MAX(alpha, 1e-3);
+}
+
+// Map standardized coefficients back to the columns of X
+void enet_coefficients(enetProblem * prob, gsl_vector * beta,
+		gsl_vector * coef)
+{
+	double intercept = prob->yMean;
+	double b;
+
+	for (size_t j = 1; j < prob->p; j++) {
+		b = gsl_vector_get(prob->sd, j) > 0 ? gsl_vector_get(beta, j) /
+			gsl_vector_get(prob->sd, j) : 0;
+		gsl_vector_set(coef, j, b);
+		intercept -= b * gsl_vector_get(prob->mean, j);
+	}
+	gsl_vector_set(coef, 0, intercept);
+}
+
+/*
+ * Fit every lambda in `lambdas` (decreasing) with warm starts. Column k of
+ * `path` receives the coefficients on the scale of X, `rss` the training
+ * residual sum of squares and `df` the number of nonzero coefficients.
+ */
+int enet_path(enetProblem * prob, double alpha, gsl_vector * lambdas,
+		gsl_matrix * path, gsl_vector * rss, gsl_vector * df)
+{
+	size_t p = prob->p;
+	double lambda;
+	double lambdaPrev;
+	double bc;
+	double bg;
+	int nonzero;
+	bool * strong;
+	gsl_vector * beta;
+	gsl_vector * grad;
+	gsl_vector_view out;
+
+	strong = malloc(p * sizeof(bool));
+	beta = gsl_vector_calloc(p);
+	grad = gsl_vector_alloc(p);
+	gsl_vector_memcpy(grad, prob->c);
+
+	lambdaPrev = enet_lambda_max(prob, alpha);
+	for (size_t k = 0; k < lambdas->size; k++) {
+		lambda = gsl_vector_get(lambdas, k);
+		enet_solve(prob, alpha, lambda, lambdaPrev, beta, grad, strong);
+		lambdaPrev = lambda;
+
+		// RSS / n = var(y) - 2 b^T c + b^T R b, with R b = c - grad
+		gsl_blas_ddot(beta, prob->c, &bc);
+		gsl_blas_ddot(beta, grad, &bg);
+		gsl_vector_set(rss, k, prob->n * (prob->yVar - bc - bg));
+
+		nonzero = 1;
+		for (size_t j = 0; j < p; j++) {
+			if (gsl_vector_get(beta, j) != 0) nonzero++;
+		}
+		gsl_vector_set(df, k, nonzero);
+
+		out = gsl_matrix_column(path, k);
+		enet_coefficients(prob, beta, &out.vector);
+	}
+
+	gsl_vector_free(grad);
+	gsl_vector_free(beta);
+	free(strong);
+
+	return 0;
+}
+
+int fit_enet_model(double alpha, double lambda, int pathLength,
+		modelConfigType * config, gsl_matrix * X, gsl_vector * y,
+		gsl_vector * coef, double * chisq, char ** colNames,
+		gsl_matrix * testMatrix, gsl_vector * testResponse)
+{
+	size_t best;
+	double lambdaMax;
+	double ratio;
+	enetProblem prob;
+	gsl_vector * lambdas;
+	gsl_vector * rss;
+	gsl_vector * df;
+	gsl_matrix * path;
+
+	if (lambda < 0) {
+		fprintf(stderr, "GCV and L-curve searches are only available "
+				"for ridge; use --path.\n");
+		return 1;
+	}
+	if (!lambda && diagnostic_needs_test(config->diagnostic) &&
+			!testMatrix) {
+		fprintf(stderr, "This diagnostic requires a test ratio.\n");
+		return 1;
+	}
+	if (enet_setup(X, y, &prob)) {
+		return 1;
+	}
+
+	// Decreasing lambdas from the smallest giving an empty model, ending
+	// at the requested lambda if there is one
+	if (!pathLength) pathLength = ENET_DEFAULT_PATH;
+	lambdaMax = enet_lambda_max(&prob, alpha);
+	ratio = lambda > 0 ? lambda / lambdaMax :
+		(X->size1 > X->size2 ? 1e-4 : 1e-2);
+	lambdas = gsl_vector_alloc(pathLength);
+	for (int k = 0; k < pathLength; k++) {
+		gsl_vector_set(lambdas, k, lambdaMax *
+				pow(ratio, (double)k / (pathLength - 1)));
+	}
+
+	path = gsl_matrix_alloc(X->size2, pathLength);
+	rss = gsl_vector_alloc(pathLength);
+	df = gsl_vector_alloc(pathLength);
+	enet_path(&prob, alpha, lambdas, path, rss, df);
+
+	if (lambda > 0) {
+		best = pathLength - 1;
+	} else {
+		best = select_path(config->diagnostic, path, rss, df, lambdas,
+				"lambda", y, colNames, testMatrix,
+				testResponse);
+		printf("Selected lambda: %g\n\n", gsl_vector_get(lambdas,
+					best));
+	}
+	gsl_matrix_get_col(coef, path, best);
+	*chisq = gsl_vector_get(rss, best);
+
+	gsl_matrix_free(path);
+	gsl_vector_free(df);
+	gsl_vector_free(rss);
+	gsl_vector_free(lambdas);
+	enet_free(&prob);
+
+	return 0;
+}
+
+int fit_ridge_model(double lambda, int pathLength, modelConfigType * config,
+		gsl_matrix * X, gsl_vector * y, gsl_vector * coef,
+		double * chisq, char ** colNames, gsl_matrix * testMatrix,
+		gsl_vector * testResponse)
+{
+	int ncol = X->size2;
+	size_t best;
+	double rnorm;
+	double snorm;
+	gsl_multifit_linear_workspace * work;
+
+	work = gsl_multifit_linear_alloc(X->size1, ncol);
+	if (gsl_multifit_linear_svd(X, work)) {
+		return 1;
+	}
+	if (pathLength) {		// Regularization path
+		gsl_vector * lambdas = gsl_vector_alloc(pathLength);
+		gsl_vector * rss = gsl_vector_alloc(pathLength);
+		gsl_vector * df = gsl_vector_alloc(pathLength);
+		gsl_matrix * path = gsl_matrix_alloc(ncol, pathLength);
+		if (diagnostic_needs_test(config->diagnostic) &&
+				!testMatrix) {
+			fprintf(stderr, "This diagnostic requires a test "
+					"ratio.\n");
+			return 1;
+		}
+		gsl_multifit_linear_lreg(gsl_vector_get(work->S, ncol - 1),
+				gsl_vector_get(work->S, 0), lambdas);
+		ridge_path(y, lambdas, path, rss, df, work);
+		best = select_path(config->diagnostic, path, rss, df, lambdas,
+				"lambda", y, colNames, testMatrix,
+				testResponse);
+		lambda = gsl_vector_get(lambdas, best);
+		printf("Selected lambda: %g\n\n", lambda);
+		gsl_matrix_free(path);
+		gsl_vector_free(df);
+		gsl_vector_free(rss);
+		gsl_vector_free(lambdas);
+	} else if (lambda == -1) {	// GCV-Curve
+		gsl_vector * G = gsl_vector_alloc(LAMBDA_POINTS);
+		double G_gcv;
+		gsl_vector * regParam = gsl_vector_alloc(LAMBDA_POINTS);
+		gsl_multifit_linear_gcv(y, regParam, G, &lambda, &G_gcv,
+				work);
+		gsl_vector_free(regParam);
+		gsl_vector_free(G);
+	} else if (lambda == -2) {	// L-Curve
+		size_t idx;
+		gsl_vector * rho = gsl_vector_alloc(LAMBDA_POINTS);
+		gsl_vector * eta = gsl_vector_alloc(LAMBDA_POINTS);
+		gsl_vector * regParam = gsl_vector_alloc(LAMBDA_POINTS);
+		gsl_multifit_linear_lcurve(y, regParam, rho, eta, work);
+		gsl_multifit_linear_lcorner(rho, eta, &idx);
+		lambda = gsl_vector_get(regParam, idx);
+		gsl_vector_free(regParam);
+		gsl_vector_free(eta);
+		gsl_vector_free(rho);
+	}
+	if (gsl_multifit_linear_solve(lambda, X, y, coef,
+				&rnorm, &snorm, work)) {
+		return 1;
+	}
+	*chisq = pow(rnorm, 2.0) + pow(lambda * snorm, 2.0);
+	gsl_multifit_linear_free(work);
+
+	return 0;
+}
+
+/*
+ * Ridge fits for every response from a single decomposition. With GCV or
+ * the L-curve (lambda -1 or -2) each response gets its own lambda, chosen
+ * from the shared decomposition.
+ */
+int fit_ridge_responses(double lambda, modelConfigType * config,
+		modelDataType * data)
+{
+	size_t rank;
+	gsl_vector * lambdas;
+	gsl_vector * rss;
+	gsl_matrix * coef;
+	gsl_multifit_linear_workspace * work;
+
+	work = gsl_multifit_linear_alloc(data->nrow, data->ncol);
+	if (gsl_multifit_linear_svd(data->dataMatrix, work)) {
+		return 1;
+	}
+	rank = gsl_multifit_linear_rank(GSL_DBL_EPSILON, work);
+
+	lambdas = gsl_vector_alloc(data->nresp);
+	gsl_vector_set_all(lambdas, lambda);
+	for (int j = 0; lambda < 0 && j < data->nresp; j++) {
+		gsl_vector_view y = gsl_matrix_column(data->responses, j);
+		gsl_vector * regParam = gsl_vector_alloc(LAMBDA_POINTS);
+		if (lambda == -1) {		// GCV-Curve
+			gsl_vector * G = gsl_vector_alloc(LAMBDA_POINTS);
+			double G_gcv;
+			gsl_multifit_linear_gcv(&y.vector, regParam, G,
+					gsl_vector_ptr(lambdas, j), &G_gcv,
+					work);
+			gsl_vector_free(G);
+		} else {			// L-Curve
+			size_t idx;
+			gsl_vector * rho = gsl_vector_alloc(LAMBDA_POINTS);
+			gsl_vector * eta = gsl_vector_alloc(LAMBDA_POINTS);
+			gsl_multifit_linear_lcurve(&y.vector, regParam, rho,
+					eta, work);
+			gsl_multifit_linear_lcorner(rho, eta, &idx);
+			gsl_vector_set(lambdas, j, gsl_vector_get(regParam,
+						idx));
+			gsl_vector_free(eta);
+			gsl_vector_free(rho);
+		}
+		gsl_vector_free(regParam);
+	}
+
+	coef = gsl_matrix_alloc(data->ncol, data->nresp);
+	rss = gsl_vector_alloc(data->nresp);
+	svd_solve_responses(rank, lambdas, data->dataMatrix, data->responses,
+			coef, rss, NULL, work);
+	gsl_multifit_linear_free(work);
+
+	// Penalized chi-squared as for a single response
+	for (int j = 0; j < data->nresp; j++) {
+		gsl_vector_view b = gsl_matrix_column(coef, j);
+		*gsl_vector_ptr(rss, j) += pow(gsl_vector_get(lambdas, j) *
+				gsl_blas_dnrm2(&b.vector), 2.0);
+	}
+	diagnostics_responses(config, data, coef, rss, NULL, NULL);
+
+	gsl_vector_free(rss);
+	gsl_vector_free(lambdas);
+	gsl_matrix_free(coef);
+
+	return 0;
+}
+
+int plm_options(int argc, char ** argv, modelConfigType * config,
+		void ** options)
 {
 	// Command-line options
 	const struct option commandOptions[] = {
@@ -45,35 +640,26 @@ int main(int argc, char *argv[])
 		{"lambda",	required_argument,	NULL, 'p'}, \
 		{"gcv-curve",	no_argument,		NULL, 'g'}, \
 		{"l-curve",	no_argument,		NULL, 'c'}, \
+		{"path",	required_argument,	NULL, 'P'}, \
+		{"elastic-net",	required_argument,	NULL, 'e'}, \
+		{"lasso",	no_argument,		NULL, 'o'}, \
+		{"sgd",		required_argument,	NULL, 'D'}, \
+		{"batch",	required_argument,	NULL, 'B'}, \
 	};
 	int opt;
-	modelConfigType * config;
-
-	// Model variables
-	int nrow;
-	int ncol;
-	int testRows;
-	double lambda = 0;
 	double tmpLambda;
-	double chisq;
-	double rnorm;
-	double snorm;
-	char ** lines = NULL;
-	char ** testLines = NULL;
-	char ** colNames = NULL;
-	encodeData * encodingInfo;
-	dataColumn * columnHead;
-	dataColumn * testData;
-	dataColumn * colPtr;
-	gsl_vector * response;
-	gsl_vector * coef;
-	gsl_matrix * dataMatrix;
-	gsl_multifit_linear_workspace * work;
+	plmOptions * opts;
 
-	config = malloc(sizeof(modelConfigType));
-	config->input = stdin;
-	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING "p:gc",
-					commandOptions, NULL)) != -1) {
+	opts = malloc(sizeof(plmOptions));
+	opts->lambda = 0;
+	opts->alpha = -1;
+	opts->pathLength = 0;
+	opts->epochs = 0;
+	opts->batch = SGD_BATCH;
+	*options = opts;
+	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING
+					"p:gcP:e:oD:B:", commandOptions,
+					NULL)) != -1) {
 		if (parse_args(opt, config, PLM_HELP_INTRO LM_HELP_MESSAGE
 					PLM_UNIQUE_HELP)) {
 			return 1;
@@ -86,157 +672,184 @@ int main(int argc, char *argv[])
 						"0.\n");
 				return 1;
 			}
-			if (0 != lambda) {
+			if (0 != opts->lambda || opts->pathLength) {
 				fprintf(stderr, MULT_LAMBDAS);
 				return 1;
 			}
-			lambda = tmpLambda;
+			opts->lambda = tmpLambda;
 		}
 		if (opt == 'g') {
-			if (0 != lambda) {
+			if (0 != opts->lambda || opts->pathLength) {
 				fprintf(stderr, MULT_LAMBDAS);
 				return 1;
 			}
-			lambda = -1;
+			opts->lambda = -1;
 		}
 		if (opt == 'c') {
-			if (0 != lambda) {
+			if (0 != opts->lambda || opts->pathLength) {
 				fprintf(stderr, MULT_LAMBDAS);
 				return 1;
 			}
-			lambda = -2;
+			opts->lambda = -2;
 		}
-	}
-
-	// Set random seed
-	srand(time(NULL));
-
-	// Parse incoming csv file
-	nrow = read_rows(&lines, config->input);
-	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
-	nrow -= testRows;
-	fclose(config->input);
-	columnHead = column_alloc(nrow, "");
-	testData = column_alloc(testRows, "");
-	switch(config->encoding) {
-		case ENCODE_DUMMY:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, dummy_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, dummy_encode,
-		 			testRows, &encodingInfo);
+		if (opt == 'P') {
+			if (0 != opts->lambda) {
+				fprintf(stderr, MULT_LAMBDAS);
+				return 1;
 			}
-			break;
-
-		case ENCODE_MEAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					mean_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					mean_target_encode, testRows,
-					&encodingInfo);
+			sscanf(optarg, "%d", &opts->pathLength);
+			if (opts->pathLength < 2) {
+				fprintf(stderr, "Path must have at least 2 "
+						"lambda values.\n");
+				return 1;
 			}
-			break;
-
-		case ENCODE_MEDIAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					median_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					median_target_encode, testRows,
-					&encodingInfo);
+		}
+		if (opt == 'e' || opt == 'o') {
+			if (opts->alpha >= 0) {
+				fprintf(stderr, "Multiple penalties "
+						"specified.\n");
+				return 1;
 			}
-			break;
-
-		case ENCODE_NONE:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, no_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, no_encode,
-					testRows, &encodingInfo);
+			opts->alpha = 1;
+			if (opt == 'e') sscanf(optarg, "%lf", &opts->alpha);
+			if (opts->alpha < 0 || opts->alpha > 1) {
+				fprintf(stderr, "Elastic-net mixing must be "
+						"between 0 and 1.\n");
+				return 1;
+			}
+		}
+		if (opt == 'D') {
+			sscanf(optarg, "%d", &opts->epochs);
+			if (opts->epochs < 1) {
+				fprintf(stderr, "Epochs must be positive.\n");
+				return 1;
 			}
-			break;
+		}
+		if (opt == 'B') {
+			sscanf(optarg, "%d", &opts->batch);
+			if (opts->batch < 1) {
+				fprintf(stderr, "Batch rows must be "
+						"positive.\n");
+				return 1;
+			}
+		}
 	}
-	dataMatrix = gsl_matrix_alloc(nrow, ncol);
-	response = columnHead->vector; // First column is the response
-	if (arrange_data(columnHead, dataMatrix, ncol)) return 1;
 
-	// Pull out column names, skipping the response
-	colPtr = columnHead;
-	colPtr = colPtr->nextColumn;
-	colNames = malloc(ncol * sizeof(char *));
-	for (int i = 0; i < ncol; i++) {
-		colNames[i] = strdup(colPtr->name);
-		colPtr = colPtr->nextColumn;
+	return 0;
+}
+
+/*
+ * Fit and report one model. A single ridge fit with the cross-products of
+ * the predictors at hand (in --jobs mode) is solved by Cholesky, falling
+ * back to the SVD when the system is too ill-conditioned.
+ */
+int plm_fit(modelConfigType * config, void * options, modelDataType * data,
+		gsl_matrix * gram)
+{
+	plmOptions * opts = options;
+	double chisq;
+	gsl_vector * coef;
+
+	if (opts->epochs) {
+		fprintf(stderr, "--sgd is not available with --jobs or "
+				"--serve.\n");
+		return 1;
+	}
+	if (data->nresp > 1) {
+		if (opts->alpha >= 0 || opts->pathLength) {
+			fprintf(stderr, "Multiple responses are only "
+					"available for ridge without "
+					"--path.\n");
+			return 1;
+		}
+		return fit_ridge_responses(opts->lambda, config, data);
 	}
+	coef = gsl_vector_calloc(data->ncol);
 
-	// We cannot make a model with more columns than rows
-	if (nrow < ncol) {
-		fprintf(stderr, "More columns than rows; check encoding "
-	  			"method or test ratio.\n");
-		exit(EXIT_FAILURE);
+	// Fit the model
+	if (opts->alpha >= 0) {
+		if (fit_enet_model(opts->alpha, opts->lambda, opts->pathLength,
+					config, data->dataMatrix,
+					data->response, coef, &chisq,
+					data->colNames, data->testMatrix,
+					data->testResponse)) {
+			return 1;
+		}
+	} else if (!gram || opts->lambda < 0 || opts->pathLength ||
+			gram_solve(gram, opts->lambda, data->dataMatrix,
+				data->response, coef, NULL, &chisq)) {
+		if (fit_ridge_model(opts->lambda, opts->pathLength, config,
+					data->dataMatrix, data->response, coef,
+					&chisq, data->colNames,
+					data->testMatrix, data->testResponse)) {
+			return 1;
+		}
 	}
 
-	// Allocate remaining data
-	work = gsl_multifit_linear_alloc(nrow, ncol);
-	coef = gsl_vector_calloc(ncol);
+	// Print diagnostics
+	diagnostics(config->diagnostic, chisq, data->response, coef, NULL,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
 
-	// Perform transformation if necessary
-	switch(config->transformation) {
-		case TRANSFORM_LOG:
-			transform(response, log, nrow);
-			break;
+	gsl_vector_free(coef);
 
-		case TRANSFORM_LOG_OFFSET:
-			transform(response, log_offset, nrow);
-			break;
+	return 0;
+}
 
-		case TRANSFORM_NONE:
-			break;
-	}
+int main(int argc, char *argv[])
+{
+	modelConfigType * config;
+	void * options;
+	plmOptions * opts;
+	modelDataType data;
+	char ** args;
 
-	// Fit the model
-	if (gsl_multifit_linear_svd(dataMatrix, work)) {
+	args = serve_arguments(argc, argv);
+	config = config_alloc();
+	if (plm_options(argc, argv, config, &options)) {
 		return 1;
 	}
-	if (lambda == -1) {		// GCV-Curve
-		gsl_vector * G = gsl_vector_alloc(nrow);
-		double G_gcv;
-		gsl_vector * regParam = gsl_vector_alloc(nrow);
-		gsl_multifit_linear_gcv(response, regParam, G, &lambda, &G_gcv,
-				work);
-	} else if (lambda == -1) {	// L-Curve
-		size_t idx;
-		gsl_vector * rho = gsl_vector_alloc(nrow);
-		gsl_vector * eta = gsl_vector_alloc(nrow);
-		gsl_vector * regParam = gsl_vector_alloc(nrow);
-		gsl_multifit_linear_lcurve(response, regParam, rho, eta, work);
-		gsl_multifit_linear_lcorner(rho, eta, &idx);
-		lambda = gsl_vector_get(regParam, idx);
+	opts = options;
+	if (config->connect) {
+		return serve_request(config, argc, args);
 	}
-	if (gsl_multifit_linear_solve(lambda, dataMatrix, response, coef,
-				&rnorm, &snorm, work)) {
-		return 1;
+	if (config->serve) {
+		return run_serve(config, plm_options, plm_fit, free, true);
 	}
-	chisq = pow(rnorm, 2.0) + pow(lambda * snorm, 2.0);
-	gsl_matrix_free(dataMatrix);
-	gsl_multifit_linear_free(work);
 
-	// Print diagnostics
-	diagnostics(config->diagnostic, chisq, response, coef, NULL, colNames,
-			testRows, testData, config->name);
+	// Set random seed
+	srand(time(NULL));
+
+	if (opts->epochs) {
+		if (opts->lambda < 0 || opts->pathLength || config->jobs) {
+			fprintf(stderr, "--sgd takes a single --lambda, "
+					"without --path or --jobs.\n");
+			return 1;
+		}
+		if (fit_sgd(config, opts->epochs, opts->batch, opts->lambda,
+					fmax(opts->alpha, 0))) {
+			return 1;
+		}
+		free(config);
+		free(options);
+		return 0;
+	}
+	if (config->jobs) {
+		return run_batch(config, plm_options, plm_fit, free, true);
+	}
+
+	// Parse incoming csv file
+	if (load_model_data(config, &data)) {
+		exit(EXIT_FAILURE);
+	}
+	if (plm_fit(config, options, &data, NULL)) {
+		return 1;
+	}
 
 	// Free memory
-	column_free(testData);
-	free(colNames);
+	model_data_free(&data);
 	free(config);
-	gsl_vector_free(coef);
+	free(options);
 
 	return 0;
 }
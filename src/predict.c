@@ -0,0 +1,442 @@
+#include <stdint.h>
+#include <omp.h>
+#include <gsl/gsl_blas.h>
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "blas.h"
+#include "model_utils.h"
+#include "model_file.h"
+
+/*
+ * Score new rows with a model saved by the modeling tools. A binary model is
+ * mapped and used in place: every encoded column comes with a hash table from
+ * its categories to what they add to the prediction, so the dummy and target
+ * encodings cost one lookup per row. A text model is built into the same
+ * layout when read.
+ * The input is streamed in blocks of rows: their fields are converted by all
+ * threads into a matrix of the numeric predictors, the block is scored with
+ * one GEMV, the response transformation is undone and the predictions are
+ * formatted in parallel before being written in order.
+ */
+
+// Rows scored at a time
+#define PREDICT_BLOCK_ROWS 4096
+
+// Digits of the predictions and the room each takes when formatted
+#define PREDICT_FORMAT "%.10g"
+#define PREDICT_WIDTH 32
+
+#define HELP_MESSAGE \
+	"Predict the response of a saved model for the rows of a CSV " \
+		"file.\n\n" \
+	"USAGE:\n" \
+	"\tpredict [-h] [-i <path>] [-b] [-a] [-x] [-N <threads>] " \
+		"-m <path>\n\n" \
+	"STANDARD OPTIONS:\n" \
+	"\t-h, --help\tPrint this help message.\n" \
+	"\t-i, --input\tSpecify input file. If not given, stdin will be " \
+		"used.\n" \
+	"\t-b, --binary\tWrite the binary stream the other tools read " \
+		"instead of\n" \
+	"\t\t\tCSV, saving them from parsing text.\n" \
+	"\t-N, --threads\tNumber of threads (default: all cores, or " \
+		"OMP_NUM_THREADS).\n\n" \
+	"PREDICTION OPTIONS:\n" \
+	"\t-m, --model\tThe <name>.model or <name>.coef file written by " \
+		"lm, plm,\n" \
+	"\t\t\ttsvdlm or step with --name. The first loads fastest.\n" \
+	"\t-a, --append\tWrite each input row followed by its prediction " \
+		"rather\n" \
+	"\t\t\tthan the prediction alone.\n" \
+	"\t-x, --export\tPrint the model as text, in the format of " \
+		"<name>.coef,\n" \
+	"\t\t\tand exit.\n\n" \
+	"The input needs every column the model uses, in any order. " \
+		"Predictions\n" \
+	"are on the scale of the response, its transformation being " \
+		"undone.\n" \
+	"Categories not seen in training add nothing, as does the last " \
+		"category\n" \
+	"of a dummy encoded column. Fields of a predictor that are not " \
+		"numbers\n" \
+	"count as 0, as they do in training.\n"
+
+// A saved model and the predictors it needs from the input
+typedef struct {
+	modelFile file;
+	double intercept;
+	int npred;			// numeric predictors
+	const char ** names;
+	gsl_vector * beta;
+	int * fields;			// of the predictors in the input
+	int * encodedFields;		// of the encoded columns
+} predictModel;
+
+/*
+ * What a category of encoded column e adds to the prediction: its dummy
+ * coefficient, or its target encoding times the column's coefficient.
+ * Categories not seen in training add 0.
+ */
+double predict_lookup(const modelFile * model, const modelEncoding * e,
+		const csvField * field)
+{
+	char number[32];
+	const char * key = field->start;
+	size_t len = field->len;
+	int c;
+	int32_t k;
+	double x;
+
+	// Packed numbers of a binary input are matched by their text
+	if (len == BINARY_CELL_LEN && binary_unpack(key, &x)) {
+		len = binary_format(x, number);
+		key = number;
+	}
+	c = model_file_lookup(model, e, key, len);
+	if (c < 0) return 0;
+	if (model->header->encoding == ENCODE_DUMMY) {
+		k = ((const int32_t *) (model->data + e->indicators))[c];
+		return k >= 0 ? model->coef[k] : 0;
+	}
+
+	return e->coef >= 0 ? model->coef[e->coef] *
+		((const double *) (model->data + e->values))[c] : 0;
+}
+
+/*
+ * Split the coefficients into the intercept, those of the encoded columns
+ * and, the rest, the numeric predictors.
+ */
+void predict_prepare(predictModel * model)
+{
+	const modelFile * file = &model->file;
+	uint32_t ncoef = file->header->ncoef;
+	bool * used = calloc(ncoef, sizeof(bool));
+
+	for (uint32_t k = 0; k < file->header->nencoded; k++) {
+		const modelEncoding * e = file->encodings + k;
+		const int32_t * indicators =
+			(const int32_t *) (file->data + e->indicators);
+
+		if (e->coef >= 0) used[e->coef] = true;
+		for (uint32_t c = 0; c < e->ncat; c++) {
+			if (indicators[c] >= 0) used[indicators[c]] = true;
+		}
+	}
+
+	model->intercept = 0;
+	model->npred = 0;
+	model->names = malloc(ncoef * sizeof(char *));
+	model->beta = gsl_vector_alloc(ncoef);
+	for (uint32_t k = 0; k < ncoef; k++) {
+		const char * name = model_file_name(file, k);
+
+		if (used[k]) continue;
+		if (!strcmp(name, "intercept")) {
+			model->intercept += file->coef[k];
+			continue;
+		}
+		model->names[model->npred] = name;
+		gsl_vector_set(model->beta, model->npred++, file->coef[k]);
+	}
+	model->fields = malloc(GSL_MAX(model->npred, 1) * sizeof(int));
+	model->encodedFields = malloc(GSL_MAX(file->header->nencoded, 1) *
+			sizeof(int));
+	free(used);
+}
+
+// Find the input field of every predictor and encoded column
+int predict_fields(predictModel * model, char ** names, int nfield)
+{
+	const modelFile * file = &model->file;
+
+	for (int j = 0; j < model->npred; j++) {
+		model->fields[j] = csv_column(names, nfield, model->names[j]);
+		if (model->fields[j] < 0) {
+			fprintf(stderr, "Column '%s' not found.\n",
+					model->names[j]);
+			return 1;
+		}
+	}
+	for (uint32_t k = 0; k < file->header->nencoded; k++) {
+		const char * name = file->strings + file->encodings[k].name;
+
+		model->encodedFields[k] = csv_column(names, nfield, name);
+		if (model->encodedFields[k] < 0) {
+			fprintf(stderr, "Column '%s' not found.\n", name);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void predict_free(predictModel * model)
+{
+	free(model->names);
+	free(model->fields);
+	free(model->encodedFields);
+	gsl_vector_free(model->beta);
+	model_file_close(&model->file);
+}
+
+/*
+ * Fill row i of the block with the predictors of a line, and y[i] with the
+ * intercept and what its categories add. Predictors that are not numbers
+ * are left at 0.
+ */
+void predict_row(const predictModel * model, const char * line,
+		const char * stop, int * slots, gsl_matrix * X, double * y,
+		size_t i)
+{
+	const char * p = line;
+	csvField field;
+	double x;
+	double sum = model->intercept;
+	double * row = gsl_matrix_ptr(X, i, 0);
+
+	for (int j = 0; j < model->npred; j++) row[j] = 0;
+	for (int f = 0; csv_next_field(&p, stop, &field); f++) {
+		int slot = slots[f];
+
+		if (slot >= 0 && csv_number(&field, &x)) {
+			row[slot] = x;
+		} else if (slot < -1) {
+			sum += predict_lookup(&model->file,
+					model->file.encodings - slot - 2,
+					&field);
+		}
+	}
+	y[i] = sum;
+}
+
+int main(int argc, char * argv[])
+{
+	// Options
+	int opt;
+	int threads;
+	const struct option commandOptions[] = {
+		{"help",	no_argument,		NULL,	'h'},
+		{"input",	required_argument,	NULL,	'i'},
+		{"model",	required_argument,	NULL,	'm'},
+		{"append",	no_argument,		NULL,	'a'},
+		{"binary",	no_argument,		NULL,	'b'},
+		{"export",	no_argument,		NULL,	'x'},
+		{"threads",	required_argument,	NULL,	'N'},
+		{NULL,		0,			NULL,	0}
+	};
+
+	char * modelPath = NULL;
+	FILE * input = stdin;
+	bool append = false;
+	bool binaryOut = false;
+	bool export = false;
+	int nfield;
+	int nout;
+	char ** names;
+	char ** outNames;
+	int * slots;
+	char * lines[PREDICT_BLOCK_ROWS] = {NULL};
+	size_t lengths[PREDICT_BLOCK_ROWS] = {0};
+	const char * stops[PREDICT_BLOCK_ROWS];
+	char * text;
+	size_t nrows;
+	ssize_t got;
+	predictModel model = {0};
+	gsl_matrix * X;
+	gsl_vector * y;
+	binaryReader * binary = NULL;
+	binaryWriter * writer = NULL;
+
+	while ((opt = getopt_long_only(argc, argv, "hi:m:abxN:",
+					commandOptions, NULL)) != -1) {
+		switch (opt) {
+			case 'h':
+				printf(HELP_MESSAGE);
+				return 0;
+			case 'i':
+				input = fopen(optarg, "r");
+				if (!input) {
+					fprintf(stderr, "Could not open "
+							"'%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'm':
+				modelPath = optarg;
+				break;
+			case 'a':
+				append = true;
+				break;
+			case 'b':
+				binaryOut = true;
+				break;
+			case 'x':
+				export = true;
+				break;
+			case 'N':
+				if (sscanf(optarg, "%d", &threads) != 1 ||
+						threads < 1) {
+					fprintf(stderr, "Threads must be "
+							"positive.\n");
+					return 1;
+				}
+				blas_set_threads(threads);
+				break;
+			default:
+				fprintf(stderr, HELP_MESSAGE);
+				return 1;
+		};
+	}
+	if (!modelPath) {
+		fprintf(stderr, "A model is required.\n");
+		return 1;
+	}
+	if (model_file_open(modelPath, &model.file)) return 1;
+	if (export) {
+		model_file_export(&model.file, stdout);
+		model_file_close(&model.file);
+		return 0;
+	}
+	if (model.file.header->kind != MODEL_LINEAR) {
+		fprintf(stderr, "Models fit with --absorb, --interact, --poly "
+				"or --spline cannot be scored.\n");
+		model_file_close(&model.file);
+		return 1;
+	}
+	predict_prepare(&model);
+
+	if ((got = binary_read_line(input, &binary, binaryOut, lines,
+					lengths)) == -1) {
+		fprintf(stderr, "No header row.\n");
+		return 1;
+	}
+	stops[0] = lines[0] + strcspn(lines[0], "\r\n");
+	nfield = csv_header(lines[0], stops[0], &names);
+	if (predict_fields(&model, names, nfield)) return 1;
+
+	// Predictor slot of each field, or -2 - e for encoded column e
+	slots = malloc(nfield * sizeof(int));
+	for (int f = 0; f < nfield; f++) slots[f] = -1;
+	for (int j = 0; j < model.npred; j++) slots[model.fields[j]] = j;
+	for (uint32_t e = 0; e < model.file.header->nencoded; e++) {
+		slots[model.encodedFields[e]] = -2 - (int) e;
+	}
+
+	// Header
+	nout = append ? nfield + 1 : 1;
+	outNames = malloc(nout * sizeof(char *));
+	for (int f = 0; f < nout - 1; f++) outNames[f] = names[f];
+	outNames[nout - 1] = "prediction";
+	if (binaryOut) {
+		writer = binary_writer_open(stdout, outNames, nout);
+	} else {
+		if (append) {
+			fwrite(lines[0], 1, stops[0] - lines[0], stdout);
+			putchar(',');
+		}
+		printf("%s\n", outNames[nout - 1]);
+	}
+
+	X = gsl_matrix_alloc(PREDICT_BLOCK_ROWS, GSL_MAX(model.npred, 1));
+	y = gsl_vector_alloc(PREDICT_BLOCK_ROWS);
+	text = malloc(PREDICT_BLOCK_ROWS * PREDICT_WIDTH);
+	do {
+		// Gather a block of non-empty lines
+		nrows = 0;
+		while (nrows < PREDICT_BLOCK_ROWS && (got = binary_read_line(
+						input, &binary, binaryOut,
+						lines + nrows,
+						lengths + nrows)) != -1) {
+			csv_line(lines[nrows], lines[nrows] + got,
+					stops + nrows);
+			if (stops[nrows] > lines[nrows]) nrows++;
+		}
+		if (nrows == 0) break;
+
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < nrows; i++) {
+			predict_row(&model, lines[i], stops[i], slots, X,
+					y->data, i);
+		}
+
+		if (model.npred > 0) {
+			gsl_matrix_view block = gsl_matrix_submatrix(X, 0, 0,
+					nrows, model.npred);
+			gsl_vector_view beta = gsl_vector_subvector(
+					model.beta, 0, model.npred);
+			gsl_vector_view yBlock = gsl_vector_subvector(y, 0,
+					nrows);
+
+			gsl_blas_dgemv(CblasNoTrans, 1.0, &block.matrix,
+					&beta.vector, 1.0, &yBlock.vector);
+		}
+
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < nrows; i++) {
+			double pred = gsl_vector_get(y, i);
+
+			if (model.file.header->transformation ==
+					TRANSFORM_LOG) {
+				pred = exp(pred);
+			} else if (model.file.header->transformation ==
+					TRANSFORM_LOG_OFFSET) {
+				pred = exp_offset(pred);
+			}
+			gsl_vector_set(y, i, pred);
+			if (!binaryOut) {
+				snprintf(text + i * PREDICT_WIDTH,
+						PREDICT_WIDTH, PREDICT_FORMAT,
+						pred);
+			}
+		}
+
+		// Written in order
+		for (size_t i = 0; i < nrows; i++) {
+			if (binaryOut) {
+				const char * p = lines[i];
+				csvField field;
+
+				for (int f = 0; append && f < nfield &&
+						csv_next_field(&p, stops[i],
+							&field); f++) {
+					binary_put_field(writer, &field);
+				}
+				while (append && writer->col < nfield) {
+					binary_put_text(writer, "", 0);
+				}
+				binary_put_number(writer,
+						gsl_vector_get(y, i));
+				binary_end_row(writer);
+				continue;
+			}
+			if (append) {
+				fwrite(lines[i], 1, stops[i] - lines[i],
+						stdout);
+				putchar(',');
+			}
+			fputs(text + i * PREDICT_WIDTH, stdout);
+			putchar('\n');
+		}
+	} while (nrows == PREDICT_BLOCK_ROWS);
+	if (writer) binary_writer_close(writer);
+	if (binary) binary_reader_close(binary);
+	if (input != stdin) fclose(input);
+
+	for (int i = 0; i < PREDICT_BLOCK_ROWS; i++) {
+		free(lines[i]);
+	}
+	for (int f = 0; f < nfield; f++) {
+		free(names[f]);
+	}
+	free(names);
+	free(outNames);
+	free(slots);
+	free(text);
+	gsl_matrix_free(X);
+	gsl_vector_free(y);
+	predict_free(&model);
+
+	return 0;
+}
@@ -1,4 +1,14 @@
 #include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "filter.h"
+#include "model_utils.h"
+#include "model_file.h"
+#include "gram.h"
+#include "group.h"
+#include "step.h"
+#include "norm.h"
+#include <unistd.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -365,6 +375,836 @@ static void test_read_rows_carriage_return(void ** state)
 	fclose(input);
 }
 
+static void test_read_rows_binary(void ** state)
+{
+	(void) state;
+	int nrow;
+	double x;
+	char ** lines = NULL;
+	char * names[] = {"a", "b"};
+	char * buffer;
+	size_t size;
+	FILE * stream = open_memstream(&buffer, &size);
+	binaryWriter * writer;
+	FILE * input;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	writer = binary_writer_open(stream, names, 2);
+	binary_put_number(writer, 1.5);
+	binary_put_text(writer, "x", 1);
+	binary_end_row(writer);
+	binary_put_number(writer, -2);
+	binary_put_text(writer, "y", 1);
+	binary_end_row(writer);
+	binary_writer_close(writer);
+	fclose(stream);
+
+	input = fmemopen(buffer, size, "r");
+	nrow = read_rows(&lines, input);
+	assert_int_equal(nrow, 2);
+	assert_string_equal(lines[0], "a,b");
+	// Numbers come out packed, text as it was
+	assert_true(binary_unpack(lines[1], &x));
+	assert_true(x == 1.5);
+	assert_string_equal(lines[1] + BINARY_CELL_LEN, ",x");
+	assert_true(binary_unpack(lines[2], &x));
+	assert_true(x == -2);
+	assert_string_equal(lines[2] + BINARY_CELL_LEN, ",y");
+	for (int i = 0; i <= nrow; i++) {
+		free(lines[i]);
+	}
+	free(lines);
+	fclose(input);
+	free(buffer);
+}
+
+// binary_pack and binary_unpack
+static void test_binary_pack_round_trip(void ** state)
+{
+	(void) state;
+	double values[] = {0, -0.0, 1, -2.5, 0.1, 1e-310, -1e300, INFINITY};
+	char cell[BINARY_CELL_LEN];
+	double x;
+
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		binary_pack(values[i], cell);
+		assert_int_equal(cell[0], BINARY_CELL);
+		// Cells sit inside csv lines
+		assert_null(memchr(cell, ',', BINARY_CELL_LEN));
+		assert_null(memchr(cell, '\0', BINARY_CELL_LEN));
+		assert_true(binary_unpack(cell, &x));
+		assert_memory_equal(&x, values + i, sizeof(double));
+	}
+}
+
+static void test_binary_unpack_invalid(void ** state)
+{
+	(void) state;
+	char cell[BINARY_CELL_LEN];
+	double x;
+
+	assert_false(binary_unpack("1.5,2", &x));
+	binary_pack(1.5, cell);
+	cell[4] &= 0x7f;
+	assert_false(binary_unpack(cell, &x));
+}
+
+// binary_writer and binary_getline
+static void test_binary_round_trip_mixed(void ** state)
+{
+	(void) state;
+	char * names[] = {"y", "name", "z"};
+	char * buffer;
+	char * line = NULL;
+	size_t size;
+	size_t len = 0;
+	FILE * stream = open_memstream(&buffer, &size);
+	binaryWriter * writer;
+	binaryReader * reader;
+	FILE * input;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	writer = binary_writer_open(stream, names, 3);
+	binary_put_number(writer, 1.5);
+	binary_put_text(writer, "ab", 2);
+	binary_put_text(writer, "", 0);
+	binary_end_row(writer);
+	binary_put_number(writer, -2);
+	binary_put_number(writer, 3);
+	binary_put_number(writer, 0.1);
+	binary_end_row(writer);
+	// Cells not put are left empty
+	binary_put_number(writer, 4);
+	binary_end_row(writer);
+	binary_writer_close(writer);
+	fclose(stream);
+
+	input = fmemopen(buffer, size, "r");
+	reader = NULL;
+	assert_int_equal(binary_read_line(input, &reader, false, &line, &len),
+			strlen("y,name,z"));
+	assert_non_null(reader);
+	assert_string_equal(line, "y,name,z");
+	binary_getline(reader, &line, &len);
+	assert_string_equal(line, "1.5,ab,");
+	binary_getline(reader, &line, &len);
+	assert_string_equal(line, "-2,3,0.1");
+	binary_getline(reader, &line, &len);
+	assert_string_equal(line, "4,,");
+	assert_int_equal(binary_getline(reader, &line, &len), -1);
+	binary_reader_close(reader);
+	fclose(input);
+	free(line);
+	free(buffer);
+}
+
+static void test_binary_round_trip_batches(void ** state)
+{
+	(void) state;
+	char * names[] = {"i", "label"};
+	char * buffer;
+	char * line = NULL;
+	char expected[64];
+	size_t size;
+	size_t len = 0;
+	int nrow = BINARY_BATCH_ROWS + 2;
+	int got = 0;
+	FILE * stream = open_memstream(&buffer, &size);
+	binaryWriter * writer;
+	binaryReader * reader;
+	FILE * input;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	// The labels are numbers up to the first full batch, text after
+	writer = binary_writer_open(stream, names, 2);
+	for (int i = 0; i < nrow; i++) {
+		binary_put_number(writer, i);
+		if (i < BINARY_BATCH_ROWS) {
+			binary_put_number(writer, -i);
+		} else {
+			binary_put_text(writer, "last", 4);
+		}
+		binary_end_row(writer);
+	}
+	binary_writer_close(writer);
+	fclose(stream);
+
+	input = fmemopen(buffer, size, "r");
+	getline(&line, &len, input);
+	assert_true(binary_detect(line, strlen(line)));
+	reader = binary_reader_open(input, false);
+	assert_non_null(reader);
+	binary_getline(reader, &line, &len);
+	assert_string_equal(line, "i,label");
+	while (binary_getline(reader, &line, &len) != -1) {
+		if (got < BINARY_BATCH_ROWS) {
+			sprintf(expected, "%d,%d", got, -got);
+		} else {
+			sprintf(expected, "%d,last", got);
+		}
+		assert_string_equal(line, expected);
+		got++;
+	}
+	assert_int_equal(got, nrow);
+	binary_reader_close(reader);
+	fclose(input);
+	free(line);
+	free(buffer);
+}
+
+// filter_compile and filter_match
+static bool filter_matches(const char * expression, const char * line)
+{
+	const char * header = "a,b,store,unit price";
+	char ** names;
+	int nfield;
+	bool * stack;
+	bool match;
+	filterProgram program;
+	filterRow row;
+
+	assert_int_equal(filter_compile(expression, &program), 0);
+	nfield = csv_header(header, header + strlen(header), &names);
+	assert_int_equal(filter_row_open(&program, names, nfield, &row), 0);
+	stack = malloc(program.depth * sizeof(bool));
+	match = filter_match(&program, &row, line, line + strlen(line),
+			stack);
+
+	for (int f = 0; f < nfield; f++) {
+		free(names[f]);
+	}
+	free(names);
+	free(stack);
+	filter_row_free(&row);
+	filter_free(&program);
+
+	return match;
+}
+
+// What filter_compile() writes to stderr on a malformed expression
+static char * filter_error(const char * expression)
+{
+	static char message[256];
+	filterProgram program;
+	FILE * err = tmpfile();
+	int saved;
+	size_t got;
+
+	fflush(stderr);
+	saved = dup(fileno(stderr));
+	dup2(fileno(err), fileno(stderr));
+	assert_int_not_equal(filter_compile(expression, &program), 0);
+	fflush(stderr);
+	dup2(saved, fileno(stderr));
+	close(saved);
+	filter_free(&program);
+
+	rewind(err);
+	got = fread(message, 1, sizeof(message) - 1, err);
+	message[got] = '\0';
+	fclose(err);
+
+	return message;
+}
+
+static void test_filter_precedence(void ** state)
+{
+	(void) state;
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	// && binds tighter than ||, ! tighter than both
+	assert_true(filter_matches("a == 1 || a == 2 && b == 3", "1,0,x,"));
+	assert_false(filter_matches("(a == 1 || a == 2) && b == 3",
+				"1,0,x,"));
+	assert_true(filter_matches("!a == 2 and b == 0", "1,0,x,"));
+	assert_false(filter_matches("not (a == 1 or b == 1)", "1,0,x,"));
+	assert_true(filter_matches("a < 2 && a <= 1 && a >= 1 && a > 0",
+				"1,0,x,"));
+}
+
+static void test_filter_in_sets(void ** state)
+{
+	(void) state;
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	assert_true(filter_matches("store in (\"B7\", \"A9\", \"C1\")",
+				"1,0,A9,"));
+	assert_false(filter_matches("store in (\"B7\", \"C1\")",
+				"1,0,A9,"));
+	assert_false(filter_matches("store in (\"A\")", "1,0,A9,"));
+	assert_true(filter_matches("a in (3, -1, 1.5)", "1.5,0,A9,"));
+	assert_false(filter_matches("a in (3, -1)", "1.5,0,A9,"));
+}
+
+static void test_filter_isna(void ** state)
+{
+	(void) state;
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	assert_true(filter_matches("isna(a)", ",0,A9,2"));
+	assert_true(filter_matches("isna(a)", "NA,0,A9,2"));
+	assert_true(filter_matches("isna(a)", "nan,0,A9,2"));
+	assert_false(filter_matches("isna(a)", "0,0,A9,2"));
+	// Fields past the end of a short row are empty
+	assert_true(filter_matches("isna(`unit price`)", "1,0"));
+	assert_false(filter_matches("not isna(`unit price`)", "1,0,A9"));
+}
+
+static void test_filter_not_number(void ** state)
+{
+	(void) state;
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	// Text fails every comparison with a number, != included
+	assert_false(filter_matches("store != 1", "1,0,A9,"));
+	assert_false(filter_matches("store == 1", "1,0,A9,"));
+	assert_false(filter_matches("a in (1)", "NA,0,A9,"));
+	assert_true(filter_matches("store != \"B7\"", "1,0,A9,"));
+}
+
+static void test_filter_errors(void ** state)
+{
+	(void) state;
+	char deep[2 * FILTER_MAX_DEPTH + 8];
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	assert_string_equal(filter_error("store == \"A9"),
+			"Unterminated \" in expression.\n");
+	assert_string_equal(filter_error("a == 1 b"),
+			"Unexpected text at the end of the expression: b\n");
+	assert_string_equal(filter_error("a = 1"),
+			"Unexpected '=' in expression.\n");
+	assert_string_equal(filter_error("a 1"),
+			"Expected a comparison in expression near '1'.\n");
+	assert_string_equal(filter_error("a == b"),
+			"Columns are compared with a number or quoted text.\n");
+	assert_string_equal(filter_error("a in (1, \"x\")"),
+			"Sets hold either numbers or quoted text.\n");
+	assert_string_equal(filter_error("(a == 1"),
+			"Expected ')' in expression near ''.\n");
+
+	// Parentheses and negations nest no deeper than the stack may
+	memset(deep, '(', 2 * FILTER_MAX_DEPTH);
+	strcpy(deep + 2 * FILTER_MAX_DEPTH, "a == 1");
+	assert_string_equal(filter_error(deep),
+			"Expression nested too deeply.\n");
+	memset(deep, '!', 2 * FILTER_MAX_DEPTH);
+	assert_string_equal(filter_error(deep),
+			"Expression nested too deeply.\n");
+	assert_true(filter_matches("!!!!(((!(a == 2))))", "1,0,x,"));
+}
+
+// model_file_build, model_file_view, model_file_export and
+// model_file_read_text
+static char * model_test_build(size_t * size)
+{
+	char * names[] = {"intercept", "x1", "store"};
+	double coef[] = {0.5, 2, -1.25};
+	double covariance[] = {1, 0.1, 0.2, 0.1, 2, 0.3, 0.2, 0.3, 3};
+	char * categories[] = {"A9", "B7"};
+	double values[] = {1.5, 2.5};
+	encodeData store = {"store", categories, NULL, values, 2};
+	modelInfo info = {
+		.transformation = TRANSFORM_LOG,
+		.encoding = ENCODE_MEAN_TARGET,
+		.kind = MODEL_LINEAR,
+		.ncoef = 3,
+		.names = names,
+		.coef = coef,
+		.covariance = covariance,
+		.encodings = &store,
+		.response = "y",
+		.nrow = 10,
+		.rss = 4.25
+	};
+
+	return model_file_build(&info, size);
+}
+
+static void test_model_file_round_trip(void ** state)
+{
+	(void) state;
+	char * data;
+	char * again;
+	char * text;
+	size_t size;
+	size_t againSize;
+	size_t textSize;
+	modelFile model;
+	modelInfo info;
+	FILE * output;
+	FILE * input;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	data = model_test_build(&size);
+	assert_int_equal(model_file_view(&model, data, size, false), 0);
+	assert_int_equal(model.header->ncoef, 3);
+	assert_int_equal(model.header->nencoded, 1);
+	assert_string_equal(model_file_name(&model, 2), "store");
+	assert_true(model.coef[2] == -1.25);
+	assert_true(model.covariance[5] == 0.3);
+	assert_int_equal(model_file_lookup(&model, model.encodings, "B7", 2),
+			1);
+	assert_int_equal(model_file_lookup(&model, model.encodings, "C1", 2),
+			-1);
+
+	output = open_memstream(&text, &textSize);
+	model_file_export(&model, output);
+	fclose(output);
+	input = fmemopen(text, textSize, "r");
+	assert_int_equal(model_file_read_text(input, &info), 0);
+	fclose(input);
+	free(text);
+	assert_int_equal(info.transformation, TRANSFORM_LOG);
+	assert_int_equal(info.encoding, ENCODE_MEAN_TARGET);
+	assert_int_equal(info.ncoef, 3);
+	assert_string_equal(info.response, "y");
+	assert_int_equal(info.nrow, 10);
+	assert_true(info.rss == 4.25);
+	assert_string_equal(info.encodings->textValues[1], "B7");
+	assert_true(info.encodings->numValues[1] == 2.5);
+
+	// The text holds all of the model, to the last bit
+	again = model_file_build(&info, &againSize);
+	assert_int_equal(againSize, size);
+	assert_memory_equal(again, data, size);
+	model_info_free(&info);
+	free(again);
+	model_file_close(&model);
+}
+
+static void test_model_file_view_damaged(void ** state)
+{
+	(void) state;
+	char * data;
+	size_t size;
+	modelFile model;
+	modelHeader * header;
+	modelEncoding * e;
+	uint64_t table;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	data = model_test_build(&size);
+	header = (modelHeader *) data;
+	e = (modelEncoding *) (data + header->encodings);
+
+	// Truncated
+	assert_int_not_equal(model_file_view(&model, data, size - 8, false),
+			0);
+	assert_int_not_equal(model_file_view(&model, data, 16, false), 0);
+
+	// Damaged in the header, then in an encoding
+	data[0] = 'X';
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+	data[0] = MODEL_MAGIC[0];
+	header->ncoef = 1 << 30;
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+	header->ncoef = 3;
+	header->kind = MODEL_SPLINE + 1;
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+	header->kind = MODEL_LINEAR;
+	table = e->table;
+	e->table = size;
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+	e->table = MODEL_ALIGN(size / 2) + 1;
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+
+	// A full table would leave lookups of unknown keys probing forever
+	e->table = table;
+	for (uint32_t s = 0; s <= e->mask; s++) {
+		((uint32_t *) (data + table))[s] = 1;
+	}
+	assert_int_not_equal(model_file_view(&model, data, size, false), 0);
+
+	free(data);
+}
+
+// gram_augmented and gram_sweep
+static void gram_test_data(gsl_matrix * X, gsl_vector * y)
+{
+	for (size_t i = 0; i < X->size1; i++) {
+		double value = 1;
+
+		gsl_matrix_set(X, i, 0, 1);
+		for (size_t j = 1; j < X->size2; j++) {
+			gsl_matrix_set(X, i, j, sin(0.7 * (i + 1) * j) + j);
+			value += j % 2 ? 2 * gsl_matrix_get(X, i, j) :
+				-gsl_matrix_get(X, i, j);
+		}
+		gsl_vector_set(y, i, value + cos(1.3 * i));
+	}
+}
+
+static void test_gram_augmented(void ** state)
+{
+	(void) state;
+	size_t n = 50;
+	size_t p = 4;
+	gsl_matrix * X;
+	gsl_vector * y;
+	gsl_matrix * A;
+
+	will_return_always(__wrap_malloc, false);
+	will_return_maybe(__wrap_gsl_vector_alloc, false);
+	ignore_function_calls(__wrap_free);
+	X = gsl_matrix_alloc(n, p);
+	y = gsl_vector_alloc(n);
+	A = gsl_matrix_alloc(p + 1, p + 1);
+	gram_test_data(X, y);
+	gram_augmented(X, y, A);
+
+	// Cross products of [X y], as sums over the rows
+	for (size_t j = 0; j <= p; j++) {
+		for (size_t k = 0; k <= p; k++) {
+			double sum = 0;
+
+			for (size_t i = 0; i < n; i++) {
+				sum += (j < p ? gsl_matrix_get(X, i, j) :
+						gsl_vector_get(y, i)) *
+					(k < p ? gsl_matrix_get(X, i, k) :
+					 gsl_vector_get(y, i));
+			}
+			assert_true(fabs(gsl_matrix_get(A, j, k) - sum) <=
+					1e-12 * fabs(sum) + 1e-12);
+		}
+	}
+
+	gsl_matrix_free(A);
+	gsl_vector_free(y);
+	gsl_matrix_free(X);
+}
+
+static void test_gram_sweep_least_squares(void ** state)
+{
+	(void) state;
+	size_t n = 50;
+	size_t p = 4;
+	double rss = 0;
+	gsl_matrix * X;
+	gsl_vector * y;
+	gsl_vector * resid;
+	gsl_matrix * A;
+	gsl_matrix * A0;
+
+	will_return_always(__wrap_malloc, false);
+	will_return_maybe(__wrap_gsl_vector_alloc, false);
+	ignore_function_calls(__wrap_free);
+	X = gsl_matrix_alloc(n, p);
+	y = gsl_vector_alloc(n);
+	resid = gsl_vector_alloc(n);
+	A = gsl_matrix_alloc(p + 1, p + 1);
+	A0 = gsl_matrix_alloc(p + 1, p + 1);
+	gram_test_data(X, y);
+	gram_augmented(X, y, A);
+	gsl_matrix_memcpy(A0, A);
+
+	for (size_t j = 0; j < p; j++) {
+		gram_sweep(A, j, false);
+	}
+
+	// The last column holds coefficients whose residuals are orthogonal
+	// to X, and the corner their sum of squares
+	for (size_t i = 0; i < n; i++) {
+		double r = gsl_vector_get(y, i);
+
+		for (size_t j = 0; j < p; j++) {
+			r -= gsl_matrix_get(X, i, j) * gsl_matrix_get(A, j, p);
+		}
+		gsl_vector_set(resid, i, r);
+		rss += r * r;
+	}
+	for (size_t j = 0; j < p; j++) {
+		double dot = 0;
+
+		for (size_t i = 0; i < n; i++) {
+			dot += gsl_matrix_get(X, i, j) *
+				gsl_vector_get(resid, i);
+		}
+		assert_true(fabs(dot) < 1e-8);
+	}
+	assert_true(fabs(gsl_matrix_get(A, p, p) - rss) < 1e-9 * rss);
+
+	// Unsweeping, in any order, restores A
+	for (size_t j = p; j-- > 0;) {
+		gram_sweep(A, (j + 2) % p, true);
+	}
+	for (size_t j = 0; j <= p; j++) {
+		for (size_t k = 0; k <= p; k++) {
+			double a0 = gsl_matrix_get(A0, j, k);
+
+			assert_true(fabs(gsl_matrix_get(A, j, k) - a0) <=
+					1e-9 * fabs(a0) + 1e-9);
+		}
+	}
+
+	gsl_matrix_free(A0);
+	gsl_matrix_free(A);
+	gsl_vector_free(resid);
+	gsl_vector_free(y);
+	gsl_matrix_free(X);
+}
+
+// Each SIMD kernel agrees with gram_tile_scalar() on every panel of its tile
+static void test_gram_tiles(void ** state)
+{
+	(void) state;
+	size_t rows = 37;
+	size_t stride = rows * GRAM_PANEL;
+	const char * names[] = {"scalar", "avx2", "avx512"};
+	double a[rows * GRAM_PANEL];
+	double b[GRAM_TILE_MAX_WIDTH / GRAM_PANEL * rows * GRAM_PANEL];
+	double expected[GRAM_TILE_ROWS * GRAM_PANEL];
+	double acc[GRAM_TILE_ROWS * GRAM_TILE_MAX_WIDTH];
+
+	for (size_t i = 0; i < sizeof(a) / sizeof(a[0]); i++) {
+		a[i] = sin(0.37 * i);
+	}
+	for (size_t i = 0; i < sizeof(b) / sizeof(b[0]); i++) {
+		b[i] = cos(0.53 * i) * (1 + i % 3);
+	}
+	assert_non_null(gram_kernel(NULL));
+	assert_null(gram_kernel("none"));
+
+	for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+		const gramKernel * kernel = gram_kernel(names[k]);
+
+		// Kernels the CPU does not support are not tested
+		if (!kernel) continue;
+		kernel->tile(a, b, rows, stride, acc);
+		for (size_t panel = 0; panel < kernel->width / GRAM_PANEL;
+				panel++) {
+			gram_tile_scalar(a, b + panel * stride, rows, stride,
+					expected);
+			for (int t = 0; t < GRAM_TILE_ROWS; t++) {
+				for (int c = 0; c < GRAM_PANEL; c++) {
+					double e = expected[t * GRAM_PANEL + c];
+					double got = acc[t * kernel->width +
+						panel * GRAM_PANEL + c];
+
+					assert_true(fabs(got - e) <= 1e-12 *
+							rows * (1 + fabs(e)));
+				}
+			}
+		}
+	}
+}
+
+// subset_search
+static void test_subset_search_exhaustive(void ** state)
+{
+	(void) state;
+	size_t n = 40;
+	size_t p = 6;
+	int keep = 2;
+	double rss[6][2];
+	uint64_t sets[6][2];
+	int count[6] = {0};
+	gsl_matrix * X;
+	gsl_vector * y;
+	gsl_matrix * A;
+	gsl_matrix * B;
+	subsetTable table;
+
+	will_return_always(__wrap_malloc, false);
+	will_return_maybe(__wrap_gsl_vector_alloc, false);
+	ignore_function_calls(__wrap_free);
+	X = gsl_matrix_alloc(n, p);
+	y = gsl_vector_alloc(n);
+	A = gsl_matrix_alloc(p + 1, p + 1);
+	B = gsl_matrix_alloc(p + 1, p + 1);
+	gram_test_data(X, y);
+	gram_augmented(X, y, A);
+
+	// Every subset of the predictors after the intercept
+	for (uint64_t set = 0; set < UINT64_C(1) << p; set += 2) {
+		int size = __builtin_popcountll(set);
+		double r;
+		int i;
+
+		gsl_matrix_memcpy(B, A);
+		for (size_t j = 0; j < p; j++) {
+			if (j == 0 || (set >> j & 1)) gram_sweep(B, j, false);
+		}
+		r = gsl_matrix_get(B, p, p);
+		if (count[size] == keep && r >= rss[size][keep - 1]) continue;
+		if (count[size] < keep) count[size]++;
+		for (i = count[size] - 1; i > 0 && rss[size][i - 1] > r; i--) {
+			rss[size][i] = rss[size][i - 1];
+			sets[size][i] = sets[size][i - 1];
+		}
+		rss[size][i] = r;
+		sets[size][i] = set;
+	}
+
+	subset_find(&table, keep, A);
+	for (size_t size = 0; size < p; size++) {
+		assert_int_equal(table.count[size], count[size]);
+		for (int i = 0; i < count[size]; i++) {
+			assert_true(fabs(table.rss[size * keep + i] -
+						rss[size][i]) <=
+					1e-9 * rss[size][i]);
+			assert_int_equal(table.sets[size * keep + i],
+					sets[size][i]);
+		}
+	}
+	subset_table_free(&table);
+
+	gsl_matrix_free(B);
+	gsl_matrix_free(A);
+	gsl_vector_free(y);
+	gsl_matrix_free(X);
+}
+
+// group_lines and compress_lines
+static char ** group_test_lines(const char ** text, int n)
+{
+	char ** lines = malloc(n * sizeof(char *));
+
+	for (int i = 0; i < n; i++) {
+		lines[i] = strdup(text[i]);
+	}
+
+	return lines;
+}
+
+static void test_group_lines(void ** state)
+{
+	(void) state;
+	const char * text[] = {"y,k,x", "1,b,5", "2,a,6", "3,b,7", "4,c,8",
+		"5,a,9"};
+	size_t rowGroup[] = {0, 1, 0, 2, 1};
+	size_t order[] = {0, 2, 1, 4, 3};
+	char ** lines;
+	groupIndex groups;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	lines = group_test_lines(text, 6);
+	assert_int_equal(group_lines(lines, 5, "k", &groups), 0);
+	assert_int_equal(groups.ngroups, 3);
+	assert_string_equal(groups.keys[0], "b");
+	assert_string_equal(groups.keys[1], "a");
+	assert_string_equal(groups.keys[2], "c");
+	assert_memory_equal(groups.rowGroup, rowGroup, sizeof(rowGroup));
+	assert_memory_equal(groups.order, order, sizeof(order));
+	assert_int_equal(groups.start[1], 2);
+	assert_int_equal(groups.start[3], 5);
+	// The key column is taken out of the lines
+	assert_string_equal(lines[0], "y,x");
+	assert_string_equal(lines[4], "4,8");
+	group_free(&groups);
+
+	assert_int_not_equal(group_lines(lines, 5, "k", &groups), 0);
+	for (int i = 0; i < 6; i++) {
+		free(lines[i]);
+	}
+	free(lines);
+}
+
+static void test_compress_lines(void ** state)
+{
+	(void) state;
+	const char * text[] = {"y,a,b", "1,x,2", "3,x,2", "2,y,2", "5,x,2",
+		"4,y,2", "7,x,3"};
+	const char * distinct[] = {"y,a", "1,x", "2,y", "3,z", "4,w"};
+	const char * repeated[] = {"y,a,b", "1,x,2", "2,x,2", "3,x,2",
+		"4,x,2"};
+	char ** lines;
+	char ** kept;
+	compressedRows rows;
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	lines = group_test_lines(text, 7);
+	assert_int_equal(compress_lines(&lines, 6, 0, TRANSFORM_NONE, false,
+				&rows), 0);
+	assert_int_equal(rows.nrow, 3);
+	assert_int_equal(rows.total, 6);
+	assert_true(rows.count[0] == 3 && rows.mean[0] == 3 &&
+			rows.ss[0] == 8);
+	assert_true(rows.count[1] == 2 && rows.mean[1] == 3 &&
+			rows.ss[1] == 2);
+	assert_true(rows.count[2] == 1 && rows.mean[2] == 7 &&
+			rows.ss[2] == 0);
+	assert_string_equal(lines[0], "y,a,b");
+	assert_string_equal(lines[1], "3,x,2");
+	assert_string_equal(lines[3], "7,x,3");
+	compressed_free(&rows);
+	for (int i = 0; i <= 3; i++) {
+		free(lines[i]);
+	}
+	free(lines);
+
+	// Rows that do not repeat are left alone
+	lines = group_test_lines(distinct, 5);
+	kept = lines;
+	assert_int_equal(compress_lines(&lines, 4, 0, TRANSFORM_NONE, false,
+				&rows), 0);
+	assert_int_equal(rows.nrow, 0);
+	assert_true(lines == kept);
+	assert_string_equal(lines[2], "2,y");
+	for (int i = 0; i < 5; i++) {
+		free(lines[i]);
+	}
+	free(lines);
+
+	// As are rows too few for the columns of the design
+	lines = group_test_lines(repeated, 5);
+	kept = lines;
+	assert_int_equal(compress_lines(&lines, 4, 0, TRANSFORM_NONE, false,
+				&rows), 0);
+	assert_int_equal(rows.nrow, 0);
+	assert_true(lines == kept);
+	for (int i = 0; i < 5; i++) {
+		free(lines[i]);
+	}
+	free(lines);
+}
+
+static void test_design_width(void ** state)
+{
+	(void) state;
+	char * keys[] = {"x,2", "y,2", "z,3", "x,4"};
+
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+	assert_int_equal(design_width("y,a,b", keys, 4, false), 3);
+	// Three categories of a make two dummy columns
+	assert_int_equal(design_width("y,a,b", keys, 4, true), 4);
+	assert_int_equal(design_width("y,a,b", keys, 1, true), 3);
+}
+
+// norm_merge
+static void test_norm_merge(void ** state)
+{
+	(void) state;
+	normMoments all = {0};
+	normMoments parts[3] = {{0}};
+	normMoments merged = {0};
+
+	// Chunks of uneven size, one of them empty
+	for (int i = 0; i < 100; i++) {
+		double x = sin(i) * 10 + i % 7;
+
+		norm_update(&all, x);
+		norm_update(parts + (i < 30 ? 0 : 2), x);
+	}
+	for (int c = 0; c < 3; c++) {
+		norm_merge(&merged, parts + c);
+	}
+	assert_int_equal(merged.n, all.n);
+	assert_true(fabs(merged.mean - all.mean) < 1e-12);
+	assert_true(fabs(merged.m2 - all.m2) < 1e-9 * all.m2);
+	assert_true(merged.min == all.min);
+	assert_true(merged.max == all.max);
+}
+
 // read_columns
 static void test_read_columns_column_number(void ** state)
 {
@@ -409,6 +1249,7 @@ static void test_read_columns_error_return(void ** state)
 
 	column_free(columnHead);
 	free(lines);
+	lines = NULL;
 	fclose(input);
 
 	// Test with too many columns
@@ -513,6 +1354,7 @@ static void test_test_split_invalid_range(void ** state)
 	testRows = test_split(&lines, &testLines, testRatio, nrow);
 	assert_int_equal(testRows, 0);
 	free(lines);
+	lines = NULL;
 	fclose(input);
 
 	input = fmemopen(input_str, strlen(input_str), "r");
@@ -544,6 +1386,49 @@ static void test_test_split_round_ratio(void ** state)
 	fclose(input);
 }
 
+static void test_test_split_partition(void ** state)
+{
+	(void) state;
+	int nrow, testRows;
+	int last = 0;
+	int seen[9] = {0};
+	char ** lines = NULL;
+	char ** testLines = NULL;
+	char * input_str = "a\n1\n2\n3\n4\n5\n6\n7\n8\n";
+	FILE * input = fmemopen(input_str, strlen(input_str), "r");
+	will_return_always(__wrap_malloc, false);
+	ignore_function_calls(__wrap_free);
+
+	// Every row lands in exactly one split, each under the header, and
+	// the training rows keep their order
+	nrow = read_rows(&lines, input);
+	testRows = test_split(&lines, &testLines, 0.25, nrow);
+	assert_int_equal(testRows, 2);
+	assert_string_equal(lines[0], "a");
+	assert_string_equal(testLines[0], "a");
+	for (int i = 1; i <= nrow - testRows; i++) {
+		assert_true(atoi(lines[i]) > last);
+		last = atoi(lines[i]);
+		seen[last]++;
+	}
+	for (int i = 1; i <= testRows; i++) {
+		seen[atoi(testLines[i])]++;
+	}
+	for (int i = 1; i <= nrow; i++) {
+		assert_int_equal(seen[i], 1);
+	}
+
+	for (int i = 0; i <= nrow - testRows; i++) {
+		free(lines[i]);
+	}
+	for (int i = 0; i <= testRows; i++) {
+		free(testLines[i]);
+	}
+	free(lines);
+	free(testLines);
+	fclose(input);
+}
+
 // log_offset and exp_offset
 static void test_log_offset_transform(void ** state)
 {
@@ -558,9 +1443,9 @@ static void test_print_columns(void ** state)
 {
 	(void) state;
 	int nrow;
-	char * line;
+	char * line = NULL;
 	char ** lines = NULL;
-	size_t len;
+	size_t len = 0;
 	dataColumn * columnHead;
 	encodeData * encoding;
         char * input_str = "a,b,c\n1,2,3\n4,5,6\n7,8,9\n";
@@ -621,6 +1506,40 @@ int main(void) {
 		cmocka_unit_test(test_read_rows_number),
 		cmocka_unit_test(test_read_rows_carriage_return),
 		cmocka_unit_test(test_read_rows_null_input),
+		cmocka_unit_test(test_read_rows_binary),
+	};
+	const struct CMUnitTest binary_test[] = {
+		cmocka_unit_test(test_binary_pack_round_trip),
+		cmocka_unit_test(test_binary_unpack_invalid),
+		cmocka_unit_test(test_binary_round_trip_mixed),
+		cmocka_unit_test(test_binary_round_trip_batches),
+	};
+	const struct CMUnitTest filter_test[] = {
+		cmocka_unit_test(test_filter_precedence),
+		cmocka_unit_test(test_filter_in_sets),
+		cmocka_unit_test(test_filter_isna),
+		cmocka_unit_test(test_filter_not_number),
+		cmocka_unit_test(test_filter_errors),
+	};
+	const struct CMUnitTest model_file_test[] = {
+		cmocka_unit_test(test_model_file_round_trip),
+		cmocka_unit_test(test_model_file_view_damaged),
+	};
+	const struct CMUnitTest gram_test[] = {
+		cmocka_unit_test(test_gram_augmented),
+		cmocka_unit_test(test_gram_sweep_least_squares),
+		cmocka_unit_test(test_gram_tiles),
+	};
+	const struct CMUnitTest subset_test[] = {
+		cmocka_unit_test(test_subset_search_exhaustive),
+	};
+	const struct CMUnitTest group_test[] = {
+		cmocka_unit_test(test_group_lines),
+		cmocka_unit_test(test_compress_lines),
+		cmocka_unit_test(test_design_width),
+	};
+	const struct CMUnitTest norm_test[] = {
+		cmocka_unit_test(test_norm_merge),
 	};
 	const struct CMUnitTest read_columns_test[] = {
 		cmocka_unit_test(test_read_columns_column_number),
@@ -634,6 +1553,7 @@ int main(void) {
 		cmocka_unit_test(test_test_split_correct),
 		cmocka_unit_test(test_test_split_invalid_range),
 		cmocka_unit_test(test_test_split_round_ratio),
+		cmocka_unit_test(test_test_split_partition),
 	};
 	const struct CMUnitTest offset_transform_test[] = {
 		cmocka_unit_test(test_log_offset_transform),
@@ -648,6 +1568,13 @@ int main(void) {
 		cmocka_run_group_tests(translate_row_value_test, NULL, NULL) &
 		cmocka_run_group_tests(process_row_test, NULL, NULL) &
 		cmocka_run_group_tests(read_rows_test, NULL, NULL) &
+		cmocka_run_group_tests(binary_test, NULL, NULL) &
+		cmocka_run_group_tests(filter_test, NULL, NULL) &
+		cmocka_run_group_tests(model_file_test, NULL, NULL) &
+		cmocka_run_group_tests(gram_test, NULL, NULL) &
+		cmocka_run_group_tests(subset_test, NULL, NULL) &
+		cmocka_run_group_tests(group_test, NULL, NULL) &
+		cmocka_run_group_tests(norm_test, NULL, NULL) &
 		cmocka_run_group_tests(read_columns_test, NULL, NULL) &
 		cmocka_run_group_tests(includes_int_test, NULL, NULL) &
 		cmocka_run_group_tests(test_split_test, NULL, NULL) &
@@ -1,21 +1,29 @@
 #include "core.h"
+#include "csv.h"
+#include "binary.h"
 
 /*
  * Simple program to select:
  * a) columns to drop
  * b) columns to keep (mutually exclusive to previous)
  * c) which row will be the response
+ *
+ * Only the header is parsed: each row is then cut into field slices, and the
+ * chosen ones are written back out as they are, one row at a time.
  */
 
 #define HELP_MESSAGE \
 	"Choose, drop, and reorder columns of a CSV file.\n\n" \
 	"USAGE:\n" \
-	"\tselect [-h] [-i <path>] [-d <comma-sepparated columns>]\n" \
+	"\tselect [-h] [-i <path>] [-b] [-d <comma-sepparated columns>]\n" \
 	"\t\t[-c <comma-sepparated columns>] [-r <column>]\n\n" \
 	"STANDARD OPTIONS:\n" \
 	"\t-h, --help\tPrint this help message.\n" \
 	"\t-i, --input\tSpecify input file. If not given, stdin will be " \
-		"used.\n\n" \
+		"used.\n" \
+	"\t-b, --binary\tWrite the binary stream the other tools read " \
+		"instead of\n" \
+	"\t\t\tCSV, saving them from parsing text.\n\n" \
 	"COLUMN OPTIONS:\n" \
 	"\tOptions in this section each work by using either column names " \
 		"or the\n" \
@@ -28,6 +36,27 @@
 		"specify\n" \
 	"\t\t\tone column.\n"
 
+/*
+ * Resolve a column given by name or index, or report it. The response
+ * cannot also be chosen or dropped.
+ */
+int select_column(char ** names, int n, const char * token, int response,
+		const char * action)
+{
+	int i = csv_column(names, n, token);
+
+	if (i < 0) {
+		fprintf(stderr, "Column '%s' not found.\n", token);
+	} else if (i == response) {
+		fprintf(stderr, "Cannot \"%s\" column and specify as "
+				"response. It will %s.\n", action,
+				!strcmp(action, "drop") ? "be kept as the "
+				"response" : "only be set as the response");
+	}
+
+	return i;
+}
+
 int main(int argc, char * argv[])
 {
 	// Options
@@ -38,23 +67,32 @@ int main(int argc, char * argv[])
 		{"drop",	required_argument,	NULL,	'd'},
 		{"choose",	required_argument,	NULL,	'c'},
 		{"response",	required_argument,	NULL,	'r'},
+		{"binary",	no_argument,		NULL,	'b'},
+		{NULL,		0,			NULL,	0}
 	};
 
-	int nrow;
 	int ncol;
-	size_t response = 0;
+	int nout = 0;
+	int last = 0;
+	int response = 0;
+	int i;
+	bool binaryOut = false;
 	char * chooseStr = NULL;
 	char * dropStr = NULL;
 	char * responseStr = NULL;
+	char * line = NULL;
+	char ** names;
+	size_t len = 0;
+	ssize_t got;
 	FILE * input;
-	char ** lines = NULL;
-	dataColumn * outputColumns;
-	dataColumn * columnHead;
-	dataColumn * colPtr;
-	encodeData * encodingInfo;
+	int * order;
+	char ** outNames;
+	csvField * fields;
+	binaryReader * binary = NULL;
+	binaryWriter * writer = NULL;
 
 	input = stdin;
-	while ((opt = getopt_long_only(argc, argv, "hi:d:c:r:", commandOptions,
+	while ((opt = getopt_long_only(argc, argv, "hi:d:c:r:b", commandOptions,
 					NULL)) != -1) {
 		switch (opt) {
 			case 'h':
@@ -63,6 +101,11 @@ int main(int argc, char * argv[])
 				break;
 			case 'i':
 				input = fopen(optarg, "r");
+				if (!input) {
+					fprintf(stderr, "Could not open "
+							"'%s'.\n", optarg);
+					return 1;
+				}
 				break;
 			case 'd':
 				// Allow multiple values with delimiter
@@ -96,6 +139,9 @@ int main(int argc, char * argv[])
 					responseStr = optarg;
 				}
 				break;
+			case 'b':
+				binaryOut = true;
+				break;
 			case '?':
 				fprintf(stderr, "Unknown option: %s", optarg);
 				return 1;
@@ -104,95 +150,120 @@ int main(int argc, char * argv[])
 				break;
 		};
 	}
-	nrow = read_rows(&lines, input);
-	fclose(input);
-	columnHead = column_alloc(nrow, "");
-	ncol = read_columns(columnHead, lines, no_encode, nrow, &encodingInfo);
 
-	size_t i = 0;
-	colPtr = columnHead;
-	dataColumn * columns[ncol];
-	while (colPtr) {
-		if (strncmp(colPtr->name, "intercept", 9)) {
-			columns[i++] = colPtr;
-		}
-		colPtr = colPtr->nextColumn;
+	// Resolve the output columns from the header alone
+	if ((got = binary_read_line(input, &binary, binaryOut, &line,
+					&len)) == -1) {
+		fprintf(stderr, "No header row.\n");
+		return 1;
 	}
-
+	ncol = csv_header(line, line + strcspn(line, "\r\n"), &names);
+	order = malloc((ncol + 1) * sizeof(int));
 	if (responseStr) {
-		if (is_string(responseStr)) {
-			response = find_column_index(columns, ncol,
-					responseStr);
-		} else {
-			sscanf(responseStr, "%ld", &response);
-		}
-		if (response < (size_t)ncol) {
-			outputColumns = columns[response];
-		} else {
+		response = csv_column(names, ncol, responseStr);
+		if (response < 0) {
 			fprintf(stderr, "Specified impossible response "
 					"variable, ignoring.\n");
-			outputColumns = columns[0];
+			response = 0;
 		}
-	} else {
-		outputColumns = columns[0];
 	}
+	order[nout++] = response;
 
-	colPtr = outputColumns;
 	if (chooseStr) {
+		bool chosen[ncol];
+		memset(chosen, 0, sizeof(chosen));
 		char * token = strtok(chooseStr, ",");
 		while (token) {
-			if (is_string(token)) {
-				i = find_column_index(columns, ncol, token);
-			} else {
-				sscanf(token, "%ld", &i);
+			i = select_column(names, ncol, token, response,
+					"choose");
+			if (i < 0) return 1;
+			if (i != response && chosen[i]) {
+				fprintf(stderr, "Column '%s' chosen more "
+						"than once.\n", token);
+				return 1;
 			}
-			if (response != i) {
-				colPtr->nextColumn = columns[i];
-				colPtr = colPtr->nextColumn;
-			} else {
-				fprintf(stderr, "Cannot \"choose\" column and "
-						"specify as response. It will "
-						"only be set as the "
-						"response.\n");
+			if (i != response) {
+				chosen[i] = true;
+				order[nout++] = i;
 			}
 			token = strtok(NULL, ",");
 		}
-	} else if (dropStr) {
+	} else {
 		bool keepColumn[ncol];
 		memset(keepColumn, 1, sizeof(keepColumn));
-		char * token = strtok(dropStr, ",");
+		char * token = dropStr ? strtok(dropStr, ",") : NULL;
 		while (token) {
-			if (is_string(token)) {
-				i = find_column_index(columns, ncol, token);
-			} else {
-				sscanf(token, "%ld", &i);
-			}
-			if (response != i) {
-				keepColumn[i] = false;
-			} else {
-				fprintf(stderr, "Cannot \"drop\" column and "
-						"specify as response. It will "
-						"be kept as the response.\n");
-			}
+			i = select_column(names, ncol, token, response, "drop");
+			if (i < 0) return 1;
+			if (i != response) keepColumn[i] = false;
 			token = strtok(NULL, ",");
 		}
-		for (i = 0; i < (size_t)ncol; i++) {
-			if ((response != i) && keepColumn[i]) {
-				colPtr->nextColumn = columns[i];
-				colPtr = colPtr->nextColumn;
-			}
+		for (i = 0; i < ncol; i++) {
+			if (i != response && keepColumn[i]) order[nout++] = i;
 		}
+	}
+	for (i = 0; i < nout; i++) {
+		last = GSL_MAX(last, order[i]);
+	}
+
+	// Header, then each row cut into fields and projected
+	outNames = malloc(nout * sizeof(char *));
+	for (i = 0; i < nout; i++) {
+		outNames[i] = names[order[i]];
+	}
+	if (binaryOut) {
+		writer = binary_writer_open(stdout, outNames, nout);
 	} else {
-		for (i = 0; i < (size_t)ncol; i++) {
-			if (response != i) {
-				colPtr->nextColumn = columns[i];
-				colPtr = colPtr->nextColumn;
+		for (i = 0; i < nout; i++) {
+			printf(i ? ",%s" : "%s", outNames[i]);
+		}
+		putchar('\n');
+	}
+	fields = malloc((last + 1) * sizeof(csvField));
+	while ((got = binary_read_line(input, &binary, binaryOut, &line,
+					&len)) != -1) {
+		const char * stop;
+		const char * p = line;
+		int n = 0;
+
+		csv_line(line, line + got, &stop);
+		if (stop == line) continue;
+		while (n <= last && csv_next_field(&p, stop, fields + n)) {
+			n++;
+		}
+		if (writer) {
+			for (i = 0; i < nout; i++) {
+				if (order[i] < n) {
+					binary_put_field(writer,
+							fields + order[i]);
+				} else {
+					binary_put_text(writer, "", 0);
+				}
 			}
+			binary_end_row(writer);
+			continue;
 		}
+		for (i = 0; i < nout; i++) {
+			if (i) putchar(',');
+			if (order[i] < n) {
+				fwrite(fields[order[i]].start, 1,
+						fields[order[i]].len, stdout);
+			}
+		}
+		putchar('\n');
+	}
+	if (writer) binary_writer_close(writer);
+	if (binary) binary_reader_close(binary);
+	if (input != stdin) fclose(input);
+
+	for (i = 0; i < ncol; i++) {
+		free(names[i]);
 	}
-	colPtr->nextColumn = NULL;
+	free(names);
+	free(order);
+	free(outNames);
+	free(fields);
+	free(line);
 
-	print_columns(outputColumns, stdout);
-	column_free(columnHead);
 	return 0;
 }
@@ -0,0 +1,450 @@
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+#include "core.h"
+#include "model_utils.h"
+#include "batch.h"
+#include "serve.h"
+#include "blas.h"
+
+// Set by SIGINT and SIGTERM to stop the daemon
+volatile sig_atomic_t serveStop = 0;
+
+void serve_signal(int sig)
+{
+	(void) sig;
+	serveStop = 1;
+}
+
+// Write all of `data`, false if the peer went away
+bool serve_write(int fd, const void * data, size_t len)
+{
+	const char * p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+// Read all of `len` bytes, false if the stream ends first
+bool serve_read(int fd, void * data, size_t len)
+{
+	char * p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+bool serve_write_string(int fd, const char * text)
+{
+	uint32_t len = strlen(text);
+
+	return serve_write(fd, &len, sizeof(len)) &&
+		serve_write(fd, text, len);
+}
+
+// Next string of a request, NULL if it is cut short or too long
+char * serve_read_string(int fd)
+{
+	uint32_t len;
+	char * text;
+
+	if (!serve_read(fd, &len, sizeof(len)) || len > SERVE_MAX_STRING) {
+		return NULL;
+	}
+	text = malloc(len + 1);
+	if (!serve_read(fd, text, len)) {
+		free(text);
+		return NULL;
+	}
+	text[len] = '\0';
+
+	return text;
+}
+
+// Send a captured stream: its length, then its contents
+bool serve_write_file(int fd, FILE * file)
+{
+	char buffer[BUFSIZ];
+	size_t nread;
+	uint64_t len;
+
+	fflush(file);
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	rewind(file);
+	if (!serve_write(fd, &len, sizeof(len))) return false;
+	while ((nread = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		if (!serve_write(fd, buffer, nread)) return false;
+	}
+
+	return true;
+}
+
+// Copy a stream of the reply to `output`
+bool serve_read_file(int fd, FILE * output)
+{
+	char buffer[BUFSIZ];
+	size_t chunk;
+	uint64_t len;
+
+	if (!serve_read(fd, &len, sizeof(len))) return false;
+	while (len > 0) {
+		chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+		if (!serve_read(fd, buffer, chunk)) return false;
+		fwrite(buffer, 1, chunk, output);
+		len -= chunk;
+	}
+
+	return true;
+}
+
+bool serve_reply(int fd, uint32_t status, FILE * out, FILE * err)
+{
+	return serve_write(fd, &status, sizeof(status)) &&
+		serve_write_file(fd, out) && serve_write_file(fd, err);
+}
+
+// Fill the address of a socket path, false if it does not fit
+bool serve_address(const char * path, struct sockaddr_un * address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path)) {
+		fprintf(stderr, "Socket path '%s' is too long.\n", path);
+		return false;
+	}
+	strcpy(address->sun_path, path);
+
+	return true;
+}
+
+/*
+ * Copy of the command line, taken before the options are parsed since some
+ * are split in place, to send it to a daemon as it was given.
+ */
+char ** serve_arguments(int argc, char ** argv)
+{
+	char ** args = malloc((argc + 1) * sizeof(char *));
+
+	for (int i = 0; i < argc; i++) {
+		args[i] = strdup(argv[i]);
+	}
+	args[argc] = NULL;
+
+	return args;
+}
+
+/*
+ * Send a command line to the daemon on config->connect, from the client's
+ * working directory so that named models are saved where they would be
+ * without the daemon, and print what the fit wrote. Returns its exit status.
+ */
+int serve_request(modelConfigType * config, int argc, char ** argv)
+{
+	struct sockaddr_un address;
+	char * cwd;
+	uint32_t n = argc + 1;
+	uint32_t status;
+	bool sent;
+	int fd;
+
+	if (config->input != stdin || config->jobs || config->serve) {
+		fprintf(stderr, "--connect fits the input of the daemon, "
+				"without --input, --jobs or --serve.\n");
+		return 1;
+	}
+	if (!serve_address(config->connect, &address)) return 1;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &address,
+				sizeof(address))) {
+		fprintf(stderr, "Could not connect to '%s'.\n",
+				config->connect);
+		return 1;
+	}
+
+	cwd = getcwd(NULL, 0);
+	sent = cwd && serve_write(fd, &n, sizeof(n)) &&
+		serve_write_string(fd, cwd);
+	for (int i = 0; sent && i < argc; i++) {
+		sent = serve_write_string(fd, argv[i]);
+	}
+	free(cwd);
+
+	if (!sent || !serve_read(fd, &status, sizeof(status)) ||
+			!serve_read_file(fd, stdout) ||
+			!serve_read_file(fd, stderr)) {
+		fprintf(stderr, "The daemon did not complete the request.\n");
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	return status;
+}
+
+// Read a request into its working directory and arguments; -1 if malformed
+int serve_read_request(int client, char ** cwd, char ** argv)
+{
+	uint32_t n;
+	int argc = 0;
+
+	*cwd = NULL;
+	if (!serve_read(client, &n, sizeof(n)) || n < 2 ||
+			n > SERVE_MAX_ARGS + 1 ||
+			!(*cwd = serve_read_string(client))) {
+		return -1;
+	}
+	while ((uint32_t) argc < n - 1) {
+		if (!(argv[argc] = serve_read_string(client))) break;
+		argc++;
+	}
+	argv[argc] = NULL;
+	if ((uint32_t) argc < n - 1) {
+		for (int i = 0; i < argc; i++) {
+			free(argv[i]);
+		}
+		free(*cwd);
+		return -1;
+	}
+
+	return argc;
+}
+
+/*
+ * Answer a request on `client`. Its options are parsed, and its encoding
+ * and responses parsed from the input if no request needed them before,
+ * with stdout and stderr captured for the reply. The fit then runs in a
+ * child process, which inherits the parsed data and sends the reply.
+ * Returns the child's pid, or 0 when the request was answered without one.
+ */
+pid_t serve_handle(serveDaemon * server, int client)
+{
+	char * cwd;
+	char * argv[SERVE_MAX_ARGS + 1];
+	int argc;
+	int savedOut;
+	int savedErr;
+	int status = 1;
+	pid_t pid = 0;
+	batchJob job;
+	FILE * out;
+	FILE * err;
+
+	argc = serve_read_request(client, &cwd, argv);
+	if (argc < 0) {
+		close(client);
+		return 0;
+	}
+	out = tmpfile();
+	err = tmpfile();
+
+	// Messages of the parse go to the client
+	fflush(stdout);
+	fflush(stderr);
+	savedOut = dup(STDOUT_FILENO);
+	savedErr = dup(STDERR_FILENO);
+	dup2(fileno(out), STDOUT_FILENO);
+	dup2(fileno(err), STDERR_FILENO);
+
+	job.config = config_alloc();
+	job.options = NULL;
+	job.dataset = -1;
+	optind = 0;
+	if (server->parse(argc, argv, job.config, &job.options) == 0) {
+		if (job.config->input != stdin || job.config->jobs ||
+				job.config->serve) {
+			fprintf(stderr, "Requests fit the input of the "
+					"daemon, without --input, --jobs or "
+					"--serve.\n");
+		} else {
+			job.dataset = batch_dataset(&server->datasets,
+					&server->ndata, job.config,
+					server->lines, server->nrow,
+					server->testLines, server->testRows,
+					server->useGram);
+		}
+	}
+	if (job.config->input != stdin && job.config->input) {
+		fclose(job.config->input);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(savedOut, STDOUT_FILENO);
+	dup2(savedErr, STDERR_FILENO);
+	close(savedOut);
+	close(savedErr);
+
+	if (job.dataset >= 0) {
+		pid = fork();
+		if (pid == 0) {
+			// As with --jobs, threads after fork would hang the
+			// OpenMP runtime
+			blas_set_threads(1);
+			dup2(fileno(out), STDOUT_FILENO);
+			dup2(fileno(err), STDERR_FILENO);
+			if (chdir(cwd)) {
+				fprintf(stderr, "Could not enter '%s'.\n",
+						cwd);
+			} else {
+				status = batch_run(&job, server->datasets +
+						job.dataset, server->fit);
+			}
+			fflush(stdout);
+			fflush(stderr);
+			serve_reply(client, status, out, err);
+			_exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
+		} else if (pid < 0) {
+			perror("Error starting request");
+			pid = 0;
+		}
+	}
+	if (pid == 0) serve_reply(client, status, out, err);
+
+	close(client);
+	fclose(out);
+	fclose(err);
+	for (int i = 0; i < argc; i++) {
+		free(argv[i]);
+	}
+	free(cwd);
+	if (job.options) server->freeOptions(job.options);
+	config_free(job.config);
+
+	return pid;
+}
+
+/*
+ * Remove the socket left at `address` by a daemon that did not exit
+ * cleanly. Returns nonzero if a daemon is still answering on it.
+ */
+int serve_stale(const struct sockaddr_un * address)
+{
+	struct stat st;
+	int fd;
+	bool live;
+
+	if (stat(address->sun_path, &st) || !S_ISSOCK(st.st_mode)) return 0;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	live = fd >= 0 && !connect(fd, (const struct sockaddr *) address,
+			sizeof(*address));
+	if (fd >= 0) close(fd);
+	if (live) {
+		fprintf(stderr, "A daemon is already serving on '%s'.\n",
+				address->sun_path);
+		return 1;
+	}
+	unlink(address->sun_path);
+
+	return 0;
+}
+
+/*
+ * Serve fits on the Unix socket at config->serve until SIGINT or SIGTERM.
+ * The input is read and split once, and parsed up front with the daemon's
+ * own encoding and responses; requests with others are parsed on first use
+ * and kept for later ones. Each fit runs in a child process as a --jobs
+ * spec does, as many at a time as OpenMP threads.
+ */
+int run_serve(modelConfigType * config, batch_parse_func parse,
+		batch_fit_func fit, batch_free_func freeOptions, bool useGram)
+{
+	struct sockaddr_un address;
+	struct sigaction action;
+	serveDaemon server;
+	int nworkers = omp_get_max_threads();
+	int running = 0;
+	int listener;
+	int client;
+
+	if (config->jobs || config->connect) {
+		fprintf(stderr, "--serve is not combined with --jobs or "
+				"--connect.\n");
+		return 1;
+	}
+	if (!serve_address(config->serve, &address)) return 1;
+
+	// Read the input once
+	server.parse = parse;
+	server.fit = fit;
+	server.freeOptions = freeOptions;
+	server.useGram = useGram;
+	server.lines = NULL;
+	server.testLines = NULL;
+	server.nrow = read_rows(&server.lines, config->input);
+	server.testRows = test_split(&server.lines, &server.testLines,
+			config->testRatio, server.nrow);
+	server.nrow -= server.testRows;
+	server.datasets = NULL;
+	server.ndata = 0;
+	fclose(config->input);
+	if (batch_dataset(&server.datasets, &server.ndata, config,
+				server.lines, server.nrow, server.testLines,
+				server.testRows, useGram) < 0) {
+		return 1;
+	}
+
+	if (serve_stale(&address)) {
+		batch_datasets_free(server.datasets, server.ndata);
+		return 1;
+	}
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *) &address,
+				sizeof(address)) ||
+			listen(listener, SOMAXCONN)) {
+		fprintf(stderr, "Could not listen on '%s': %s.\n",
+				config->serve, strerror(errno));
+		batch_datasets_free(server.datasets, server.ndata);
+		return 1;
+	}
+
+	// Stop on a signal, interrupting accept(); clients that hang up
+	// leave their fit to fail on writing the reply
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = serve_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Serving on '%s'.\n", config->serve);
+
+	while (!serveStop) {
+		client = accept(listener, NULL, NULL);
+		if (client >= 0 && serve_handle(&server, client) > 0) {
+			running++;
+		}
+
+		// Reap finished fits, waiting for one when all workers are busy
+		while (running > 0 && waitpid(-1, NULL,
+					running < nworkers ? WNOHANG : 0) > 0) {
+			running--;
+		}
+	}
+
+	close(listener);
+	unlink(config->serve);
+	while (wait(NULL) > 0);
+	batch_datasets_free(server.datasets, server.ndata);
+
+	return 0;
+}
@@ -0,0 +1,426 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gsl/gsl_blas.h>
+#include "core.h"
+#include "csv.h"
+#include "binary.h"
+#include "model_utils.h"
+#include "sgd.h"
+
+/*
+ * Map the csv input of `config` and find the fields of the response and
+ * predictors from its header. Rows are then parsed a block at a time, so the
+ * input must be a regular file (-i or a redirect) rather than a pipe, and
+ * only numeric columns are read.
+ */
+int stream_open(modelConfigType * config, streamInput * input)
+{
+	int fd = fileno(config->input);
+	int nnames = 0;
+	char * end;
+	char * header;
+	char * rest;
+	char * name;
+	char ** names = NULL;
+	struct stat st;
+
+	if (config->nresp > 1 || config->testRatio > 0 ||
+			config->encoding != ENCODE_NONE) {
+		fprintf(stderr, "--sgd fits a single response from numeric "
+				"columns without a test split.\n");
+		return 1;
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		fprintf(stderr, "--sgd needs a regular, nonempty input "
+				"file.\n");
+		return 1;
+	}
+	input->size = st.st_size;
+	input->map = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (input->map == MAP_FAILED) {
+		fprintf(stderr, "Could not map the input file.\n");
+		return 1;
+	}
+	madvise(input->map, input->size, MADV_SEQUENTIAL);
+
+	// Header
+	end = memchr(input->map, '\n', input->size);
+	if (!end) end = input->map + input->size;
+	if (end < input->map + input->size &&
+			binary_detect(input->map, end + 1 - input->map)) {
+		fprintf(stderr, "--sgd reads csv rather than binary input.\n");
+		munmap(input->map, input->size);
+		return 1;
+	}
+	header = strndup(input->map, end - input->map);
+	header[strcspn(header, "\r")] = '\0';
+	input->first = end < input->map + input->size ? end + 1 : end;
+	input->next = input->first;
+	rest = header;
+	while ((name = strsep(&rest, ","))) {
+		names = realloc(names, (nnames + 1) * sizeof(char *));
+		names[nnames++] = name;
+	}
+	input->nfield = nnames;
+	input->values = malloc(input->nfield * sizeof(double));
+
+	input->response = 0;
+	if (config->nresp == 1) {
+		while (input->response < nnames &&
+				strcmp(names[input->response],
+					config->responses[0])) {
+			input->response++;
+		}
+		if (input->response == nnames) {
+			fprintf(stderr, "Response column '%s' not found.\n",
+					config->responses[0]);
+			free(input->values);
+			munmap(input->map, input->size);
+			free(names);
+			free(header);
+			return 1;
+		}
+	}
+
+	// Predictors: the intercept, then the named or all other fields
+	input->ncol = 1 + (config->ncols ? config->ncols : nnames - 1);
+	input->fields = malloc(input->ncol * sizeof(int));
+	input->colNames = malloc(input->ncol * sizeof(char *));
+	input->fields[0] = -1;
+	input->colNames[0] = strdup("intercept");
+	for (int j = 1, f = 0; j < input->ncol; j++, f++) {
+		if (config->ncols) {
+			char * column = config->columns[j - 1];
+
+			for (f = 0; f < nnames && (f == input->response ||
+						strcmp(names[f], column)); f++);
+			if (f == nnames) {
+				fprintf(stderr, "Column '%s' not found.\n",
+						column);
+				input->ncol = j;
+				stream_close(input);
+				free(names);
+				free(header);
+				return 1;
+			}
+		} else if (f == input->response) {
+			f++;
+		}
+		input->fields[j] = f;
+		input->colNames[j] = strdup(names[f]);
+	}
+	free(names);
+	free(header);
+
+	input->transformation = config->transformation;
+
+	return 0;
+}
+
+void stream_rewind(streamInput * input)
+{
+	input->next = input->first;
+}
+
+/*
+ * Parse up to X->size1 of the next rows into X (intercept first) and y,
+ * returning how many were read; 0 at the end of the input. Text and missing
+ * fields come up as 0, and blank lines are skipped.
+ */
+size_t stream_block(streamInput * input, gsl_matrix * X, gsl_vector * y)
+{
+	char * end = input->map + input->size;
+	char field[64];
+	size_t rows = 0;
+
+	while (rows < X->size1 && input->next < end) {
+		char * line = input->next;
+		char * stop = memchr(line, '\n', end - line);
+		double response;
+		int f = 0;
+
+		if (!stop) stop = end;
+		input->next = stop < end ? stop + 1 : end;
+		if (stop == line || (stop == line + 1 && *line == '\r')) {
+			continue;
+		}
+
+		// Fields go through a bounded copy since the map is not
+		// terminated
+		while (line <= stop && f < input->nfield) {
+			char * comma = memchr(line, ',', stop - line);
+			size_t len;
+
+			if (!comma) comma = stop;
+			len = comma - line;
+			if (len >= sizeof(field)) len = sizeof(field) - 1;
+			memcpy(field, line, len);
+			field[len] = '\0';
+			input->values[f++] = atof(field);
+			line = comma + 1;
+		}
+		while (f < input->nfield) {
+			input->values[f++] = 0;
+		}
+
+		gsl_matrix_set(X, rows, 0, 1);
+		for (int j = 1; j < input->ncol; j++) {
+			gsl_matrix_set(X, rows, j,
+					input->values[input->fields[j]]);
+		}
+		response = input->values[input->response];
+		if (input->transformation == TRANSFORM_LOG) {
+			response = log(response);
+		} else if (input->transformation == TRANSFORM_LOG_OFFSET) {
+			response = log_offset(response);
+		}
+		gsl_vector_set(y, rows++, response);
+	}
+
+	return rows;
+}
+
+void stream_close(streamInput * input)
+{
+	munmap(input->map, input->size);
+	for (int j = 0; j < input->ncol; j++) {
+		free(input->colNames[j]);
+	}
+	free(input->colNames);
+	free(input->fields);
+	free(input->values);
+}
+
+/*
+ * Minimize (1/2n)||y - X coef||^2 + lambda (alpha ||b||_1 + (1 - alpha)/2
+ * ||b||^2) over the standardized predictors b, as the elastic net of plm
+ * does, by mini-batch Adam with a proximal step for the lasso part. The
+ * iterates of each epoch are averaged to damp the noise of the batches.
+ * Memory is a block of `batch` rows plus O(p) however many rows there are:
+ * one pass finds the column means and deviations, each epoch streams the
+ * rows once more, and a last pass finds the residual sum of squares.
+ * With `verbose`, the objective and relative coefficient change of every
+ * epoch are printed. Returns nonzero without data rows.
+ */
+int sgd_solve(streamInput * input, int epochs, size_t batch, double lambda,
+		double alpha, bool verbose, gsl_vector * coef, double * chisq,
+		double * tss, size_t * nrow)
+{
+	size_t p = input->ncol;
+	size_t n = 0;
+	size_t rows;
+	size_t t = 0;
+	size_t steps;
+	int epoch;
+	double yMean = 0;
+	double yM2 = 0;
+	double l1 = lambda * alpha;
+	double l2 = lambda * (1 - alpha);
+	double objective = 0;
+	double change = 0;
+	double rate;
+	double intercept;
+	gsl_matrix * X = gsl_matrix_alloc(batch, p);
+	gsl_vector * y = gsl_vector_alloc(batch);
+	gsl_vector * r;
+	gsl_vector * mean;
+	gsl_vector * sd;
+	gsl_vector * beta;
+	gsl_vector * average;
+	gsl_vector * prev;
+	gsl_vector * grad;
+	gsl_vector * m;
+	gsl_vector * v;
+
+	// Only blank lines are skipped, so one block tells if there are rows
+	stream_rewind(input);
+	if (!stream_block(input, X, y)) {
+		fprintf(stderr, "No data rows.\n");
+		gsl_matrix_free(X);
+		gsl_vector_free(y);
+		return 1;
+	}
+	r = gsl_vector_alloc(batch);
+	mean = gsl_vector_calloc(p);
+	sd = gsl_vector_calloc(p);
+	beta = gsl_vector_calloc(p);
+	average = gsl_vector_alloc(p);
+	prev = gsl_vector_calloc(p);
+	grad = gsl_vector_alloc(p);
+	m = gsl_vector_calloc(p);
+	v = gsl_vector_calloc(p);
+
+	// Column means and standard deviations (Welford)
+	stream_rewind(input);
+	while ((rows = stream_block(input, X, y))) {
+		for (size_t i = 0; i < rows; i++) {
+			double yi = gsl_vector_get(y, i);
+			double delta = yi - yMean;
+
+			n++;
+			yMean += delta / n;
+			yM2 += delta * (yi - yMean);
+			for (size_t j = 0; j < p; j++) {
+				double x = gsl_matrix_get(X, i, j);
+				double * mj = gsl_vector_ptr(mean, j);
+
+				delta = x - *mj;
+				*mj += delta / n;
+				*gsl_vector_ptr(sd, j) += delta * (x - *mj);
+			}
+		}
+	}
+	// Constant columns, the intercept among them, stay out of b
+	for (size_t j = 0; j < p; j++) {
+		gsl_vector_set(sd, j, sqrt(gsl_vector_get(sd, j) / n));
+	}
+
+	if (verbose) printf("Epoch\tObjective\tChange\n");
+	for (epoch = 1; epoch <= epochs; epoch++) {
+		objective = 0;
+		steps = 0;
+		rate = SGD_RATE / sqrt(epoch);
+		gsl_vector_set_zero(average);
+		stream_rewind(input);
+		while ((rows = stream_block(input, X, y))) {
+			gsl_matrix_view Z = gsl_matrix_submatrix(X, 0, 0, rows,
+					p);
+			gsl_vector_view rb = gsl_vector_subvector(r, 0, rows);
+
+			// Standardize the block in place and take residuals
+			// of the centered response
+			for (size_t i = 0; i < rows; i++) {
+				for (size_t j = 0; j < p; j++) {
+					double s = gsl_vector_get(sd, j);
+					double * x = gsl_matrix_ptr(X, i, j);
+
+					*x = s > 0 ? (*x - gsl_vector_get(mean,
+								j)) / s : 0;
+				}
+				gsl_vector_set(r, i, gsl_vector_get(y, i) -
+						yMean);
+			}
+			gsl_blas_dgemv(CblasNoTrans, -1.0, &Z.matrix, beta,
+					1.0, &rb.vector);
+			objective += pow(gsl_blas_dnrm2(&rb.vector), 2);
+
+			// Gradient of the smooth part over the batch
+			gsl_blas_dgemv(CblasTrans, -1.0 / rows, &Z.matrix,
+					&rb.vector, 0, grad);
+			gsl_blas_daxpy(l2, beta, grad);
+
+			t++;
+			for (size_t j = 0; j < p; j++) {
+				double g = gsl_vector_get(grad, j);
+				double * mj = gsl_vector_ptr(m, j);
+				double * vj = gsl_vector_ptr(v, j);
+				double step;
+				double b;
+
+				if (gsl_vector_get(sd, j) == 0) continue;
+				*mj = SGD_BETA1 * *mj + (1 - SGD_BETA1) * g;
+				*vj = SGD_BETA2 * *vj + (1 - SGD_BETA2) * g * g;
+				step = rate / (sqrt(*vj / (1 - pow(SGD_BETA2,
+							t))) + SGD_EPSILON);
+				b = gsl_vector_get(beta, j) - step * *mj /
+					(1 - pow(SGD_BETA1, t));
+
+				// Soft-threshold in Adam's scaled metric
+				gsl_vector_set(beta, j, copysign(fmax(fabs(b) -
+							step * l1, 0), b));
+			}
+			gsl_vector_add(average, beta);
+			steps++;
+		}
+		gsl_vector_scale(average, 1.0 / steps);
+
+		objective = objective / (2 * n) + l1 * gsl_blas_dasum(average) +
+			l2 / 2 * pow(gsl_blas_dnrm2(average), 2);
+		gsl_vector_sub(prev, average);
+		change = gsl_blas_dnrm2(prev) / fmax(gsl_blas_dnrm2(average),
+				SGD_EPSILON);
+		gsl_vector_memcpy(prev, average);
+		if (verbose) printf("%d\t%g\t%g\n", epoch, objective, change);
+		if (change < SGD_TOLERANCE) break;
+	}
+	if (verbose) printf("\n");
+	if (epoch > epochs) {
+		fprintf(stderr, "Stopped after %d epochs with relative change "
+				"%g.\n", epochs, change);
+	}
+
+	// Back to the original scale
+	intercept = yMean;
+	for (size_t j = 0; j < p; j++) {
+		double s = gsl_vector_get(sd, j);
+		double c = s > 0 ? gsl_vector_get(prev, j) / s : 0;
+
+		gsl_vector_set(coef, j, c);
+		intercept -= c * gsl_vector_get(mean, j);
+	}
+	*gsl_vector_ptr(coef, 0) += intercept;
+
+	// Residual sum of squares
+	*chisq = 0;
+	stream_rewind(input);
+	while ((rows = stream_block(input, X, y))) {
+		gsl_matrix_view Xb = gsl_matrix_submatrix(X, 0, 0, rows, p);
+		gsl_vector_view yb = gsl_vector_subvector(y, 0, rows);
+
+		gsl_blas_dgemv(CblasNoTrans, -1.0, &Xb.matrix, coef, 1.0,
+				&yb.vector);
+		*chisq += pow(gsl_blas_dnrm2(&yb.vector), 2);
+	}
+	*tss = yM2;
+	*nrow = n;
+
+	gsl_matrix_free(X);
+	gsl_vector_free(y);
+	gsl_vector_free(r);
+	gsl_vector_free(mean);
+	gsl_vector_free(sd);
+	gsl_vector_free(beta);
+	gsl_vector_free(average);
+	gsl_vector_free(prev);
+	gsl_vector_free(grad);
+	gsl_vector_free(m);
+	gsl_vector_free(v);
+
+	return 0;
+}
+
+/*
+ * Fit and report a model by the first-order solver, streaming the input
+ * instead of parsing it whole. P-values are not reported.
+ */
+int fit_sgd(modelConfigType * config, int epochs, int batch, double lambda,
+		double alpha)
+{
+	double chisq;
+	double tss;
+	size_t nrow;
+	streamInput input;
+	gsl_vector * coef;
+
+	if (stream_open(config, &input)) {
+		return 1;
+	}
+	coef = gsl_vector_alloc(input.ncol);
+	if (sgd_solve(&input, epochs, batch, lambda, alpha,
+				config->diagnostic == ALL, coef, &chisq, &tss,
+				&nrow)) {
+		gsl_vector_free(coef);
+		stream_close(&input);
+		return 1;
+	}
+
+	diagnostics_report(config->diagnostic, chisq, tss, nrow,
+			input.ncol - 1, coef, NULL, input.colNames, NULL,
+			config);
+
+	gsl_vector_free(coef);
+	stream_close(&input);
+	fclose(config->input);
+
+	return 0;
+}
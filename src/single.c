@@ -0,0 +1,230 @@
+#include <gsl/gsl_blas.h>
+#include <gsl/gsl_eigen.h>
+#include "core.h"
+#include "gram.h"
+#include "single.h"
+
+// Copy of X rounded to single precision
+gsl_matrix_float * single_matrix(const gsl_matrix * X)
+{
+	gsl_matrix_float * S = gsl_matrix_float_alloc(X->size1, X->size2);
+
+	#pragma omp parallel for
+	for (size_t i = 0; i < X->size1; i++) {
+		for (size_t j = 0; j < X->size2; j++) {
+			gsl_matrix_float_set(S, i, j, gsl_matrix_get(X, i, j));
+		}
+	}
+
+	return S;
+}
+
+/*
+ * G = X^T X and Xty = X^T y accumulated in double precision. Each thread
+ * widens a block of GRAM_BLOCK_ROWS rows at a time, so no double precision
+ * copy of the whole design is needed.
+ */
+int single_gram(const gsl_matrix_float * X, const gsl_vector * y,
+		gsl_matrix * G, gsl_vector * Xty)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	size_t nblocks = (n + GRAM_BLOCK_ROWS - 1) / GRAM_BLOCK_ROWS;
+
+	gsl_matrix_set_zero(G);
+	gsl_vector_set_zero(Xty);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * localG = gsl_matrix_calloc(p, p);
+		gsl_vector * localXty = gsl_vector_calloc(p);
+		gsl_matrix * wide = gsl_matrix_alloc(GRAM_BLOCK_ROWS, p);
+
+		#pragma omp for schedule(static)
+		for (size_t b = 0; b < nblocks; b++) {
+			size_t start = b * GRAM_BLOCK_ROWS;
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, n - start);
+			gsl_matrix_view block = gsl_matrix_submatrix(wide, 0,
+					0, rows, p);
+			gsl_vector_const_view yBlock =
+				gsl_vector_const_subvector(y, start, rows);
+
+			for (size_t i = 0; i < rows; i++) {
+				for (size_t j = 0; j < p; j++) {
+					gsl_matrix_set(wide, i, j,
+						gsl_matrix_float_get(X,
+							start + i, j));
+				}
+			}
+			gram_accumulate(&block.matrix, &yBlock.vector, localG,
+					localXty);
+		}
+
+		#pragma omp critical
+		{
+			gsl_matrix_add(G, localG);
+			gsl_vector_add(Xty, localXty);
+		}
+
+		gsl_matrix_free(wide);
+		gsl_matrix_free(localG);
+		gsl_vector_free(localXty);
+	}
+
+	gram_symmetrize(G);
+
+	return 0;
+}
+
+// resid = y - X coef, in double precision
+void single_residuals(const gsl_matrix_float * X, const gsl_vector * y,
+		const gsl_vector * coef, gsl_vector * resid)
+{
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < X->size1; i++) {
+		double fit = 0;
+
+		for (size_t j = 0; j < X->size2; j++) {
+			fit += gsl_matrix_float_get(X, i, j) *
+				gsl_vector_get(coef, j);
+		}
+		gsl_vector_set(resid, i, gsl_vector_get(y, i) - fit);
+	}
+}
+
+// g = X^T r, in double precision
+void single_gradient(const gsl_matrix_float * X, const gsl_vector * r,
+		gsl_vector * g)
+{
+	size_t p = X->size2;
+
+	gsl_vector_set_zero(g);
+
+	#pragma omp parallel
+	{
+		gsl_vector * local = gsl_vector_calloc(p);
+
+		#pragma omp for schedule(static)
+		for (size_t i = 0; i < X->size1; i++) {
+			double ri = gsl_vector_get(r, i);
+
+			for (size_t j = 0; j < p; j++) {
+				*gsl_vector_ptr(local, j) +=
+					gsl_matrix_float_get(X, i, j) * ri;
+			}
+		}
+
+		#pragma omp critical
+		gsl_vector_add(g, local);
+
+		gsl_vector_free(local);
+	}
+}
+
+/*
+ * Iterative refinement of coef towards the least squares solution for the
+ * float design X: with the residuals r = y - X coef taken directly from X,
+ * coef += M X^T r, where M is the (possibly truncated) inverse of the Gram
+ * matrix that gave coef. Each step shrinks the error left by solving the
+ * normal equations by a factor of about cond(X)^2 times the rounding unit,
+ * so a few steps reach the accuracy the residuals allow. The residuals of
+ * the result are left in `resid`. Returns the number of steps taken.
+ */
+int single_refine(const gsl_matrix_float * X, const gsl_vector * y,
+		const gsl_matrix * M, gsl_vector * coef, gsl_vector * resid)
+{
+	int steps = 0;
+	gsl_vector * g = gsl_vector_alloc(X->size2);
+	gsl_vector * delta = gsl_vector_alloc(X->size2);
+
+	while (steps++ < SINGLE_MAX_REFINE) {
+		single_residuals(X, y, coef, resid);
+		single_gradient(X, resid, g);
+		gsl_blas_dsymv(CblasUpper, 1.0, M, g, 0, delta);
+		gsl_vector_add(coef, delta);
+		if (gsl_blas_dnrm2(delta) <= SINGLE_TOLERANCE *
+				gsl_blas_dnrm2(coef)) {
+			break;
+		}
+	}
+	single_residuals(X, y, coef, resid);
+
+	gsl_vector_free(g);
+	gsl_vector_free(delta);
+
+	return steps;
+}
+
+/*
+ * Truncated pseudo-inverse M of the Gram matrix G = X^T X from its
+ * eigendecomposition, keeping the singular values of X (square roots of the
+ * eigenvalues) above `tol` times the largest, as gsl_multifit_linear_rank()
+ * does for the SVD. With `balance`, the columns are first scaled to about
+ * unit norm. Squaring the singular values costs half the digits of the
+ * SVD, which still resolves everything a float design holds. Returns the rank.
+ */
+int single_pseudo_inverse(const gsl_matrix * G, double tol, bool balance,
+		gsl_matrix * M)
+{
+	size_t p = G->size1;
+	size_t rank = 0;
+	double smax;
+	gsl_vector * d = gsl_vector_alloc(p);
+	gsl_vector * eval = gsl_vector_alloc(p);
+	gsl_matrix * A = gsl_matrix_alloc(p, p);
+	gsl_matrix * evec = gsl_matrix_alloc(p, p);
+	gsl_matrix_view W;
+	gsl_eigen_symmv_workspace * work = gsl_eigen_symmv_alloc(p);
+
+	// Powers of two near the column norms, as gsl_multifit_linear_bsvd()
+	for (size_t j = 0; j < p; j++) {
+		double g = gsl_matrix_get(G, j, j);
+		int e;
+
+		// Smallest power with the scaled norm at most 1
+		if (frexp(sqrt(g), &e) == 0.5) e--;
+		gsl_vector_set(d, j, balance && g > 0 ? ldexp(1, e) : 1);
+	}
+	for (size_t i = 0; i < p; i++) {
+		for (size_t j = 0; j < p; j++) {
+			gsl_matrix_set(A, i, j, gsl_matrix_get(G, i, j) /
+					(gsl_vector_get(d, i) *
+					 gsl_vector_get(d, j)));
+		}
+	}
+	gsl_eigen_symmv(A, eval, evec, work);
+	gsl_eigen_symmv_sort(eval, evec, GSL_EIGEN_SORT_VAL_DESC);
+	gsl_eigen_symmv_free(work);
+
+	smax = sqrt(GSL_MAX(gsl_vector_get(eval, 0), 0));
+	while (rank < p && sqrt(GSL_MAX(gsl_vector_get(eval, rank), 0)) >
+			tol * smax) {
+		rank++;
+	}
+
+	// M = D^{-1} V_k \Lambda_k^{-1} V_k^T D^{-1} = W W^T
+	gsl_matrix_set_zero(M);
+	if (rank) {
+		W = gsl_matrix_submatrix(evec, 0, 0, p, rank);
+		for (size_t k = 0; k < rank; k++) {
+			gsl_vector_view col = gsl_matrix_column(&W.matrix, k);
+
+			gsl_vector_scale(&col.vector,
+					1 / sqrt(gsl_vector_get(eval, k)));
+		}
+		for (size_t j = 0; j < p; j++) {
+			gsl_vector_view row = gsl_matrix_row(&W.matrix, j);
+
+			gsl_vector_scale(&row.vector, 1 / gsl_vector_get(d, j));
+		}
+		gsl_blas_dsyrk(CblasUpper, CblasNoTrans, 1.0, &W.matrix, 0, M);
+		gram_symmetrize(M);
+	}
+
+	gsl_vector_free(d);
+	gsl_vector_free(eval);
+	gsl_matrix_free(A);
+	gsl_matrix_free(evec);
+
+	return rank;
+}
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <gsl/gsl_blas.h>
+#include "core.h"
+#include "sketch.h"
+
+// Mix of a row number into a bucket and sign (splitmix64)
+uint64_t sketch_hash(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/*
+ * CountSketch of [X y] into the M = SX->size1 rows of SX and Sy: every row
+ * is added, with a random sign, to one random bucket. Least squares on the
+ * sketch is (1 + eps)-accurate once M is of order p^2 / eps^2, and often
+ * with far fewer rows. One pass over the rows, spread over threads that each
+ * sketch into their own copy.
+ */
+int sketch_count(const gsl_matrix * X, const gsl_vector * y,
+		unsigned long seed, gsl_matrix * SX, gsl_vector * Sy)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	size_t m = SX->size1;
+
+	gsl_matrix_set_zero(SX);
+	gsl_vector_set_zero(Sy);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * localSX = gsl_matrix_calloc(m, p);
+		gsl_vector * localSy = gsl_vector_calloc(m);
+
+		#pragma omp for schedule(static)
+		for (size_t i = 0; i < n; i++) {
+			uint64_t h = sketch_hash(seed + i);
+			size_t bucket = (h >> 1) % m;
+			double sign = h & 1 ? 1 : -1;
+			gsl_vector_const_view row = gsl_matrix_const_row(X, i);
+			gsl_vector_view dest = gsl_matrix_row(localSX, bucket);
+
+			gsl_blas_daxpy(sign, &row.vector, &dest.vector);
+			*gsl_vector_ptr(localSy, bucket) +=
+				sign * gsl_vector_get(y, i);
+		}
+
+		#pragma omp critical
+		{
+			gsl_matrix_add(SX, localSX);
+			gsl_vector_add(Sy, localSy);
+		}
+
+		gsl_matrix_free(localSX);
+		gsl_vector_free(localSy);
+	}
+
+	return 0;
+}
+
+// s = R^{-T} X^T r
+void sketch_gradient(const gsl_matrix * X, const gsl_matrix * R,
+		const gsl_vector * r, gsl_vector * s)
+{
+	gsl_blas_dgemv(CblasTrans, 1.0, X, r, 0, s);
+	gsl_blas_dtrsv(CblasUpper, CblasTrans, CblasNonUnit, R, s);
+}
+
+/*
+ * Refine coef to the full least squares solution by conjugate gradients on
+ * the normal equations (CGLS) of X R^{-1}, where R is the triangular factor
+ * of the sketched design. The sketch makes X R^{-1} well conditioned, so
+ * few passes over X are needed (as in Blendenpik). Returns nonzero if R is
+ * singular.
+ */
+int sketch_refine(const gsl_matrix * X, const gsl_vector * y,
+		const gsl_matrix * R, gsl_vector * coef, size_t * iterations)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	double gamma;
+	double gammaNew;
+	double qq;
+	double alpha;
+	gsl_vector * z;
+	gsl_vector * r;
+	gsl_vector * s;
+	gsl_vector * d;
+	gsl_vector * t;
+	gsl_vector * q;
+
+	for (size_t j = 0; j < p; j++) {
+		if (gsl_matrix_get(R, j, j) == 0) return 1;
+	}
+
+	z = gsl_vector_alloc(p);
+	r = gsl_vector_alloc(n);
+	s = gsl_vector_alloc(p);
+	d = gsl_vector_alloc(p);
+	t = gsl_vector_alloc(p);
+	q = gsl_vector_alloc(n);
+
+	// Start from the sketched solution: z = R coef
+	gsl_vector_memcpy(z, coef);
+	gsl_blas_dtrmv(CblasUpper, CblasNoTrans, CblasNonUnit, R, z);
+	gsl_vector_memcpy(r, y);
+	gsl_blas_dgemv(CblasNoTrans, -1.0, X, coef, 1.0, r);
+	sketch_gradient(X, R, r, s);
+	gsl_vector_memcpy(d, s);
+	gsl_blas_ddot(s, s, &gamma);
+
+	for (*iterations = 0; *iterations < SKETCH_MAX_ITER; (*iterations)++) {
+		if (sqrt(gamma) <= SKETCH_TOLERANCE * gsl_blas_dnrm2(r)) {
+			break;
+		}
+
+		// q = X R^{-1} d
+		gsl_vector_memcpy(t, d);
+		gsl_blas_dtrsv(CblasUpper, CblasNoTrans, CblasNonUnit, R, t);
+		gsl_blas_dgemv(CblasNoTrans, 1.0, X, t, 0, q);
+		gsl_blas_ddot(q, q, &qq);
+		if (qq == 0) break;
+		alpha = gamma / qq;
+		gsl_blas_daxpy(alpha, d, z);
+		gsl_blas_daxpy(-alpha, q, r);
+
+		sketch_gradient(X, R, r, s);
+		gsl_blas_ddot(s, s, &gammaNew);
+		gsl_vector_scale(d, gammaNew / gamma);
+		gsl_vector_add(d, s);
+		gamma = gammaNew;
+	}
+
+	// coef = R^{-1} z
+	gsl_vector_memcpy(coef, z);
+	gsl_blas_dtrsv(CblasUpper, CblasNoTrans, CblasNonUnit, R, coef);
+
+	gsl_vector_free(q);
+	gsl_vector_free(t);
+	gsl_vector_free(d);
+	gsl_vector_free(s);
+	gsl_vector_free(r);
+	gsl_vector_free(z);
+
+	return 0;
+}
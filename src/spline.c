@@ -0,0 +1,220 @@
+#include <gsl/gsl_blas.h>
+#include "core.h"
+#include "gram.h"
+#include "spline.h"
+
+/*
+ * Cubic B-spline basis of a column of X on `nbreak` uniform knots over its
+ * range. The basis sums to one, so the first function is dropped to keep
+ * the intercept identifiable.
+ */
+int spline_basis(const gsl_matrix * X, size_t column, size_t nbreak,
+		splineBasis * spline)
+{
+	gsl_vector_const_view x = gsl_matrix_const_column(X, column);
+
+	if (nbreak < 2) {
+		fprintf(stderr, "A spline needs at least 2 knots.\n");
+		return 1;
+	}
+	spline->min = gsl_vector_min(&x.vector);
+	spline->max = gsl_vector_max(&x.vector);
+	if (spline->min == spline->max) {
+		fprintf(stderr, "Cannot fit a spline to a constant "
+				"column.\n");
+		return 1;
+	}
+	spline->column = column;
+	spline->nbreak = nbreak;
+	spline->ncoef = nbreak + SPLINE_ORDER - 3;
+	spline->start = NULL;
+	spline->values = NULL;
+	spline_eval(X, spline);
+
+	return 0;
+}
+
+/*
+ * Evaluate the nonzero basis functions of each row of X, clamped to the
+ * knot range (so test rows use the training knots).
+ */
+void spline_eval(const gsl_matrix * X, splineBasis * spline)
+{
+	size_t n = X->size1;
+	size_t end;
+	double x;
+	gsl_vector_view values;
+	gsl_bspline_workspace * work;
+
+	work = gsl_bspline_alloc(SPLINE_ORDER, spline->nbreak);
+	gsl_bspline_knots_uniform(spline->min, spline->max, work);
+	spline->start = realloc(spline->start, n * sizeof(size_t));
+	spline->values = realloc(spline->values,
+			n * SPLINE_ORDER * sizeof(double));
+	for (size_t i = 0; i < n; i++) {
+		x = gsl_matrix_get(X, i, spline->column);
+		x = GSL_MIN(GSL_MAX(x, spline->min), spline->max);
+		values = gsl_vector_view_array(spline->values +
+				i * SPLINE_ORDER, SPLINE_ORDER);
+		gsl_bspline_eval_nonzero(x, &values.vector, &spline->start[i],
+				&end, work);
+	}
+	gsl_bspline_free(work);
+}
+
+void spline_free(splineBasis * spline)
+{
+	free(spline->name);
+	free(spline->start);
+	free(spline->values);
+}
+
+/*
+ * Add the cross-products of row i's spline values to G and Xty. Spline s
+ * occupies columns offsets[s].. of the extended design, and the dropped
+ * first function of each basis is skipped. Only blocks on or above the
+ * diagonal are touched.
+ */
+void spline_accumulate_row(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines,
+		const size_t * offsets, size_t i, gsl_matrix * G,
+		gsl_vector * Xty)
+{
+	size_t p = X->size2;
+	double yi = gsl_vector_get(y, i);
+	gsl_vector_const_view x = gsl_matrix_const_row(X, i);
+
+	for (int s = 0; s < nsplines; s++) {
+		const double * b = splines[s].values + i * SPLINE_ORDER;
+		size_t first = splines[s].start[i];
+
+		for (size_t a = 0; a < SPLINE_ORDER; a++) {
+			size_t ca;
+
+			if (first + a == 0) continue;
+			ca = offsets[s] + first + a - 1;
+
+			// Against the dense columns and the response
+			for (size_t j = 0; j < p; j++) {
+				*gsl_matrix_ptr(G, j, ca) +=
+					gsl_vector_get(&x.vector, j) * b[a];
+			}
+			*gsl_vector_ptr(Xty, ca) += yi * b[a];
+
+			// Against the splines from this one on: a band
+			for (int t = s; t < nsplines; t++) {
+				const double * c = splines[t].values +
+					i * SPLINE_ORDER;
+				size_t firstT = splines[t].start[i];
+
+				for (size_t d = 0; d < SPLINE_ORDER; d++) {
+					size_t cd;
+
+					if (firstT + d == 0) continue;
+					cd = offsets[t] + firstT + d - 1;
+					if (cd < ca) continue;
+					*gsl_matrix_ptr(G, ca, cd) +=
+						b[a] * c[d];
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Cross-products of X extended by spline bases: G = Z^T Z and Xty = Z^T y
+ * with Z = [X B_1 B_2 ...]. The dense block is accumulated by row blocks as
+ * in gram_compute(); each spline contributes only its SPLINE_ORDER nonzeros
+ * per row, against the dense columns and as a banded block against the
+ * splines, so a spline costs O(n (p + SPLINE_ORDER)) whatever its number of
+ * knots.
+ */
+int spline_gram(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines, gsl_matrix * G,
+		gsl_vector * Xty)
+{
+	size_t n = X->size1;
+	size_t p = X->size2;
+	size_t q = G->size1;
+	size_t nblocks = (n + GRAM_BLOCK_ROWS - 1) / GRAM_BLOCK_ROWS;
+	size_t * offsets;
+
+	offsets = malloc(nsplines * sizeof(size_t));
+	offsets[0] = p;
+	for (int s = 1; s < nsplines; s++) {
+		offsets[s] = offsets[s - 1] + splines[s - 1].ncoef;
+	}
+
+	gsl_matrix_set_zero(G);
+	gsl_vector_set_zero(Xty);
+
+	#pragma omp parallel
+	{
+		gsl_matrix * localG = gsl_matrix_calloc(q, q);
+		gsl_vector * localXty = gsl_vector_calloc(q);
+		gsl_matrix_view denseG = gsl_matrix_submatrix(localG, 0, 0,
+				p, p);
+		gsl_vector_view denseXty = gsl_vector_subvector(localXty, 0,
+				p);
+
+		#pragma omp for schedule(static)
+		for (size_t b = 0; b < nblocks; b++) {
+			size_t start = b * GRAM_BLOCK_ROWS;
+			size_t rows = GSL_MIN(GRAM_BLOCK_ROWS, n - start);
+			gsl_matrix_const_view block = gsl_matrix_const_submatrix(
+					X, start, 0, rows, p);
+			gsl_vector_const_view yBlock =
+				gsl_vector_const_subvector(y, start, rows);
+
+			gram_accumulate(&block.matrix, &yBlock.vector,
+					&denseG.matrix, &denseXty.vector);
+			for (size_t i = start; i < start + rows; i++) {
+				spline_accumulate_row(X, y, splines, nsplines,
+						offsets, i, localG, localXty);
+			}
+		}
+
+		#pragma omp critical
+		{
+			gsl_matrix_add(G, localG);
+			gsl_vector_add(Xty, localXty);
+		}
+
+		gsl_matrix_free(localG);
+		gsl_vector_free(localXty);
+	}
+
+	gram_symmetrize(G);
+	free(offsets);
+
+	return 0;
+}
+
+// Residuals y - Z coef of X extended by spline bases
+void spline_residuals(const gsl_matrix * X, const gsl_vector * y,
+		const splineBasis * splines, int nsplines,
+		const gsl_vector * coef, gsl_vector * resid)
+{
+	size_t p = X->size2;
+	size_t offset = p;
+	gsl_vector_const_view dense = gsl_vector_const_subvector(coef, 0, p);
+
+	gsl_vector_memcpy(resid, y);
+	gsl_blas_dgemv(CblasNoTrans, -1.0, X, &dense.vector, 1.0, resid);
+	for (int s = 0; s < nsplines; s++) {
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < X->size1; i++) {
+			const double * b = splines[s].values + i * SPLINE_ORDER;
+			size_t first = splines[s].start[i];
+			double fit = 0;
+
+			for (size_t a = 0; a < SPLINE_ORDER; a++) {
+				if (first + a == 0) continue;
+				fit += b[a] * gsl_vector_get(coef,
+						offset + first + a - 1);
+			}
+			*gsl_vector_ptr(resid, i) -= fit;
+		}
+		offset += splines[s].ncoef;
+	}
+}
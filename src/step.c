@@ -0,0 +1,416 @@
+#include <gsl/gsl_multifit.h>
+#include <gsl/gsl_blas.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include "core.h"
+#include "gram.h"
+#include "model_utils.h"
+#include "step.h"
+
+#define STEP_HELP_INTRO \
+	"Usage: step [-h] [-i file] [-n name] [TRANSFORM] [ENCODING] " \
+		"[DIAGNOSTIC] \\\n\t\t[UNIQUE]\n\n" \
+	"Choose the predictors of a linear model by stepwise selection. At " \
+		"each step\n" \
+	"every predictor is considered for addition or removal, and the " \
+		"change that\n" \
+	"most improves the DIAGNOSTIC (AIC if none is given) is made until " \
+		"none\n" \
+	"does. Candidates are scored in parallel. The selected model is " \
+		"reported as\n" \
+	"by lm.\n\n"
+
+#define STEP_UNIQUE_HELP \
+	"UNIQUE:\n" \
+	"\t-F, --forward\n\n" \
+	"\tStart from the intercept-only model and only add predictors.\n\n" \
+	"\t-B, --backward\n\n" \
+	"\tStart from the full model and only remove predictors.\n\n" \
+	"\tWithout either, start from the intercept-only model and both add " \
+		"and\n" \
+	"\tremove predictors.\n\n" \
+	"\t-S, --subsets <number of models per size>\n\n" \
+	"\tInstead of stepping, find the exact best subsets of each size by " \
+		"residual\n" \
+	"\tsum of squares (at most " SUBSET_MAX_PREDICTORS_STR " predictors). " \
+		"The given number of\n" \
+	"\tmodels per size are printed with their DIAGNOSTIC, and the best " \
+		"of them is\n" \
+	"\treported.\n"
+
+typedef enum {
+	STEP_BOTH,
+	STEP_FORWARD,
+	STEP_BACKWARD,
+	STEP_SUBSETS
+} stepDirection;
+
+/*
+ * Score the model reached from the one swept into A by toggling predictor
+ * `toggle` (or the model itself when `toggle` is the response index). The
+ * residual sum of squares is read off A without refitting; holdout
+ * diagnostics also need the coefficients, which come from sweeping a copy.
+ * `size` is the number of predictors besides the intercept.
+ */
+double step_score(diagnoseType type, const gsl_matrix * A, size_t toggle,
+		const bool * inModel, int size, double tss, int nrow,
+		gsl_matrix * testMatrix, gsl_vector * testResponse)
+{
+	size_t p = A->size1 - 1;
+	double rss = gsl_matrix_get(A, p, p);
+	double value;
+	gsl_matrix * B;
+	gsl_vector * coef;
+	gsl_vector * resid;
+
+	if (toggle < p) {
+		rss -= pow(gsl_matrix_get(A, toggle, p), 2) /
+			gsl_matrix_get(A, toggle, toggle);
+	}
+	if (!testMatrix || !diagnostic_needs_test(type)) {
+		return diagnostic_value(type, rss, tss, nrow, size, NULL);
+	}
+
+	B = gsl_matrix_alloc(p + 1, p + 1);
+	coef = gsl_vector_calloc(p);
+	resid = gsl_vector_alloc(testResponse->size);
+	gsl_matrix_memcpy(B, A);
+	if (toggle < p) gram_sweep(B, toggle, inModel[toggle]);
+	for (size_t i = 0; i < p; i++) {
+		if (i == toggle ? !inModel[i] : inModel[i]) {
+			gsl_vector_set(coef, i, gsl_matrix_get(B, i, p));
+		}
+	}
+	gsl_vector_memcpy(resid, testResponse);
+	gsl_blas_dgemv(CblasNoTrans, -1.0, testMatrix, coef, 1.0, resid);
+	value = diagnostic_value(type, rss, tss, nrow, size, resid);
+
+	gsl_vector_free(resid);
+	gsl_vector_free(coef);
+	gsl_matrix_free(B);
+
+	return value;
+}
+
+/*
+ * Stepwise selection on the augmented cross-product matrix A (see
+ * gram_augmented()), which is left swept on the chosen predictors as marked
+ * in `inModel`. The intercept (predictor 0) is always kept. Each step scores
+ * every candidate in parallel and sweeps in the best one. Returns the number
+ * of predictors chosen besides the intercept.
+ */
+int stepwise(diagnoseType type, stepDirection direction, gsl_matrix * A,
+		bool * inModel, double tss, int nrow, char ** colNames,
+		gsl_matrix * testMatrix, gsl_vector * testResponse)
+{
+	size_t p = A->size1 - 1;
+	size_t best;
+	int size = 0;
+	int step = 0;
+	double current;
+	gsl_vector * pivots;
+	gsl_vector * scores;
+
+	pivots = gsl_vector_alloc(p);
+	scores = gsl_vector_alloc(p);
+	for (size_t j = 0; j < p; j++) {
+		gsl_vector_set(pivots, j, gsl_matrix_get(A, j, j));
+	}
+
+	// Starting model
+	for (size_t j = 0; j < p; j++) {
+		if ((j == 0 || direction == STEP_BACKWARD) &&
+				gsl_matrix_get(A, j, j) > STEP_COLLINEAR *
+				gsl_vector_get(pivots, j)) {
+			gram_sweep(A, j, false);
+			inModel[j] = true;
+			if (j > 0) size++;
+		}
+	}
+	current = step_score(type, A, p, inModel, size, tss, nrow,
+			testMatrix, testResponse);
+	printf("Steps:\nstep\tchange\tdiagnostic\n");
+	printf("%d\tstart\t%g\n", step, current);
+
+	while (true) {
+		#pragma omp parallel for schedule(dynamic)
+		for (size_t j = 1; j < p; j++) {
+			double value = NAN;
+
+			if (inModel[j] && direction != STEP_FORWARD) {
+				value = step_score(type, A, j, inModel,
+						size - 1, tss, nrow,
+						testMatrix, testResponse);
+			} else if (!inModel[j] &&
+					direction != STEP_BACKWARD &&
+					gsl_matrix_get(A, j, j) >
+					STEP_COLLINEAR *
+					gsl_vector_get(pivots, j)) {
+				value = step_score(type, A, j, inModel,
+						size + 1, tss, nrow,
+						testMatrix, testResponse);
+			}
+			gsl_vector_set(scores, j, value);
+		}
+
+		// Best improving candidate, if any
+		best = 0;
+		for (size_t j = 1; j < p; j++) {
+			double value = gsl_vector_get(scores, j);
+			double bestValue = best ? gsl_vector_get(scores, best) :
+				current;
+			if (diagnostic_lower_better(type) ? value < bestValue :
+					value > bestValue) {
+				best = j;
+			}
+		}
+		if (!best) break;
+
+		gram_sweep(A, best, inModel[best]);
+		inModel[best] = !inModel[best];
+		size += inModel[best] ? 1 : -1;
+		current = gsl_vector_get(scores, best);
+		printf("%d\t%c%s\t%g\n", ++step, inModel[best] ? '+' : '-',
+				colNames[best], current);
+	}
+	printf("\n");
+
+	gsl_vector_free(scores);
+	gsl_vector_free(pivots);
+
+	return size;
+}
+
+/*
+ * Report the model swept into A as lm would: coefficients from its last
+ * column, the covariance from its swept block and holdout diagnostics from
+ * the matching columns of the test matrix.
+ */
+int step_report(modelConfigType * config, gsl_matrix * A, bool * inModel,
+		int size, modelDataType * data)
+{
+	size_t p = A->size1 - 1;
+	size_t k = size + 1;
+	size_t * cols;
+	double chisq = gsl_matrix_get(A, p, p);
+	double sigma2 = chisq / (data->nrow - k);
+	char ** names;
+	gsl_vector * coef;
+	gsl_matrix * covMatrix;
+	gsl_matrix * testMatrix = NULL;
+
+	cols = malloc(k * sizeof(size_t));
+	names = malloc(k * sizeof(char *));
+	for (size_t j = 0, i = 0; j < p; j++) {
+		if (inModel[j]) {
+			names[i] = data->colNames[j];
+			cols[i++] = j;
+		}
+	}
+
+	coef = gsl_vector_alloc(k);
+	covMatrix = gsl_matrix_alloc(k, k);
+	for (size_t i = 0; i < k; i++) {
+		gsl_vector_set(coef, i, gsl_matrix_get(A, cols[i], p));
+		for (size_t j = 0; j < k; j++) {
+			gsl_matrix_set(covMatrix, i, j, -sigma2 *
+					gsl_matrix_get(A, cols[i], cols[j]));
+		}
+	}
+	if (data->testMatrix) {
+		testMatrix = gsl_matrix_alloc(data->testRows, k);
+		for (size_t i = 0; i < k; i++) {
+			gsl_vector_view col = gsl_matrix_column(
+					data->testMatrix, cols[i]);
+			gsl_matrix_set_col(testMatrix, i, &col.vector);
+		}
+	}
+
+	diagnostics(config->diagnostic, chisq, data->response, coef,
+			covMatrix, names, testMatrix, data->testResponse,
+			config);
+
+	if (testMatrix) gsl_matrix_free(testMatrix);
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+	free(names);
+	free(cols);
+
+	return 0;
+}
+
+/*
+ * Find the `keep` best subsets of each size, print them with their score by
+ * `type` and leave A swept on (and `inModel` marking) the best scoring one.
+ * Returns its number of predictors besides the intercept.
+ */
+int best_subsets(diagnoseType type, int keep, gsl_matrix * A, bool * inModel,
+		double tss, int nrow, char ** colNames,
+		gsl_matrix * testMatrix, gsl_vector * testResponse)
+{
+	size_t p = A->size1 - 1;
+	int bestSize = 0;
+	double bestValue = 0;
+	uint64_t bestSet = 0;
+	subsetTable table;
+	gsl_matrix * B;
+	bool * members;
+
+	subset_find(&table, keep, A);
+
+	// Score and print the models kept for each size
+	B = gsl_matrix_alloc(p + 1, p + 1);
+	members = malloc(p * sizeof(bool));
+	printf("Subsets:\nsize\tRSS\tdiagnostic\tpredictors\n");
+	for (size_t size = 0; size < p; size++) {
+		for (int i = 0; i < table.count[size]; i++) {
+			uint64_t set = table.sets[size * keep + i];
+			bool first = true;
+			double value;
+
+			gsl_matrix_memcpy(B, A);
+			for (size_t j = 0; j < p; j++) {
+				members[j] = j == 0 || (set >> j & 1);
+				if (members[j]) gram_sweep(B, j, false);
+			}
+			value = step_score(type, B, p, members, size, tss,
+					nrow, testMatrix, testResponse);
+			if ((size == 0 && i == 0) ||
+					(diagnostic_lower_better(type) ?
+					 value < bestValue :
+					 value > bestValue)) {
+				bestValue = value;
+				bestSet = set;
+				bestSize = size;
+			}
+
+			printf("%zu\t%g\t%g\t", size,
+					table.rss[size * keep + i], value);
+			for (size_t j = 1; j < p; j++) {
+				if (members[j]) {
+					printf("%s%s", first ? "" : ",",
+							colNames[j]);
+					first = false;
+				}
+			}
+			printf("\n");
+		}
+	}
+	printf("\n");
+
+	// Leave A swept on the best
+	for (size_t j = 0; j < p; j++) {
+		inModel[j] = j == 0 || (bestSet >> j & 1);
+		if (inModel[j]) gram_sweep(A, j, false);
+	}
+
+	free(members);
+	gsl_matrix_free(B);
+	subset_table_free(&table);
+
+	return bestSize;
+}
+
+int main(int argc, char *argv[])
+{
+	// Command-line options
+	const struct option commandOptions[] = {
+		COMMON_OPTIONS,
+		{"forward",	no_argument,		NULL, 'F'},
+		{"backward",	no_argument,		NULL, 'B'},
+		{"subsets",	required_argument,	NULL, 'S'},
+	};
+	int opt;
+	modelConfigType * config;
+
+	// Model variables
+	stepDirection direction = STEP_BOTH;
+	diagnoseType criterion;
+	int keep = 0;
+	int size;
+	double tss;
+	bool * inModel;
+	modelDataType data;
+	gsl_matrix * A;
+
+	config = config_alloc();
+	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING "FBS:",
+					commandOptions, NULL)) != -1) {
+		if (parse_args(opt, config, STEP_HELP_INTRO LM_HELP_MESSAGE
+					STEP_UNIQUE_HELP)) {
+			return 1;
+		}
+		if (opt == 'F' || opt == 'B' || opt == 'S') {
+			if (direction != STEP_BOTH) {
+				fprintf(stderr, "Multiple directions "
+						"specified.\n");
+				return 1;
+			}
+			direction = opt == 'F' ? STEP_FORWARD :
+				opt == 'B' ? STEP_BACKWARD : STEP_SUBSETS;
+		}
+		if (opt == 'S') {
+			sscanf(optarg, "%d", &keep);
+			if (keep < 1) {
+				fprintf(stderr, "Must keep at least 1 model "
+						"per size.\n");
+				return 1;
+			}
+		}
+	}
+
+	if (config->jobs || config->serve || config->connect) {
+		fprintf(stderr, "step does not run --jobs or --serve.\n");
+		return 1;
+	}
+
+	// Set random seed
+	srand(time(NULL));
+
+	// Parse incoming csv file
+	if (load_model_data(config, &data)) {
+		exit(EXIT_FAILURE);
+	}
+	if (diagnostic_needs_test(config->diagnostic) && !data.testMatrix) {
+		fprintf(stderr, "This diagnostic requires a test ratio.\n");
+		return 1;
+	}
+	if (data.nresp > 1) {
+		fprintf(stderr, "step selects for a single response.\n");
+		return 1;
+	}
+	criterion = config->diagnostic == ALL ? AIC : config->diagnostic;
+
+	// One pass over the data; every step after works on A alone
+	A = gsl_matrix_alloc(data.ncol + 1, data.ncol + 1);
+	gram_augmented(data.dataMatrix, data.response, A);
+	tss = gsl_stats_tss(data.response->data, data.response->stride,
+			data.nrow);
+
+	inModel = calloc(data.ncol, sizeof(bool));
+	if (direction == STEP_SUBSETS) {
+		if (data.ncol - 1 > SUBSET_MAX_PREDICTORS) {
+			fprintf(stderr, "Best subsets supports at most "
+					SUBSET_MAX_PREDICTORS_STR
+					" predictors.\n");
+			return 1;
+		}
+		size = best_subsets(criterion, keep, A, inModel, tss,
+				data.nrow, data.colNames, data.testMatrix,
+				data.testResponse);
+	} else {
+		size = stepwise(criterion, direction, A, inModel, tss,
+				data.nrow, data.colNames, data.testMatrix,
+				data.testResponse);
+	}
+	step_report(config, A, inModel, size, &data);
+
+	// Free memory
+	gsl_matrix_free(A);
+	free(inModel);
+	model_data_free(&data);
+	free(config);
+
+	return 0;
+}
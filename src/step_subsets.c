@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include "core.h"
+#include "gram.h"
+#include "step.h"
+
+void subset_record(subsetTable * table, uint64_t set, int size, double rss)
+{
+	double * sizeRss = table->rss + size * table->keep;
+	uint64_t * sizeSets = table->sets + size * table->keep;
+	int i;
+
+	#pragma omp critical(subset_table)
+	{
+		if (table->count[size] < table->keep ||
+				rss < sizeRss[table->keep - 1]) {
+			if (table->count[size] < table->keep) {
+				table->count[size]++;
+			}
+			for (i = table->count[size] - 1; i > 0 &&
+					sizeRss[i - 1] > rss; i--) {
+				sizeRss[i] = sizeRss[i - 1];
+				sizeSets[i] = sizeSets[i - 1];
+			}
+			sizeRss[i] = rss;
+			sizeSets[i] = set;
+			if (table->count[size] == table->keep) {
+				#pragma omp atomic write
+				table->worst[size] = sizeRss[table->keep - 1];
+			}
+		}
+	}
+}
+
+// Whether no subset of sizes lo through hi can beat `bound`
+bool subset_prune(subsetTable * table, double bound, int lo, int hi)
+{
+	double worst;
+
+	for (int size = lo; size <= hi; size++) {
+		#pragma omp atomic read
+		worst = table->worst[size];
+		if (bound < worst) return false;
+	}
+
+	return true;
+}
+
+/*
+ * Branch and bound over the subsets containing `set`, with A (owned by the
+ * search and freed here) swept on `set`. Children add one of the `ncand`
+ * candidates and keep only those after it. Every subset below a child has
+ * an RSS no less than that of the child's set plus all of its remaining
+ * candidates, so those bounds come from sweeping in every candidate once and
+ * taking them back out in turn. Candidates are ordered by how much the RSS
+ * rises when each is removed from the largest model, so the later subtrees,
+ * which lack the most useful predictors, are the ones pruned.
+ */
+void subset_search(subsetTable * table, gsl_matrix * A, uint64_t set,
+		int size, size_t * cand, int ncand)
+{
+	size_t m = A->size1;
+	size_t y = m - 1;
+	double * cost;
+	double * bounds;
+	bool * swept;
+	gsl_matrix * F;
+
+	subset_record(table, set, size, gsl_matrix_get(A, y, y));
+	if (ncand == 0) {
+		gsl_matrix_free(A);
+		free(cand);
+		return;
+	}
+
+	// Largest model below this node
+	cost = malloc(ncand * sizeof(double));
+	bounds = malloc(ncand * sizeof(double));
+	swept = calloc(ncand, sizeof(bool));
+	F = gsl_matrix_alloc(m, m);
+	gsl_matrix_memcpy(F, A);
+	for (int i = 0; i < ncand; i++) {
+		if (gsl_matrix_get(F, cand[i], cand[i]) > STEP_COLLINEAR *
+				gsl_vector_get(table->pivots, cand[i])) {
+			gram_sweep(F, cand[i], false);
+			swept[i] = true;
+		}
+	}
+	for (int i = 0; i < ncand; i++) {
+		cost[i] = swept[i] ? pow(gsl_matrix_get(F, cand[i], y), 2) /
+			-gsl_matrix_get(F, cand[i], cand[i]) : 0;
+	}
+
+	// Most costly to remove first
+	for (int i = 1; i < ncand; i++) {
+		for (int j = i; j > 0 && cost[j - 1] < cost[j]; j--) {
+			double c = cost[j];
+			size_t k = cand[j];
+			bool b = swept[j];
+			cost[j] = cost[j - 1];
+			cand[j] = cand[j - 1];
+			swept[j] = swept[j - 1];
+			cost[j - 1] = c;
+			cand[j - 1] = k;
+			swept[j - 1] = b;
+		}
+	}
+	for (int i = 0; i < ncand; i++) {
+		bounds[i] = gsl_matrix_get(F, y, y);
+		if (swept[i]) gram_sweep(F, cand[i], true);
+	}
+	gsl_matrix_free(F);
+
+	for (int i = 0; i < ncand; i++) {
+		int nrest = ncand - i - 1;
+		uint64_t childSet = set | (UINT64_C(1) << cand[i]);
+		size_t * rest;
+		gsl_matrix * child;
+
+		if (subset_prune(table, bounds[i], size + 1, size + 1 + nrest) ||
+				gsl_matrix_get(A, cand[i], cand[i]) <=
+				STEP_COLLINEAR *
+				gsl_vector_get(table->pivots, cand[i])) {
+			continue;
+		}
+		child = gsl_matrix_alloc(m, m);
+		gsl_matrix_memcpy(child, A);
+		gram_sweep(child, cand[i], false);
+		rest = malloc((nrest + 1) * sizeof(size_t));
+		memcpy(rest, cand + i + 1, nrest * sizeof(size_t));
+
+		#pragma omp task if(nrest >= SUBSET_TASK_CANDIDATES)
+		subset_search(table, child, childSet, size + 1, rest, nrest);
+	}
+
+	free(swept);
+	free(bounds);
+	free(cost);
+	free(cand);
+	gsl_matrix_free(A);
+}
+
+/*
+ * Fill `table` with the `keep` lowest residual sums of squares of each
+ * subset size, from the cross-product matrix A of [X y] whose first column
+ * is the intercept, which every subset includes.
+ */
+void subset_find(subsetTable * table, int keep, const gsl_matrix * A)
+{
+	size_t p = A->size1 - 1;
+	size_t * cand;
+	gsl_matrix * root;
+
+	table->keep = keep;
+	table->count = calloc(p, sizeof(int));
+	table->worst = malloc(p * sizeof(double));
+	table->rss = malloc(p * keep * sizeof(double));
+	table->sets = malloc(p * keep * sizeof(uint64_t));
+	table->pivots = gsl_vector_alloc(p);
+	for (size_t j = 0; j < p; j++) {
+		table->worst[j] = INFINITY;
+		gsl_vector_set(table->pivots, j, gsl_matrix_get(A, j, j));
+	}
+
+	// Search from the intercept-only model, spreading subtrees over threads
+	root = gsl_matrix_alloc(p + 1, p + 1);
+	gsl_matrix_memcpy(root, A);
+	gram_sweep(root, 0, false);
+	cand = malloc(p * sizeof(size_t));
+	for (size_t j = 1; j < p; j++) {
+		cand[j - 1] = j;
+	}
+	#pragma omp parallel
+	#pragma omp single
+	subset_search(table, root, 0, 0, cand, p - 1);
+}
+
+void subset_table_free(subsetTable * table)
+{
+	gsl_vector_free(table->pivots);
+	free(table->sets);
+	free(table->rss);
+	free(table->worst);
+	free(table->count);
+}
@@ -1,10 +1,14 @@
 #include <gsl/gsl_multifit.h>
 #include <gsl/gsl_linalg.h>
+#include <gsl/gsl_blas.h>
 #include <unistd.h>
 #include <time.h>
 #include "core.h"
 #include "debug.h"
 #include "model_utils.h"
+#include "batch.h"
+#include "serve.h"
+#include "single.h"
 
 #define TSVD_HELP_INTRO \
 	"Usage: tsvdlm [-h] [-i file] [-n name] [TRANSFORM] [ENCODING] " \
@@ -27,32 +31,49 @@
 	"\tDo not balance magnitude of data matrix prior to SVD " \
 		"decomposition. By\n" \
 	"\tdefault, columns are scaled to similar magnitudes to improve " \
-		"accuracy.\n"
+		"accuracy.\n\n" \
+	"\t-G, --tolerance-grid <comma-separated tolerances>\n\n" \
+	"\tFit every distinct rank implied by the listed tolerances from a " \
+		"single\n" \
+	"\tdecomposition and print the coefficient path. The rank with the " \
+		"best\n" \
+	"\tDIAGNOSTIC (GCV if none is given) is reported as the model.\n\n" \
+	"\t-g, --gcv\n\n" \
+	"\tLike --tolerance-grid, but evaluate every rank and select by GCV " \
+		"(Generalized\n" \
+	"\tCross Validation). May be combined with --tolerance-grid to " \
+		"restrict the\n" \
+	"\tranks considered.\n\n" \
+	"\t-F, --single\n\n" \
+	"\tFit against a copy of the design rounded to single precision. " \
+		"The\n" \
+	"\ttruncated decomposition is taken from the cross-products " \
+		"accumulated in\n" \
+	"\tdouble precision and the fit refined against the copy; " \
+		"coefficients\n" \
+	"\tagree with the default fit to about the condition number of " \
+		"the kept\n" \
+	"\tcomponents times 1e-7, relative to their size. Both copies are " \
+		"held\n" \
+	"\tonly while the float one is made; the double precision design " \
+		"is then\n" \
+	"\tfreed, so the fit runs in half its memory. Requires " \
+		"--tolerance.\n"
 
-int fit_svd_model(double tol, gsl_matrix * X, gsl_vector * y,
-		gsl_vector * beta, gsl_matrix * varBeta, double * chisq,
-		bool balance)
-{
-	size_t rank;
-	double s;
-	gsl_vector * yHat;
-	gsl_vector * residuals;
-	gsl_vector * tmpCol;
-	gsl_vector * tmpRow;
-	gsl_matrix * U;
-	gsl_matrix * V;
-	gsl_matrix * SigmaInv;
-	gsl_matrix * DInv;
-	gsl_matrix * DInvV;
-	gsl_matrix * SigmaInvUT;
-	gsl_matrix * SigmaInvInv;
-	gsl_matrix * VTDInv;
-	gsl_matrix * intOne;
-	gsl_matrix * intTwo;
-	gsl_multifit_linear_workspace * work;
+// Options of one tsvdlm model
+typedef struct {
+	bool balance;
+	bool useGCV;
+	double tolerance;
+	double * tolerances;		// --tolerance-grid
+	int ntol;
+	bool single;
+} tsvdOptions;
 
+int svd_decompose(gsl_matrix * X, bool balance,
+		gsl_multifit_linear_workspace * work)
+{
 	// Perform BSVD or standard SVD
-	work = gsl_multifit_linear_alloc(X->size1, X->size2);
 	if (balance) {
 		if (gsl_multifit_linear_bsvd(X, work)) {
 			return 1;
@@ -62,254 +83,600 @@ int fit_svd_model(double tol, gsl_matrix * X, gsl_vector * y,
 			return 1;
 		}
 	}
-	rank = gsl_multifit_linear_rank(tol, work);
 
-	// Set up matrices
-	U = gsl_matrix_alloc(X->size1, rank);		// A
-	SigmaInv = gsl_matrix_calloc(rank, rank);	// S^{-1}
-	V = gsl_matrix_alloc(X->size2, rank);		// Q
-	SigmaInvInv = gsl_matrix_calloc(rank, rank);
-	tmpCol = gsl_vector_alloc(X->size1);
-	tmpRow = gsl_vector_alloc(X->size2);
-	for (size_t i = 0; i < rank; i++) {
-		gsl_matrix_get_col(tmpCol, work->A, i);
-		gsl_matrix_set_col(U, i, tmpCol);
-		gsl_matrix_get_col(tmpRow, work->Q, i);
-		gsl_matrix_set_col(V, i, tmpRow);
-		s = gsl_vector_get(work->S, i);
-		gsl_matrix_set(SigmaInv, i, i, 1 / s);
-		gsl_matrix_set(SigmaInvInv, i, i, 1 / (s * s));
+	return 0;
+}
+
+int svd_solve(size_t rank, gsl_vector * y, gsl_vector * beta,
+		gsl_matrix * varBeta, double * chisq,
+		gsl_multifit_linear_workspace * work)
+{
+	size_t n = y->size;
+	size_t p = beta->size;
+	double s;
+	double fit;
+	double r;
+	double delta;
+	double mean;
+	gsl_vector * UTy;
+	gsl_matrix * W;
+	gsl_vector_view D;
+	gsl_vector_view col;
+	gsl_vector_view row;
+	gsl_vector_const_view uRow;
+	gsl_matrix_const_view U;
+	gsl_matrix_const_view V;
+
+	// Views into the decomposition held by the workspace; nothing is
+	// copied out of A (U, n x p) or Q (V, p x p)
+	U = gsl_matrix_const_submatrix(work->A, 0, 0, n, rank);
+	V = gsl_matrix_const_submatrix(work->Q, 0, 0, p, rank);
+	D = gsl_vector_subvector(work->D, 0, p);
+
+	// U^T y is the only projection of the data we need
+	UTy = gsl_vector_alloc(rank);
+	gsl_blas_dgemv(CblasTrans, 1.0, &U.matrix, y, 0, UTy);
+
+	// Residuals: X beta = U U^T y, so each residual is available from a
+	// single row of U. Accumulate their sum of squares (about the mean,
+	// matching gsl_stats_tss) without storing them.
+	mean = 0;
+	*chisq = 0;
+	for (size_t i = 0; i < n; i++) {
+		uRow = gsl_matrix_const_row(&U.matrix, i);
+		gsl_blas_ddot(&uRow.vector, UTy, &fit);
+		r = gsl_vector_get(y, i) - fit;
+		delta = r - mean;
+		mean += delta / (i + 1);
+		*chisq += delta * (r - mean);
 	}
-	gsl_vector_free(tmpRow);
-	gsl_vector_free(tmpCol);
 
 	// Model computations: D^{-1} V \Sigma^{-1} U^T y
-	DInv = gsl_matrix_calloc(X->size2, X->size2);	// D^{-1}
-	DInvV = gsl_matrix_alloc(X->size2, rank);
-	SigmaInvUT = gsl_matrix_alloc(rank, X->size1);
-	intOne = gsl_matrix_alloc(X->size2, X->size1);
-	for (size_t i = 0; i < X->size2; i++) {
-		gsl_matrix_set(DInv, i, i, 1 / gsl_vector_get(work->D, i));
+	for (size_t i = 0; i < rank; i++) {
+		s = gsl_vector_get(work->S, i);
+		*gsl_vector_ptr(UTy, i) /= s;
 	}
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, DInv, V, 0, DInvV);
-	gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, SigmaInv, U, 0,
-			SigmaInvUT);
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, DInvV, SigmaInvUT, 0,
-			intOne);
-	gsl_blas_dgemv(CblasNoTrans, 1.0, intOne, y, 0, beta);
-	gsl_matrix_free(U);
-	gsl_matrix_free(SigmaInv);
-	gsl_matrix_free(SigmaInvUT);
-	gsl_matrix_free(intOne);
-
-	// Residuals
-	yHat = gsl_vector_alloc(y->size);
-	residuals = gsl_vector_alloc(y->size);
-	gsl_blas_dgemv(CblasNoTrans, 1.0, X, beta, 0, yHat);
-	gsl_vector_memcpy(residuals, y);
-	gsl_vector_sub(residuals, yHat);
-	gsl_vector_free(yHat);
+	gsl_blas_dgemv(CblasNoTrans, 1.0, &V.matrix, UTy, 0, beta);
+	gsl_vector_div(beta, &D.vector);
+	gsl_vector_free(UTy);
 
 	// Variance-Covariance matrix
 	// \hat\sigma^2 = RSS (Residual Sum of Squares)
-	// \hat\sigma^2 D^{-1} V \Sigma^{-2} V^T D^{-1}
-	VTDInv = gsl_matrix_alloc(rank, X->size2);
-	intTwo = gsl_matrix_alloc(X->size2, rank);
-	*chisq = gsl_stats_tss(residuals->data, residuals->stride,
-			residuals->size);
-	gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, V, DInv, 0,
-			VTDInv);
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, DInvV, SigmaInvInv, 0,
-			intTwo);
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, *chisq, intTwo, VTDInv, 0,
-			varBeta);
-
-	// Free up remaining allocated memory
-	gsl_vector_free(residuals);
-	gsl_matrix_free(DInv);
-	gsl_matrix_free(V);
-	gsl_matrix_free(DInvV);
-	gsl_matrix_free(SigmaInvInv);
-	gsl_matrix_free(VTDInv);
-	gsl_matrix_free(intTwo);
+	// \hat\sigma^2 D^{-1} V \Sigma^{-2} V^T D^{-1} = \hat\sigma^2 W W^T
+	// with W = D^{-1} V \Sigma^{-1} (p x rank)
+	W = gsl_matrix_alloc(p, rank);
+	gsl_matrix_memcpy(W, &V.matrix);
+	for (size_t i = 0; i < rank; i++) {
+		col = gsl_matrix_column(W, i);
+		gsl_vector_scale(&col.vector, 1 / gsl_vector_get(work->S, i));
+	}
+	for (size_t j = 0; j < p; j++) {
+		row = gsl_matrix_row(W, j);
+		gsl_vector_scale(&row.vector, 1 / gsl_vector_get(&D.vector, j));
+	}
+	gsl_blas_dsyrk(CblasUpper, CblasNoTrans, *chisq, W, 0, varBeta);
+	for (size_t i = 0; i < p; i++) {
+		for (size_t j = 0; j < i; j++) {
+			gsl_matrix_set(varBeta, i, j,
+					gsl_matrix_get(varBeta, j, i));
+		}
+	}
+	gsl_matrix_free(W);
+
+	return 0;
+}
+
+int fit_svd_model(double tol, gsl_matrix * X, gsl_vector * y,
+		gsl_vector * beta, gsl_matrix * varBeta, double * chisq,
+		bool balance, gsl_multifit_linear_workspace * work)
+{
+	if (svd_decompose(X, balance, work)) {
+		return 1;
+	}
+
+	return svd_solve(gsl_multifit_linear_rank(tol, work), y, beta, varBeta,
+			chisq, work);
+}
+
+int compare_sizes(const void * a, const void * b)
+{
+	size_t sa = *(const size_t *)a;
+	size_t sb = *(const size_t *)b;
+	return (sa > sb) - (sa < sb);
+}
+
+/*
+ * Coefficients for every rank in `ranks` (ascending) from an existing
+ * decomposition. Truncation keeps a prefix of the singular triplets, so each
+ * rank adds one term D^{-1} v_i (u_i^T y / s_i) to the previous solution and
+ * one term to the explained sum of squares. Column k of `path` receives the
+ * coefficients for ranks[k] and element k of `rss` its residual sum of
+ * squares about the residual mean (as in svd_solve() and the ridge path of
+ * plm).
+ */
+int svd_rank_path(gsl_vector * y, size_t * ranks, size_t nranks,
+		gsl_matrix * path, gsl_vector * rss,
+		gsl_multifit_linear_workspace * work)
+{
+	size_t n = y->size;
+	size_t p = path->size1;
+	size_t maxRank = ranks[nranks - 1];
+	size_t k = 0;
+	double b;
+	double yi;
+	double ySq = 0;
+	double ySum = 0;
+	double fitSq = 0;
+	double fitSum = 0;
+	double mean;
+	gsl_vector * UTy;
+	gsl_vector * USum;
+	gsl_vector * current;
+	gsl_vector_view D;
+	gsl_vector_view out;
+	gsl_vector_const_view uRow;
+	gsl_vector_const_view v;
+	gsl_matrix_const_view U;
+	gsl_matrix_const_view V;
+
+	U = gsl_matrix_const_submatrix(work->A, 0, 0, n, maxRank);
+	V = gsl_matrix_const_submatrix(work->Q, 0, 0, p, maxRank);
+	D = gsl_vector_subvector(work->D, 0, p);
+
+	// One pass over U for both U^T y and the column sums of U
+	UTy = gsl_vector_calloc(maxRank);
+	USum = gsl_vector_calloc(maxRank);
+	for (size_t i = 0; i < n; i++) {
+		yi = gsl_vector_get(y, i);
+		uRow = gsl_matrix_const_row(&U.matrix, i);
+		gsl_blas_daxpy(yi, &uRow.vector, UTy);
+		gsl_blas_daxpy(1.0, &uRow.vector, USum);
+		ySq += yi * yi;
+		ySum += yi;
+	}
+
+	current = gsl_vector_calloc(p);
+	for (size_t i = 0; i < maxRank && k < nranks; i++) {
+		b = gsl_vector_get(UTy, i);
+		v = gsl_matrix_const_column(&V.matrix, i);
+		gsl_blas_daxpy(b / gsl_vector_get(work->S, i), &v.vector,
+				current);
+		fitSq += b * b;
+		fitSum += b * gsl_vector_get(USum, i);
+
+		if (i + 1 == ranks[k]) {
+			out = gsl_matrix_column(path, k);
+			gsl_vector_memcpy(&out.vector, current);
+			gsl_vector_div(&out.vector, &D.vector);
+			mean = (ySum - fitSum) / n;
+			gsl_vector_set(rss, k, ySq - fitSq - n * mean * mean);
+			k++;
+		}
+	}
+
+	gsl_vector_free(current);
+	gsl_vector_free(USum);
+	gsl_vector_free(UTy);
+
+	return 0;
+}
+
+/*
+ * Evaluate every distinct rank implied by `tolerances` (or every rank when
+ * `ntol` is 0) against a single decomposition, print the coefficient path and
+ * return the rank with the best criterion (see select_path()).
+ */
+size_t tolerance_sweep(double * tolerances, int ntol, bool useGCV,
+		modelConfigType * config, gsl_vector * y, char ** colNames,
+		gsl_matrix * testMatrix, gsl_vector * testResponse,
+		gsl_multifit_linear_workspace * work)
+{
+	size_t p = work->p;
+	size_t nranks = 0;
+	size_t best;
+	size_t maxRank;
+	size_t * ranks;
+	double s0;
+	gsl_vector * rss;
+	gsl_vector * df;
+	gsl_vector * thresholds;
+	gsl_matrix * path;
+
+	// Distinct ranks to evaluate, ascending
+	maxRank = gsl_multifit_linear_rank(GSL_DBL_EPSILON, work);
+	if (ntol > 0) {
+		ranks = malloc(ntol * sizeof(size_t));
+		for (int i = 0; i < ntol; i++) {
+			ranks[i] = gsl_multifit_linear_rank(tolerances[i], work);
+		}
+		qsort(ranks, ntol, sizeof(size_t), compare_sizes);
+		for (int i = 0; i < ntol; i++) {
+			if (ranks[i] > 0 && (nranks == 0 ||
+						ranks[i] != ranks[nranks - 1])) {
+				ranks[nranks++] = ranks[i];
+			}
+		}
+	} else {
+		ranks = malloc(maxRank * sizeof(size_t));
+		for (size_t i = 0; i < maxRank; i++) {
+			ranks[nranks++] = i + 1;
+		}
+	}
+	if (nranks == 0) {
+		free(ranks);
+		return 0;
+	}
+
+	path = gsl_matrix_alloc(p, nranks);
+	rss = gsl_vector_alloc(nranks);
+	df = gsl_vector_alloc(nranks);
+	thresholds = gsl_vector_alloc(nranks);
+	svd_rank_path(y, ranks, nranks, path, rss, work);
+
+	// Label each rank by its relative singular value
+	s0 = gsl_vector_get(work->S, 0);
+	for (size_t k = 0; k < nranks; k++) {
+		gsl_vector_set(df, k, ranks[k]);
+		gsl_vector_set(thresholds, k,
+				gsl_vector_get(work->S, ranks[k] - 1) / s0);
+	}
+
+	best = select_path(useGCV ? ALL : config->diagnostic, path, rss, df,
+			thresholds, "threshold", y, colNames, testMatrix,
+			testResponse);
+	best = ranks[best];
+	printf("Selected rank: %zu\n\n", best);
+
+	gsl_matrix_free(path);
+	gsl_vector_free(rss);
+	gsl_vector_free(df);
+	gsl_vector_free(thresholds);
+	free(ranks);
+
+	return best;
+}
+
+/*
+ * Turn each residual sum of squares of Y - X B in `rss` into the sum about
+ * that residual's mean, as svd_solve() reports it. The residual means are
+ * the column means of Y less those of X times B, so no residual is formed.
+ */
+void center_rss(const gsl_matrix * X, const gsl_matrix * Y,
+		const gsl_matrix * B, gsl_vector * rss)
+{
+	size_t n = X->size1;
+	gsl_vector * weights = gsl_vector_alloc(n);
+	gsl_vector * xMean = gsl_vector_alloc(X->size2);
+	gsl_vector * rMean = gsl_vector_alloc(Y->size2);
+
+	gsl_vector_set_all(weights, 1.0 / n);
+	gsl_blas_dgemv(CblasTrans, 1.0, X, weights, 0, xMean);
+	gsl_blas_dgemv(CblasTrans, 1.0, Y, weights, 0, rMean);
+	gsl_blas_dgemv(CblasTrans, -1.0, B, xMean, 1.0, rMean);
+	for (size_t j = 0; j < rss->size; j++) {
+		*gsl_vector_ptr(rss, j) -= n * pow(gsl_vector_get(rMean, j), 2);
+	}
+
+	gsl_vector_free(rMean);
+	gsl_vector_free(xMean);
+	gsl_vector_free(weights);
+}
+
+/*
+ * Fit every response with the rank implied by `tol` from a single
+ * decomposition. The covariance of each is scaled as in svd_solve(), by the
+ * residual sum of squares about the residual mean.
+ */
+int fit_svd_responses(double tol, bool balance, modelConfigType * config,
+		modelDataType * data)
+{
+	size_t rank;
+	gsl_vector * rss;
+	gsl_matrix * coef;
+	gsl_matrix * covFactor;
+	gsl_multifit_linear_workspace * work;
+
+	work = gsl_multifit_linear_alloc(data->nrow, data->ncol);
+	if (svd_decompose(data->dataMatrix, balance, work)) {
+		return 1;
+	}
+	rank = gsl_multifit_linear_rank(tol, work);
+
+	coef = gsl_matrix_alloc(data->ncol, data->nresp);
+	covFactor = gsl_matrix_alloc(data->ncol, data->ncol);
+	rss = gsl_vector_alloc(data->nresp);
+	svd_solve_responses(rank, NULL, data->dataMatrix, data->responses,
+			coef, rss, covFactor, work);
 	gsl_multifit_linear_free(work);
+	center_rss(data->dataMatrix, data->responses, coef, rss);
+	diagnostics_responses(config, data, coef, rss, covFactor, rss);
+
+	gsl_vector_free(rss);
+	gsl_matrix_free(covFactor);
+	gsl_matrix_free(coef);
 
 	return 0;
 }
 
-int main(int argc, char *argv[])
+int tsvd_options(int argc, char ** argv, modelConfigType * config,
+		void ** options)
 {
 	// Command-line options
 	const struct option commandOptions[] = {
 		COMMON_OPTIONS,
 		{"tolerance",	required_argument,	NULL, 'p'},
 		{"unbalance",	no_argument,		NULL, 'u'},
+		{"tolerance-grid", required_argument,	NULL, 'G'},
+		{"gcv",		no_argument,		NULL, 'g'},
+		{"single",	no_argument,		NULL, 'F'},
 	};
 	int opt;
-	modelConfigType * config;
+	char * token;
+	tsvdOptions * opts;
 
-	// Model variables
-	bool balance;
-	double tolerance;
-	int nrow;
-	int ncol;
-	int testRows;
-	double chisq;
-	char ** lines = NULL;
-	char ** testLines = NULL;
-	char ** colNames = NULL;
-	encodeData * encodingInfo;
-	dataColumn * columnHead;
-	dataColumn * testData;
-	dataColumn * colPtr;
-	gsl_vector * response;
-	gsl_vector * coef;
-	gsl_matrix * dataMatrix;
-	gsl_matrix * covMatrix;
-	gsl_multifit_linear_workspace * work;
-
-	config = malloc(sizeof(modelConfigType));
-	config->input = stdin;
-	balance = true;
-	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING "p:u",
-					commandOptions, NULL)) != -1) {
+	opts = malloc(sizeof(tsvdOptions));
+	opts->balance = true;
+	opts->useGCV = false;
+	opts->tolerance = 0;
+	opts->tolerances = NULL;
+	opts->ntol = 0;
+	opts->single = false;
+	*options = opts;
+	while ((opt = getopt_long_only(argc, argv, COMMON_OPTION_STRING
+					"p:uG:gF", commandOptions,
+					NULL)) != -1) {
 		if (parse_args(opt, config, TSVD_HELP_INTRO LM_HELP_MESSAGE
 					ADDITIONAL_HELP)) {
 			return 1;
 		}
 		if (opt == 'p') {
-			sscanf(optarg, "%lf", &tolerance);
-			if ((0 >= tolerance) ||
-					(1 <= tolerance)) {
+			sscanf(optarg, "%lf", &opts->tolerance);
+			if ((0 >= opts->tolerance) ||
+					(1 <= opts->tolerance)) {
 				fprintf(stderr, "Tolerance value must be "
 						"between 0 and 1.\n");
 				return 1;
 			}
 		}
 		if (opt == 'u') {
-			balance = false;
+			opts->balance = false;
+		}
+		if (opt == 'G') {
+			token = strtok(optarg, ",");
+			while (token) {
+				opts->tolerances = realloc(opts->tolerances,
+						(opts->ntol + 1) *
+						sizeof(double));
+				sscanf(token, "%lf",
+						&opts->tolerances[opts->ntol]);
+				if ((0 >= opts->tolerances[opts->ntol]) ||
+						(1 <= opts->tolerances[
+							opts->ntol])) {
+					fprintf(stderr, "Tolerance values "
+							"must be between 0 "
+							"and 1.\n");
+					return 1;
+				}
+				opts->ntol++;
+				token = strtok(NULL, ",");
+			}
+		}
+		if (opt == 'g') {
+			opts->useGCV = true;
+		}
+		if (opt == 'F') {
+			opts->single = true;
 		}
 	}
 
-	if (!tolerance) {
+	if (!config->jobs && !config->serve && !opts->tolerance &&
+			!opts->ntol && !opts->useGCV) {
 		fprintf(stderr, "Must set a tolerance value "
 				"(argument `-p`).\n");
 		return 1;
 	}
 
-	// Set random seed
-	srand(time(NULL));
+	return 0;
+}
 
-	// Parse incoming csv file
-	nrow = read_rows(&lines, config->input);
-	testRows = test_split(&lines, &testLines, config->testRatio, nrow);
-	nrow -= testRows;
-	fclose(config->input);
-	columnHead = column_alloc(nrow, "");
-	testData = column_alloc(testRows, "");
-	switch(config->encoding) {
-		case ENCODE_DUMMY:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, dummy_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, dummy_encode,
-		 			testRows, &encodingInfo);
-			}
-			break;
-
-		case ENCODE_MEAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					mean_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					mean_target_encode, testRows,
-					&encodingInfo);
-			}
-			break;
-
-		case ENCODE_MEDIAN_TARGET:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines,
-					median_target_encode, nrow,
-					&encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines,
-					median_target_encode, testRows,
-					&encodingInfo);
-			}
-			break;
-
-		case ENCODE_NONE:
-			encodingInfo = NULL;
-			ncol = read_columns(columnHead, lines, no_encode,
-					nrow, &encodingInfo);
-			if (testRows > 0) {
-				read_columns(testData, testLines, no_encode,
-					testRows, &encodingInfo);
-			}
-			break;
+void tsvd_options_free(void * options)
+{
+	tsvdOptions * opts = options;
+
+	free(opts->tolerances);
+	free(opts);
+}
+
+/*
+ * Fit the model with the design held in single precision. The truncated
+ * inverse comes from the eigendecomposition of the cross-products, which
+ * are accumulated in double precision, and the solution is then refined
+ * against the float design.
+ */
+int fit_svd_single(double tol, bool balance, modelConfigType * config,
+		modelDataType * data)
+{
+	size_t n = data->nrow;
+	size_t p = data->ncol;
+	int steps;
+	double chisq;
+	gsl_vector * Xty;
+	gsl_vector * coef;
+	gsl_vector * resid;
+	gsl_matrix * G;
+	gsl_matrix * covMatrix;
+	gsl_matrix_float * X;
+
+	X = single_matrix(data->dataMatrix);
+	gsl_matrix_free(data->dataMatrix);
+	data->dataMatrix = NULL;
+
+	G = gsl_matrix_alloc(p, p);
+	Xty = gsl_vector_alloc(p);
+	coef = gsl_vector_alloc(p);
+	covMatrix = gsl_matrix_alloc(p, p);
+	single_gram(X, data->response, G, Xty);
+	if (!single_pseudo_inverse(G, tol, balance, covMatrix)) {
+		fprintf(stderr, "The design has no nonzero singular "
+				"values.\n");
+		return 1;
 	}
-	dataMatrix = gsl_matrix_alloc(nrow, ncol);
-	response = columnHead->vector; // First column is the response
-	if (arrange_data(columnHead, dataMatrix, ncol)) return 1;
-
-	// Pull out column names, skipping the response
-	colPtr = columnHead;
-	colPtr = colPtr->nextColumn;
-	colNames = malloc(ncol * sizeof(char *));
-	for (int i = 0; i < ncol; i++) {
-		colNames[i] = strdup(colPtr->name);
-		colPtr = colPtr->nextColumn;
+	gsl_blas_dsymv(CblasUpper, 1.0, covMatrix, Xty, 0, coef);
+	gsl_matrix_free(G);
+	gsl_vector_free(Xty);
+
+	resid = gsl_vector_alloc(n);
+	steps = single_refine(X, data->response, covMatrix, coef, resid);
+	if (config->diagnostic == ALL) {
+		printf("Refinement steps: %d\n\n", steps);
 	}
 
-	// We cannot make a model with more columns than rows
-	if (nrow < ncol) {
-		fprintf(stderr, "More columns than rows; check encoding "
-	  			"method or test ratio.\n");
-		exit(EXIT_FAILURE);
+	// Scaled as svd_solve() does, by the residual sum of squares about
+	// the mean
+	chisq = gsl_stats_tss(resid->data, resid->stride, n);
+	gsl_matrix_scale(covMatrix, chisq);
+	gsl_vector_free(resid);
+	gsl_matrix_float_free(X);
+
+	diagnostics(config->diagnostic, chisq, data->response, coef, covMatrix,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
+
+	gsl_matrix_free(covMatrix);
+	gsl_vector_free(coef);
+
+	return 0;
+}
+
+// Fit and report one model
+int tsvd_fit(modelConfigType * config, void * options, modelDataType * data,
+		gsl_matrix * gram)
+{
+	tsvdOptions * opts = options;
+	size_t rank;
+	double chisq;
+	gsl_vector * coef;
+	gsl_matrix * covMatrix;
+	gsl_multifit_linear_workspace * work;
+
+	(void) gram;
+	if (opts->single) {
+		fprintf(stderr, "--single is not available with --jobs or "
+				"--serve.\n");
+		return 1;
+	}
+	if (data->nresp > 1) {
+		if (opts->ntol || opts->useGCV) {
+			fprintf(stderr, "Rank selection is not available "
+					"with multiple responses.\n");
+			return 1;
+		}
+		return fit_svd_responses(opts->tolerance, opts->balance,
+				config, data);
 	}
 
 	// Allocate remaining data
-	work = gsl_multifit_linear_alloc(nrow, ncol);
-	coef = gsl_vector_calloc(ncol);
-	covMatrix = gsl_matrix_calloc(ncol, ncol);
-
-	// Perform transformation if necessary
-	switch(config->transformation) {
-		case TRANSFORM_LOG:
-			transform(response, log, nrow);
-			break;
-
-		case TRANSFORM_LOG_OFFSET:
-			transform(response, log_offset, nrow);
-			break;
-
-		case TRANSFORM_NONE:
-			break;
-	}
+	work = gsl_multifit_linear_alloc(data->nrow, data->ncol);
+	coef = gsl_vector_calloc(data->ncol);
+	covMatrix = gsl_matrix_calloc(data->ncol, data->ncol);
 
 	// Fit the model
-	if (fit_svd_model(tolerance, dataMatrix, response, coef, covMatrix,
-				&chisq, balance)) {
+	if (opts->ntol || opts->useGCV) {
+		if (diagnostic_needs_test(config->diagnostic) &&
+				!opts->useGCV && !data->testMatrix) {
+			fprintf(stderr, "This diagnostic requires a test "
+					"ratio.\n");
+			return 1;
+		}
+		if (svd_decompose(data->dataMatrix, opts->balance, work)) {
+			return 1;
+		}
+		rank = tolerance_sweep(opts->tolerances, opts->ntol,
+				opts->useGCV, config, data->response,
+				data->colNames, data->testMatrix,
+				data->testResponse, work);
+		if (!rank || svd_solve(rank, data->response, coef, covMatrix,
+					&chisq, work)) {
+			return 1;
+		}
+	} else if (fit_svd_model(opts->tolerance, data->dataMatrix,
+				data->response, coef, covMatrix, &chisq,
+				opts->balance, work)) {
 		return 1;
 	}
-
-	gsl_matrix_free(dataMatrix);
 	gsl_multifit_linear_free(work);
 
 	// Print diagnostics
-	diagnostics(config->diagnostic, chisq, response, coef, covMatrix,
-			colNames, testRows, testData, config->name);
+	diagnostics(config->diagnostic, chisq, data->response, coef, covMatrix,
+			data->colNames, data->testMatrix, data->testResponse,
+			config);
 
-	// Free memory
 	gsl_matrix_free(covMatrix);
-	column_free(testData);
-	free(colNames);
-	free(config);
 	gsl_vector_free(coef);
 
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	modelConfigType * config;
+	void * options;
+	tsvdOptions * opts;
+	modelDataType data;
+	char ** args;
+
+	args = serve_arguments(argc, argv);
+	config = config_alloc();
+	if (tsvd_options(argc, argv, config, &options)) {
+		return 1;
+	}
+	opts = options;
+	if (config->connect) {
+		return serve_request(config, argc, args);
+	}
+	if (config->serve) {
+		return run_serve(config, tsvd_options, tsvd_fit,
+				tsvd_options_free, false);
+	}
+
+	// Set random seed
+	srand(time(NULL));
+
+	// The SVD works on the data itself, so no cross-products are shared
+	if (config->jobs) {
+		if (opts->single) {
+			fprintf(stderr, "--single is not available with "
+					"--jobs.\n");
+			return 1;
+		}
+		return run_batch(config, tsvd_options, tsvd_fit,
+				tsvd_options_free, false);
+	}
+
+	// Parse incoming csv file
+	if (load_model_data(config, &data)) {
+		exit(EXIT_FAILURE);
+	}
+	if (opts->single) {
+		if (!opts->tolerance || opts->ntol || opts->useGCV ||
+				data.nresp > 1) {
+			fprintf(stderr, "--single fits a single response at "
+					"one tolerance.\n");
+			return 1;
+		}
+		if (fit_svd_single(opts->tolerance, opts->balance, config,
+					&data)) {
+			return 1;
+		}
+	} else if (tsvd_fit(config, options, &data, NULL)) {
+		return 1;
+	}
+
+	// Free memory
+	model_data_free(&data);
+	free(config);
+	free(((tsvdOptions *) options)->tolerances);
+	free(options);
+
+	return 0;
+}